@@ -26,6 +26,9 @@
 #include "iregistry.h"
 #include "sv_main.h"
 #include "hltvserver.h"
+#include "tier1/compressioncodec.h"
+#include "vstdlib/jobthread.h"
+#include "dt_instrumentation_server.h"
 #include <ctype.h>
 #if defined( REPLAY_ENABLED )
 #include "replay_internal.h"
@@ -40,6 +43,7 @@ extern ConVar tv_enable;
 ConVar sv_namechange_cooldown_seconds( "sv_namechange_cooldown_seconds", "30.0", FCVAR_NONE, "When a client name change is received, wait N seconds before allowing another name change" );
 ConVar sv_netspike_on_reliable_snapshot_overflow( "sv_netspike_on_reliable_snapshot_overflow", "0", FCVAR_NONE, "If nonzero, the server will dump a netspike trace if a client is dropped due to reliable snapshot overflow" );
 ConVar sv_netspike_sendtime_ms( "sv_netspike_sendtime_ms", "0", FCVAR_NONE, "If nonzero, the server will dump a netspike trace if it takes more than N ms to prepare a snapshot to a single client.  This feature does take some CPU cycles, so it should be left off when not in use." );
+ConVar sv_compressioncodecs( "sv_compressioncodecs", "lz4,snappy", FCVAR_NONE, "Comma separated codecs clients may ask the server to compress their data with (lz4, snappy, lzss). Others get snappy." );
 ConVar sv_netspike_output( "sv_netspike_output", "1", FCVAR_NONE, "Where the netspike data be written?  Sum of the following values: 1=netspike.txt, 2=ordinary server log" );
 
 //////////////////////////////////////////////////////////////////////
@@ -53,6 +57,12 @@ CBaseClient::CBaseClient()
 	m_ConVars = NULL;
 	m_Server = NULL;
 	m_pBaseline = NULL;
+	m_pszPendingDisconnect = NULL;
+	m_pPipelinedFrame = NULL;
+	m_pPipelinedDeltaFrame = NULL;
+	m_bPipelinedDelta = false;
+	m_bPipelinedBaselineUpdate = false;
+	m_pPipelinedJob = NULL;
 	m_bIsHLTV = false;
 #if defined( REPLAY_ENABLED )
 	m_bIsReplay = false;
@@ -216,6 +226,9 @@ int CBaseClient::GetUpdateRate(void) const
 
 void CBaseClient::FreeBaselines()
 {
+	// the snapshot job reads and updates the baselines
+	WaitForPipelinedSnapshot();
+
 	if ( m_pBaseline )
 	{
 		m_pBaseline->ReleaseReference();
@@ -229,6 +242,8 @@ void CBaseClient::FreeBaselines()
 
 void CBaseClient::Clear()
 {
+	DiscardPipelinedSnapshot();
+
 	// Throw away any residual garbage in the channel.
 	if ( m_NetChannel )
 	{
@@ -273,6 +288,7 @@ void CBaseClient::Clear()
 	m_bFullyAuthenticated = false;
 	m_fTimeLastNameChange = 0.0;
 	m_szPendingNameChange[0] = '\0';
+	m_pszPendingDisconnect = NULL;
 
 	Q_memset( m_nCustomFiles, 0, sizeof(m_nCustomFiles) );
 }
@@ -322,6 +338,8 @@ void CBaseClient::Reconnect( void )
 
 void CBaseClient::Inactivate( void )
 {
+	DiscardPipelinedSnapshot();
+
 	FreeBaselines();
 
 	m_nDeltaTick = -1;
@@ -933,6 +951,9 @@ bool CBaseClient::ProcessClientInfo( CLC_ClientInfo *msg )
 
 bool CBaseClient::ProcessBaselineAck( CLC_BaselineAck *msg )
 {
+	// the snapshot job may be starting a baseline update of its own
+	WaitForPipelinedSnapshot();
+
 	if ( msg->m_nBaselineTick != m_nBaselineUpdateTick )
 	{
 		// This occurs when there are multiple ack's queued up for processing from a client.
@@ -1143,13 +1164,13 @@ void CBaseClient::TraceNetworkMsg( int nBits, char const *fmt, ... )
 	m_Trace.m_Records.AddToTail( t );
 }
 
-void CBaseClient::SendSnapshot( CClientFrame *pFrame )
+bool CBaseClient::SkipSnapshot( CClientFrame *pFrame )
 {
 	// never send the same snapshot twice
 	if ( m_pLastSnapshot == pFrame->GetSnapshot() )
 	{
 		m_NetChannel->Transmit();	
-		return;
+		return true;
 	}
 
 	// if we send a full snapshot (no delta-compression) before, wait until client
@@ -1158,16 +1179,18 @@ void CBaseClient::SendSnapshot( CClientFrame *pFrame )
 	{
 		// just continue transmitting reliable data
 		m_NetChannel->Transmit();	
-		return;
+		return true;
 	}
 
-	VPROF_BUDGET( "SendSnapshot", VPROF_BUDGETGROUP_OTHER_NETWORKING );
-	tmZoneFiltered( TELEMETRY_LEVEL0, 50, TMZF_NONE, "%s", __FUNCTION__ );
-
-	bool bFailedOnce = false;
-write_again:
-	bf_write msg( "CBaseClient::SendSnapshot", m_SnapshotScratchBuffer, sizeof( m_SnapshotScratchBuffer ) );
+	return false;
+}
 
+//-----------------------------------------------------------------------------
+// Purpose: Writes everything that has to come from the main thread, returns
+//  the frame the entities are delta compressed from, NULL for a full update.
+//-----------------------------------------------------------------------------
+CClientFrame *CBaseClient::WriteSnapshotHeader( CClientFrame *pFrame, bf_write &msg )
+{
 	TRACE_PACKET( ( "SendSnapshot(%d)\n", pFrame->tick_count ) );
 
 	// now create client snapshot packet
@@ -1199,6 +1222,16 @@ write_again:
 	}
 #endif
 
+	return deltaFrame;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes the entity and temp entity updates. Only reads the frames,
+//  the snapshots and this client's baseline state, so it can run on a job
+//  thread as long as nobody else touches this client meanwhile.
+//-----------------------------------------------------------------------------
+void CBaseClient::WriteSnapshotEntities( CClientFrame *pFrame, CClientFrame *deltaFrame, bf_write &msg )
+{
 	int nDeltaStartBit = 0;
 	if ( IsTracing() )
 	{
@@ -1223,6 +1256,23 @@ write_again:
 	{
 		TraceNetworkData( msg, "Temp Entities" );
 	}
+}
+
+void CBaseClient::SendSnapshot( CClientFrame *pFrame )
+{
+	if ( SkipSnapshot( pFrame ) )
+		return;
+
+	VPROF_BUDGET( "SendSnapshot", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+	tmZoneFiltered( TELEMETRY_LEVEL0, 50, TMZF_NONE, "%s", __FUNCTION__ );
+
+	bool bFailedOnce = false;
+write_again:
+	bf_write msg( "CBaseClient::SendSnapshot", m_SnapshotScratchBuffer, sizeof( m_SnapshotScratchBuffer ) );
+
+	CClientFrame *deltaFrame = WriteSnapshotHeader( pFrame, msg );
+
+	WriteSnapshotEntities( pFrame, deltaFrame, msg );
 
 	WriteGameSounds( msg );
 	
@@ -1257,7 +1307,7 @@ write_again:
 			}
 
 			// if this is a reliable snapshot, drop the client
-			Disconnect( "ERROR! Reliable snapshot overflow." );
+			OnSnapshotSendFailed( "ERROR! Reliable snapshot overflow." );
 			return;
 		}
 		else
@@ -1268,6 +1318,11 @@ write_again:
 		}
 	}
 
+	SendSnapshotMessage( pFrame, deltaFrame != NULL, msg );
+}
+
+void CBaseClient::SendSnapshotMessage( CClientFrame *pFrame, bool bDelta, bf_write &msg )
+{
 	// remember this snapshot
 	m_pLastSnapshot = pFrame->GetSnapshot();
 
@@ -1282,7 +1337,7 @@ write_again:
 	bool bSendOK;
 
 	// is this is a full entity update (no delta) ?
-	if ( !deltaFrame )
+	if ( !bDelta )
 	{
 		VPROF_BUDGET( "SendSnapshot Transmit Full", VPROF_BUDGETGROUP_OTHER_NETWORKING );
 
@@ -1306,14 +1361,139 @@ write_again:
 	{
 		if ( IsTracing() )
 		{
-			TraceNetworkMsg( 0, "Finished [delta %s]", deltaFrame ? "yes" : "no" );
+			TraceNetworkMsg( 0, "Finished [delta %s]", bDelta ? "yes" : "no" );
 			EndTrace( msg );
 		}
 	}
 	else
 	{
-		Disconnect( "ERROR! Couldn't send snapshot." );
+		OnSnapshotSendFailed( "ERROR! Couldn't send snapshot." );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Netspike traces look at the edicts and reliable overflows may be
+//  retried with a trace, so those snapshots are never pipelined.
+//-----------------------------------------------------------------------------
+bool CBaseClient::CanPipelineSnapshot( CClientFrame *pFrame )
+{
+	if ( m_pLastSnapshot == pFrame->GetSnapshot() || m_nForceWaitForTick > 0 )
+		return false;
+
+	if ( m_iTracing >= 2 || sv_netspike_sendtime_ms.GetFloat() > 0.0f )
+		return false;
+
+	// DTI reads the live edicts and its event list isn't thread safe
+	if ( g_bServerDTIEnabled )
+		return false;
+
+	if ( !IsHLTV() && !IsReplay() && !IsFakeClient() && GetNetSpikeValue() > 0 )
+		return false;
+
+	return !sv_netspike_on_reliable_snapshot_overflow.GetBool() || GetDeltaFrame( m_nDeltaTick ) != NULL;
+}
+
+void CBaseClient::StartPipelinedSnapshot( CClientFrame *pFrame )
+{
+	Assert( ThreadInMainThread() );
+	Assert( !HasPipelinedSnapshot() );
+
+	VPROF_BUDGET( "StartPipelinedSnapshot", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+
+	m_PipelinedMsg.StartWriting( m_SnapshotScratchBuffer, sizeof( m_SnapshotScratchBuffer ) );
+	m_PipelinedMsg.SetDebugName( "CBaseClient::StartPipelinedSnapshot" );
+
+	m_pPipelinedFrame = pFrame;
+	m_pPipelinedDeltaFrame = WriteSnapshotHeader( pFrame, m_PipelinedMsg );
+	m_bPipelinedDelta = ( m_pPipelinedDeltaFrame != NULL );
+	m_bPipelinedBaselineUpdate = ( m_nBaselineUpdateTick == -1 );
+	Assert( !IsTracing() );
+
+	m_pPipelinedJob = g_pThreadPool->QueueCall( this, &CBaseClient::WritePipelinedSnapshot );
+}
+
+void CBaseClient::WritePipelinedSnapshot()
+{
+	WriteSnapshotEntities( m_pPipelinedFrame, m_pPipelinedDeltaFrame, m_PipelinedMsg );
+}
+
+void CBaseClient::WaitForPipelinedSnapshot()
+{
+	if ( !m_pPipelinedJob )
+		return;
+
+	Assert( ThreadInMainThread() );
+	m_pPipelinedJob->WaitForFinishAndRelease();
+	m_pPipelinedJob = NULL;
+
+	// the delta frame may be freed once this client's acks are processed
+	m_pPipelinedDeltaFrame = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sends the pipelined snapshot. Sounds started since then go out
+//  with it, they have to follow the temp entities the job wrote.
+//-----------------------------------------------------------------------------
+void CBaseClient::FinishPipelinedSnapshot()
+{
+	if ( !HasPipelinedSnapshot() )
+		return;
+
+	WaitForPipelinedSnapshot();
+
+	CClientFrame *pFrame = m_pPipelinedFrame;
+	m_pPipelinedFrame = NULL;
+
+	WriteGameSounds( m_PipelinedMsg );
+
+	if ( m_PipelinedMsg.IsOverflowed() )
+	{
+		if ( !m_bPipelinedDelta )
+		{
+			// if this is a reliable snapshot, drop the client
+			OnSnapshotSendFailed( "ERROR! Reliable snapshot overflow." );
+			return;
+		}
+
+		// unreliable snapshots may be dropped
+		ConMsg ("WARNING: msg overflowed for %s\n", m_Name);
+		m_PipelinedMsg.Reset();
 	}
+
+	SendSnapshotMessage( pFrame, m_bPipelinedDelta, m_PipelinedMsg );
+}
+
+void CBaseClient::DiscardPipelinedSnapshot()
+{
+	WaitForPipelinedSnapshot();
+	m_pPipelinedFrame = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Disconnecting touches the game DLL and global server state, so if
+//  the snapshot was written by a parallel send thread just remember the reason
+//  and let the main thread drop the client in FlushPendingDisconnect().
+//-----------------------------------------------------------------------------
+void CBaseClient::OnSnapshotSendFailed( const char *pszReason )
+{
+	if ( ThreadInMainThread() )
+	{
+		Disconnect( "%s", pszReason );
+		return;
+	}
+
+	m_pszPendingDisconnect = pszReason;
+}
+
+bool CBaseClient::FlushPendingDisconnect()
+{
+	if ( !m_pszPendingDisconnect )
+		return false;
+
+	const char *pszReason = m_pszPendingDisconnect;
+	m_pszPendingDisconnect = NULL;
+	Disconnect( "%s", pszReason );
+	return true;
 }
 
 bool CBaseClient::ExecuteStringCommand( const char *pCommand )
@@ -1437,6 +1617,9 @@ void CBaseClient::UpdateUserSettings()
 
 	SetMaxRoutablePayloadSize( m_ConVars->GetInt( "net_maxroutable", MAX_ROUTABLE_PAYLOAD ) );
 
+	// clients that don't ask for a codec only know Snappy
+	SetCompressionCodec( m_ConVars->GetString( "net_compressioncodec", "snappy" ) );
+
 	m_Server->UserInfoChanged( m_nClientSlot );
 
 	m_bConVarsChanged = false;
@@ -1510,6 +1693,9 @@ void CBaseClient::OnRequestFullUpdate()
 {
 	VPROF_BUDGET( "CBaseClient::OnRequestFullUpdate", VPROF_BUDGETGROUP_OTHER_NETWORKING );
 
+	// the snapshot job writes temp entities since m_pLastSnapshot
+	WaitForPipelinedSnapshot();
+
 	// client requests a full update 
 	m_pLastSnapshot = NULL;
 
@@ -1606,7 +1792,11 @@ bool CBaseClient::UpdateAcknowledgedFramecount(int tick)
 		m_nStringTableAckTick = m_nDeltaTick;
 	}
 
-	if ( (m_nBaselineUpdateTick > -1) && (m_nDeltaTick > m_nBaselineUpdateTick) )
+	// A running snapshot job only starts a baseline update if none is pending, and
+	// for a tick the client can't have acknowledged yet. Don't race it for nothing.
+	bool bJobOwnsBaselineTick = m_pPipelinedJob && m_bPipelinedBaselineUpdate;
+
+	if ( !bJobOwnsBaselineTick && (m_nBaselineUpdateTick > -1) && (m_nDeltaTick > m_nBaselineUpdateTick) )
 	{
 		// server sent a baseline update, but it wasn't acknowledged yet so it was probably lost. 
 		m_nBaselineUpdateTick = -1;
@@ -1707,6 +1897,41 @@ void CBaseClient::SetMaxRoutablePayloadSize( int nMaxRoutablePayloadSize )
 	}
 }
 
+static bool IsAllowedCompressionCodec( const ICompressionCodec *pCodec )
+{
+	CUtlVector<char*> CodecList;
+	V_SplitString( sv_compressioncodecs.GetString(), ",", CodecList );
+
+	bool bAllowed = false;
+	for ( int i = 0; i < CodecList.Count(); i++ )
+	{
+		Q_StripPrecedingAndTrailingWhitespace( CodecList[i] );
+		if ( !Q_stricmp( CodecList[i], pCodec->GetName() ) )
+		{
+			bAllowed = true;
+			break;
+		}
+	}
+	CodecList.PurgeAndDeleteElements();
+
+	return bAllowed;
+}
+
+void CBaseClient::SetCompressionCodec( const char *pszCodec )
+{
+	// the codec costs the server CPU, so the client only picks from the server's list
+	const ICompressionCodec *pCodec = FindCompressionCodec( pszCodec );
+	if ( pCodec && !IsAllowedCompressionCodec( pCodec ) )
+	{
+		pCodec = NULL;
+	}
+
+	if ( m_NetChannel )
+	{
+		m_NetChannel->SetCompressionCodec( pCodec ? pCodec->GetCodec() : COMPRESSION_CODEC_SNAPPY );
+	}
+}
+
 int CBaseClient::GetMaxAckTickCount() const
 {
 	int nMaxTick = m_nSignonTick;
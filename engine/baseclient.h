@@ -30,6 +30,7 @@ class CClientFrame;
 struct player_info_s;
 class CFrameSnapshot;
 class CEventInfo;
+class CJob;
 
 struct Spike_t
 {
@@ -125,6 +126,8 @@ public:
 	virtual	bool	IsProximityHearingClient( int index ) const { return false; };
 
 	virtual void	SetMaxRoutablePayloadSize( int nMaxRoutablePayloadSize );
+	// Codec for the data we compress for this client, by name, unknown names fall back to Snappy
+	void			SetCompressionCodec( const char *pszCodec );
 
 	virtual bool	IsSplitScreenUser( void ) const { return false; } // !KLUDGE! We don't have splitscreen support, but this makes merges easier
 
@@ -159,6 +162,18 @@ public:
 	
 	virtual CClientFrame *GetDeltaFrame( int nTick );
 	virtual void	SendSnapshot( CClientFrame *pFrame );
+			bool	FlushPendingDisconnect();	// drops the client if a snapshot send thread failed it, returns true if so
+
+	// Pipelined snapshots (sv_pipeline_snapshots): the main thread writes the tick and string
+	// table updates, a job thread the entities, and the message is sent on the main thread the
+	// next time SendClientMessages runs.
+			bool	CanPipelineSnapshot( CClientFrame *pFrame );
+			void	StartPipelinedSnapshot( CClientFrame *pFrame );
+			void	WaitForPipelinedSnapshot();		// call before touching anything the job reads
+			CClientFrame *GetPipelinedDeltaFrame() const { return m_pPipelinedJob ? m_pPipelinedDeltaFrame : NULL; }
+			void	FinishPipelinedSnapshot();
+			void	DiscardPipelinedSnapshot();
+			bool	HasPipelinedSnapshot() const { return m_pPipelinedFrame != NULL; }
 	virtual bool	SendServerInfo( void );
 	virtual bool	SendSignonData( void );
 	virtual void	SpawnPlayer( void );
@@ -166,6 +181,7 @@ public:
 	virtual void	SetName( const char * playerName );
 	virtual void	SetUserCVar( const char *cvar, const char *value);
 	virtual void	FreeBaselines();
+	virtual bool	CanUpdateBaselines() const { return true; }	// false keeps the instance baselines for entering entities
 	virtual bool	IgnoreTempEntity( CEventInfo *event );
 	
 	void			SetSteamID( const CSteamID &steamID );
@@ -188,6 +204,13 @@ public:
 private:	
 
 	void			OnRequestFullUpdate();
+	void			OnSnapshotSendFailed( const char *pszReason );
+
+	bool			SkipSnapshot( CClientFrame *pFrame );
+	CClientFrame	*WriteSnapshotHeader( CClientFrame *pFrame, bf_write &msg );
+	void			WriteSnapshotEntities( CClientFrame *pFrame, CClientFrame *deltaFrame, bf_write &msg );
+	void			SendSnapshotMessage( CClientFrame *pFrame, bool bDelta, bf_write &msg );
+	void			WritePipelinedSnapshot();
 
 
 public:
@@ -286,6 +309,15 @@ private:
 
 	int					m_iTracing; // 0 = not active, 1 = active for this frame, 2 = forced active
 	CNetworkStatTrace	m_Trace;
+
+	const char			*m_pszPendingDisconnect; // set if a snapshot send thread had to drop this client
+
+	CClientFrame		*m_pPipelinedFrame;		// frame being written by m_pPipelinedJob, NULL if none
+	CClientFrame		*m_pPipelinedDeltaFrame;	// only valid until the job is done
+	bool				m_bPipelinedDelta;
+	bool				m_bPipelinedBaselineUpdate;	// the job may set m_nBaselineUpdateTick
+	CJob				*m_pPipelinedJob;
+	bf_write			m_PipelinedMsg;			// writes into m_SnapshotScratchBuffer
 };
 
 
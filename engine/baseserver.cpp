@@ -57,6 +57,7 @@
 #include "cl_steamauth.h"
 #include "sv_filter.h"
 #include "master.h"
+#include "sv_tickmetrics.h"
 
 #if defined( _X360 )
 #include "xbox/xbox_win32stubs.h"
@@ -69,7 +70,7 @@ CThreadFastMutex g_svInstanceBaselineMutex;
 extern	CGlobalVars g_ServerGlobalVariables;
 
 static ConVar	sv_max_queries_sec( "sv_max_queries_sec", "3.0", 0, "Maximum queries per second to respond to from a single IP address." );
-static ConVar	sv_max_queries_window( "sv_max_queries_window", "30", 0, "Window over which to average queries per second averages." );
+static ConVar	sv_max_queries_window( "sv_max_queries_window", "30", 0, "Window over which to average queries per second averages. A single IP's burst is capped at 1023 queries." );
 static ConVar	sv_max_queries_sec_global( "sv_max_queries_sec_global", "3000", 0, "Maximum queries per second to respond to from anywhere." );
 
 static ConVar	sv_max_connects_sec( "sv_max_connects_sec", "2.0", 0, "Maximum connections per second to respond to from a single IP address." );
@@ -80,6 +81,12 @@ static ConVar	sv_max_connects_sec_global( "sv_max_connects_sec_global", "0", 0,
 static CIPRateLimit s_queryRateChecker( &sv_max_queries_sec, &sv_max_queries_window, &sv_max_queries_sec_global );
 static CIPRateLimit s_connectRateChecker( &sv_max_connects_sec, &sv_max_connects_window, &sv_max_connects_sec_global );
 
+// the network layer checks the queries in IsRateLimitedOnReceive() as they arrive, possibly on its own thread
+bool CheckConnectionLessRateLimits( netadr_t & adr )
+{
+	return s_queryRateChecker.CheckIP( adr );
+}
+
 // Give new data to Steam's master server updater every N seconds.
 // This is NOT how often packets are sent to master servers, only how often the
 // game server talks to Steam's master server updater (which is on the game server's
@@ -768,7 +775,7 @@ bool CBaseServer::ProcessConnectionlessPacket(netpacket_t * packet)
 		default:
 			{
 				// rate limit the more expensive server query packets
-				if ( !s_queryRateChecker.CheckIP( packet->from ) )
+				if ( !packet->ratechecked && !s_queryRateChecker.CheckIP( packet->from ) )
 					return false;
 
 				// We don't understand it, let the master server updater at it.
@@ -1924,10 +1931,9 @@ Read's packets from clients and executes messages as appropriate.
 =================
 */
 
-void CBaseServer::RunFrame( void )
+void CBaseServer::ReadPackets( void )
 {
-	VPROF_BUDGET( "CBaseServer::RunFrame", VPROF_BUDGETGROUP_OTHER_NETWORKING );
-	tmZone( TELEMETRY_LEVEL0, TMZF_NONE, "CBaseServer::RunFrame" );
+	CTimeAdder metricsTimer( TickMetrics_GetTimer( TICKMETRICS_NETREAD ) );
 
 	NET_ProcessSocket( m_Socket, this );	
 
@@ -1936,6 +1942,14 @@ void CBaseServer::RunFrame( void )
 	if ( NET_GetUDPPort( NS_SVLAN ) )
 		NET_ProcessSocket( NS_SVLAN, this );
 #endif
+}
+
+void CBaseServer::RunFrame( void )
+{
+	VPROF_BUDGET( "CBaseServer::RunFrame", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+	tmZone( TELEMETRY_LEVEL0, TMZF_NONE, "CBaseServer::RunFrame" );
+
+	ReadPackets();
 
 	CheckTimeouts();	// drop clients that timeed out
 
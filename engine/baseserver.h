@@ -120,6 +120,7 @@ public: // IConnectionlessPacketHandler implementation
 
 	bool	GetClassBaseline( ServerClass *pClass, void const **pData, int *pDatalen );
 	void	RunFrame( void );
+	void	ReadPackets( void );
 	void	InactivateClients( void );
 	void	ReconnectClients( void );
 	void	CheckTimeouts (void);
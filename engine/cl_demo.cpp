@@ -924,7 +924,22 @@ void CDemoPlayer::SkipToTick( int tick, bool bRelative, bool bPause )
 	if ( tick < 0 )
 		return;
 
-	if ( tick < GetPlaybackTick() )
+	// indexed demos jump to the last keyframe before tick, unless that's
+	// behind us anyway. The keyframe replaces all state, so signon has to be done.
+	const demoindexentry_t *pKeyframe = cl.IsActive() ? m_DemoFile.FindKeyframe( tick ) : NULL;
+
+	if ( pKeyframe && ( tick < GetPlaybackTick() || pKeyframe->tick > GetPlaybackTick() ) )
+	{
+		ETWMark1I( "DemoPlayer: Seeking to keyframe", pKeyframe->tick );
+
+		m_DemoFile.SeekTo( pKeyframe->fileoffset, true );
+		m_nKeyframeTick = pKeyframe->tick;
+		m_DestCmdInfo.RemoveAll();
+
+		// keep skipping until the keyframe has reset the playback clock
+		tick |= SKIP_TO_TICK_FLAG;
+	}
+	else if ( tick < GetPlaybackTick() )
 	{
 		// we have to reload the whole demo file
 		// we need to create a temp copy of the filename
@@ -1024,6 +1039,11 @@ bool CDemoPlayer::ParseAheadForInterval( int curtick, int intervalticks )
 					m_DemoFile.ReadStringTables( NULL );
 				}
 				break;
+			case dem_keyframe:
+				{
+					m_DemoFile.SkipKeyframe();
+				}
+				break;
 			default:
 				{
 					swallowmessages = false;
@@ -1076,6 +1096,40 @@ bool CDemoPlayer::ParseAheadForInterval( int curtick, int intervalticks )
 	return true;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Replaces the client string tables with the ones stored in the demo
+//-----------------------------------------------------------------------------
+void CDemoPlayer::ReadDemoStringTables( void )
+{
+	void *data = NULL;
+	int dataLen = 512 * 1024;
+	while ( dataLen <= DEMO_FILE_MAX_STRINGTABLE_SIZE )
+	{
+		data = realloc( data, dataLen );
+		bf_read buf( "dem_stringtables", data, dataLen );
+		// did we successfully read
+		if ( m_DemoFile.ReadStringTables( &buf ) > 0 )
+		{
+			buf.Seek( 0 );
+			if ( !networkStringTableContainerClient->ReadStringTables( buf ) )
+			{
+				Host_Error( "Error parsing string tables during demo playback." );
+			}
+			break;
+		}
+
+		// Didn't fit.  Try doubling the size of the buffer
+		dataLen *= 2;
+	}
+
+	if ( dataLen > DEMO_FILE_MAX_STRINGTABLE_SIZE )
+	{
+		Warning( "ReadPacket failed to read string tables. Trying to read string tables that's bigger than max string table size\n" );
+	}
+
+	free( data );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Read in next demo message and send to local client over network channel, if it's time.
 // Output : netpacket_t* -- NULL if there is no packet available at this time.
@@ -1244,33 +1298,32 @@ netpacket_t *CDemoPlayer::ReadPacket( void )
 			break;
 		case dem_stringtables:
 			{
-				void *data = NULL;
-				int dataLen = 512 * 1024;
-				while ( dataLen <= DEMO_FILE_MAX_STRINGTABLE_SIZE )
+				ReadDemoStringTables();
+			}
+			break;
+		case dem_keyframe:
+			{
+				if ( tick != m_nKeyframeTick )
 				{
-					data = realloc( data, dataLen );
-					bf_read buf( "dem_stringtables", data, dataLen );
-					// did we successfully read
-					if ( m_DemoFile.ReadStringTables( &buf ) > 0 )
-					{
-						buf.Seek( 0 );
-						if ( !networkStringTableContainerClient->ReadStringTables( buf ) )
-						{
-							Host_Error( "Error parsing string tables during demo playback." );
-						}
-						break;
-					}
-
-					// Didn't fit.  Try doubling the size of the buffer
-					dataLen *= 2;
+					// the packets around it hold the same state, keyframes are only for seeking
+					m_DemoFile.SkipKeyframe();
+					break;
 				}
 
-				if ( dataLen > DEMO_FILE_MAX_STRINGTABLE_SIZE )
+				if ( demo_debug.GetBool() )
 				{
-					Warning( "ReadPacket failed to read string tables. Trying to read string tables that's bigger than max string table size\n" );
+					Msg( "%d dem_keyframe\n", tick );
 				}
 
-				free( data );
+				m_nKeyframeTick = -1;
+
+				ReadDemoStringTables();
+
+				// playback clock continues from here, the packet is read like any dem_packet
+				m_nSkipToTick &= ~SKIP_TO_TICK_FLAG;
+				m_nStartTick = host_tickcount - tick;
+
+				bStopReading = true;
 			}
 			break;
 		case dem_usercmd:
@@ -1620,6 +1673,7 @@ CDemoPlayer::CDemoPlayer()
 	m_bLoading = false;
 	m_bPlaybackPaused = false;
 	m_nSkipToTick = -1;
+	m_nKeyframeTick = -1;
 	m_nSkipPacketsPlayed = 0;
 	m_nSnapshotTick = 0;
 	m_SnapshotFilename[0] = 0;
@@ -1672,6 +1726,12 @@ bool CDemoPlayer::StartPlayback( const char *filename, bool bAsTimeDemo )
 	
 	ConMsg ("Playing demo from %s.\n", filename);
 
+	m_nKeyframeTick = -1;
+	if ( m_DemoFile.ReadKeyframeIndex() > 0 )
+	{
+		ConDMsg( "Demo has %i keyframes for seeking.\n", m_DemoFile.m_Keyframes.Count() );
+	}
+
 	// Now read in the directory structure.
 	m_bPlayingBack = true;
 	cl.m_nSignonState= SIGNONSTATE_CONNECTED;
@@ -77,6 +77,7 @@ public:	// other public functions
 	bool	CheckPausedPlayback( void );
 	void	WriteTimeDemoResults( void );
 	bool	ParseAheadForInterval( int curtick, int intervalticks );
+	void	ReadDemoStringTables( void );
 	void	InterpolateDemoCommand( int targettick, DemoCommandQueue& prev, DemoCommandQueue& next );
 
 protected:
@@ -95,6 +96,7 @@ public:
 	float			m_flAutoResumeTime; // how long do we pause demo playback
 	float			m_flPlaybackRateModifier;
 	int				m_nSkipToTick;	// skip to tick ASAP, -1 = off
+	int				m_nKeyframeTick; // dem_keyframe a seek jumped to, -1 = skip all keyframes
 	int				m_nEndTick; // if nonzero, stop playback once we reach this tick
 	bool			m_bLoading; // true if demo is loading
 
@@ -2564,6 +2564,11 @@ void CDemoSmootherPanel::ParseSmoothingInfo( CDemoFile &demoFile, CSmoothingCont
 					demoFile.ReadStringTables( NULL );
 				}
 				break;
+			case dem_keyframe:
+				{
+					demoFile.SkipKeyframe();
+				}
+				break;
 			case dem_usercmd:
 				{
 					demoFile.ReadUserCmd( NULL, dummy );
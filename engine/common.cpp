@@ -43,6 +43,7 @@
 #include "tier3/tier3.h"
 #include <vgui/ILocalize.h>
 #include "tier1/lzss.h"
+#include "tier1/compressioncodec.h"
 #include "tier1/snappy.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -1342,19 +1343,10 @@ bool COM_BufferToBufferCompress_LZSS( void *dest, unsigned int *destLen, const v
 //-----------------------------------------------------------------------------
 int COM_GetUncompressedSize( const void *compressed, unsigned int compressedLen )
 {
-	const lzss_header_t *pHeader = (const lzss_header_t *)compressed;
-
-	// Check for our own LZSS compressed data
-	if ( ( compressedLen >= sizeof(lzss_header_t) ) && pHeader->id == LZSS_ID )
-		return LittleLong( pHeader->actualSize );
-
-	// Check for Snappy compressed
-	if ( compressedLen > sizeof(pHeader->id) && pHeader->id == SNAPPY_ID )
-	{
-		size_t snappySize;
-		if ( snappy::GetUncompressedLength( (const char *)compressed + sizeof(pHeader->id), compressedLen-sizeof(pHeader->id), &snappySize ) )
-			return (int)snappySize;
-	}
+	// Check for any of our compressed formats (LZSS, Snappy, LZ4)
+	const ICompressionCodec *pCodec = FindCompressionCodecForData( compressed, compressedLen );
+	if ( pCodec )
+		return pCodec->GetUncompressedSize( compressed, compressedLen );
 
 	return -1;
 }
@@ -1375,34 +1367,16 @@ bool COM_BufferToBufferDecompress( void *dest, unsigned int *destLen, const void
 			return false;
 		}
 
-		const lzss_header_t *pHeader = (const lzss_header_t *)source;
-		if ( pHeader->id == LZSS_ID )
-		{
-			CLZSS s;
-			int nActualDecompressedSize = s.SafeUncompress( (byte *)source, sourceLen, (byte *)dest, *destLen );
-			if ( nActualDecompressedSize != nDecompressedSize )
-			{
-				Warning( "NET_BufferToBufferDecompress: header said %d bytes would be decompressed, but we LZSS decompressed %d\n", nDecompressedSize, nActualDecompressedSize );
-				return false;
-			}
-			*destLen = nDecompressedSize;
-			return true;
-		}
-
-		if ( pHeader->id == SNAPPY_ID )
+		const ICompressionCodec *pCodec = FindCompressionCodecForData( source, sourceLen );
+		unsigned int nActualDecompressedSize = *destLen;
+		if ( !pCodec->Uncompress( dest, &nActualDecompressedSize, source, sourceLen ) )
 		{
-			if ( !snappy::RawUncompress( (const char *)source + 4, sourceLen - 4, (char *)dest ) )
-			{
-				Warning( "NET_BufferToBufferDecompress: Snappy decompression failed\n" );
-				return false;
-			}
-			*destLen = nDecompressedSize;
-			return true;
+			Warning( "NET_BufferToBufferDecompress: %s decompression of %d bytes failed\n", pCodec->GetName(), nDecompressedSize );
+			return false;
 		}
 
-		// Mismatch between this routine and COM_GetUncompressedSize
-		AssertMsg( false, "Unknown compression type?" );
-		return false;
+		*destLen = nActualDecompressedSize;
+		return true;
 	}
 	else
 	{
@@ -9,10 +9,12 @@
 #include <utlbuffer.h>
 
 #include "demofile.h"
+#include "demowriter.h"
 #include "filesystem_engine.h"
 #include "demo.h"
 #include "proto_version.h"
 #include "convar.h"	// For dbg_demofile
+#include "tier1/compressioncodec.h"
 
 // NOTE: This has to be the last file included!
 #include "tier0/memdbgon.h"
@@ -22,6 +24,7 @@ void Host_EndGame (bool bShowMainMenu, const char *message, ...);
 
 // Debug helpers - this class prints in a nested format
 ConVar dbg_demofile( "dbg_demofile", "0", FCVAR_DEVELOPMENTONLY | FCVAR_HIDDEN );
+static ConVar demo_asyncwrite( "demo_asyncwrite", "1", 0, "Write recorded demos on a background thread." );
 //#define DEMOFILE_DBG_PRINT
 #if defined( DEMOFILE_DBG_PRINT )
 class CDbgPrint
@@ -53,7 +56,9 @@ int CDbgPrint::s_nIndent = 0;
 CDemoFile::CDemoFile() :
 	m_pBuffer( NULL ),
 	m_bAllowHeaderWrite( true ),
-	m_bIsStreamBuffer( false )
+	m_bIsStreamBuffer( false ),
+	m_pWriter( NULL ),
+	m_nWriterOffset( 0 )
 {
 }
 
@@ -146,6 +151,13 @@ void CDemoFile::WriteCmdHeader( unsigned char cmd, int tick )
 	Assert( cmd >= dem_signon && cmd <= dem_lastcmd );
 
 	Assert( m_pBuffer && m_pBuffer->IsValid() );
+
+	// commands never span blocks, a block is handed over once it's full
+	if ( m_pWriter && m_pBuffer->TellPut() >= DEMO_WRITE_BLOCK_SIZE )
+	{
+		FlushToWriter();
+	}
+
 	m_pBuffer->PutUnsignedChar( cmd );
 	m_pBuffer->PutInt( tick );
 
@@ -159,7 +171,8 @@ void CDemoFile::WriteCmdHeader( unsigned char cmd, int tick )
 		"dem_usercmd",
 		"dem_datatables",
 		"dem_stop",
-		"dem_stringtables"
+		"dem_stringtables",
+		"dem_keyframe"
 	};
 
 	DemoFileDbg( "WriteCmdHeader()..." );
@@ -229,7 +242,7 @@ unsigned int CDemoFile::GetCurPos( bool bRead )
 		return 0;
 	if ( bRead )
 		return m_pBuffer->TellGet();
-	return m_pBuffer->TellPut();
+	return m_nWriterOffset + m_pBuffer->TellPut();
 }
 
 //-----------------------------------------------------------------------------
@@ -320,6 +333,153 @@ int CDemoFile::ReadUserCmd( char *buffer, int &size )
 	return outgoing_sequence;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Writes a point playback can start from without reading anything
+//			before it and remembers it for the index
+//-----------------------------------------------------------------------------
+void CDemoFile::WriteKeyframe( int tick, bf_write *stringtables, democmdinfo_t& info, int nSeqNrIn, int nSeqNrOutAck, bf_write *packet )
+{
+	DemoFileDbg( "WriteKeyframe()\n" );
+	MEM_ALLOC_CREDIT();
+
+	if ( !m_pBuffer || !m_pBuffer->IsValid() )
+		return;
+
+	Assert( m_DemoHeader.demoprotocol >= DEMO_PROTOCOL_INDEXED );
+	Assert( !m_Keyframes.Count() || m_Keyframes.Tail().tick <= tick );
+
+	demoindexentry_t entry;
+	entry.tick = tick;
+	entry.fileoffset = GetCurPos( false );
+	m_Keyframes.AddToTail( entry );
+
+	WriteCmdHeader( dem_keyframe, tick );
+	WriteRawData( (char*)stringtables->GetBasePointer(), stringtables->GetNumBytesWritten() );
+	WriteCmdInfo( info );
+	WriteSequenceInfo( nSeqNrIn, nSeqNrOutAck );
+	WriteRawData( (char*)packet->GetBasePointer(), packet->GetNumBytesWritten() );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Skips the rest of a dem_keyframe, the packets around it already
+//			carry the same state as deltas
+//-----------------------------------------------------------------------------
+void CDemoFile::SkipKeyframe()
+{
+	int dummy;
+	democmdinfo_t info;
+
+	ReadRawData( NULL, 0 );
+	ReadCmdInfo( info );
+	ReadSequenceInfo( dummy, dummy );
+	ReadRawData( NULL, 0 );
+}
+
+void CDemoFile::WriteKeyframeIndex()
+{
+	DemoFileDbg( "WriteKeyframeIndex()\n" );
+
+	if ( !m_pBuffer || !m_pBuffer->IsValid() )
+		return;
+
+	demoindextrailer_t trailer;
+	Q_memset( &trailer, 0, sizeof( trailer ) );
+	Q_strncpy( trailer.indexfilestamp, DEMO_INDEX_ID, sizeof( trailer.indexfilestamp ) );
+	trailer.numentries = m_Keyframes.Count();
+	trailer.indexoffset = GetCurPos( false );
+
+	FOR_EACH_VEC( m_Keyframes, i )
+	{
+		m_pBuffer->PutInt( m_Keyframes[i].tick );
+		m_pBuffer->PutInt( m_Keyframes[i].fileoffset );
+	}
+
+	m_pBuffer->Put( trailer.indexfilestamp, sizeof( trailer.indexfilestamp ) );
+	m_pBuffer->PutInt( trailer.numentries );
+	m_pBuffer->PutInt( trailer.indexoffset );
+
+	if ( dbg_demofile.GetInt() ) DevMsg( "wrote %i keyframes at file pos %i\n", trailer.numentries, trailer.indexoffset );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Loads the keyframe index from the end of the file. Demos that were
+//			never stopped properly have none and can only be played linearly.
+//-----------------------------------------------------------------------------
+int CDemoFile::ReadKeyframeIndex()
+{
+	m_Keyframes.RemoveAll();
+
+	if ( !m_pBuffer || !m_pBuffer->IsValid() || m_DemoHeader.demoprotocol < DEMO_PROTOCOL_INDEXED )
+		return 0;
+
+	int nSize = GetSize();
+	if ( nSize < (int)( sizeof( demoheader_t ) + sizeof( demoindextrailer_t ) ) )
+		return 0;
+
+	int nStartPos = GetCurPos( true );
+
+	demoindextrailer_t trailer;
+	m_pBuffer->SeekGet( CUtlBuffer::SEEK_HEAD, nSize - sizeof( demoindextrailer_t ) );
+	m_pBuffer->Get( trailer.indexfilestamp, sizeof( trailer.indexfilestamp ) );
+	trailer.numentries = m_pBuffer->GetInt();
+	trailer.indexoffset = m_pBuffer->GetInt();
+
+	bool bValid = m_pBuffer->IsValid() &&
+		!Q_strncmp( trailer.indexfilestamp, DEMO_INDEX_ID, sizeof( trailer.indexfilestamp ) ) &&
+		trailer.numentries >= 0 && trailer.indexoffset >= (int)sizeof( demoheader_t ) &&
+		trailer.indexoffset + trailer.numentries * (int)sizeof( demoindexentry_t ) == nSize - (int)sizeof( demoindextrailer_t );
+
+	if ( bValid )
+	{
+		m_pBuffer->SeekGet( CUtlBuffer::SEEK_HEAD, trailer.indexoffset );
+		m_Keyframes.EnsureCapacity( trailer.numentries );
+
+		for ( int i = 0; i < trailer.numentries && bValid; i++ )
+		{
+			demoindexentry_t entry;
+			entry.tick = m_pBuffer->GetInt();
+			entry.fileoffset = m_pBuffer->GetInt();
+
+			bValid = m_pBuffer->IsValid() &&
+				entry.fileoffset >= (int)sizeof( demoheader_t ) && entry.fileoffset < trailer.indexoffset &&
+				( !m_Keyframes.Count() || ( m_Keyframes.Tail().tick <= entry.tick && m_Keyframes.Tail().fileoffset < entry.fileoffset ) );
+
+			m_Keyframes.AddToTail( entry );
+		}
+	}
+
+	if ( !bValid )
+	{
+		ConDMsg( "%s has no valid keyframe index.\n", m_szFileName );
+		m_Keyframes.RemoveAll();
+	}
+
+	m_pBuffer->SeekGet( CUtlBuffer::SEEK_HEAD, nStartPos );
+
+	return m_Keyframes.Count();
+}
+
+const demoindexentry_t *CDemoFile::FindKeyframe( int tick )
+{
+	// binary search for the last keyframe not after tick
+	int nLow = 0;
+	int nHigh = m_Keyframes.Count();
+	while ( nLow < nHigh )
+	{
+		int nMid = ( nLow + nHigh ) / 2;
+		if ( m_Keyframes[nMid].tick <= tick )
+		{
+			nLow = nMid + 1;
+		}
+		else
+		{
+			nHigh = nMid;
+		}
+	}
+
+	return nLow > 0 ? &m_Keyframes[nLow - 1] : NULL;
+}
+
 //
 // Purpose: Rewind from the current spot by the time stamp, byte code and frame counter offsets
 //-----------------------------------------------------------------------------
@@ -332,6 +492,7 @@ void CDemoFile::SeekTo( int position, bool bRead )
 	}
 	else
 	{
+		Assert( !m_pWriter ); // handed over data can only be rewritten by WriteDemoHeader
 		m_pBuffer->SeekPut( CUtlBuffer::SEEK_HEAD, position );
 	}
 }
@@ -413,6 +574,24 @@ void CDemoFile::WriteDemoHeader()
 	demoheader_t littleEndianHeader = *((demoheader_t*)&m_DemoHeader);
 	ByteSwap_demoheader_t( littleEndianHeader );
 
+	if ( m_pWriter )
+	{
+		if ( m_nWriterOffset > 0 )
+		{
+			// already handed over, queue the rewrite behind it
+			m_pWriter->WriteAt( 0, &littleEndianHeader, sizeof( littleEndianHeader ) );
+		}
+		else
+		{
+			// still in the buffer, patch it there and keep appending behind it
+			int nPut = m_pBuffer->TellPut();
+			m_pBuffer->SeekPut( CUtlBuffer::SEEK_HEAD, 0 );
+			m_pBuffer->Put( &littleEndianHeader, sizeof( littleEndianHeader ) );
+			m_pBuffer->SeekPut( CUtlBuffer::SEEK_HEAD, MAX( nPut, (int)sizeof( littleEndianHeader ) ) );
+		}
+		return;
+	}
+
 	// Goto file start
 	m_pBuffer->SeekPut( CUtlBuffer::SEEK_HEAD, 0 );
 
@@ -454,11 +633,11 @@ demoheader_t *CDemoFile::ReadDemoHeader()
 		return NULL;
 	}
 
-	if ( ( m_DemoHeader.demoprotocol > DEMO_PROTOCOL) ||
+	if ( ( m_DemoHeader.demoprotocol > DEMO_PROTOCOL_INDEXED ) ||
 		 ( m_DemoHeader.demoprotocol < 2 ) )
 	{
 		ConMsg ("ERROR: demo file protocol %i outdated, engine vnoteersion is %i \n", 
-			m_DemoHeader.demoprotocol, DEMO_PROTOCOL );
+			m_DemoHeader.demoprotocol, DEMO_PROTOCOL_INDEXED );
 
 		return NULL;
 	}
@@ -495,6 +674,8 @@ bool CDemoFile::Open(const char *name, bool bReadOnly, bool bMemoryBuffer, int n
 
 	m_szFileName[0] = 0;  // clear name
 	Q_memset( &m_DemoHeader, 0, sizeof(m_DemoHeader) ); // and demo header
+	m_Keyframes.RemoveAll(); // and keyframes
+	m_nWriterOffset = 0;
 
 	// This is used by replay, which manually writes a header.
 	m_bAllowHeaderWrite = bAllowHeaderWrite;
@@ -506,6 +687,20 @@ bool CDemoFile::Open(const char *name, bool bReadOnly, bool bMemoryBuffer, int n
 		m_pBuffer = new CUtlBuffer( nBufferSize, nBufferSize, 0 );
 		m_bIsStreamBuffer = false;
 	}
+	else if ( !bReadOnly && demo_asyncwrite.GetBool() )
+	{
+		m_pWriter = new CDemoWriter;
+		if ( !m_pWriter->Open( name, NULL, sizeof( demoheader_t ) ) )
+		{
+			ConMsg ("CDemoFile::Open: couldn't open file %s for writing.\n", name );
+			delete m_pWriter;
+			m_pWriter = NULL;
+			return false;
+		}
+
+		m_pBuffer = new CUtlBuffer( 0, DEMO_WRITE_BLOCK_SIZE, 0 );
+		m_bIsStreamBuffer = false;
+	}
 	else
 	{
 		m_pBuffer = new CUtlStreamBuffer( name, NULL, bReadOnly ? CUtlBuffer::READ_ONLY : 0, false );
@@ -528,6 +723,13 @@ bool CDemoFile::Open(const char *name, bool bReadOnly, bool bMemoryBuffer, int n
 		Q_strncpy( m_szFileName, name, sizeof(m_szFileName) );
 	}
 
+	if ( bReadOnly && !UncompressDemo() )
+	{
+		ConMsg ("CDemoFile::Open: %s is compressed and damaged.\n", name );
+		Close();
+		return false;
+	}
+
 	return true;
 }
 
@@ -538,6 +740,19 @@ bool CDemoFile::IsOpen()
 
 void CDemoFile::Close()
 {
+	if ( m_pWriter )
+	{
+		// waits for the writer to finish the file
+		if ( m_pBuffer )
+		{
+			FlushToWriter();
+		}
+		m_pWriter->Close();
+		delete m_pWriter;
+		m_pWriter = NULL;
+	}
+	m_nWriterOffset = 0;
+
 	// CUtlBuffer base class does NOT have a virtual destructor!
 	if ( m_bIsStreamBuffer )
 	{
@@ -553,9 +768,131 @@ void CDemoFile::Close()
 
 int CDemoFile::GetSize()
 {
+	if ( m_pWriter )
+		return m_nWriterOffset + MAX( m_pBuffer->TellMaxPut(), 0 );
+
 	return m_pBuffer->TellMaxPut();
 }
 
+bool CDemoFile::SetCompressionCodec( const char *pszCodec )
+{
+	const ICompressionCodec *pCodec = FindCompressionCodec( pszCodec );
+	if ( !pCodec )
+	{
+		ConMsg( "Unknown demo compression codec \"%s\".\n", pszCodec );
+		return false;
+	}
+
+	if ( !m_pWriter || !m_pWriter->SetCodec( pCodec ) )
+	{
+		ConMsg( "Demo compression needs demo_asyncwrite 1, writing %s uncompressed.\n", m_szFileName );
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Hands everything written so far to the writer thread
+//-----------------------------------------------------------------------------
+void CDemoFile::FlushToWriter()
+{
+	Assert( m_pWriter );
+	m_nWriterOffset += m_pBuffer->TellPut();
+	m_pWriter->Write( *m_pBuffer );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Replaces the stream of a compressed demo with the whole demo
+//			uncompressed in memory. Uncompressed demos are left alone.
+//-----------------------------------------------------------------------------
+bool CDemoFile::UncompressDemo()
+{
+	const int nHeaderSize = sizeof( demoheader_t );
+	int nSize = GetSize();
+
+	char id[4];
+	if ( nSize < nHeaderSize + (int)sizeof( id ) )
+		return true;
+
+	m_pBuffer->SeekGet( CUtlBuffer::SEEK_HEAD, nHeaderSize );
+	m_pBuffer->Get( id, sizeof( id ) );
+	bool bCompressed = m_pBuffer->IsValid() && !V_memcmp( id, DEMO_COMPRESSED_ID, sizeof( id ) );
+	m_pBuffer->SeekGet( CUtlBuffer::SEEK_HEAD, 0 );
+
+	if ( !bCompressed )
+		return true;
+
+	CUtlBuffer *pUncompressed = new CUtlBuffer( 0, nSize * 2, 0 );
+	pUncompressed->SetBigEndian( false );
+
+	CUtlMemory<byte> block, uncompressed;
+	block.EnsureCapacity( nHeaderSize );
+	m_pBuffer->Get( block.Base(), nHeaderSize );
+	pUncompressed->Put( block.Base(), nHeaderSize );
+
+	m_pBuffer->SeekGet( CUtlBuffer::SEEK_HEAD, nHeaderSize + sizeof( id ) );
+
+	bool bOk = true;
+	while ( bOk && m_pBuffer->TellGet() < nSize )
+	{
+		int nBlockSize = m_pBuffer->GetInt();
+		bool bStored = nBlockSize < 0;
+		if ( bStored )
+		{
+			nBlockSize = -nBlockSize;
+		}
+
+		if ( !m_pBuffer->IsValid() || nBlockSize <= 0 || nBlockSize > nSize - m_pBuffer->TellGet() )
+		{
+			bOk = false;
+			break;
+		}
+
+		block.EnsureCapacity( nBlockSize );
+		m_pBuffer->Get( block.Base(), nBlockSize );
+
+		if ( bStored )
+		{
+			pUncompressed->Put( block.Base(), nBlockSize );
+			continue;
+		}
+
+		const ICompressionCodec *pCodec = FindCompressionCodecForData( block.Base(), nBlockSize );
+		int nUncompressedSize = pCodec ? pCodec->GetUncompressedSize( block.Base(), nBlockSize ) : -1;
+		if ( nUncompressedSize <= 0 || nUncompressedSize > DEMO_COMPRESSED_MAX_BLOCK )
+		{
+			bOk = false;
+			break;
+		}
+
+		uncompressed.EnsureCapacity( nUncompressedSize );
+		unsigned int nUncompressedLen = nUncompressedSize;
+		bOk = pCodec->Uncompress( uncompressed.Base(), &nUncompressedLen, block.Base(), nBlockSize );
+		pUncompressed->Put( uncompressed.Base(), nUncompressedLen );
+	}
+
+	if ( !bOk || !m_pBuffer->IsValid() || !pUncompressed->IsValid() )
+	{
+		delete pUncompressed;
+		return false;
+	}
+
+	if ( m_bIsStreamBuffer )
+	{
+		delete static_cast<CUtlStreamBuffer*>(m_pBuffer);
+	}
+	else
+	{
+		delete m_pBuffer;
+	}
+
+	m_pBuffer = pUncompressed;
+	m_bIsStreamBuffer = false;
+
+	return true;
+}
+
 // Returns the PROTOCOL_VERSION used when .dem was recorded
 int CDemoFile::GetProtocolVersion()
 {
@@ -28,6 +28,7 @@
 // Forward declarations
 //-----------------------------------------------------------------------------
 class IDemoBuffer;
+class CDemoWriter;
 
 //-----------------------------------------------------------------------------
 // Demo file 
@@ -42,6 +43,9 @@ public:
 	bool	IsOpen();
 	void	Close();
 
+	// compress everything after the demo header, call right after Open. Needs demo_asyncwrite.
+	bool	SetCompressionCodec( const char *pszCodec );
+
 	void	SeekTo( int position, bool bRead );
 	unsigned int GetCurPos( bool bRead );
 	int		GetSize();
@@ -70,6 +74,15 @@ public:
 	void	WriteUserCmd( int cmdnumber, const char *buffer, unsigned char bytes, int tick );
 	int		ReadUserCmd( char *buffer, int &size );
 
+	// keyframes are string tables followed by a packet, only written to DEMO_PROTOCOL_INDEXED demos.
+	// Read them with ReadStringTables and then like a dem_packet.
+	void	WriteKeyframe( int tick, bf_write *stringtables, democmdinfo_t& info, int nSeqNrIn, int nSeqNrOutAck, bf_write *packet );
+	void	SkipKeyframe();
+
+	void	WriteKeyframeIndex();	// after dem_stop
+	int		ReadKeyframeIndex();	// returns # of keyframes, 0 if the demo has no index
+	const demoindexentry_t *FindKeyframe( int tick );	// last keyframe at or before tick
+
 	void	WriteDemoHeader();
 	demoheader_t *ReadDemoHeader();
 
@@ -77,12 +90,20 @@ public:
 
 	// Returns the PROTOCOL_VERSION used when .dem was recorded
 	int		GetProtocolVersion();
+
+private:
+	void	FlushToWriter();
+	bool	UncompressDemo();
+
 public:
 	char			m_szFileName[MAX_PATH];	//name of current demo file
 	demoheader_t    m_DemoHeader;  //general demo info
 	CUtlBuffer		*m_pBuffer;
 	bool			m_bAllowHeaderWrite;
 	bool			m_bIsStreamBuffer;
+	CDemoWriter		*m_pWriter;			// set if a background thread writes the file, m_pBuffer holds what wasn't handed to it yet
+	int				m_nWriterOffset;	// file position of m_pBuffer's start
+	CUtlVector<demoindexentry_t> m_Keyframes;	// sorted by tick
 };
 
 #endif // DEMOFILE_H
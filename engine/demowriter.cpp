@@ -0,0 +1,302 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Background thread that writes recorded demo files
+//
+//=============================================================================
+
+#include "demowriter.h"
+#include "filesystem_engine.h"
+#include "demofile/demoformat.h"
+#include "tier1/compressioncodec.h"
+#include "tier1/convar.h"
+#include "tier1/strtools.h"
+#include "tier0/vprof.h"
+
+#ifdef POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static ConVar demo_asyncwrite_maxqueue( "demo_asyncwrite_maxqueue", "32", 0, "Megabytes of recorded demo data that may wait for the disk. Past this recording waits until the writer thread catches up.", true, 1, false, 0 );
+static ConVar demo_asyncwrite_fsync( "demo_asyncwrite_fsync", "1", 0, "Sync demo files to disk when recording stops." );
+
+CDemoWriter::CDemoWriter()
+{
+	SetName( "DemoWriter" );
+	m_szFileName[0] = 0;
+	m_hFile = FILESYSTEM_INVALID_HANDLE;
+	m_pCodec = NULL;
+	m_nRawPrefix = 0;
+	m_nBytesHandedOver = 0;
+	m_nBytesWritten = 0;
+	m_nStalls = 0;
+	m_bWriteFailed = false;
+	m_bThreadShouldExit = false;
+}
+
+CDemoWriter::~CDemoWriter()
+{
+	Close();
+
+	WriteBlock_t *pBlock;
+	while ( m_FreeBlocks.PopItem( &pBlock ) )
+	{
+		delete pBlock;
+	}
+}
+
+bool CDemoWriter::Open( const char *pszFileName, const ICompressionCodec *pCodec, int nRawPrefix )
+{
+	Close();
+
+	// open here so a bad path fails StartRecording, not the thread
+	m_hFile = g_pFileSystem->Open( pszFileName, "wb" );
+	if ( m_hFile == FILESYSTEM_INVALID_HANDLE )
+		return false;
+
+	Q_strncpy( m_szFileName, pszFileName, sizeof( m_szFileName ) );
+	m_pCodec = pCodec;
+	m_nRawPrefix = nRawPrefix;
+	m_nBytesHandedOver = 0;
+	m_nBytesWritten = 0;
+	m_nStalls = 0;
+	m_bWriteFailed = false;
+	m_bThreadShouldExit = false;
+
+	if ( !Start() )
+	{
+		Warning( "CDemoWriter: couldn't start writer thread for %s.\n", pszFileName );
+		g_pFileSystem->Close( m_hFile );
+		m_hFile = FILESYSTEM_INVALID_HANDLE;
+		return false;
+	}
+
+	return true;
+}
+
+void CDemoWriter::Close()
+{
+	if ( !IsAlive() )
+		return;
+
+	m_bThreadShouldExit = true;
+	m_QueuedEvent.Set();
+
+	Join(); // the thread writes everything queued before it exits
+
+	if ( m_nStalls )
+	{
+		ConMsg( "Demo recording waited %i times for the disk writing %s.\n", m_nStalls, m_szFileName );
+	}
+}
+
+bool CDemoWriter::SetCodec( const ICompressionCodec *pCodec )
+{
+	if ( m_nBytesHandedOver > 0 )
+		return false;
+
+	m_pCodec = pCodec;
+	return true;
+}
+
+CDemoWriter::WriteBlock_t *CDemoWriter::AllocBlock()
+{
+	WriteBlock_t *pBlock;
+	if ( !m_FreeBlocks.PopItem( &pBlock ) )
+	{
+		pBlock = new WriteBlock_t;
+		pBlock->m_Data.EnsureCapacity( DEMO_WRITE_BLOCK_SIZE );
+	}
+
+	pBlock->m_nFileOffset = -1;
+	return pBlock;
+}
+
+void CDemoWriter::QueueBlock( WriteBlock_t *pBlock )
+{
+	m_nQueuedBytes += pBlock->m_Data.TellPut();
+	m_Queue.PushItem( pBlock );
+	m_QueuedEvent.Set();
+
+	// backpressure: memory stays bounded, recording waits for the disk instead
+	int nMaxQueuedBytes = demo_asyncwrite_maxqueue.GetInt() * 1024 * 1024;
+	if ( m_nQueuedBytes > nMaxQueuedBytes )
+	{
+		VPROF_BUDGET( "CDemoWriter::WaitForDisk", VPROF_BUDGETGROUP_OTHER_FILESYSTEM );
+
+		if ( !m_nStalls )
+		{
+			Warning( "Demo recording of %s is waiting for the disk, more than %i MB queued.\n", m_szFileName, demo_asyncwrite_maxqueue.GetInt() );
+		}
+		m_nStalls++;
+
+		while ( m_nQueuedBytes > nMaxQueuedBytes && IsAlive() )
+		{
+			m_WrittenEvent.Wait( 100 );
+		}
+	}
+}
+
+void CDemoWriter::Write( CUtlBuffer &buf )
+{
+	int nSize = buf.TellPut();
+	if ( nSize <= 0 )
+		return;
+
+	Assert( IsAlive() );
+
+	// hand over the filled memory and continue in a pooled buffer
+	WriteBlock_t *pBlock = AllocBlock();
+	pBlock->m_Data.Swap( buf );
+	buf.Clear();
+
+	m_nBytesHandedOver += nSize;
+	QueueBlock( pBlock );
+}
+
+void CDemoWriter::WriteAt( int nFileOffset, const void *pData, int nSize )
+{
+	Assert( IsAlive() );
+	Assert( nFileOffset >= 0 && nFileOffset + nSize <= m_nBytesHandedOver );
+	Assert( !m_pCodec || nFileOffset + nSize <= m_nRawPrefix );
+
+	WriteBlock_t *pBlock = AllocBlock();
+	pBlock->m_nFileOffset = nFileOffset;
+	pBlock->m_Data.Put( pData, nSize );
+
+	QueueBlock( pBlock );
+}
+
+void CDemoWriter::WriteToFile( const void *pData, int nSize )
+{
+	if ( m_bWriteFailed || nSize <= 0 )
+		return;
+
+	if ( g_pFileSystem->Write( pData, nSize, m_hFile ) != nSize )
+	{
+		Warning( "CDemoWriter: write to %s failed, the demo will be incomplete.\n", m_szFileName );
+		m_bWriteFailed = true;
+	}
+}
+
+void CDemoWriter::WriteBlock( WriteBlock_t *pBlock )
+{
+	const byte *pData = (const byte *)pBlock->m_Data.Base();
+	int nSize = pBlock->m_Data.TellPut();
+
+	if ( pBlock->m_nFileOffset >= 0 )
+	{
+		g_pFileSystem->Seek( m_hFile, pBlock->m_nFileOffset, FILESYSTEM_SEEK_HEAD );
+		WriteToFile( pData, nSize );
+		g_pFileSystem->Seek( m_hFile, 0, FILESYSTEM_SEEK_TAIL );
+		return;
+	}
+
+	if ( !m_pCodec )
+	{
+		WriteToFile( pData, nSize );
+		m_nBytesWritten += nSize;
+		return;
+	}
+
+	// the demo header stays uncompressed so it can be rewritten in place
+	if ( m_nBytesWritten < m_nRawPrefix )
+	{
+		int nRaw = MIN( nSize, m_nRawPrefix - m_nBytesWritten );
+		WriteToFile( pData, nRaw );
+		m_nBytesWritten += nRaw;
+		pData += nRaw;
+		nSize -= nRaw;
+
+		if ( m_nBytesWritten == m_nRawPrefix )
+		{
+			WriteToFile( DEMO_COMPRESSED_ID, 4 );
+		}
+	}
+
+	// a big string table or keyframe makes a handed over block bigger than
+	// readers accept, those are split and continue in the next block
+	while ( nSize > 0 )
+	{
+		int nChunk = MIN( nSize, DEMO_COMPRESSED_MAX_BLOCK );
+
+		m_Compressed.EnsureCapacity( sizeof( int ) + m_pCodec->GetMaxCompressedSize( nChunk ) );
+
+		unsigned int nCompressedSize = m_Compressed.NumAllocated() - sizeof( int );
+		int nBlockSize;
+		if ( m_pCodec->Compress( m_Compressed.Base() + sizeof( int ), &nCompressedSize, pData, nChunk ) )
+		{
+			nBlockSize = LittleLong( (int)nCompressedSize );
+			V_memcpy( m_Compressed.Base(), &nBlockSize, sizeof( int ) );
+			WriteToFile( m_Compressed.Base(), sizeof( int ) + nCompressedSize );
+		}
+		else
+		{
+			// stored, a negative size means the bytes follow as they are
+			nBlockSize = LittleLong( -nChunk );
+			WriteToFile( &nBlockSize, sizeof( int ) );
+			WriteToFile( pData, nChunk );
+		}
+
+		m_nBytesWritten += nChunk;
+		pData += nChunk;
+		nSize -= nChunk;
+	}
+}
+
+void CDemoWriter::SyncFile()
+{
+	g_pFileSystem->Flush( m_hFile );
+	g_pFileSystem->Close( m_hFile );
+	m_hFile = FILESYSTEM_INVALID_HANDLE;
+
+#ifdef POSIX
+	// the file system doesn't expose descriptors, sync through a new one
+	if ( demo_asyncwrite_fsync.GetBool() )
+	{
+		char szFullPath[MAX_PATH];
+		if ( g_pFileSystem->RelativePathToFullPath_safe( m_szFileName, NULL, szFullPath ) )
+		{
+			int fd = open( szFullPath, O_RDONLY );
+			if ( fd >= 0 )
+			{
+				fsync( fd );
+				close( fd );
+			}
+		}
+	}
+#endif
+}
+
+int CDemoWriter::Run()
+{
+	for ( ;; )
+	{
+		// read the flag first, everything queued before it was set is written below
+		bool bExit = m_bThreadShouldExit;
+		ThreadMemoryBarrier();
+
+		WriteBlock_t *pBlock;
+		while ( m_Queue.PopItem( &pBlock ) )
+		{
+			WriteBlock( pBlock );
+
+			m_nQueuedBytes -= pBlock->m_Data.TellPut();
+			pBlock->m_Data.Clear();
+			m_FreeBlocks.PushItem( pBlock );
+			m_WrittenEvent.Set();
+		}
+
+		if ( bExit )
+			break;
+
+		m_QueuedEvent.Wait();
+	}
+
+	SyncFile();
+
+	return 0;
+}
@@ -0,0 +1,82 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Background thread that writes recorded demo files
+//
+//=============================================================================
+
+#ifndef DEMOWRITER_H
+#define DEMOWRITER_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/threadtools.h"
+#include "tier0/tslist.h"
+#include "tier1/utlbuffer.h"
+#include "tier1/utlmemory.h"
+#include "filesystem.h"
+
+class ICompressionCodec;
+
+#define DEMO_WRITE_BLOCK_SIZE	(256*1024)	// the recording thread hands over data in blocks about this big
+
+//-----------------------------------------------------------------------------
+// The recording thread fills a CUtlBuffer and swaps it with an empty pooled
+// one, the writer thread owns the file handle and does all file system calls.
+// With a codec everything after the raw prefix (the demo header, which is
+// rewritten when recording stops) is compressed block by block.
+//-----------------------------------------------------------------------------
+class CDemoWriter : public CThread
+{
+public:
+	CDemoWriter();
+	~CDemoWriter();
+
+	// Recording thread
+	bool	Open( const char *pszFileName, const ICompressionCodec *pCodec, int nRawPrefix );
+	void	Close();	// writes everything queued, then flushes and syncs the file
+
+	// Takes all data in buf and leaves it empty. Waits for the disk if too much is queued.
+	void	Write( CUtlBuffer &buf );
+	// Overwrites bytes that were written before, with a codec only within the raw prefix
+	void	WriteAt( int nFileOffset, const void *pData, int nSize );
+
+	bool	SetCodec( const ICompressionCodec *pCodec );	// only before anything was written
+
+private:
+	struct WriteBlock_t
+	{
+		CUtlBuffer	m_Data;
+		int			m_nFileOffset;	// -1 appends
+	};
+
+	// CThread Overrides
+	virtual int Run();
+
+	WriteBlock_t *AllocBlock();
+	void	QueueBlock( WriteBlock_t *pBlock );
+	void	WriteBlock( WriteBlock_t *pBlock );
+	void	WriteToFile( const void *pData, int nSize );
+	void	SyncFile();
+
+private:
+	CTSQueue< WriteBlock_t * >	m_Queue;
+	CTSList< WriteBlock_t * >	m_FreeBlocks;
+	CInterlockedInt				m_nQueuedBytes;
+	CThreadEvent				m_QueuedEvent;		// wakes the writer
+	CThreadEvent				m_WrittenEvent;		// wakes a recording thread waiting for space
+
+	char						m_szFileName[MAX_PATH];
+	FileHandle_t				m_hFile;
+	const ICompressionCodec		*m_pCodec;
+	int							m_nRawPrefix;
+	int							m_nBytesHandedOver;	// recording thread
+	int							m_nBytesWritten;	// writer thread, before compression
+	CUtlMemory<byte>			m_Compressed;		// writer thread
+	int							m_nStalls;
+	bool						m_bWriteFailed;
+
+	volatile bool				m_bThreadShouldExit;
+};
+
+#endif // DEMOWRITER_H
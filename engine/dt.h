@@ -404,6 +404,13 @@ public:
 	// from the server entity to the client entity.
 	CFastLocalTransferInfo	m_FastLocalTransfer;
 
+	// SendProp_GetFixedEncodedBits for each flat property, lets SendTable_CalcDelta step
+	// over props that can't have changed without decoding them.
+	CUtlVector<short>		m_PropFixedBits;
+
+	// One op per flat property, built by SendTable_BuildEncodePrograms. Empty until then.
+	CUtlVector<CSendPropEncodeOp>	m_EncodeProgram;
+
 	// This tells how many data table properties there are without SPROP_PROXY_ALWAYS_YES.
 	// Arrays allocated with this size can be indexed by CSendNode::GetDataTableProxyIndex().
 	int						m_nDataTableProxies;
@@ -1426,3 +1426,292 @@ PropTypeFns g_PropTypeFns[DPT_NUMSendPropTypes] =
 #endif
 
 };
+
+
+// ---------------------------------------------------------------------------------------- //
+// Fixed encoded sizes, these mirror the SkipProp functions above.
+// ---------------------------------------------------------------------------------------- //
+
+static int Float_GetFixedEncodedBits( const SendProp *pProp )
+{
+	int flags = pProp->GetFlags();
+	if ( flags & ( SPROP_COORD | SPROP_COORD_MP | SPROP_COORD_MP_LOWPRECISION | SPROP_COORD_MP_INTEGRAL ) )
+		return -1;
+	if ( flags & SPROP_NOSCALE )
+		return 32;
+	if ( flags & SPROP_NORMAL )
+		return NORMAL_FRACTIONAL_BITS + 1;
+	return pProp->m_nBits;
+}
+
+int SendProp_GetFixedEncodedBits( const SendProp *pProp )
+{
+	int nFloatBits;
+	switch ( pProp->GetType() )
+	{
+	case DPT_Int:
+#ifdef SUPPORTS_INT64
+	case DPT_Int64:
+#endif
+		return ( pProp->GetFlags() & SPROP_VARINT ) ? -1 : pProp->m_nBits;
+
+	case DPT_Float:
+		return Float_GetFixedEncodedBits( pProp );
+
+	case DPT_Vector:
+		nFloatBits = Float_GetFixedEncodedBits( pProp );
+		if ( nFloatBits < 0 )
+			return -1;
+		// Normals write a sign bit instead of z.
+		return ( pProp->GetFlags() & SPROP_NORMAL ) ? nFloatBits * 2 + 1 : nFloatBits * 3;
+
+	case DPT_VectorXY:
+		nFloatBits = Float_GetFixedEncodedBits( pProp );
+		return ( nFloatBits < 0 ) ? -1 : nFloatBits * 2;
+	}
+
+	return -1;
+}
+
+// ---------------------------------------------------------------------------------------- //
+// Encode program kernels. These must write exactly the same bits as the g_PropTypeFns
+// encoders, dt_encodeprogram_verify and RunDataTableTest check that they do.
+// ---------------------------------------------------------------------------------------- //
+
+enum
+{
+	FLOAT_ENCODE_QUANTIZED=0,
+	FLOAT_ENCODE_COORD,
+	FLOAT_ENCODE_COORD_MP,
+	FLOAT_ENCODE_COORD_MP_LOWPRECISION,
+	FLOAT_ENCODE_COORD_MP_INTEGRAL,
+	FLOAT_ENCODE_NOSCALE,
+	FLOAT_ENCODE_NORMAL
+};
+
+// Same precedence as EncodeSpecialFloat.
+static int GetFloatEncoding( int flags )
+{
+	if ( flags & SPROP_COORD )
+		return FLOAT_ENCODE_COORD;
+	if ( flags & SPROP_COORD_MP )
+		return FLOAT_ENCODE_COORD_MP;
+	if ( flags & SPROP_COORD_MP_LOWPRECISION )
+		return FLOAT_ENCODE_COORD_MP_LOWPRECISION;
+	if ( flags & SPROP_COORD_MP_INTEGRAL )
+		return FLOAT_ENCODE_COORD_MP_INTEGRAL;
+	if ( flags & SPROP_NOSCALE )
+		return FLOAT_ENCODE_NOSCALE;
+	if ( flags & SPROP_NORMAL )
+		return FLOAT_ENCODE_NORMAL;
+	return FLOAT_ENCODE_QUANTIZED;
+}
+
+template< int nEncoding >
+static FORCEINLINE void EncodeFloat_Kernel( const CSendPropEncodeOp *pOp, float fVal, bf_write *pOut, int objectID )
+{
+	switch ( nEncoding )
+	{
+	case FLOAT_ENCODE_COORD:					pOut->WriteBitCoord( fVal ); break;
+	case FLOAT_ENCODE_COORD_MP:					pOut->WriteBitCoordMP( fVal, false, false ); break;
+	case FLOAT_ENCODE_COORD_MP_LOWPRECISION:	pOut->WriteBitCoordMP( fVal, false, true ); break;
+	case FLOAT_ENCODE_COORD_MP_INTEGRAL:		pOut->WriteBitCoordMP( fVal, true, false ); break;
+	case FLOAT_ENCODE_NOSCALE:					pOut->WriteBitFloat( fVal ); break;
+	case FLOAT_ENCODE_NORMAL:					pOut->WriteBitNormal( fVal ); break;
+	default:
+		if ( fVal >= pOp->m_fLowValue && fVal <= pOp->m_fHighValue )
+		{
+			pOut->WriteUBitLong( RoundFloatToUnsignedLong( ( fVal - pOp->m_fLowValue ) * pOp->m_fHighLowMul ), pOp->m_nBits );
+		}
+		else
+		{
+			// Let the slow path clamp and warn.
+			EncodeFloat( pOp->m_pProp, fVal, pOut, objectID );
+		}
+		break;
+	}
+}
+
+// SendProxy_FloatToFloat
+template< int nEncoding >
+static void Float_EncodeKernel( const CSendPropEncodeOp *pOp, const unsigned char *pStructBase, CDeltaBitsWriter *pWriter, int objectID, bool bNonZeroOnly )
+{
+	float fVal = *(const float*)( pStructBase + pOp->m_Offset );
+	Assert( IsFinite( fVal ) );
+
+	if ( bNonZeroOnly && fVal == 0 )
+		return;
+
+	pWriter->WritePropIndex( pOp->m_iProp );
+	EncodeFloat_Kernel<nEncoding>( pOp, fVal, pWriter->GetBitBuf(), objectID );
+}
+
+// SendProxy_VectorToVector. Normals write a sign bit instead of z so they use the generic kernel.
+template< int nEncoding >
+static void Vector_EncodeKernel( const CSendPropEncodeOp *pOp, const unsigned char *pStructBase, CDeltaBitsWriter *pWriter, int objectID, bool bNonZeroOnly )
+{
+	const float *v = (const float*)( pStructBase + pOp->m_Offset );
+
+	if ( bNonZeroOnly && v[0] == 0 && v[1] == 0 && v[2] == 0 )
+		return;
+
+	pWriter->WritePropIndex( pOp->m_iProp );
+
+	bf_write *pOut = pWriter->GetBitBuf();
+	EncodeFloat_Kernel<nEncoding>( pOp, v[0], pOut, objectID );
+	EncodeFloat_Kernel<nEncoding>( pOp, v[1], pOut, objectID );
+	EncodeFloat_Kernel<nEncoding>( pOp, v[2], pOut, objectID );
+}
+
+// SendProxy_(U)Int8/16/32ToInt32, T is the member type the proxy reads.
+template< class T, bool bVarInt >
+static void Int_EncodeKernel( const CSendPropEncodeOp *pOp, const unsigned char *pStructBase, CDeltaBitsWriter *pWriter, int objectID, bool bNonZeroOnly )
+{
+	T memberValue;
+	memcpy( &memberValue, pStructBase + pOp->m_Offset, sizeof( T ) );
+	int nValue = (int)memberValue;
+
+	if ( bNonZeroOnly && nValue == 0 )
+		return;
+
+	pWriter->WritePropIndex( pOp->m_iProp );
+
+	bf_write *pOut = pWriter->GetBitBuf();
+	if ( bVarInt )
+	{
+		if ( pOp->m_pProp->GetFlags() & SPROP_UNSIGNED )
+		{
+			pOut->WriteVarInt32( nValue );
+		}
+		else
+		{
+			pOut->WriteSignedVarInt32( nValue );
+		}
+	}
+	else
+	{
+		int nSignExtension = ( nValue >> 31 ) & ~pOp->m_nPreserveBits;
+		pOut->WriteUBitLong( ( nValue & pOp->m_nPreserveBits ) | nSignExtension, pOp->m_nBits, false );
+	}
+}
+
+// Anything else goes through the proxy and g_PropTypeFns.
+static void Generic_EncodeKernel( const CSendPropEncodeOp *pOp, const unsigned char *pStructBase, CDeltaBitsWriter *pWriter, int objectID, bool bNonZeroOnly )
+{
+	const SendProp *pProp = pOp->m_pProp;
+
+	DVariant var;
+	pOp->m_ProxyFn( 
+		pProp,
+		pStructBase, 
+		pStructBase + pOp->m_Offset, 
+		&var, 
+		0, // iElement
+		objectID
+		);
+
+	if ( bNonZeroOnly && g_PropTypeFns[pProp->m_Type].IsZero( pStructBase, &var, pProp ) )
+		return;
+
+	pWriter->WritePropIndex( pOp->m_iProp );
+	g_PropTypeFns[pProp->m_Type].Encode( pStructBase, &var, pProp, pWriter->GetBitBuf(), objectID );
+}
+
+
+static SendPropEncodeFn g_FloatEncodeKernels[] =
+{
+	Float_EncodeKernel<FLOAT_ENCODE_QUANTIZED>,
+	Float_EncodeKernel<FLOAT_ENCODE_COORD>,
+	Float_EncodeKernel<FLOAT_ENCODE_COORD_MP>,
+	Float_EncodeKernel<FLOAT_ENCODE_COORD_MP_LOWPRECISION>,
+	Float_EncodeKernel<FLOAT_ENCODE_COORD_MP_INTEGRAL>,
+	Float_EncodeKernel<FLOAT_ENCODE_NOSCALE>,
+	Float_EncodeKernel<FLOAT_ENCODE_NORMAL>,
+};
+
+static SendPropEncodeFn g_VectorEncodeKernels[] =
+{
+	Vector_EncodeKernel<FLOAT_ENCODE_QUANTIZED>,
+	Vector_EncodeKernel<FLOAT_ENCODE_COORD>,
+	Vector_EncodeKernel<FLOAT_ENCODE_COORD_MP>,
+	Vector_EncodeKernel<FLOAT_ENCODE_COORD_MP_LOWPRECISION>,
+	Vector_EncodeKernel<FLOAT_ENCODE_COORD_MP_INTEGRAL>,
+	Vector_EncodeKernel<FLOAT_ENCODE_NOSCALE>,
+	Generic_EncodeKernel,
+};
+
+template< class T >
+static SendPropEncodeFn GetIntEncodeKernel( const SendProp *pProp )
+{
+	if ( pProp->GetFlags() & SPROP_VARINT )
+		return Int_EncodeKernel<T, true>;
+	
+	return Int_EncodeKernel<T, false>;
+}
+
+static SendPropEncodeFn GetEncodeKernel( const SendProp *pProp, const CStandardSendProxies *pSendProxies )
+{
+	if ( !pSendProxies )
+		return Generic_EncodeKernel;
+
+	SendVarProxyFn proxyFn = pProp->GetProxyFn();
+	switch ( pProp->GetType() )
+	{
+	case DPT_Int:
+		if ( proxyFn == pSendProxies->m_Int32ToInt32 )
+			return GetIntEncodeKernel<int32>( pProp );
+		if ( proxyFn == pSendProxies->m_UInt32ToInt32 )
+			return GetIntEncodeKernel<uint32>( pProp );
+		if ( proxyFn == pSendProxies->m_Int16ToInt32 )
+			return GetIntEncodeKernel<int16>( pProp );
+		if ( proxyFn == pSendProxies->m_UInt16ToInt32 )
+			return GetIntEncodeKernel<uint16>( pProp );
+		if ( proxyFn == pSendProxies->m_Int8ToInt32 )
+			return GetIntEncodeKernel<char>( pProp );	// char, like SendProxy_Int8ToInt32
+		if ( proxyFn == pSendProxies->m_UInt8ToInt32 )
+			return GetIntEncodeKernel<uint8>( pProp );
+		break;
+
+	case DPT_Float:
+		if ( proxyFn == pSendProxies->m_FloatToFloat )
+			return g_FloatEncodeKernels[GetFloatEncoding( pProp->GetFlags() )];
+		break;
+
+	case DPT_Vector:
+		if ( proxyFn == pSendProxies->m_VectorToVector )
+			return g_VectorEncodeKernels[GetFloatEncoding( pProp->GetFlags() )];
+		break;
+	}
+
+	return Generic_EncodeKernel;
+}
+
+void SendProp_InitEncodeOp( CSendPropEncodeOp *pOp, const SendProp *pProp, int iProp, int iProxy, const CStandardSendProxies *pSendProxies )
+{
+	Assert( iProp >= 0 && iProp < MAX_DATATABLE_PROPS );
+	Assert( iProxy >= 0 && iProxy <= 0xFF );
+
+	pOp->m_EncodeFn = GetEncodeKernel( pProp, pSendProxies );
+	pOp->m_pProp = pProp;
+	pOp->m_ProxyFn = pProp->GetProxyFn();
+	pOp->m_Offset = pProp->GetOffset();
+	pOp->m_fLowValue = pProp->m_fLowValue;
+	pOp->m_fHighValue = pProp->m_fHighValue;
+	pOp->m_fHighLowMul = pProp->m_fHighLowMul;
+	pOp->m_iProp = (unsigned short)iProp;
+	pOp->m_iProxy = (unsigned char)iProxy;
+	pOp->m_nBits = (unsigned char)pProp->m_nBits;
+
+	// See Int_Encode.
+	pOp->m_nPreserveBits = 0;
+	if ( pProp->GetType() == DPT_Int && pProp->m_nBits > 0 && pProp->m_nBits <= 32 )
+	{
+		pOp->m_nPreserveBits = ( 0x7FFFFFFF >> ( 32 - pProp->m_nBits ) );
+		pOp->m_nPreserveBits |= ( pProp->GetFlags() & SPROP_UNSIGNED ) ? 0xFFFFFFFF : 0;
+	}
+}
+
+bool SendProp_IsSpecializedEncodeOp( const CSendPropEncodeOp *pOp )
+{
+	return pOp->m_EncodeFn != Generic_EncodeKernel;
+}
@@ -91,4 +91,49 @@ extern PropTypeFns g_PropTypeFns[DPT_NUMSendPropTypes];
 int	DecodeBits( DecodeInfo *pInfo, unsigned char *pOut );
 
 
+// Number of bits pProp always encodes to, or -1 if that depends on the value (coords,
+// varints, strings, arrays). Must agree with the SkipProp functions.
+int SendProp_GetFixedEncodedBits( const SendProp *pProp );
+
+
+// ------------------------------------------------------------------------------------ //
+// Compiled encode programs.
+//
+// SendTable_BuildEncodePrograms turns each flattened SendTable into an array of
+// CSendPropEncodeOps with the offsets, bit counts and proxies already looked up, so
+// SendTable_Encode doesn't have to go through the SendProp and g_PropTypeFns per prop.
+// ------------------------------------------------------------------------------------ //
+
+class CDeltaBitsWriter;
+class CStandardSendProxies;
+class CSendPropEncodeOp;
+
+// Writes the prop index and value for one op, or nothing if bNonZeroOnly is set and the value is zero.
+typedef void (*SendPropEncodeFn)( const CSendPropEncodeOp *pOp, const unsigned char *pStructBase, CDeltaBitsWriter *pWriter, int objectID, bool bNonZeroOnly );
+
+class CSendPropEncodeOp
+{
+public:
+	SendPropEncodeFn	m_EncodeFn;
+	const SendProp		*m_pProp;
+	SendVarProxyFn		m_ProxyFn;			// Only the generic kernel calls the proxy.
+	int					m_Offset;
+	int					m_nPreserveBits;	// DPT_Int: the value bits that survive m_nBits (see Int_Encode).
+	float				m_fLowValue;
+	float				m_fHighValue;
+	float				m_fHighLowMul;
+	unsigned short		m_iProp;
+	unsigned char		m_iProxy;			// CSendTablePrecalc::m_PropProxyIndices[m_iProp]
+	unsigned char		m_nBits;
+};
+
+// Fills in pOp for pProp. Ints, floats and vectors that use one of the standard proxies in
+// pSendProxies get a kernel that reads the member directly, everything else (and everything
+// if pSendProxies is NULL) calls the proxy and g_PropTypeFns like SendTable_Encode always did.
+void SendProp_InitEncodeOp( CSendPropEncodeOp *pOp, const SendProp *pProp, int iProp, int iProxy, const CStandardSendProxies *pSendProxies );
+
+// True if pOp uses one of the specialized kernels.
+bool SendProp_IsSpecializedEncodeOp( const CSendPropEncodeOp *pOp );
+
+
 #endif // DATATABLE_ENCODE_H
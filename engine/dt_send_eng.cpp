@@ -10,6 +10,7 @@
 #include <tier0/icommandline.h>
 #include <commonmacros.h>
 #include <checksum_crc.h>
+#include "convar.h"
 
 #include "dt_send_eng.h"
 #include "dt_encode.h"
@@ -29,6 +30,10 @@ class CSendNode;
 
 extern bool Sendprop_UsingDebugWatch();
 
+static ConVar dt_encodeprogram( "dt_encodeprogram", "1", 0, "Encode entities with the per-SendTable encode programs built at startup instead of walking the SendProps." );
+static ConVar dt_calcdelta_wordcompare( "dt_calcdelta_wordcompare", "1", 0, "Compare packed entities 64 bits at a time in SendTable_CalcDelta and only compare the props where they differ." );
+static ConVar dt_encodeprogram_verify( "dt_encodeprogram_verify", "0", 0, "Encode entities both ways and warn if the encode program writes different bits than the SendProp walk." );
+
 
 // This stack doesn't actually call any proxies. It uses the CSendProxyRecipients to tell
 // what can be sent to the specified client.
@@ -403,7 +408,7 @@ int SendTable_WriteAllDeltaProps(
 }
 
 
-bool SendTable_Encode(
+bool SendTable_EncodeWalk(
 	const SendTable *pTable,
 	const void *pStruct, 
 	bf_write *pOut, 
@@ -450,6 +455,119 @@ bool SendTable_Encode(
 }
 
 
+bool SendTable_EncodeProgram(
+	const SendTable *pTable,
+	const void *pStruct, 
+	bf_write *pOut, 
+	int objectID,
+	CUtlMemory<CSendProxyRecipients> *pRecipients,
+	bool bNonZeroOnly
+	)
+{
+	CSendTablePrecalc *pPrecalc = pTable->m_pPrecalc;
+	ErrorIfNot( pPrecalc, ("SendTable_Encode: Missing m_pPrecalc for SendTable %s.", pTable->m_pNetTableName) );
+
+	if ( pPrecalc->m_EncodeProgram.Count() != pPrecalc->GetNumProps() )
+	{
+		return SendTable_EncodeWalk( pTable, pStruct, pOut, objectID, pRecipients, bNonZeroOnly );
+	}
+
+	if ( pRecipients )
+	{
+		ErrorIfNot(	pRecipients->NumAllocated() >= pPrecalc->GetNumDataTableProxies(), ("SendTable_Encode: pRecipients array too small.") );
+	}
+
+	VPROF( "SendTable_Encode" );
+
+	CServerDTITimer timer( pTable, SERVERDTI_ENCODE );
+
+	// The datatable proxies still have to run to find each prop's struct base (and fill in pRecipients).
+	CEncodeInfo info( pPrecalc, (unsigned char*)pStruct, objectID, pOut );
+	info.m_pRecipients = pRecipients;
+
+	info.Init();
+
+	const CSendPropEncodeOp *pOp = pPrecalc->m_EncodeProgram.Base();
+	const CSendPropEncodeOp *pEnd = pOp + pPrecalc->m_EncodeProgram.Count();
+	for ( ; pOp < pEnd; ++pOp )
+	{
+		// skip if we don't have a valid prop proxy
+		const unsigned char *pStructBase = info.m_pProxies[pOp->m_iProxy];
+		if ( !pStructBase )
+			continue;
+
+		pOp->m_EncodeFn( pOp, pStructBase, &info.m_DeltaBitsWriter, objectID, bNonZeroOnly );
+	}
+
+	return !pOut->IsOverflowed();
+}
+
+
+// Re-encodes with the SendProp walk and compares it to what the encode program wrote
+// into pOut starting at iStartBit.
+static void SendTable_VerifyEncodeProgram(
+	const SendTable *pTable,
+	const void *pStruct, 
+	bf_write *pOut, 
+	int iStartBit,
+	int objectID,
+	bool bNonZeroOnly
+	)
+{
+	ALIGN4 unsigned char walkData[MAX_PACKEDENTITY_DATA] ALIGN4_POST;
+	bf_write walkBuf( "SendTable_VerifyEncodeProgram->walkBuf", walkData, sizeof( walkData ) );
+	SendTable_EncodeWalk( pTable, pStruct, &walkBuf, objectID, NULL, bNonZeroOnly );
+
+	int nProgramBits = pOut->GetNumBitsWritten() - iStartBit;
+	int nWalkBits = walkBuf.GetNumBitsWritten();
+
+	int iFirstDiff = -1;
+	bf_read programRead( "SendTable_VerifyEncodeProgram->programRead", pOut->GetBasePointer(), pOut->GetNumBytesWritten() );
+	bf_read walkRead( "SendTable_VerifyEncodeProgram->walkRead", walkData, walkBuf.GetNumBytesWritten() );
+	programRead.Seek( iStartBit );
+	for ( int i=0; i < MIN( nProgramBits, nWalkBits ); i++ )
+	{
+		if ( programRead.ReadOneBit() != walkRead.ReadOneBit() )
+		{
+			iFirstDiff = i;
+			break;
+		}
+	}
+
+	if ( iFirstDiff == -1 && nProgramBits == nWalkBits )
+		return;
+
+	Warning( "dt_encodeprogram_verify: %s (ent %d) encoded %d bits, SendProp walk encoded %d bits, first difference at bit %d.\n",
+		pTable->GetName(), objectID, nProgramBits, nWalkBits, iFirstDiff == -1 ? MIN( nProgramBits, nWalkBits ) : iFirstDiff );
+}
+
+
+bool SendTable_Encode(
+	const SendTable *pTable,
+	const void *pStruct, 
+	bf_write *pOut, 
+	int objectID,
+	CUtlMemory<CSendProxyRecipients> *pRecipients,
+	bool bNonZeroOnly
+	)
+{
+	if ( !dt_encodeprogram.GetBool() )
+	{
+		return SendTable_EncodeWalk( pTable, pStruct, pOut, objectID, pRecipients, bNonZeroOnly );
+	}
+
+	int iStartBit = pOut->GetNumBitsWritten();
+	bool bRet = SendTable_EncodeProgram( pTable, pStruct, pOut, objectID, pRecipients, bNonZeroOnly );
+
+	if ( bRet && dt_encodeprogram_verify.GetBool() )
+	{
+		SendTable_VerifyEncodeProgram( pTable, pStruct, pOut, iStartBit, objectID, bNonZeroOnly );
+	}
+
+	return bRet;
+}
+
+
 void SendTable_WritePropList(
 	const SendTable *pTable,
 	const void *pState,
@@ -533,7 +651,104 @@ void SendTable_WritePropList(
 }
 
 
-int SendTable_CalcDelta(
+// Compares the rest of two packed entities prop by prop. iFromProp and iToProp are the
+// indices the readers last returned. Returns the new end of the delta prop list.
+static int *SendTable_CompareRemainingProps(
+	CSendTablePrecalc *pPrecalc,
+	CDeltaBitsReader &fromBitsReader,
+	unsigned int iFromProp,
+	CDeltaBitsReader &toBitsReader,
+	unsigned int iToProp,
+	int *pDeltaProps,
+	int *pDeltaPropsEnd
+	)
+{
+	for ( ; iToProp < MAX_DATATABLE_PROPS; iToProp = toBitsReader.ReadNextPropIndex() )
+	{
+		Assert( (int)iToProp >= 0 );
+
+		// Skip any properties in the from state that aren't in the to state.
+		while ( iFromProp < iToProp )
+		{
+			fromBitsReader.SkipPropData( pPrecalc->GetProp( iFromProp ) );
+			iFromProp = fromBitsReader.ReadNextPropIndex();
+		}
+
+		if ( iFromProp == iToProp )
+		{
+			// The property is in both states, so compare them and write the index 
+			// if the states are different.
+			if ( fromBitsReader.ComparePropData( &toBitsReader, pPrecalc->GetProp( iToProp ) ) )
+			{
+				*pDeltaProps++ = iToProp;
+				if ( pDeltaProps >= pDeltaPropsEnd )
+				{
+					break;
+				}
+			}
+
+			// Seek to the next property.
+			iFromProp = fromBitsReader.ReadNextPropIndex();
+		}
+		else
+		{
+			// Only the 'to' state has this property, so just skip its data and register a change.
+			toBitsReader.SkipPropData( pPrecalc->GetProp( iToProp ) );
+			*pDeltaProps++ = iToProp;
+			if ( pDeltaProps >= pDeltaPropsEnd )
+			{
+				break;
+			}
+		}
+	}
+
+	Assert( iToProp == ~0u );
+
+	fromBitsReader.ForceFinished();
+	return pDeltaProps;
+}
+
+
+// Returns the first bit at or after iStartBit where the two packed buffers differ, or nBits
+// if they're the same up to there. Packed entities are little endian dwords, so byte i
+// always holds bits i*8 to i*8+7 and the buffers can be compared 64 bits at a time.
+static int FindFirstDifferentBit( const unsigned char *pData1, const unsigned char *pData2, int iStartBit, int nBits )
+{
+	int iByte = iStartBit >> 3;
+	int nWholeBytes = nBits >> 3;
+	uint64 mask = ~(uint64)0 << ( iStartBit & 7 );
+
+	for ( ; iByte + (int)sizeof( uint64 ) <= nWholeBytes; iByte += sizeof( uint64 ) )
+	{
+		uint64 word1, word2;
+		memcpy( &word1, pData1 + iByte, sizeof( word1 ) );
+		memcpy( &word2, pData2 + iByte, sizeof( word2 ) );
+
+		uint64 diff = LittleQWord( word1 ^ word2 ) & mask;
+		if ( diff )
+		{
+			uint32 nLow = (uint32)diff;
+			int iBit = nLow ? FirstBitInWord( nLow, iByte * 8 ) : FirstBitInWord( (uint32)( diff >> 32 ), iByte * 8 + 32 );
+			return MIN( iBit, nBits );
+		}
+		mask = ~(uint64)0;
+	}
+
+	for ( ; iByte < Bits2Bytes( nBits ); iByte++ )
+	{
+		uint32 diff = ( pData1[iByte] ^ pData2[iByte] ) & (uint32)mask & 0xFF;
+		if ( diff )
+		{
+			return MIN( FirstBitInWord( diff, iByte * 8 ), nBits );
+		}
+		mask = ~(uint64)0;
+	}
+
+	return nBits;
+}
+
+
+int SendTable_CalcDeltaWalk(
 	const SendTable *pTable,
 	
 	const void *pFromState,
@@ -573,37 +788,17 @@ int SendTable_CalcDelta(
 		CDeltaBitsReader fromBitsReader( &fromBits );
 		unsigned int iFromProp = fromBitsReader.ReadNextPropIndex();
 
-		for ( ; iToProp < MAX_DATATABLE_PROPS; iToProp = toBitsReader.ReadNextPropIndex() )
+		pDeltaProps = SendTable_CompareRemainingProps( pPrecalc, fromBitsReader, iFromProp, toBitsReader, iToProp, pDeltaProps, pDeltaPropsEnd );
+	}
+	else
+	{
+		for ( ; iToProp != (uint)-1; iToProp = toBitsReader.ReadNextPropIndex() )
 		{
-			Assert( (int)iToProp >= 0 );
-
-			// Skip any properties in the from state that aren't in the to state.
-			while ( iFromProp < iToProp )
-			{
-				fromBitsReader.SkipPropData( pPrecalc->GetProp( iFromProp ) );
-				iFromProp = fromBitsReader.ReadNextPropIndex();
-			}
-
-			if ( iFromProp == iToProp )
-			{
-				// The property is in both states, so compare them and write the index 
-				// if the states are different.
-				if ( fromBitsReader.ComparePropData( &toBitsReader, pPrecalc->GetProp( iToProp ) ) )
-				{
-					*pDeltaProps++ = iToProp;
-					if ( pDeltaProps >= pDeltaPropsEnd )
-					{
-						break;
-					}
-				}
+			Assert( (int)iToProp >= 0 && iToProp < MAX_DATATABLE_PROPS );
 
-				// Seek to the next property.
-				iFromProp = fromBitsReader.ReadNextPropIndex();
-			}
-			else
+			const SendProp *pProp = pPrecalc->GetProp( iToProp );
+			if ( !g_PropTypeFns[pProp->m_Type].IsEncodedZero( pProp, &toBits ) )
 			{
-				// Only the 'to' state has this property, so just skip its data and register a change.
-				toBitsReader.SkipPropData( pPrecalc->GetProp( iToProp ) );
 				*pDeltaProps++ = iToProp;
 				if ( pDeltaProps >= pDeltaPropsEnd )
 				{
@@ -611,33 +806,150 @@ int SendTable_CalcDelta(
 				}
 			}
 		}
+	}
+
+	// Return the # of properties that changed between 'from' and 'to'.
+	return pDeltaProps - pDeltaPropsBase;
+}
+
 
-		Assert( iToProp == ~0u );
+int SendTable_CalcDeltaWordCompare(
+	const SendTable *pTable,
+	
+	const void *pFromState,
+	const int nFromBits,
+	
+	const void *pToState,
+	const int nToBits,
+	
+	int *pDeltaProps,
+	int nMaxDeltaProps,
 
-		fromBitsReader.ForceFinished();
+	const int objectID
+	)
+{
+	if ( !pFromState )
+	{
+		return SendTable_CalcDeltaWalk( pTable, pFromState, nFromBits, pToState, nToBits, pDeltaProps, nMaxDeltaProps, objectID );
 	}
-	else
+
+	CServerDTITimer timer( pTable, SERVERDTI_CALCDELTA );
+
+	int *pDeltaPropsBase = pDeltaProps;
+	int *pDeltaPropsEnd = pDeltaProps + nMaxDeltaProps;
+
+	VPROF( "SendTable_CalcDelta" );
+
+	CSendTablePrecalc* pPrecalc = pTable->m_pPrecalc;
+	const unsigned char *pFromData = (const unsigned char*)pFromState;
+	const unsigned char *pToData = (const unsigned char*)pToState;
+
+	bf_read toBits( "SendTable_CalcDelta/toBits", pToState, BitByte(nToBits), nToBits );
+	bf_read fromBits( "SendTable_CalcDelta/fromBits", pFromState, BitByte(nFromBits), nFromBits );
+	CDeltaBitsReader toBitsReader( &toBits );
+	CDeltaBitsReader fromBitsReader( &fromBits );
+
+	// While both readers are at the same bit and last prop index, everything before them
+	// is identical and the props up to iDiffBit can be stepped over without comparing them.
+	int nCompareBits = MIN( nFromBits, nToBits );
+	int iDiffBit = -1;
+	unsigned int iFromProp, iToProp;
+	for ( ;; )
 	{
-		for ( ; iToProp != (uint)-1; iToProp = toBitsReader.ReadNextPropIndex() )
+		int iCurBit = toBits.GetNumBitsRead();
+		if ( iDiffBit < iCurBit )
 		{
-			Assert( (int)iToProp >= 0 && iToProp < MAX_DATATABLE_PROPS );
+			iDiffBit = FindFirstDifferentBit( pFromData, pToData, iCurBit, nCompareBits );
 
-			const SendProp *pProp = pPrecalc->GetProp( iToProp );
-			if ( !g_PropTypeFns[pProp->m_Type].IsEncodedZero( pProp, &toBits ) )
+			// The rest of the states is identical, nothing else can have changed.
+			if ( iDiffBit == nCompareBits && nFromBits == nToBits )
 			{
-				*pDeltaProps++ = iToProp;
-				if ( pDeltaProps >= pDeltaPropsEnd )
-				{
-					break;
-				}
+				toBitsReader.ForceFinished();
+				fromBitsReader.ForceFinished();
+				return pDeltaProps - pDeltaPropsBase;
 			}
 		}
+
+		iToProp = toBitsReader.ReadNextPropIndex();
+		iFromProp = fromBitsReader.ReadNextPropIndex();
+		if ( iToProp != iFromProp || toBits.GetNumBitsRead() != fromBits.GetNumBitsRead() )
+			break;	// the prop lists differ from here on
+
+		if ( iToProp == ~0u )
+			return pDeltaProps - pDeltaPropsBase;
+
+		const SendProp *pProp = pPrecalc->GetProp( iToProp );
+		int iDataBit = toBits.GetNumBitsRead();
+		int nFixedBits = pPrecalc->m_PropFixedBits[iToProp];
+		if ( nFixedBits >= 0 )
+		{
+			if ( iDataBit + nFixedBits <= iDiffBit )
+			{
+				toBits.SeekRelative( nFixedBits );
+				fromBits.SeekRelative( nFixedBits );
+				continue;
+			}
+		}
+		else
+		{
+			toBitsReader.SkipPropData( pProp );
+			if ( toBits.GetNumBitsRead() <= iDiffBit )
+			{
+				fromBits.Seek( toBits.GetNumBitsRead() );
+				continue;
+			}
+			toBits.Seek( iDataBit );
+		}
+
+		// The difference is in this prop's data.
+		if ( fromBitsReader.ComparePropData( &toBitsReader, pProp ) )
+		{
+			*pDeltaProps++ = iToProp;
+			if ( pDeltaProps >= pDeltaPropsEnd )
+			{
+				toBitsReader.ForceFinished();
+				fromBitsReader.ForceFinished();
+				return pDeltaProps - pDeltaPropsBase;
+			}
+		}
+
+		// If it changed size the rest of the props aren't lined up anymore.
+		if ( toBits.GetNumBitsRead() != fromBits.GetNumBitsRead() )
+		{
+			iToProp = toBitsReader.ReadNextPropIndex();
+			iFromProp = fromBitsReader.ReadNextPropIndex();
+			break;
+		}
 	}
 
-	// Return the # of properties that changed between 'from' and 'to'.
+	pDeltaProps = SendTable_CompareRemainingProps( pPrecalc, fromBitsReader, iFromProp, toBitsReader, iToProp, pDeltaProps, pDeltaPropsEnd );
 	return pDeltaProps - pDeltaPropsBase;
 }
 
+
+int SendTable_CalcDelta(
+	const SendTable *pTable,
+	
+	const void *pFromState,
+	const int nFromBits,
+	
+	const void *pToState,
+	const int nToBits,
+	
+	int *pDeltaProps,
+	int nMaxDeltaProps,
+
+	const int objectID
+	)
+{
+	if ( dt_calcdelta_wordcompare.GetBool() )
+	{
+		return SendTable_CalcDeltaWordCompare( pTable, pFromState, nFromBits, pToState, nToBits, pDeltaProps, nMaxDeltaProps, objectID );
+	}
+
+	return SendTable_CalcDeltaWalk( pTable, pFromState, nFromBits, pToState, nToBits, pDeltaProps, nMaxDeltaProps, objectID );
+}
+
 bool SendTable_WriteInfos( SendTable *pTable, bf_write *pBuf )
 {
 	pBuf->WriteString( pTable->GetName() );
@@ -763,11 +1075,29 @@ static bool SendTable_InitTable( SendTable *pTable )
 	if ( !pPrecalc->SetupFlatPropertyArray() )
 		return false;
 
+	pPrecalc->m_PropFixedBits.SetCount( pPrecalc->GetNumProps() );
+	for ( int i=0; i < pPrecalc->GetNumProps(); i++ )
+	{
+		pPrecalc->m_PropFixedBits[i] = SendProp_GetFixedEncodedBits( pPrecalc->GetProp( i ) );
+	}
+
 	SendTable_Validate( pPrecalc );
 	return true;
 }
 
 
+static void SendTable_BuildEncodeProgram( CSendTablePrecalc *pPrecalc, const CStandardSendProxies *pSendProxies )
+{
+	int nProps = pPrecalc->GetNumProps();
+	pPrecalc->m_EncodeProgram.SetCount( nProps );
+
+	for ( int iProp=0; iProp < nProps; iProp++ )
+	{
+		SendProp_InitEncodeOp( &pPrecalc->m_EncodeProgram[iProp], pPrecalc->GetProp( iProp ), iProp, pPrecalc->m_PropProxyIndices[iProp], pSendProxies );
+	}
+}
+
+
 static void SendTable_TermTable( SendTable *pTable )
 {
 	if( !pTable->m_pPrecalc )
@@ -929,6 +1259,31 @@ bool SendTable_Init( SendTable **pTables, int nTables )
 
 	return true;	
 }
+void SendTable_BuildEncodePrograms( const CStandardSendProxies *pSendProxies )
+{
+	int nOps = 0;
+	int nSpecializedOps = 0;
+
+	for ( int i=0; i < g_SendTables.Count(); i++ )
+	{
+		CSendTablePrecalc *pPrecalc = g_SendTables[i]->m_pPrecalc;
+		SendTable_BuildEncodeProgram( pPrecalc, pSendProxies );
+
+		for ( int iOp=0; iOp < pPrecalc->m_EncodeProgram.Count(); iOp++ )
+		{
+			if ( SendProp_IsSpecializedEncodeOp( &pPrecalc->m_EncodeProgram[iOp] ) )
+				++nSpecializedOps;
+		}
+		nOps += pPrecalc->m_EncodeProgram.Count();
+	}
+
+	if ( CommandLine()->FindParm( "-dti" ) )
+	{
+		Msg( "Encode programs: %i ops, %i specialized\n", nOps, nSpecializedOps );
+	}
+}
+
+
 void SendTable_Term()
 {
 	// Term all the SendTables.
@@ -35,6 +35,11 @@ int			SendTable_GetNum();
 SendTable	*SendTabe_GetTable(int index);
 
 
+// Build the encode programs SendTable_Encode runs when dt_encodeprogram is set. Int, float and
+// vector props using the game's standard proxies in pSendProxies get specialized kernels.
+void		SendTable_BuildEncodePrograms( const CStandardSendProxies *pSendProxies );
+
+
 // Return the number of unique properties in the table.
 int	SendTable_GetNumFlatProps( SendTable *pTable );
 
@@ -77,6 +82,11 @@ int	SendTable_CalcDelta(
 
 	const int objectID );
 
+// The two diffs SendTable_CalcDelta picks from. The word compare one scans the packed data
+// 64 bits at a time and only compares the props that overlap a differing bit.
+int SendTable_CalcDeltaWalk( const SendTable *pTable, const void *pFromState, const int nFromBits, const void *pToState, const int nToBits, int *pDeltaProps, int nMaxDeltaProps, const int objectID );
+int SendTable_CalcDeltaWordCompare( const SendTable *pTable, const void *pFromState, const int nFromBits, const void *pToState, const int nToBits, int *pDeltaProps, int nMaxDeltaProps, const int objectID );
+
 
 // This function takes the list of property indices in startProps and the values from
 // SendProxies in pProxyResults, and fills in a new array in outProps with the properties
@@ -117,6 +127,12 @@ bool SendTable_Encode(
 	);
 
 
+// The two encoders SendTable_Encode picks from. The program one falls back to walking the
+// SendProps if SendTable_BuildEncodePrograms hasn't been called.
+bool SendTable_EncodeWalk( const SendTable *pTable, const void *pStruct, bf_write *pOut, int objectID, CUtlMemory<CSendProxyRecipients> *pRecipients, bool bNonZeroOnly );
+bool SendTable_EncodeProgram( const SendTable *pTable, const void *pStruct, bf_write *pOut, int objectID, CUtlMemory<CSendProxyRecipients> *pRecipients, bool bNonZeroOnly );
+
+
 // In order to receive a table, you must send it from the server and receive its info
 // on the client so the client knows how to unpack it.
 bool SendTable_WriteInfos( SendTable *pTable, bf_write *pBuf );
@@ -831,6 +831,150 @@ bool WriteSendTable_R( SendTable *pTable, bf_write &bfWrite, bool bNeedsDecoder
 }
 
 
+// ------------------------------------------------------------------------------------------- //
+// Encode program test: one prop per encode kernel, encoded with the program and with the
+// SendProp walk, which must write exactly the same bits.
+// ------------------------------------------------------------------------------------------- //
+class DTEncodeProgramTest
+{
+public:
+	int				m_Int32;
+	int				m_IntSigned;
+	unsigned int	m_UInt32;
+	short			m_Int16;
+	unsigned short	m_UInt16;
+	char			m_Int8;
+	unsigned char	m_UInt8;
+	int				m_VarInt;
+	unsigned int	m_UVarInt;
+	float			m_FloatQuantized;
+	float			m_FloatCoord;
+	float			m_FloatCoordMP;
+	float			m_FloatCoordMPLow;
+	float			m_FloatCoordMPIntegral;
+	float			m_FloatNoScale;
+	float			m_FloatNormal;
+	float			m_FloatProxied;
+	Vector			m_VectorQuantized;
+	Vector			m_VectorCoord;
+	Vector			m_VectorNormal;
+	char			m_String[32];
+};
+
+void SendProxy_DTEncodeProgramTestFloat( const SendProp *pProp, const void *pStruct, const void *pData, DVariant *pOut, int iElement, int objectID )
+{
+	pOut->m_Float = *(const float*)pData * 0.5f;
+}
+
+BEGIN_SEND_TABLE_NOBASE( DTEncodeProgramTest, DT_DTEncodeProgramTest )
+	SendPropInt( SENDINFO_NOCHECK( m_Int32 ), 32 ),
+	SendPropInt( SENDINFO_NOCHECK( m_IntSigned ), 10 ),
+	SendPropInt( SENDINFO_NOCHECK( m_UInt32 ), 20, SPROP_UNSIGNED ),
+	SendPropInt( SENDINFO_NOCHECK( m_Int16 ), 16 ),
+	SendPropInt( SENDINFO_NOCHECK( m_UInt16 ), 12, SPROP_UNSIGNED ),
+	SendPropInt( SENDINFO_NOCHECK( m_Int8 ), 8 ),
+	SendPropInt( SENDINFO_NOCHECK( m_UInt8 ), 8, SPROP_UNSIGNED ),
+	SendPropInt( SENDINFO_NOCHECK( m_VarInt ), 32, SPROP_VARINT ),
+	SendPropInt( SENDINFO_NOCHECK( m_UVarInt ), 32, SPROP_VARINT | SPROP_UNSIGNED ),
+	SendPropFloat( SENDINFO_NOCHECK( m_FloatQuantized ), 11, 0, -100.0f, 100.0f ),
+	SendPropFloat( SENDINFO_NOCHECK( m_FloatCoord ), -1, SPROP_COORD ),
+	SendPropFloat( SENDINFO_NOCHECK( m_FloatCoordMP ), -1, SPROP_COORD_MP ),
+	SendPropFloat( SENDINFO_NOCHECK( m_FloatCoordMPLow ), -1, SPROP_COORD_MP_LOWPRECISION ),
+	SendPropFloat( SENDINFO_NOCHECK( m_FloatCoordMPIntegral ), -1, SPROP_COORD_MP_INTEGRAL ),
+	SendPropFloat( SENDINFO_NOCHECK( m_FloatNoScale ), 32, SPROP_NOSCALE ),
+	SendPropFloat( SENDINFO_NOCHECK( m_FloatNormal ), 12, SPROP_NORMAL ),
+	SendPropFloat( SENDINFO_NOCHECK( m_FloatProxied ), 16, 0, -1000.0f, 1000.0f, SendProxy_DTEncodeProgramTestFloat ),
+	SendPropVector( SENDINFO_NOCHECK( m_VectorQuantized ), 14, 0, -500.0f, 500.0f ),
+	SendPropVector( SENDINFO_NOCHECK( m_VectorCoord ), -1, SPROP_COORD ),
+	SendPropVector( SENDINFO_NOCHECK( m_VectorNormal ), -1, SPROP_NORMAL ),
+	SendPropString( SENDINFO_NOCHECK( m_String ) ),
+END_SEND_TABLE()
+
+
+void RandomlyChangeEncodeProgramTest( DTEncodeProgramTest *pTest )
+{
+	// Zeros exercise bNonZeroOnly, the quantized ranges are exceeded now and then to hit the clamping.
+	bool bZero = ( rand() % 4 ) == 0;
+	pTest->m_Int32 = bZero ? 0 : rand() - VALVE_RAND_MAX / 2;
+	pTest->m_IntSigned = bZero ? 0 : rand() % 1024 - 512;
+	pTest->m_UInt32 = bZero ? 0 : rand() % ( 1 << 20 );
+	pTest->m_Int16 = bZero ? 0 : (short)rand();
+	pTest->m_UInt16 = bZero ? 0 : rand() % ( 1 << 12 );
+	pTest->m_Int8 = bZero ? 0 : (char)rand();
+	pTest->m_UInt8 = bZero ? 0 : (unsigned char)rand();
+	pTest->m_VarInt = bZero ? 0 : ( rand() - VALVE_RAND_MAX / 2 ) * ( rand() % 100 );
+	pTest->m_UVarInt = bZero ? 0 : (unsigned int)rand() * ( rand() % 100 );
+	pTest->m_FloatQuantized = bZero ? 0 : FRand( -120, 120 );
+	pTest->m_FloatCoord = bZero ? 0 : FRand( -16000, 16000 );
+	pTest->m_FloatCoordMP = bZero ? 0 : FRand( -16000, 16000 );
+	pTest->m_FloatCoordMPLow = bZero ? 0 : FRand( -16000, 16000 );
+	pTest->m_FloatCoordMPIntegral = bZero ? 0 : (float)( rand() % 32000 - 16000 );
+	pTest->m_FloatNoScale = bZero ? 0 : FRand( -500000, 500000 );
+	pTest->m_FloatNormal = bZero ? 0 : FRand( -1, 1 );
+	pTest->m_FloatProxied = bZero ? 0 : FRand( -1500, 1500 );
+	pTest->m_VectorQuantized.Init( FRand( -600, 600 ), bZero ? 0 : FRand( -600, 600 ), FRand( -600, 600 ) );
+	pTest->m_VectorCoord.Init( bZero ? 0 : FRand( -16000, 16000 ), FRand( -16000, 16000 ), FRand( -16000, 16000 ) );
+	pTest->m_VectorNormal.Init( FRand( -1, 1 ), FRand( -1, 1 ), FRand( -1, 1 ) );
+	pTest->m_VectorNormal.NormalizeInPlace();
+	if ( bZero )
+	{
+		pTest->m_VectorQuantized.Init();
+		pTest->m_VectorCoord.Init();
+	}
+	RandomlyChangeStringGeneric( pTest->m_String, 1 + rand() % sizeof( pTest->m_String ) );
+}
+
+
+// Encodes pStruct with the encode program and the SendProp walk and makes sure they match.
+void VerifyEncodeProgram( SendTable *pSendTable, const void *pStruct, bool bNonZeroOnly )
+{
+	ALIGN4 unsigned char walkEncoded[4096] ALIGN4_POST;
+	ALIGN4 unsigned char programEncoded[4096] ALIGN4_POST;
+
+	bf_write bfWalk( "VerifyEncodeProgram->bfWalk", walkEncoded, sizeof( walkEncoded ) );
+	bf_write bfProgram( "VerifyEncodeProgram->bfProgram", programEncoded, sizeof( programEncoded ) );
+
+	Verify( SendTable_EncodeWalk( pSendTable, pStruct, &bfWalk, -1, NULL, bNonZeroOnly ) );
+	Verify( SendTable_EncodeProgram( pSendTable, pStruct, &bfProgram, -1, NULL, bNonZeroOnly ) );
+	Verify( CompareBitArrays( walkEncoded, programEncoded, bfWalk.GetNumBitsWritten(), bfProgram.GetNumBitsWritten() ) );
+}
+
+
+void RunEncodeProgramTest()
+{
+	SendTable *pSendTable = &REFERENCE_SEND_TABLE(DT_DTEncodeProgramTest);
+
+	SendTable_Init( &pSendTable, 1 );
+	SendTable_BuildEncodePrograms( &g_StandardSendProxies );
+
+	// Only the custom proxy, the string and the normal vector (it writes a sign bit for z)
+	// should go through the generic kernel.
+	CSendTablePrecalc *pPrecalc = pSendTable->m_pPrecalc;
+	int nGeneric = 0;
+	for ( int i=0; i < pPrecalc->m_EncodeProgram.Count(); i++ )
+	{
+		if ( !SendProp_IsSpecializedEncodeOp( &pPrecalc->m_EncodeProgram[i] ) )
+			++nGeneric;
+	}
+	Verify( pPrecalc->m_EncodeProgram.Count() == pPrecalc->GetNumProps() );
+	Verify( nGeneric == 3 );
+
+	DTEncodeProgramTest test;
+	memset( &test, 0, sizeof( test ) );
+	VerifyEncodeProgram( pSendTable, &test, false );
+	VerifyEncodeProgram( pSendTable, &test, true );
+
+	for ( int iIteration=0; iIteration < 200; iIteration++ )
+	{
+		RandomlyChangeEncodeProgramTest( &test );
+		VerifyEncodeProgram( pSendTable, &test, false );
+		VerifyEncodeProgram( pSendTable, &test, true );
+	}
+
+	SendTable_Term();
+}
+
+
 void RunDataTableTest()
 {
 	RecvTable *pRecvTable = &REFERENCE_RECV_TABLE(DT_DTTest);
@@ -851,6 +995,7 @@ void RunDataTableTest()
 
 	// Initialize the send and receive modules.
 	SendTable_Init( &pSendTable, 1 );
+	SendTable_BuildEncodePrograms( &g_StandardSendProxies );
 	RecvTable_Init( &pRecvTable, 1 );
 
 	pSendTable->SetWriteFlag( false );
@@ -932,6 +1077,10 @@ void RunDataTableTest()
 			Assert(false);
 		}
 
+		// The encode program and the SendProp walk must agree, including when the subtable proxy is off.
+		VerifyEncodeProgram( pSendTable, &dtServer, false );
+		VerifyEncodeProgram( pSendTable, &dtServer, true );
+
 
 		ALIGN4 unsigned char deltaEncoded[4096] ALIGN4_POST;
 		bf_write bfDeltaEncoded( "RunDataTableTest->bfDeltaEncoded", deltaEncoded, sizeof(deltaEncoded) );
@@ -962,6 +1111,14 @@ void RunDataTableTest()
 			
 			Assert( nDeltaProps != -1 ); // BAD: buffer overflow
 
+			// The word compare diff must find the same props as the prop by prop walk.
+			ALIGN4 int walkDeltaProps[MAX_DATATABLE_PROPS] ALIGN4_POST;
+			ALIGN4 int wordDeltaProps[MAX_DATATABLE_PROPS] ALIGN4_POST;
+			int nWalkDeltaProps = SendTable_CalcDeltaWalk( pSendTable, prevEncoded, sizeof( prevEncoded ) * 8, fullEncoded, bfFullEncoded.GetNumBitsWritten(), walkDeltaProps, ARRAYSIZE( walkDeltaProps ), -1 );
+			int nWordDeltaProps = SendTable_CalcDeltaWordCompare( pSendTable, prevEncoded, sizeof( prevEncoded ) * 8, fullEncoded, bfFullEncoded.GetNumBitsWritten(), wordDeltaProps, ARRAYSIZE( wordDeltaProps ), -1 );
+			Verify( nWalkDeltaProps == nWordDeltaProps );
+			Verify( memcmp( walkDeltaProps, wordDeltaProps, nWalkDeltaProps * sizeof( int ) ) == 0 );
+
 			
 			// Reencode with just the delta. This is what is actually sent to the client.
 			SendTable_WritePropList( 
@@ -1004,6 +1161,8 @@ void RunDataTableTest()
 
 	SendTable_Term();
 	RecvTable_Term();
+
+	RunEncodeProgramTest();
 }
 
 
@@ -12,9 +12,11 @@
 
 #include <mempool.h>
 #include <utllinkedlist.h>
+#include <tier0/tslist.h>
 
 
 class PackedEntity;
+class CPackedEntityArena;
 class HLTVEntityData;
 class ReplayEntityData;
 class ServerClass;
@@ -105,6 +107,11 @@ public:
 
 	CUtlVector<int>			m_iExplicitDeleteSlots;
 
+	// Blocks holding the data of the entities packed for this snapshot, the last one is
+	// being filled. The snapshot keeps a reference to each until it's freed.
+	CUtlVector<CPackedEntityArena*>		m_PackedEntityArenas;
+	CInterlockedPtr<CPackedEntityArena>	m_pPackedEntityArena;
+
 private:
 
 	// Snapshots auto-delete themselves when their refcount goes to zero.
@@ -142,6 +149,14 @@ public:
 	// Returns the pack data for a particular entity for a particular snapshot
 	PackedEntity*	GetPackedEntity( CFrameSnapshot* pSnapshot, int entity );
 
+	// Copies pData into one of pSnapshot's arena blocks, or the heap if it doesn't fit one.
+	bool			AllocAndCopyPackedData( CFrameSnapshot* pSnapshot, PackedEntity *pPackedEntity, const void *pData, int nBytes );
+
+	// Called when the last PackedEntity in the block is freed.
+	void			FreePackedEntityArena( CPackedEntityArena *pArena );
+
+	void			PrintPackedEntityArenaStats();
+
 	// if we are copying a Packed Entity, we have to increase the reference counter 
 	void			AddEntityReference( PackedEntityHandle_t handle );
 
@@ -163,10 +178,22 @@ public:
 	// List of entities to explicitly delete
 	void			AddExplicitDelete( int iSlot );
 
+	// Brackets the parallel snapshot send. Snapshots and packed entities released
+	// in between are queued and only freed on the main thread by EndParallelSend().
+	void			BeginParallelSend();
+	void			EndParallelSend();
+
 private:
 	void	DeleteFrameSnapshot( CFrameSnapshot* pSnapshot );
+	void	FreeFrameSnapshot( CFrameSnapshot* pSnapshot );
+	void	FreePackedEntity( PackedEntity *packedEntity );
+	CPackedEntityArena *AllocPackedEntityArena();
 
 	CUtlLinkedList<CFrameSnapshot*, unsigned short>		m_FrameSnapshots;
+	CThreadSpinRWLock									m_FrameSnapshotsLock;	// guards m_FrameSnapshots links
+	CTSList<CFrameSnapshot*>							m_PendingDeletes;		// snapshots released during a parallel send
+	CTSList<PackedEntity*>								m_PendingEntityFrees;	// packed entities released during a parallel send
+	bool												m_bDeferDeletes;
 	CClassMemoryPool< PackedEntity >					m_PackedEntitiesPool;
 
 	int								m_nPackedEntityCacheCounter;  // increase with every cache access
@@ -179,6 +206,11 @@ private:
 	CThreadFastMutex		m_WriteMutex;
 
 	CUtlVector<int>			m_iExplicitDeleteSlots;
+
+	CThreadFastMutex		m_ArenaMutex;			// guards the free list and the counts below
+	CPackedEntityArena		*m_pFreeArenas;
+	int						m_nFreeArenas;
+	int						m_nLiveArenas;
 };
 
 extern CFrameSnapshotManager *framesnapshotmanager;
@@ -44,6 +44,7 @@ CHLTVClient::CHLTVClient(int slot, CBaseServer *pServer)
 	m_fLastSendTime = 0.0f;
 	m_flLastChatTime = 0.0f;
 	m_bNoChat = false;
+	m_bBroadcastSnapshots = false;
 
 	if ( tv_chatgroupsize.GetInt() > 0  )
 	{
@@ -421,6 +422,18 @@ void CHLTVClient::UpdateUserSettings()
 	CBaseClient::UpdateUserSettings();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Baselines start over here, so this is where a spectator can switch to
+//  broadcast snapshots: it never gets baseline updates, which makes its
+//  snapshots depend only on the frame, delta tick and string table tick.
+//-----------------------------------------------------------------------------
+void CHLTVClient::FreeBaselines()
+{
+	CBaseClient::FreeBaselines();
+
+	m_bBroadcastSnapshots = tv_broadcast.GetBool();
+}
+
 void CHLTVClient::SendSnapshot( CClientFrame * pFrame )
 {
 	VPROF_BUDGET( "CHLTVClient::SendSnapshot", "HLTV" );
@@ -470,24 +483,50 @@ void CHLTVClient::SendSnapshot( CClientFrame * pFrame )
 		pLastFrame = (CHLTVFrame*) pLastFrame->m_pNext;
 	}
 
+	// baselines are clean, so going back to updating them is always safe
+	if ( m_bBroadcastSnapshots && !tv_broadcast.GetBool() )
+	{
+		m_bBroadcastSnapshots = false;
+	}
+
 	// now create client snapshot packet
 
-	// send tick time
-	NET_Tick tickmsg( pFrame->tick_count, host_frametime_unbounded, host_frametime_stddeviation );
-	tickmsg.WriteToBuffer( msg );
+	CHLTVBroadcastSnapshot *pBroadcast = NULL;
 
-	// Update shared client/server string tables. Must be done before sending entities
-	m_Server->m_StringTables->WriteUpdateMessage( NULL, GetMaxAckTickCount(), msg );
+	if ( m_bBroadcastSnapshots && !IsTracing() )
+	{
+		pBroadcast = m_pHLTV->GetBroadcastSnapshot( this, pFrame, pDeltaFrame, GetMaxAckTickCount(), msg );
 
-	// TODO delta cache whole snapshots, not just packet entities. then use net_Align
-	// send entity update, delta compressed if deltaFrame != NULL
-	m_Server->WriteDeltaEntities( this, pFrame, pDeltaFrame, msg );
+		// only read from here on, the netchannel copies it into the packet
+		msg.StartWriting( pBroadcast->m_pData, pBroadcast->GetNumBytes(), pBroadcast->m_nBits );
+		if ( pBroadcast->m_bOverflowed )
+		{
+			msg.SetOverflowFlag();
+		}
+	}
+	else
+	{
+		// send tick time
+		NET_Tick tickmsg( pFrame->tick_count, host_frametime_unbounded, host_frametime_stddeviation );
+		tickmsg.WriteToBuffer( msg );
+
+		// Update shared client/server string tables. Must be done before sending entities
+		m_Server->m_StringTables->WriteUpdateMessage( NULL, GetMaxAckTickCount(), msg );
+
+		// send entity update, delta compressed if deltaFrame != NULL
+		m_Server->WriteDeltaEntities( this, pFrame, pDeltaFrame, msg );
+	}
 
 	// write message to packet and check for overflow
 	if ( msg.IsOverflowed() )
 	{
 		if ( !pDeltaFrame )
 		{
+			if ( pBroadcast )
+			{
+				pBroadcast->ReleaseReference();
+			}
+
 			// if this is a reliable snapshot, drop the client
 			Disconnect( "ERROR! Reliable snapshot overflow." );
 			return;
@@ -507,6 +546,11 @@ void CHLTVClient::SendSnapshot( CClientFrame * pFrame )
 	// Don't send the datagram to fakeplayers
 	if ( m_bFakePlayer )
 	{
+		if ( pBroadcast )
+		{
+			pBroadcast->ReleaseReference();
+		}
+
 		m_nDeltaTick = pFrame->tick_count;
 		return;
 	}
@@ -530,6 +574,11 @@ void CHLTVClient::SendSnapshot( CClientFrame * pFrame )
 		bSendOK = m_NetChannel->SendDatagram( &msg ) > 0;
 	}
 
+	if ( pBroadcast )
+	{
+		pBroadcast->ReleaseReference();
+	}
+
 	if ( !bSendOK )
 	{
 		Disconnect( "ERROR! Couldn't send snapshot." );
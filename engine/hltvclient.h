@@ -44,6 +44,8 @@ public:
 	void	SetRate( int nRate, bool bForce );
 	void	SetUpdateRate(int udpaterate, bool bForce);
 	void	UpdateUserSettings();
+	void	FreeBaselines();
+	bool	CanUpdateBaselines() const { return !m_bBroadcastSnapshots; }
 	
 public: // IClientMessageHandlers
 	
@@ -67,6 +69,7 @@ public:
 	double	m_flLastChatTime;	// last time user send a chat text
 	bool	m_bNoChat;			// if true don't send chat message to this client
 	char	m_szChatGroup[64];	// client password
+	bool	m_bBroadcastSnapshots;	// baselines never change, so snapshots can be shared (tv_broadcast)
 	CHLTVServer *m_pHLTV;
 };
 
@@ -9,6 +9,7 @@
 #include <eiface.h>
 #include <bitbuf.h>
 #include <time.h>
+#include <tier0/vprof.h>
 #include "hltvdemo.h"
 #include "hltvserver.h"
 #include "demo.h"
@@ -30,6 +31,9 @@
 
 extern CNetworkStringTableContainer *networkStringTableContainerServer;
 
+static ConVar tv_demo_keyframe_interval( "tv_demo_keyframe_interval", "0", 0, "Seconds between keyframes in recorded SourceTV demos, 0=off. Demos with keyframes seek instantly but need a new engine to play back.", true, 0, false, 0 );
+static ConVar tv_demo_compress( "tv_demo_compress", "", 0, "Compress recorded SourceTV demos with this codec (lzss, snappy or lz4), empty=uncompressed. Needs demo_asyncwrite 1." );
+
 //////////////////////////////////////////////////////////////////////
 // Construction/Destruction
 //////////////////////////////////////////////////////////////////////
@@ -37,6 +41,8 @@ extern CNetworkStringTableContainer *networkStringTableContainerServer;
 CHLTVDemoRecorder::CHLTVDemoRecorder()
 {
 	m_bIsRecording = false;
+	m_bWriteKeyframes = false;
+	m_nKeyframeTick = -1;
 }
 
 CHLTVDemoRecorder::~CHLTVDemoRecorder()
@@ -68,6 +74,11 @@ void CHLTVDemoRecorder::StartRecording( const char *filename, bool bContinuously
 		return;
 	}
 
+	if ( tv_demo_compress.GetString()[0] )
+	{
+		m_DemoFile.SetCompressionCodec( tv_demo_compress.GetString() );
+	}
+
 	ConMsg ("Recording SourceTV demo to %s...\n", filename);
 
 	demoheader_t *dh = &m_DemoFile.m_DemoHeader;
@@ -75,8 +86,13 @@ void CHLTVDemoRecorder::StartRecording( const char *filename, bool bContinuously
 	// open demo header file containing sigondata
 	Q_memset( dh, 0, sizeof(demoheader_t));
 
+	// keyframes need the indexed format, only pick it when they're wanted so
+	// older engines can still play everything else
+	m_bWriteKeyframes = tv_demo_keyframe_interval.GetFloat() > 0.0f;
+	m_nKeyframeTick = -1;
+
 	Q_strncpy( dh->demofilestamp, DEMO_HEADER_ID, sizeof(dh->demofilestamp) );
-	dh->demoprotocol = DEMO_PROTOCOL;
+	dh->demoprotocol = m_bWriteKeyframes ? DEMO_PROTOCOL_INDEXED : DEMO_PROTOCOL;
 	dh->networkprotocol = PROTOCOL_VERSION;
 
 	Q_strncpy( dh->mapname, hltv->GetMapName(), sizeof( dh->mapname ) );
@@ -121,6 +137,11 @@ void CHLTVDemoRecorder::StopRecording()
 	// Demo playback should read this as an incoming message.
 	m_DemoFile.WriteCmdHeader( dem_stop, GetRecordingTick() );
 
+	if ( m_bWriteKeyframes )
+	{
+		m_DemoFile.WriteKeyframeIndex();
+	}
+
 	// update demo header info
 	m_DemoFile.m_DemoHeader.playback_ticks = GetRecordingTick();
 	m_DemoFile.m_DemoHeader.playback_time =  host_state.interval_per_tick *	GetRecordingTick();
@@ -143,6 +164,11 @@ void CHLTVDemoRecorder::StopRecording()
 	ConMsg("Completed SourceTV demo \"%s\", recording time %.1f\n",
 		m_DemoFile.m_szFileName,
 		m_DemoFile.m_DemoHeader.playback_time );
+
+	if ( m_bWriteKeyframes )
+	{
+		ConMsg( "Wrote %i keyframes for seeking.\n", m_DemoFile.m_Keyframes.Count() );
+	}
 }
 
 CDemoFile *CHLTVDemoRecorder::GetDemoFile()
@@ -248,9 +274,12 @@ void CHLTVDemoRecorder::RecordServerClasses( ServerClass *pClasses )
 	m_DemoFile.WriteNetworkDataTables( &buf, GetRecordingTick() );
 }
 
-void CHLTVDemoRecorder::RecordStringTables()
+//-----------------------------------------------------------------------------
+// Purpose: Writes all server string tables into buf, growing it until they
+//			fit. Returns the memory behind buf for the caller to free, or NULL.
+//-----------------------------------------------------------------------------
+static void *WriteAllStringTables( bf_write &buf )
 {
-
 	// !KLUDGE! It would be nice if the bit buffer could write into a stream
 	// with the power to grow itself.  But it can't.  Hence this really bad
 	// kludge
@@ -259,30 +288,36 @@ void CHLTVDemoRecorder::RecordStringTables()
 	while ( dataLen <= DEMO_FILE_MAX_STRINGTABLE_SIZE )
 	{
 		data = realloc( data, dataLen );
-		bf_write buf( data, dataLen );
+		buf.StartWriting( data, dataLen );
 		buf.SetDebugName("CHLTVDemoRecorder_StringTables");
 		buf.SetAssertOnOverflow( false ); // Doesn't turn off all the spew / asserts, but turns off one
 		networkStringTableContainerServer->WriteStringTables( buf );
 
 		// Did we fit?
 		if ( !buf.IsOverflowed() )
-		{
-
-			// Now write the buffer into the demo file
-			m_DemoFile.WriteStringTables( &buf, GetRecordingTick() );
-			break;
-		}
+			return data;
 
 		// Didn't fit.  Try doubling the size of the buffer
 		dataLen *= 2;
 	}
 
-	if ( dataLen > DEMO_FILE_MAX_STRINGTABLE_SIZE )
+	Warning( "Failed to RecordStringTables. Trying to record string table that's bigger than max string table size\n" );
+
+	free( data );
+	return NULL;
+}
+
+void CHLTVDemoRecorder::RecordStringTables()
+{
+	bf_write buf;
+	void *data = WriteAllStringTables( buf );
+
+	if ( data )
 	{
-		Warning( "Failed to RecordStringTables. Trying to record string table that's bigger than max string table size\n" );
+		// Now write the buffer into the demo file
+		m_DemoFile.WriteStringTables( &buf, GetRecordingTick() );
+		free( data );
 	}
-
-	free(data);
 }
 
 int CHLTVDemoRecorder::WriteSignonData()
@@ -384,6 +419,62 @@ void CHLTVDemoRecorder::WriteFrame( CHLTVFrame *pFrame )
 
 	// write packet to demo file
 	WriteMessages( dem_packet, msg ); 
+
+	if ( m_bWriteKeyframes &&
+		( m_nKeyframeTick < 0 || GetRecordingTick() - m_nKeyframeTick >= TIME_TO_TICKS( tv_demo_keyframe_interval.GetFloat() ) ) )
+	{
+		msg.Reset();
+		WriteKeyframe( pFrame, msg );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes the complete string table and entity state of the frame
+//			just written, so playback can start here without reading the
+//			packets before it. msg is the scratch buffer for the packet.
+//-----------------------------------------------------------------------------
+void CHLTVDemoRecorder::WriteKeyframe( CHLTVFrame *pFrame, bf_write &msg )
+{
+	VPROF_BUDGET( "CHLTVDemoRecorder::WriteKeyframe", "HLTV" );
+
+	m_nKeyframeTick = GetRecordingTick();
+
+	bf_write stringtables;
+	void *data = WriteAllStringTables( stringtables );
+	if ( !data )
+		return;
+
+	NET_Tick tickmsg( pFrame->tick_count, host_frametime_unbounded, host_frametime_stddeviation );
+	tickmsg.WriteToBuffer( msg );
+
+	// uncompressed, the master client has no baselines of its own that this could touch
+	sv.WriteDeltaEntities( hltv->m_MasterClient, pFrame, NULL, msg );
+
+	if ( msg.IsOverflowed() )
+	{
+		Warning( "CHLTVDemoRecorder::WriteKeyframe: entity state doesn't fit into a packet, skipping keyframe.\n" );
+		free( data );
+		return;
+	}
+
+	// fill last bits in last byte with NOP if necessary
+	int nRemainingBits = msg.GetNumBitsWritten() % 8;
+	if ( nRemainingBits > 0 && nRemainingBits <= (8-NETMSG_TYPE_BITS) )
+	{
+		msg.WriteUBitLong( net_NOP, NETMSG_TYPE_BITS );
+	}
+
+	// the keyframe belongs to the packet just written, reuse its sequence number
+	democmdinfo_t info;
+	Q_memset( &info, 0, sizeof( info ) );
+	m_DemoFile.WriteKeyframe( GetRecordingTick(), &stringtables, info, m_SequenceInfo - 1, m_SequenceInfo - 1, &msg );
+
+	free( data );
+
+	if ( tv_debug.GetInt() > 1 )
+	{
+		Msg( "Writing SourceTV demo keyframe at tick %i, file pos %i\n", m_nKeyframeTick, m_DemoFile.m_Keyframes.Tail().fileoffset );
+	}
 }
 
 void CHLTVDemoRecorder::WriteMessages( unsigned char cmd, bf_write &message )
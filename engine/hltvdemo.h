@@ -45,6 +45,7 @@ public:
 
 public:
 	void	WriteFrame( CHLTVFrame *pFrame );
+	void	WriteKeyframe( CHLTVFrame *pFrame, bf_write &msg );
 	void	CloseFile();
 	void	Reset();
 
@@ -62,6 +63,8 @@ public:
 	int				m_SequenceInfo;
 	int				m_nDeltaTick;	
 	int				m_nSignonTick;
+	bool			m_bWriteKeyframes;	// demo is DEMO_PROTOCOL_INDEXED
+	int				m_nKeyframeTick;	// recording tick of the last keyframe
 	bf_write		m_MessageData; // temp buffer for all network messages
 };
 
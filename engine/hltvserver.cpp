@@ -39,6 +39,7 @@
 #include "sv_steamauth.h"
 #include "tier0/icommandline.h"
 #include "sys_dll.h"
+#include "tier1/fmtstr.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -86,6 +87,7 @@ ConVar tv_transmitall( "tv_transmitall", "0", FCVAR_REPLICATED, "Transmit all en
 ConVar tv_debug( "tv_debug", "0", 0, "SourceTV debug info." );
 ConVar tv_title( "tv_title", "SourceTV", 0, "Set title for SourceTV spectator UI", tv_title_changed_f );
 static ConVar tv_deltacache( "tv_deltacache", "2", 0, "Enable delta entity bit stream cache" );
+ConVar tv_broadcast( "tv_broadcast", "0", 0, "Serialize each snapshot once for all spectators at the same delta tick. Spectators switch on their next full update." );
 static ConVar tv_relayvoice( "tv_relayvoice", "1", 0, "Relay voice data: 0=off, 1=on" );
 
 CDeltaEntityCache::CDeltaEntityCache()
@@ -475,10 +477,15 @@ CHLTVServer::CHLTVServer()
 	m_nGlobalSlots = 0;
 	m_nGlobalClients = 0;
 	m_nGlobalProxies = 0;
+	m_nBroadcastTick = -1;
+	m_nBroadcastEncoded = 0;
+	m_nBroadcastShared = 0;
 }
 
 CHLTVServer::~CHLTVServer()
 {
+	FreeBroadcastSnapshots();
+
 	if ( m_nRecvTables > 0 )
 	{
 		RecvTable_Term();
@@ -1532,6 +1539,225 @@ CClientFrame *CHLTVServer::GetDeltaFrame( int nTick )
 	return entry.pFrame;
 }
 
+CHLTVBroadcastSnapshot::CHLTVBroadcastSnapshot( int nDeltaTick, int nStringTableTick, bf_write &msg )
+{
+	m_nDeltaTick = nDeltaTick;
+	m_nStringTableTick = nStringTableTick;
+	m_bOverflowed = msg.IsOverflowed();
+	m_nBits = m_bOverflowed ? 0 : msg.GetNumBitsWritten();
+	m_pData = new byte[ GetNumBytes() ];
+	m_nReferences = 1;
+
+	if ( m_nBits > 0 )
+	{
+		V_memcpy( m_pData, msg.GetData(), GetNumBytes() );
+	}
+}
+
+CHLTVBroadcastSnapshot::~CHLTVBroadcastSnapshot()
+{
+	delete[] m_pData;
+}
+
+void CHLTVBroadcastSnapshot::ReleaseReference()
+{
+	Assert( m_nReferences > 0 );
+
+	if ( --m_nReferences == 0 )
+	{
+		delete this;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Spectators with broadcast snapshots all get the same packet body for
+//  the same frame, delta tick and string table tick, so only the first one to
+//  ask writes it. Nothing in the body is client specific: their baselines never
+//  change and they share the HLTV entity index.
+//-----------------------------------------------------------------------------
+CHLTVBroadcastSnapshot *CHLTVServer::GetBroadcastSnapshot( CHLTVClient *pClient, CClientFrame *pFrame, CClientFrame *pDeltaFrame, int nStringTableTick, bf_write &msg )
+{
+	VPROF_BUDGET( "CHLTVServer::GetBroadcastSnapshot", "HLTV" );
+
+	Assert( pClient->m_bBroadcastSnapshots && !pClient->IsTracing() );
+
+	if ( pFrame->tick_count != m_nBroadcastTick )
+	{
+		FreeBroadcastSnapshots();
+		m_nBroadcastTick = pFrame->tick_count;
+	}
+
+	int nDeltaTick = pDeltaFrame ? pDeltaFrame->tick_count : -1;
+
+	FOR_EACH_VEC( m_BroadcastSnapshots, i )
+	{
+		CHLTVBroadcastSnapshot *pSnapshot = m_BroadcastSnapshots[i];
+		if ( pSnapshot->m_nDeltaTick == nDeltaTick && pSnapshot->m_nStringTableTick == nStringTableTick )
+		{
+			m_nBroadcastShared++;
+			pSnapshot->AddReference();
+			return pSnapshot;
+		}
+	}
+
+	// send tick time
+	NET_Tick tickmsg( pFrame->tick_count, host_frametime_unbounded, host_frametime_stddeviation );
+	tickmsg.WriteToBuffer( msg );
+
+	// Update shared client/server string tables. Must be done before sending entities
+	m_StringTables->WriteUpdateMessage( NULL, nStringTableTick, msg );
+
+	// send entity update, delta compressed if deltaFrame != NULL
+	WriteDeltaEntities( pClient, pFrame, pDeltaFrame, msg );
+
+	m_nBroadcastEncoded++;
+
+	CHLTVBroadcastSnapshot *pSnapshot = new CHLTVBroadcastSnapshot( nDeltaTick, nStringTableTick, msg );
+	m_BroadcastSnapshots.AddToTail( pSnapshot );
+
+	pSnapshot->AddReference();
+	return pSnapshot;
+}
+
+void CHLTVServer::FreeBroadcastSnapshots( void )
+{
+	FOR_EACH_VEC( m_BroadcastSnapshots, i )
+	{
+		m_BroadcastSnapshots[i]->ReleaseReference();
+	}
+
+	m_BroadcastSnapshots.RemoveAll();
+	m_nBroadcastTick = -1;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sends the last nFrames frames to nSpectators fake spectators whose
+//  netchannels point at a local UDP socket, first with per spectator snapshots
+//  and then with broadcast snapshots. Every spectator acks each frame at once.
+//-----------------------------------------------------------------------------
+void CHLTVServer::RunBroadcastLoadTest( int nSpectators, int nFrames )
+{
+	if ( !m_CurrentFrame )
+	{
+		ConMsg( "tv_broadcast_loadtest: no SourceTV frames yet.\n" );
+		return;
+	}
+
+	CUtlVector< CClientFrame* > frames;
+	for ( CClientFrame *pFrame = GetClientFrame( 0, false ); pFrame; pFrame = pFrame->m_pNext )
+	{
+		frames.AddToTail( pFrame );
+
+		if ( pFrame == m_CurrentFrame )
+			break;
+	}
+
+	// the first frame is the full update
+	if ( frames.Count() > nFrames + 1 )
+	{
+		frames.RemoveMultipleFromHead( frames.Count() - nFrames - 1 );
+	}
+
+	if ( frames.Count() < 2 )
+	{
+		ConMsg( "tv_broadcast_loadtest: not enough SourceTV frames yet.\n" );
+		return;
+	}
+
+	netadr_t adrSink;
+	int hSink = NET_OpenLoopbackSink( adrSink );
+	if ( !hSink )
+	{
+		ConMsg( "tv_broadcast_loadtest: couldn't open a loopback socket.\n" );
+		return;
+	}
+
+	CUtlVector< CHLTVClient* > spectators;
+	for ( int i = 0; i < nSpectators; i++ )
+	{
+		CHLTVClient *pClient = new CHLTVClient( GetMaxClients() + i, this );
+		INetChannel *pNetChannel = NET_CreateNetChannel( m_Socket, &adrSink, adrSink.ToString(), pClient, true );
+		pClient->Connect( CFmtStr( "loadtest%d", i ), -1, pNetChannel, false, 0 );
+		spectators.AddToTail( pClient );
+	}
+
+	ConMsg( "tv_broadcast_loadtest: %d spectators, %d frames from tick %d\n", nSpectators, frames.Count() - 1, frames[0]->tick_count );
+
+	int nOldBroadcast = tv_broadcast.GetInt();
+
+	for ( int iMode = 0; iMode < 2; iMode++ )
+	{
+		bool bBroadcast = ( iMode == 1 );
+		if ( bBroadcast )
+		{
+			tv_broadcast.SetValue( 1 );
+		}
+
+		FOR_EACH_VEC( spectators, i )
+		{
+			CHLTVClient *pClient = spectators[i];
+			pClient->FreeBaselines();
+			pClient->m_pBaseline = framesnapshotmanager->CreateEmptySnapshot( 0, MAX_EDICTS );
+			pClient->m_bBroadcastSnapshots = bBroadcast;
+			pClient->m_nDeltaTick = -1;
+			pClient->m_nStringTableAckTick = 0;
+			pClient->m_nLastSendTick = 0;
+			pClient->m_pLastSnapshot = NULL;
+			pClient->m_nForceWaitForTick = -1;
+		}
+
+		int nEncoded = m_nBroadcastEncoded;
+		int nBytes = 0;
+		double flStart = Plat_FloatTime();
+
+		FOR_EACH_VEC( frames, iFrame )
+		{
+			CClientFrame *pFrame = frames[iFrame];
+
+			if ( !IsMasterProxy() )
+			{
+				m_DeltaCache.SetTick( pFrame->tick_count, pFrame->last_entity+1 );
+			}
+
+			FOR_EACH_VEC( spectators, i )
+			{
+				CHLTVClient *pClient = spectators[i];
+				if ( !pClient->IsConnected() )
+					continue;
+
+				pClient->SendSnapshot( pFrame );
+
+				pClient->m_nDeltaTick = pFrame->tick_count;
+				pClient->m_nStringTableAckTick = pFrame->tick_count;
+				pClient->m_nForceWaitForTick = -1;
+			}
+
+			nBytes += NET_DrainLoopbackSink( hSink );
+		}
+
+		double flElapsed = Plat_FloatTime() - flStart;
+		nBytes += NET_DrainLoopbackSink( hSink );
+
+		ConMsg( "  %-12s %8.2f ms/frame, %6.2f us/spectator, %.1f KB sent, %d snapshots written\n",
+			bBroadcast ? "broadcast" : "per client", flElapsed * 1000.0 / frames.Count(), flElapsed * 1000000.0 / ( frames.Count() * nSpectators ),
+			nBytes / 1024.0f, bBroadcast ? m_nBroadcastEncoded - nEncoded : frames.Count() * nSpectators );
+	}
+
+	tv_broadcast.SetValue( nOldBroadcast );
+
+	FOR_EACH_VEC( spectators, i )
+	{
+		CHLTVClient *pClient = spectators[i];
+
+		// skip the disconnect notifications, these were never real clients
+		pClient->m_nSignonState = SIGNONSTATE_NONE;
+		pClient->Clear();
+		delete pClient;
+	}
+
+	NET_CloseLoopbackSink( hSink );
+}
+
 void CHLTVServer::RunFrame()
 {
 	VPROF_BUDGET( "CHLTVServer::RunFrame", "HLTV" );
@@ -1769,6 +1995,8 @@ void CHLTVServer::Shutdown( void )
 
 	g_GameEventManager.RemoveListener( this );
 
+	FreeBroadcastSnapshots();
+
 	CBaseServer::Shutdown();
 }
 
@@ -1949,6 +2177,9 @@ void CHLTVServer::ReadCompleteDemoFile()
 				free( data );
 			}
 			break;
+		case dem_keyframe:
+			m_DemoFile.SkipKeyframe();
+			break;
 		case dem_usercmd:
 			{
 				char bufferIn[256];
@@ -2201,6 +2432,13 @@ CON_COMMAND( tv_status, "Show SourceTV server status." )
 	ConMsg("Total Slots %i, Spectators %i, Proxies %i\n", 
 		slots, clients-proxies, proxies);
 
+	if ( tv_broadcast.GetBool() )
+	{
+		ConMsg("Broadcast snapshots written %i, shared %i\n", hltv->m_nBroadcastEncoded, hltv->m_nBroadcastShared );
+		hltv->m_nBroadcastEncoded = 0;
+		hltv->m_nBroadcastShared = 0;
+	}
+
 	if ( hltv->m_DemoRecorder.IsRecording() )
 	{
 		ConMsg("Recording to \"%s\", length %s.\n", hltv->m_DemoRecorder.GetDemoFile()->m_szFileName, 
@@ -2208,6 +2446,26 @@ CON_COMMAND( tv_status, "Show SourceTV server status." )
 	}		
 }
 
+CON_COMMAND( tv_broadcast_loadtest, "Send recent SourceTV frames to fake spectators over loopback, with and without tv_broadcast. Usage: tv_broadcast_loadtest <spectators> [frames]" )
+{
+	if ( !hltv || !hltv->IsActive() )
+	{
+		ConMsg("SourceTV not active.\n" );
+		return;
+	}
+
+	if ( args.ArgC() < 2 )
+	{
+		ConMsg( "Usage: tv_broadcast_loadtest <spectators> [frames]\n" );
+		return;
+	}
+
+	int nSpectators = clamp( atoi( args[1] ), 1, 10000 );
+	int nFrames = ( args.ArgC() > 2 ) ? clamp( atoi( args[2] ), 1, 1000 ) : 100;
+
+	hltv->RunBroadcastLoadTest( nSpectators, nFrames );
+}
+
 CON_COMMAND( tv_relay, "Connect to SourceTV server and relay broadcast." )
 {
 	if ( args.ArgC() < 2 )
@@ -33,6 +33,7 @@
 #define DISPATCH_MODE_ALWAYS		2
 
 extern ConVar tv_debug;
+extern ConVar tv_broadcast;
 
 class CHLTVFrame : public CClientFrame
 {
@@ -85,6 +86,34 @@ protected:
 };
 
 
+//-----------------------------------------------------------------------------
+// Snapshot packet body (tick, string table updates, packet entities) that is
+// serialized once and shared by every spectator at the same delta and string
+// table tick. Immutable once built, the netchannels only add their headers.
+//-----------------------------------------------------------------------------
+class CHLTVBroadcastSnapshot
+{
+public:
+	CHLTVBroadcastSnapshot( int nDeltaTick, int nStringTableTick, bf_write &msg );
+
+	void	AddReference() { ++m_nReferences; }
+	void	ReleaseReference();
+
+	int		GetNumBytes() const { return PAD_NUMBER( m_nBits, 32 ) >> 3; }	// dword padded for bf_write
+
+public:
+	int		m_nDeltaTick;		// -1 for full updates
+	int		m_nStringTableTick;
+	int		m_nBits;
+	bool	m_bOverflowed;
+	byte	*m_pData;
+
+private:
+	~CHLTVBroadcastSnapshot();
+
+	CInterlockedInt	m_nReferences;
+};
+
 class CGameClient;
 class CGameServer;
 class IHLTVDirector;
@@ -187,6 +216,11 @@ public:
 	bool	DispatchToRelay( CHLTVClient *pClient);
 	bf_write *GetBuffer( int nBuffer);
 	CClientFrame *GetDeltaFrame( int nTick );
+
+	// returns a referenced body for pFrame, msg is scratch space if it has to be written
+	CHLTVBroadcastSnapshot *GetBroadcastSnapshot( CHLTVClient *pClient, CClientFrame *pFrame, CClientFrame *pDeltaFrame, int nStringTableTick, bf_write &msg );
+	void	FreeBroadcastSnapshots( void );
+	void	RunBroadcastLoadTest( int nSpectators, int nFrames );
 		
 	inline  CHLTVClient* Client( int i ) { return static_cast<CHLTVClient*>(m_Clients[i]); }
 
@@ -247,6 +281,11 @@ public:
 	CDeltaEntityCache				m_DeltaCache;
 	CUtlVector<CFrameCacheEntry_s>	m_FrameCache;
 
+	CUtlVector<CHLTVBroadcastSnapshot*>	m_BroadcastSnapshots;	// bodies for m_nBroadcastTick
+	int								m_nBroadcastTick;
+	int								m_nBroadcastEncoded;	// bodies written since the last tv_status
+	int								m_nBroadcastShared;		// spectators that got a body somebody else wrote
+
 	// demoplayer stuff:
 	CDemoFile		m_DemoFile;		// for demo playback
 	int				m_nStartTick;
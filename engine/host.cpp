@@ -85,6 +85,7 @@
 #include "tmessage.h"
 #include "tier0/vprof.h"
 #include "tier0/icommandline.h"
+#include "tier0/memtrace.h"
 #include "materialsystem/imaterialsystemhardwareconfig.h"
 #include "MapReslistGenerator.h"
 #include "DownloadListGenerator.h"
@@ -121,6 +122,8 @@
 #include "filesystem/IQueuedLoader.h"
 #include "soundservice.h"
 #include "profile.h"
+#include "ticksampler.h"
+#include "sv_tickmetrics.h"
 #include "steam/isteamremotestorage.h"
 #if defined( _X360 )
 #include "xbox/xbox_win32stubs.h"
@@ -361,6 +364,41 @@ CON_COMMAND( mem_test, "" )
 	MemAlloc_CrtCheckMemory();
 }
 
+CON_COMMAND( mem_trace_start, "Record every allocation for utils/allocreplay: mem_trace_start [file.mtr under the game dir] [max MB per file]" )
+{
+	const char *pszFileName = ( args.ArgC() > 1 ) ? args[1] : "memtrace.mtr";
+	int nMaxMB = ( args.ArgC() > 2 ) ? atoi( args[2] ) : 256;
+
+	// rcon can run this, so only .mtr files under the game directory
+	const char *pszExtension = V_GetFileExtension( pszFileName );
+	if ( !COM_IsValidPath( pszFileName ) || V_IsAbsolutePath( pszFileName ) || !pszExtension || V_stricmp( pszExtension, "mtr" ) )
+	{
+		ConMsg( "mem_trace_start %s: expected a relative .mtr path.\n", pszFileName );
+		return;
+	}
+
+	char szFullPath[MAX_OSPATH];
+	V_snprintf( szFullPath, sizeof( szFullPath ), "%s/%s", com_gamedir, pszFileName );
+	V_FixSlashes( szFullPath );
+
+	if ( MemAlloc_StartTrace( szFullPath, nMaxMB ) )
+	{
+		ConMsg( "Recording allocations to %s\n", szFullPath );
+	}
+}
+
+CON_COMMAND( mem_trace_stop, "Stop the allocation trace mem_trace_start began" )
+{
+	if ( !MemAlloc_IsTracing() )
+	{
+		ConMsg( "No allocation trace is running.\n" );
+		return;
+	}
+
+	MemAlloc_StopTrace();
+	ConMsg( "Allocation trace stopped.\n" );
+}
+
 static ConVar host_competitive_ever_enabled( "host_competitive_ever_enabled", "0", FCVAR_HIDDEN, "Has competitive ever been enabled this run?", true, 0, true, 1, true, 1, false, 1, NULL  );
 
 static ConVar mem_test_each_frame( "mem_test_each_frame", "0", 0, "Run heap check at end of every frame\n" );
@@ -614,11 +652,20 @@ CON_COMMAND( host_timer_report, "Spew CPU timer jitter for the last 128 frames i
 {
 	if ( sv.IsDedicated() )
 	{
+		float flMin = FLT_MAX, flMax = -FLT_MAX;
+		double flSum = 0;
 		for (int i = 1; i <= ARRAYSIZE( host_jitterhistory ); ++i)
 		{
 			unsigned int slot = ( i + host_jitterhistorypos ) % ARRAYSIZE( host_jitterhistory );
 			Msg( "%1.3fms\n", host_jitterhistory[ slot ] * 1000 );
+
+			flMin = MIN( flMin, host_jitterhistory[ slot ] );
+			flMax = MAX( flMax, host_jitterhistory[ slot ] );
+			flSum += host_jitterhistory[ slot ];
 		}
+
+		Msg( "tick jitter: min %1.3fms avg %1.3fms max %1.3fms\n", flMin * 1000, flSum * 1000 / ARRAYSIZE( host_jitterhistory ), flMax * 1000 );
+		Sys_PrintFrameWakeReport();
 	}
 }
 
@@ -2669,7 +2716,11 @@ void _Host_RunFrame_Server( bool finaltick )
 
 	// Run the Server frame ( read, run physics, respond )
 	g_HostTimes.StartFrameSegment( FRAME_SEGMENT_SERVER );
+	TickSampler_BeginTick();
+	TickMetrics_BeginTick();
 	SV_Frame ( finaltick );
+	TickMetrics_EndTick( sv.m_nTickCount );
+	TickSampler_EndTick( sv.m_nTickCount );
 	g_HostTimes.EndFrameSegment( FRAME_SEGMENT_SERVER );
 
 	// Look for connectionless rcon packets on dedicated servers
@@ -4961,6 +5012,10 @@ void Host_Shutdown(void)
 
 	TRACESHUTDOWN( sv.Shutdown() );
 
+	TRACESHUTDOWN( TickSampler_Shutdown() );
+	TRACESHUTDOWN( TickMetrics_Shutdown() );
+	TRACESHUTDOWN( MemAlloc_StopTrace() );
+
 	TRACESHUTDOWN( NET_Shutdown() );
 
 #ifndef SWDS
@@ -114,6 +114,7 @@ typedef struct netpacket_s
 	int				size;		// size in bytes
 	int				wiresize;   // size in bytes before decompression
 	bool			stream;		// was send as stream
+	bool			ratechecked;	// a query the network layer checked against the query rate limit on receive
 	struct netpacket_s *pNext;	// for internal use, should be NULL in public
 } netpacket_t;
 
@@ -137,17 +138,33 @@ void		NET_OutOfBandPrintf(int sock, const netadr_t &adr, PRINTF_FORMAT_STRING co
 int			NET_SendPacket ( INetChannel *chan, int sock,  const netadr_t &to, const  unsigned char *data, int length, bf_write *pVoicePayload = NULL, bool bUseCompression = false );
 // Called periodically to maybe send any queued packets (up to 4 per frame)
 void		NET_SendQueuedPackets();
+// Datagrams sent in between are flushed together with one syscall per socket (Linux dedicated servers)
+void		NET_BeginSendBatch();
+void		NET_EndSendBatch();
 // Start set current network configuration
 void		NET_SetMutiplayer(bool multiplayer);
 // Set net_time
 void		NET_SetTime( double realtime );
 // RunFrame must be called each system frame before reading/sending on any socket
 void		NET_RunFrame( double realtime );
+
+// Dedicated frame scheduler: handles that turn readable when datagrams for the game server
+// arrive, returns how many were written. Call NET_ClearServerWait() after waking on one.
+int			NET_GetServerWaitHandles( int *pHandles, int nMaxHandles );
+void		NET_ClearServerWait();
+// UDP socket on 127.0.0.1 that swallows whatever load tests send to adr
+int			NET_OpenLoopbackSink( netadr_t &adr );
+int			NET_DrainLoopbackSink( int hSocket );
+void		NET_CloseLoopbackSink( int hSocket );
+// Bytes NET_SendTo handed to the OS from any thread, wraps around
+uint		NET_GetBytesSent();
 // Check configuration state
 bool		NET_IsMultiplayer( void );
 bool		NET_IsDedicated( void );
 // Writes a error file with bad packet content
 void		NET_LogBadPacket(netpacket_t * packet);
+// Saves a payload about to be compressed for net_compressionbench (net_compresspackets_dump)
+void		NET_DumpCompressionPayload( const char *pszKind, const void *pData, unsigned int nBytes );
 
 // bForceNew (used for bots) tells it not to share INetChannels (bots will crash when disconnecting if they
 // share an INetChannel).
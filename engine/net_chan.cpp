@@ -21,6 +21,7 @@
 #include "net_ws_headers.h"
 #include "net_ws_queued_packet_sender.h"
 #include "filesystem_init.h"
+#include "tier1/compressioncodec.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -43,6 +44,7 @@ static ConVar net_chokeloopback( "net_chokeloop", "0", 0, "Apply bandwidth choke
 static ConVar net_maxfilesize( "net_maxfilesize", "16", 0, "Maximum allowed file size for uploading in MB", true, 0, true, 64 );
 static ConVar net_compresspackets( "net_compresspackets", "1", 0, "Use compression on game packets." );
 static ConVar net_compresspackets_minsize( "net_compresspackets_minsize", "1024", 0, "Don't bother compressing packets below this size." );
+static ConVar net_compresspackets_dump( "net_compresspackets_dump", "0", 0, "Write every payload we compress to netpayload_*.dat, for net_compressionbench." );
 static ConVar net_maxcleartime( "net_maxcleartime", "4.0", 0, "Max # of seconds we can wait for next packets to be sent based on rate setting (0 == no limit)." );
 static ConVar net_maxpacketdrop( "net_maxpacketdrop", "5000", 0, "Ignore any packets with the sequence number more than this ahead (0 == no limit)" );
 
@@ -127,6 +129,129 @@ void CNetChan::Clear()
 	Reset();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Saves a payload we are about to compress (net_compresspackets_dump)
+//			so codecs can be compared offline with net_compressionbench.
+//-----------------------------------------------------------------------------
+void NET_DumpCompressionPayload( const char *pszKind, const void *pData, unsigned int nBytes )
+{
+	if ( !net_compresspackets_dump.GetBool() )
+		return;
+
+	static CInterlockedInt s_nPayloads;
+	char filename[ MAX_OSPATH ];
+	Q_snprintf( filename, sizeof( filename ), "netpayload_%s_%05d.dat", pszKind, (int)s_nPayloads++ );
+
+	FileHandle_t fp = g_pFileSystem->Open( filename, "wb" );
+	if ( fp )
+	{
+		g_pFileSystem->Write( pData, nBytes, fp );
+		g_pFileSystem->Close( fp );
+	}
+}
+
+static void NET_CompressionBenchFile( const char *pszFilename, double *pflTotals )
+{
+	CUtlBuffer buf;
+	if ( !g_pFileSystem->ReadFile( pszFilename, NULL, buf ) || !buf.TellPut() )
+	{
+		ConMsg( "net_compressionbench: couldn't read %s\n", pszFilename );
+		return;
+	}
+
+	unsigned int nSize = buf.TellPut();
+	CUtlMemory< char > compressed, uncompressed( 0, nSize );
+
+	// enough passes over small payloads to get past the timer resolution
+	int nPasses = clamp( (int)( ( 4 << 20 ) / nSize ), 1, 1000 );
+
+	for ( int c = 0; c < COMPRESSION_CODEC_COUNT; c++ )
+	{
+		const ICompressionCodec *pCodec = GetCompressionCodec( (CompressionCodec_t)c );
+		compressed.EnsureCapacity( pCodec->GetMaxCompressedSize( nSize ) );
+
+		unsigned int nCompressedSize = 0;
+		bool bOk = true;
+		double flStart = Plat_FloatTime();
+		for ( int i = 0; i < nPasses && bOk; i++ )
+		{
+			nCompressedSize = compressed.Count();
+			bOk = pCodec->Compress( compressed.Base(), &nCompressedSize, buf.Base(), nSize );
+		}
+		double flCompress = Plat_FloatTime() - flStart;
+
+		if ( !bOk )
+		{
+			// LZSS gives up on data it can't shrink, count it as sent uncompressed
+			nCompressedSize = nSize;
+			flCompress = 0;
+		}
+
+		flStart = Plat_FloatTime();
+		for ( int i = 0; i < nPasses && bOk; i++ )
+		{
+			unsigned int nUncompressedSize = nSize;
+			bOk = pCodec->Uncompress( uncompressed.Base(), &nUncompressedSize, compressed.Base(), nCompressedSize );
+		}
+		double flUncompress = bOk ? Plat_FloatTime() - flStart : 0;
+
+		double *pTotals = &pflTotals[c * 4];
+		pTotals[0] += nSize;
+		pTotals[1] += nCompressedSize;
+		pTotals[2] += flCompress / nPasses;
+		pTotals[3] += flUncompress / nPasses;
+	}
+}
+
+CON_COMMAND( net_compressionbench, "Compress payload files (see net_compresspackets_dump) with every codec and report ratio and MB/s: <file|wildcard> ..." )
+{
+	if ( args.ArgC() < 2 )
+	{
+		ConMsg( "Usage:  net_compressionbench <file|wildcard> ...\n" );
+		return;
+	}
+
+	// per codec: raw bytes, compressed bytes, compress seconds, uncompress seconds
+	double flTotals[COMPRESSION_CODEC_COUNT * 4];
+	V_memset( flTotals, 0, sizeof( flTotals ) );
+	int nFiles = 0;
+
+	for ( int i = 1; i < args.ArgC(); i++ )
+	{
+		if ( !V_strstr( args[i], "*" ) )
+		{
+			NET_CompressionBenchFile( args[i], flTotals );
+			nFiles++;
+			continue;
+		}
+
+		char path[ MAX_OSPATH ];
+		V_ExtractFilePath( args[i], path, sizeof( path ) );
+
+		FileFindHandle_t findHandle;
+		for ( const char *pszFile = g_pFileSystem->FindFirst( args[i], &findHandle ); pszFile; pszFile = g_pFileSystem->FindNext( findHandle ) )
+		{
+			char filename[ MAX_OSPATH ];
+			V_snprintf( filename, sizeof( filename ), "%s%s", path, pszFile );
+			NET_CompressionBenchFile( filename, flTotals );
+			nFiles++;
+		}
+		g_pFileSystem->FindClose( findHandle );
+	}
+
+	ConMsg( "%d files\n", nFiles );
+	for ( int c = 0; c < COMPRESSION_CODEC_COUNT; c++ )
+	{
+		const double *pTotals = &flTotals[c * 4];
+		if ( !pTotals[1] )
+			continue;
+
+		double flMB = pTotals[0] / ( 1024.0 * 1024.0 );
+		ConMsg( "%-8s %10.0f -> %10.0f bytes  ratio %5.2f  compress %8.1f MB/s  uncompress %8.1f MB/s\n",
+			GetCompressionCodec( (CompressionCodec_t)c )->GetName(), pTotals[0], pTotals[1], pTotals[0] / pTotals[1],
+			pTotals[2] > 0 ? flMB / pTotals[2] : 0.0, pTotals[3] > 0 ? flMB / pTotals[3] : 0.0 );
+	}
+}
 
 void CNetChan::CompressFragments()
 {
@@ -166,16 +291,19 @@ void CNetChan::CompressFragments()
 			CFastTimer compressTimer;
 			compressTimer.Start();
 
+			NET_DumpCompressionPayload( "fragments", data->buffer, data->bytes );
+
 			// fragments data is in memory
-			unsigned int compressedSize = COM_GetIdealDestinationCompressionBufferSize_Snappy( data->bytes );
+			const ICompressionCodec *pCodec = ::GetCompressionCodec( (CompressionCodec_t)m_nCompressionCodec );
+			unsigned int compressedSize = pCodec->GetMaxCompressedSize( data->bytes );
 			char * compressedData = new char[ compressedSize ];
 
-			if ( COM_BufferToBufferCompress_Snappy( compressedData, &compressedSize, data->buffer, data->bytes ) &&
+			if ( pCodec->Compress( compressedData, &compressedSize, data->buffer, data->bytes ) &&
 				( compressedSize < data->bytes ) )
 			{
 				compressTimer.End(); 
-				DevMsg("Compressing fragments (%d -> %d bytes): %.2fms\n",
-						data->bytes, compressedSize, compressTimer.GetDuration().GetMillisecondsF() );
+				DevMsg("Compressing fragments with %s (%d -> %d bytes): %.2fms\n",
+						pCodec->GetName(), data->bytes, compressedSize, compressTimer.GetDuration().GetMillisecondsF() );
 
 				// copy compressed data but dont reallocate memory
 				Q_memcpy( data->buffer, compressedData, compressedSize );
@@ -216,7 +344,8 @@ void CNetChan::CompressFragments()
 			}
 			else
 			{
-				// create compressed version of source file
+				// create compressed version of source file, always Snappy since the
+				// .ztmp is shared by every client that asks for this file
 				unsigned int uncompressedSize = data->bytes;
 				unsigned int compressedSize = COM_GetIdealDestinationCompressionBufferSize_Snappy( uncompressedSize );
 				char *uncompressed = new char[uncompressedSize];
@@ -458,6 +587,7 @@ CNetChan::CNetChan()
 	m_FileRequestCounter = 0;
 	m_bFileBackgroundTranmission = true;
 	m_bUseCompression = false;
+	m_nCompressionCodec = COMPRESSION_CODEC_SNAPPY;
 	m_nQueuedPackets = 0;
 
 	m_flRemoteFrameTime = 0;
@@ -716,6 +846,19 @@ void CNetChan::SetCompressionMode( bool bUseCompression )
 	m_bUseCompression = bUseCompression;
 }
 
+void CNetChan::SetCompressionCodec( int nCodec )
+{
+	if ( nCodec >= 0 && nCodec < COMPRESSION_CODEC_COUNT )
+	{
+		m_nCompressionCodec = nCodec;
+	}
+}
+
+int CNetChan::GetCompressionCodec() const
+{
+	return m_nCompressionCodec;
+}
+
 void CNetChan::SetDataRate(float rate)
 {
 	m_Rate = clamp( rate, (float) MIN_RATE, (float) MAX_RATE );
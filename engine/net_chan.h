@@ -200,6 +200,9 @@ public:	// INetChannel interface
 
 	virtual int		GetProtocolVersion();
 
+	virtual void	SetCompressionCodec( int nCodec );
+	virtual int		GetCompressionCodec() const;
+
 	int			IncrementSplitPacketSequence();
 
 public:
@@ -311,6 +314,7 @@ public:
 	unsigned int	m_FileRequestCounter;	// increasing counter with each file request
 	bool			m_bFileBackgroundTranmission; // if true, only send 1 fragment per packet
 	bool			m_bUseCompression;	// if true, larger reliable data will be bzip compressed
+	int				m_nCompressionCodec;	// CompressionCodec_t negotiated with the remote side
 	
 	// TCP stream state maschine:
 	bool		m_StreamActive;		// true if TCP is active
@@ -12,8 +12,11 @@
 #include "tier0/vprof.h"
 #include "net_ws_headers.h"
 #include "net_ws_queued_packet_sender.h"
+#include "net_ws_socket_thread.h"
+#include "tier1/compressioncodec.h"
 #include "fmtstr.h"
 #include "master.h"
+#include "sv_ipratelimit.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -173,6 +176,14 @@ ConVar net_maxroutable
 	true, MAX_USER_MAXROUTABLE_SIZE 
 	);
 
+ConVar net_compressioncodec
+	(
+	"net_compressioncodec",
+	"lz4",
+	FCVAR_ARCHIVE | FCVAR_USERINFO,
+	"Requested codec for data the server compresses for us (lz4, snappy, lzss). Servers fall back to snappy if they don't allow it."
+	);
+
 netadr_t	net_local_adr;
 double		net_time = 0.0f;	// current time, updated each frame
 
@@ -445,6 +456,9 @@ void NET_CloseSocket( int hSocket, int sock = -1)
 	if ( !hSocket )
 		return;
 
+	// the network thread must be done with it first
+	g_pSocketThread->UnwatchSocket( hSocket );
+
 	// close socket handle
 	int ret;
 	VCR_NONPLAYBACKFN( closesocket( hSocket ), ret, "closesocket" );
@@ -1090,6 +1104,7 @@ bool NET_LagPacket (bool newdata, netpacket_t * packet)
 	packet->size	= p->size;		
 	packet->wiresize = p->wiresize;
 	packet->stream	= p->stream;
+	packet->ratechecked = p->ratechecked;
 			
 	Q_memcpy( packet->data, p->data, p->size );
 
@@ -1400,6 +1415,299 @@ bool NET_GetLoopPacket ( netpacket_t * packet )
 	return ( NET_LagPacket( true, packet ) );	
 }
 
+static int				s_nSendBatchDepth;
+
+#if defined( LINUX )
+//-----------------------------------------------------------------------------
+// Batched UDP socket I/O. Dedicated servers drain each socket with recvmmsg()
+// into a ring of preallocated datagram slots and collect the datagrams sent
+// between NET_BeginSendBatch() and NET_EndSendBatch() into one sendmmsg() per
+// socket, which cuts the syscall count per tick by the batch size.
+// VCR record/playback always uses the single packet recvfrom()/sendto() path.
+//-----------------------------------------------------------------------------
+static ConVar net_batchsockets( "net_batchsockets", "1", 0, "Use recvmmsg/sendmmsg to batch UDP socket reads and writes on dedicated servers." );
+
+#define NET_MMSG_BATCH		32		// datagrams per recvmmsg/sendmmsg call
+#define NET_MMSG_SLOT_SIZE	8192	// larger datagrams are received truncated and treated as oversize
+
+struct netmmsgbatch_t
+{
+	int				nCount;		// received: datagrams in the ring, send: datagrams queued
+	int				nNext;		// received: next datagram to hand out
+	SOCKET			hSocket[NET_MMSG_BATCH];
+	struct mmsghdr	msgs[NET_MMSG_BATCH];
+	struct iovec	iov[NET_MMSG_BATCH];
+	struct sockaddr	addr[NET_MMSG_BATCH];
+	byte			control[NET_MMSG_BATCH][NET_RECV_CONTROL_SIZE];	// receive timestamps for net_recvlatency
+	SOCKET			hStamped;	// socket that has receive timestamps turned on
+	byte			data[NET_MMSG_BATCH][NET_MMSG_SLOT_SIZE];
+};
+
+static netmmsgbatch_t	*s_pRecvBatch[MAX_SOCKETS];
+static netmmsgbatch_t	*s_pSendBatch;
+static CThreadFastMutex	s_SendBatchMutex;
+
+static inline bool NET_UseBatchedSockets()
+{
+	return net_dedicated && net_batchsockets.GetBool() && VCRGetMode() == VCR_Disabled && !g_pSocketThread->IsRunning();
+}
+
+static int NET_RecvFromBatched( const int sock, SOCKET s, char *buf, int len, struct sockaddr *from, int *fromlen )
+{
+	netmmsgbatch_t *pBatch = s_pRecvBatch[sock];
+	if ( !pBatch )
+	{
+		pBatch = s_pRecvBatch[sock] = new netmmsgbatch_t;
+		pBatch->nCount = pBatch->nNext = 0;
+		pBatch->hStamped = 0;
+	}
+
+	// datagrams left over from a socket that was closed in between are stale
+	if ( pBatch->nNext < pBatch->nCount && pBatch->hSocket[0] != s )
+	{
+		pBatch->nCount = pBatch->nNext = 0;
+	}
+
+	if ( pBatch->nNext >= pBatch->nCount )
+	{
+		pBatch->nCount = pBatch->nNext = 0;
+
+		bool bSample = net_recvlatency.GetBool();
+		if ( bSample && pBatch->hStamped != s && NET_EnableRecvTimestamps( s ) )
+		{
+			pBatch->hStamped = s;
+		}
+
+		for ( int i = 0; i < NET_MMSG_BATCH; i++ )
+		{
+			pBatch->iov[i].iov_base = pBatch->data[i];
+			pBatch->iov[i].iov_len = NET_MMSG_SLOT_SIZE;
+
+			struct msghdr &hdr = pBatch->msgs[i].msg_hdr;
+			Q_memset( &hdr, 0, sizeof( hdr ) );
+			hdr.msg_name = &pBatch->addr[i];
+			hdr.msg_namelen = sizeof( pBatch->addr[i] );
+			hdr.msg_iov = &pBatch->iov[i];
+			hdr.msg_iovlen = 1;
+			if ( bSample )
+			{
+				hdr.msg_control = pBatch->control[i];
+				hdr.msg_controllen = NET_RECV_CONTROL_SIZE;
+			}
+		}
+
+		int nReceived = recvmmsg( s, pBatch->msgs, NET_MMSG_BATCH, MSG_DONTWAIT, NULL );
+		if ( nReceived <= 0 )
+			return -1; // errno tells NET_GetLastError what happened
+
+		pBatch->nCount = nReceived;
+		pBatch->hSocket[0] = s;
+	}
+
+	int i = pBatch->nNext++;
+	struct mmsghdr &msg = pBatch->msgs[i];
+
+	if ( msg.msg_hdr.msg_control )
+	{
+		NET_RecordRecvLatency( false, NET_GetRecvTimestamp( &msg.msg_hdr ) );
+	}
+
+	if ( NET_IsRateLimitedDatagram( sock, pBatch->data[i], msg.msg_len, &pBatch->addr[i] ) )
+		return 0;
+
+	int nSize = MIN( (int)msg.msg_len, len );
+	Q_memcpy( buf, pBatch->data[i], nSize );
+	Q_memcpy( from, &pBatch->addr[i], MIN( (int)msg.msg_hdr.msg_namelen, *fromlen ) );
+	*fromlen = msg.msg_hdr.msg_namelen;
+
+	if ( msg.msg_hdr.msg_flags & MSG_TRUNC )
+		return len; // same as a recvfrom() that filled the whole buffer
+
+	return nSize;
+}
+
+static void NET_FlushSendBatch()
+{
+	netmmsgbatch_t *pBatch = s_pSendBatch;
+	if ( !pBatch || !pBatch->nCount )
+		return;
+
+	VPROF_BUDGET( "sendmmsg", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+
+	// one sendmmsg per run of datagrams going out of the same socket
+	int nStart = 0;
+	while ( nStart < pBatch->nCount )
+	{
+		int nEnd = nStart + 1;
+		while ( nEnd < pBatch->nCount && pBatch->hSocket[nEnd] == pBatch->hSocket[nStart] )
+		{
+			nEnd++;
+		}
+
+		while ( nStart < nEnd )
+		{
+			int nSent = sendmmsg( pBatch->hSocket[nStart], &pBatch->msgs[nStart], nEnd - nStart, 0 );
+			if ( nSent <= 0 )
+			{
+				// like a failed sendto(), e.g. EWOULDBLOCK, drop the datagram and go on
+				nSent = 1;
+			}
+			nStart += nSent;
+		}
+	}
+
+	pBatch->nCount = 0;
+}
+
+static bool NET_SendToBatched( SOCKET s, const char *buf, int len, const struct sockaddr *to, int tolen )
+{
+	if ( !s_nSendBatchDepth || !NET_UseBatchedSockets() )
+		return false;
+
+	if ( len > NET_MMSG_SLOT_SIZE || tolen > (int)sizeof( struct sockaddr ) )
+		return false;
+
+	AUTO_LOCK( s_SendBatchMutex );
+
+	netmmsgbatch_t *pBatch = s_pSendBatch;
+	if ( !pBatch )
+	{
+		pBatch = s_pSendBatch = new netmmsgbatch_t;
+		pBatch->nCount = pBatch->nNext = 0;
+	}
+	else if ( pBatch->nCount == NET_MMSG_BATCH )
+	{
+		NET_FlushSendBatch();
+	}
+
+	int i = pBatch->nCount++;
+	Q_memcpy( pBatch->data[i], buf, len );
+	Q_memcpy( &pBatch->addr[i], to, tolen );
+
+	pBatch->hSocket[i] = s;
+	pBatch->iov[i].iov_base = pBatch->data[i];
+	pBatch->iov[i].iov_len = len;
+
+	struct msghdr &hdr = pBatch->msgs[i].msg_hdr;
+	Q_memset( &hdr, 0, sizeof( hdr ) );
+	hdr.msg_name = &pBatch->addr[i];
+	hdr.msg_namelen = tolen;
+	hdr.msg_iov = &pBatch->iov[i];
+	hdr.msg_iovlen = 1;
+
+	return true;
+}
+#endif // LINUX
+
+void NET_BeginSendBatch()
+{
+	Assert( ThreadInMainThread() );
+	s_nSendBatchDepth++;
+}
+
+void NET_EndSendBatch()
+{
+	Assert( ThreadInMainThread() && s_nSendBatchDepth > 0 );
+	if ( --s_nSendBatchDepth == 0 )
+	{
+		// the network thread sends everything queued during the batch in one go
+		if ( g_pSocketThread->IsRunning() )
+		{
+			g_pSocketThread->Wake();
+		}
+
+#if defined( LINUX )
+		AUTO_LOCK( s_SendBatchMutex );
+		NET_FlushSendBatch();
+#endif
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Starts or stops the network thread to match net_socketthread and
+//			tells it about reopened sockets. Main thread, once per frame.
+//-----------------------------------------------------------------------------
+static void NET_UpdateSocketThread()
+{
+	bool bWantThread = net_socketthread.GetBool() && net_dedicated && NET_IsMultiplayer() && VCRGetMode() == VCR_Disabled;
+	if ( bWantThread != g_pSocketThread->IsRunning() )
+	{
+		if ( !bWantThread )
+		{
+			g_pSocketThread->Shutdown();
+		}
+		else if ( !g_pSocketThread->Setup() )
+		{
+			net_socketthread.SetValue( 0 );
+		}
+	}
+
+	if ( g_pSocketThread->IsRunning() )
+	{
+		for ( int i = 0; i < MAX_SOCKETS; i++ )
+		{
+			g_pSocketThread->WatchSocket( i, net_sockets[i].hUDP );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Whether a datagram, as it came off the wire, is a query the receive
+//			path checks against the query rate limit. Queries sent split or
+//			compressed aren't, CBaseServer checks those once they're reassembled.
+//-----------------------------------------------------------------------------
+bool NET_IsReceiveRateLimitedQuery( int sock, const byte *pData, int nSize )
+{
+	// the sockets CBaseServer::ProcessConnectionlessPacket answers on
+	if ( sock != NS_SERVER && sock != NS_HLTV
+#ifdef LINUX
+		&& sock != NS_SVLAN
+#endif
+		)
+		return false;
+
+	return nSize >= 5 && LittleLong( *(unsigned int *)pData ) == CONNECTIONLESS_HEADER && IsRateLimitedOnReceive( pData[4] );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Drops the queries of sources over the query rate limit before they are
+//			copied or parsed, the datagrams are read but get no further than this
+//-----------------------------------------------------------------------------
+bool NET_IsRateLimitedDatagram( int sock, const byte *pData, int nSize, const struct sockaddr *from )
+{
+	if ( !NET_IsReceiveRateLimitedQuery( sock, pData, nSize ) )
+		return false;
+
+	netadr_t adr;
+	adr.SetFromSockadr( from );
+	return !CheckConnectionLessRateLimits( adr );
+}
+
+static int NET_RecvFrom( const int sock, SOCKET s, char *buf, int len, struct sockaddr *from, int *fromlen )
+{
+	// extra test sockets are never handed to the network thread, and datagrams
+	// it received before being stopped are handed out before reading the socket again
+	if ( sock < MAX_SOCKETS && ( g_pSocketThread->IsRunning() || g_pSocketThread->HasReceived( sock ) ) )
+		return g_pSocketThread->RecvFrom( sock, buf, len, from, fromlen );
+
+#if defined( LINUX )
+	// extra test sockets always read one datagram at a time
+	if ( sock < MAX_SOCKETS )
+	{
+		// keep handing out what is left in the ring if batching just got turned off
+		netmmsgbatch_t *pBatch = s_pRecvBatch[sock];
+		if ( NET_UseBatchedSockets() || ( pBatch && pBatch->nNext < pBatch->nCount ) )
+			return NET_RecvFromBatched( sock, s, buf, len, from, fromlen );
+	}
+#endif
+
+	int ret = VCRHook_recvfrom( s, buf, len, 0, from, fromlen );
+	if ( ret > 0 && NET_IsRateLimitedDatagram( sock, (const byte *)buf, ret, from ) )
+		return 0;
+
+	return ret;
+}
+
 bool NET_ReceiveDatagram ( const int sock, netpacket_t * packet )
 {
 	VPROF_BUDGET( "NET_ReceiveDatagram", VPROF_BUDGETGROUP_OTHER_NETWORKING );
@@ -1414,13 +1722,14 @@ bool NET_ReceiveDatagram ( const int sock, netpacket_t * packet )
 	int ret = 0;
 	{
 		VPROF_BUDGET( "recvfrom", VPROF_BUDGETGROUP_OTHER_NETWORKING );
-		ret = VCRHook_recvfrom(net_socket, (char *)packet->data, NET_MAX_MESSAGE, 0, (struct sockaddr *)&from, (int *)&fromlen );
+		ret = NET_RecvFrom( packet->source, net_socket, (char *)packet->data, NET_MAX_MESSAGE, (struct sockaddr *)&from, (int *)&fromlen );
 	}
 	if ( ret >= NET_MIN_MESSAGE )
 	{
 		packet->wiresize = ret;
 		packet->from.SetFromSockadr( &from );
 		packet->size = ret;
+		packet->ratechecked = NET_IsReceiveRateLimitedQuery( packet->source, packet->data, ret );
 
 		if ( net_showudp_wire.GetBool() )
 		{
@@ -1639,6 +1948,7 @@ netpacket_t *NET_GetPacket (int sock, byte *scratch )
 	inpacket.data = scratch;
 	inpacket.size = 0;
 	inpacket.wiresize = 0;
+	inpacket.ratechecked = false;
 	inpacket.pNext = NULL;
 	inpacket.message.SetDebugName("inpacket.message");
 
@@ -1850,6 +2160,10 @@ void NET_ProcessSocket( int sock, IConnectionlessPacketHandler *handler )
 	{
 		scratch = new NetScratchBuffer_t;
 	}
+
+	// replies to the packets read here go out together
+	NET_BeginSendBatch();
+
 	while ( ( packet = NET_GetPacket ( sock, scratch->data ) ) != NULL )
 	{
 		if ( Filter_ShouldDiscard ( packet->from ) )	// filtering is done by network layer
@@ -1885,6 +2199,9 @@ void NET_ProcessSocket( int sock, IConnectionlessPacketHandler *handler )
 			Msg ("Sequenced packet without connection from %s\n" , packet->from.ToString() );
 		}*/
 	}
+
+	NET_EndSendBatch();
+
 	g_NetScratchBuffers.Push( scratch );
 }
 
@@ -1950,6 +2267,18 @@ int NET_SendToImpl( SOCKET s, const char FAR * buf, int len, const struct sockad
 	}
 	else
 #endif //defined( _X360 )
+	if ( g_pSocketThread->IsRunning() && g_pSocketThread->QueueSend( s, buf, len, to, tolen, s_nSendBatchDepth == 0 ) )
+	{
+		nSend = len;
+	}
+	else
+#if defined( LINUX )
+	if ( NET_SendToBatched( s, buf, len, to, tolen ) )
+	{
+		nSend = len;
+	}
+	else
+#endif
 	{
 		nSend = sendto( s, buf, len, 0, to, tolen );
 	}
@@ -1970,6 +2299,7 @@ int NET_SendToImpl( SOCKET s, const char FAR * buf, int len, const struct sockad
 //-----------------------------------------------------------------------------
 bool CL_IsHL2Demo();
 bool CL_IsPortalDemo();
+static CInterlockedUInt s_nBytesSent;
 int NET_SendTo( bool verbose, SOCKET s, const char FAR * buf, int len, const struct sockaddr FAR * to, int tolen, int iGameDataLength )
 {	
 	int nSend = 0;
@@ -2020,6 +2350,11 @@ int NET_SendTo( bool verbose, SOCKET s, const char FAR * buf, int len, const str
 		);
 	}
 
+	if ( nSend > 0 )
+	{
+		s_nBytesSent += nSend;
+	}
+
 #if defined( _DEBUG )
 	if ( verbose && 
 		( nSend > 0 ) && 
@@ -2434,13 +2769,16 @@ int NET_SendPacket ( INetChannel *chan, int sock,  const netadr_t &to, const uns
 	if ( bUseCompression )
 	{
 		VPROF_BUDGET( "NET_SendPacket_Compress", VPROF_BUDGETGROUP_OTHER_NETWORKING );
-		unsigned int nCompressedLength = COM_GetIdealDestinationCompressionBufferSize_Snappy( length );
+		NET_DumpCompressionPayload( "packet", data, length );
+
+		const ICompressionCodec *pCodec = GetCompressionCodec( chan ? (CompressionCodec_t)chan->GetCompressionCodec() : COMPRESSION_CODEC_SNAPPY );
+		unsigned int nCompressedLength = pCodec->GetMaxCompressedSize( length );
 	
 		memCompressed.EnsureCapacity( nCompressedLength + nVoiceBytes + sizeof( unsigned int ) );
 
 		*(int *)memCompressed.Base() = LittleLong( NET_HEADER_FLAG_COMPRESSEDPACKET );
 
-		if ( COM_BufferToBufferCompress_Snappy( memCompressed.Base() + sizeof( unsigned int ), &nCompressedLength, data, length )
+		if ( pCodec->Compress( memCompressed.Base() + sizeof( unsigned int ), &nCompressedLength, data, length )
 			&& (int)nCompressedLength < length )
 		{
 			data	= memCompressed.Base();
@@ -2574,6 +2912,18 @@ void NET_FlushAllSockets( void )
 	char data[2048];
 	struct sockaddr	from;
 	int	fromlen = sizeof(from);
+
+#if defined( LINUX )
+	for ( int i = 0; i < MAX_SOCKETS; i++ )
+	{
+		if ( s_pRecvBatch[i] )
+		{
+			s_pRecvBatch[i]->nCount = s_pRecvBatch[i]->nNext = 0;
+		}
+	}
+#endif
+
+	g_pSocketThread->Flush();
 	
 	for (int i=0 ; i<net_sockets.Count() ; i++)
 	{
@@ -2964,6 +3314,105 @@ void NET_SetTime( double flRealtime )
 	net_time += frametime * host_timescale.GetFloat();
 }
 
+int NET_GetServerWaitHandles( int *pHandles, int nMaxHandles )
+{
+#ifdef POSIX
+	// the network thread drains the sockets itself and signals its notify pipe instead
+	int hNotify = g_pSocketThread->GetReceiveNotifyHandle();
+	if ( hNotify >= 0 )
+	{
+		if ( nMaxHandles < 1 )
+			return 0;
+
+		pHandles[0] = hNotify;
+		return 1;
+	}
+
+	static const int s_ServerSockets[] =
+	{
+		NS_SERVER,
+#ifdef LINUX
+		NS_SVLAN,
+#endif
+	};
+
+	int nHandles = 0;
+	for ( int i = 0; i < ARRAYSIZE( s_ServerSockets ) && nHandles < nMaxHandles; i++ )
+	{
+		int sock = s_ServerSockets[i];
+		if ( sock < net_sockets.Count() && net_sockets[sock].hUDP )
+		{
+			pHandles[nHandles++] = net_sockets[sock].hUDP;
+		}
+	}
+
+	return nHandles;
+#else
+	return 0;
+#endif
+}
+
+void NET_ClearServerWait()
+{
+	if ( g_pSocketThread->IsRunning() )
+	{
+		g_pSocketThread->ClearReceiveNotify();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: UDP socket on 127.0.0.1 that load tests can point netchannels at,
+//  returns 0 on failure
+//-----------------------------------------------------------------------------
+int NET_OpenLoopbackSink( netadr_t &adr )
+{
+	int port = PORT_ANY;
+	int hSocket = NET_OpenSocket( "127.0.0.1", port, IPPROTO_UDP );
+	if ( !hSocket )
+		return 0;
+
+	struct sockaddr_in address;
+	socklen_t len = sizeof( address );
+	if ( getsockname( hSocket, (struct sockaddr *)&address, &len ) == -1 )
+	{
+		NET_CloseSocket( hSocket );
+		return 0;
+	}
+
+	adr.SetType( NA_IP );
+	adr.SetIP( 127, 0, 0, 1 );
+	adr.SetPort( NET_NetToHostShort( address.sin_port ) );
+	return hSocket;
+}
+
+uint NET_GetBytesSent()
+{
+	return s_nBytesSent;
+}
+
+// reads everything that arrived, returns the number of bytes
+int NET_DrainLoopbackSink( int hSocket )
+{
+	char buf[NET_MAX_MESSAGE];
+	int nTotal = 0;
+
+	for ( ;; )
+	{
+		int ret = recv( hSocket, buf, sizeof( buf ), 0 );
+		if ( ret <= 0 )
+			break;
+
+		nTotal += ret;
+	}
+
+	return nTotal;
+}
+
+void NET_CloseLoopbackSink( int hSocket )
+{
+	NET_CloseSocket( hSocket );
+}
+
 /*
 ====================
 NET_RunFrame
@@ -2975,6 +3424,8 @@ void NET_RunFrame( double flRealtime )
 {
 	NET_SetTime( flRealtime );
 
+	NET_UpdateSocketThread();
+
 	RCONServer().RunFrame();
 
 #ifdef ENABLE_RPT
@@ -3332,6 +3783,7 @@ void NET_Shutdown (void)
 	}
 
 	g_pQueuedPackedSender->Shutdown();
+	g_pSocketThread->Shutdown();
 
 	net_multiplayer = false;
 	net_dedicated = false;
@@ -0,0 +1,650 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Optional network I/O thread that owns the UDP sockets
+//
+//=============================================================================
+
+#include "net_ws_headers.h"
+#include "net_ws_socket_thread.h"
+
+#ifdef POSIX
+#include <poll.h>
+#include <fcntl.h>
+#include <time.h>
+#endif
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+ConVar net_socketthread( "net_socketthread", "0", 0, "Receive and send UDP datagrams on a dedicated network thread instead of inline in the server frame (dedicated servers only)." );
+ConVar net_recvlatency( "net_recvlatency", "0", 0, "Collect a histogram of UDP receive latency, see net_recvlatency_report." );
+static ConVar net_socketthread_maxqueue( "net_socketthread_maxqueue", "1024", 0, "Max datagrams the network thread keeps queued per socket before it drops new ones." );
+
+#define NET_THREAD_SLOT_SIZE	8192	// larger datagrams are received truncated and treated as oversize
+#define NET_THREAD_MAX_SENDS	8192	// past this senders go straight to the socket
+
+struct sockdatagram_t
+{
+	SOCKET			hSocket;
+	int				nSize;
+	bool			bTruncated;
+	int				nAddrLen;
+	struct sockaddr	addr;
+	double			flKernelTime;	// 0 if not sampled
+	byte			data[NET_THREAD_SLOT_SIZE];
+};
+
+class CSocketThread : public CThread, public ISocketThread
+{
+public:
+	CSocketThread();
+	~CSocketThread();
+
+	// ISocketThread
+
+	virtual bool Setup();
+	virtual void Shutdown();
+	virtual bool IsRunning() { return m_bRunning; }
+
+	virtual void WatchSocket( int sock, SOCKET s );
+	virtual void UnwatchSocket( SOCKET s );
+
+	virtual int RecvFrom( int sock, char *buf, int len, struct sockaddr *from, int *fromlen );
+	virtual bool HasReceived( int sock ) { return m_Received[sock].Count() > 0; }
+	virtual void Flush();
+
+	virtual bool QueueSend( SOCKET s, const char *buf, int len, const struct sockaddr *to, int tolen, bool bWake );
+	virtual void Wake();
+
+	virtual int GetReceiveNotifyHandle() { return m_bRunning ? m_hNotifyPipe[0] : -1; }
+	virtual void ClearReceiveNotify();
+
+private:
+
+	// CThread Overrides
+	virtual int Run();
+
+	sockdatagram_t *AllocDatagram();
+	void FreeDatagram( sockdatagram_t *pDatagram ) { m_FreeDatagrams.PushItem( pDatagram ); }
+
+	void ReceiveAll( int sock, SOCKET s );
+	void SendQueued();
+	void NotifyReceived();
+	void ClosePipes();
+
+private:
+
+	CTSQueue< sockdatagram_t * >	m_Received[MAX_SOCKETS];
+	CInterlockedInt					m_nReceived[MAX_SOCKETS];
+	CTSQueue< sockdatagram_t * >	m_Send;
+	CInterlockedInt					m_nSend;
+	CInterlockedInt					m_nQueueing;		// senders between their m_bRunning check and the push
+	CTSList< sockdatagram_t * >		m_FreeDatagrams;
+
+	// held by the thread while it reads or sends, so UnwatchSocket() knows the handle is idle
+	CThreadFastMutex				m_SocketsMutex;
+	SOCKET							m_hSockets[MAX_SOCKETS];
+
+	CInterlockedInt					m_nWakePending;
+	int								m_hWakePipe[2];
+	CInterlockedInt					m_nNotifyPending;
+	int								m_hNotifyPipe[2];
+	int								m_nDropped;
+
+	volatile bool					m_bRunning;
+	volatile bool					m_bThreadShouldExit;
+};
+
+static CSocketThread g_SocketThread;
+ISocketThread *g_pSocketThread = &g_SocketThread;
+
+CSocketThread::CSocketThread()
+{
+	SetName( "SocketThread" );
+	Q_memset( m_hSockets, 0, sizeof( m_hSockets ) );
+	m_hWakePipe[0] = m_hWakePipe[1] = -1;
+	m_hNotifyPipe[0] = m_hNotifyPipe[1] = -1;
+	m_nDropped = 0;
+	m_bRunning = false;
+	m_bThreadShouldExit = false;
+}
+
+CSocketThread::~CSocketThread()
+{
+	Shutdown();
+
+	sockdatagram_t *pDatagram;
+	while ( m_FreeDatagrams.PopItem( &pDatagram ) )
+	{
+		delete pDatagram;
+	}
+}
+
+bool CSocketThread::Setup()
+{
+#ifdef POSIX
+	Shutdown();
+
+	if ( pipe( m_hWakePipe ) != 0 )
+	{
+		Warning( "CSocketThread: couldn't create wake pipe (%s).\n", strerror( errno ) );
+		return false;
+	}
+	fcntl( m_hWakePipe[0], F_SETFL, O_NONBLOCK );
+	fcntl( m_hWakePipe[1], F_SETFL, O_NONBLOCK );
+
+	if ( pipe( m_hNotifyPipe ) != 0 )
+	{
+		Warning( "CSocketThread: couldn't create notify pipe (%s).\n", strerror( errno ) );
+		ClosePipes();
+		return false;
+	}
+	fcntl( m_hNotifyPipe[0], F_SETFL, O_NONBLOCK );
+	fcntl( m_hNotifyPipe[1], F_SETFL, O_NONBLOCK );
+
+	m_nWakePending = 0;
+	m_nNotifyPending = 0;
+	m_bThreadShouldExit = false;
+	m_bRunning = true;
+
+	if ( !Start() )
+	{
+		m_bRunning = false;
+		ClosePipes();
+		return false;
+	}
+
+	return true;
+#else
+	Warning( "net_socketthread is not supported on this platform.\n" );
+	return false;
+#endif
+}
+
+void CSocketThread::Shutdown()
+{
+	if ( !m_bRunning )
+		return;
+
+	// senders see this first and go back to sending themselves
+	m_bRunning = false;
+
+	// and the ones that saw it still set push before the last SendQueued() below.
+	// AssignIf is a full barrier, so the store above can't pass the counter read.
+	while ( !m_nQueueing.AssignIf( 0, 0 ) )
+	{
+		ThreadPause();
+	}
+
+	m_bThreadShouldExit = true;
+	Wake();
+	Join(); // Wait for the thread to exit.
+
+	// whatever got queued while the thread was exiting still goes out
+	SendQueued();
+
+	ClosePipes();
+
+	Q_memset( m_hSockets, 0, sizeof( m_hSockets ) );
+
+	if ( m_nDropped )
+	{
+		DevMsg( "CSocketThread: dropped %d datagrams on full queues.\n", m_nDropped );
+		m_nDropped = 0;
+	}
+}
+
+void CSocketThread::ClosePipes()
+{
+#ifdef POSIX
+	for ( int i = 0; i < 2; i++ )
+	{
+		if ( m_hWakePipe[i] >= 0 )
+			close( m_hWakePipe[i] );
+		if ( m_hNotifyPipe[i] >= 0 )
+			close( m_hNotifyPipe[i] );
+	}
+	m_hWakePipe[0] = m_hWakePipe[1] = -1;
+	m_hNotifyPipe[0] = m_hNotifyPipe[1] = -1;
+#endif
+}
+
+void CSocketThread::WatchSocket( int sock, SOCKET s )
+{
+	Assert( sock >= 0 && sock < MAX_SOCKETS );
+	if ( m_hSockets[sock] != s )
+	{
+		AUTO_LOCK( m_SocketsMutex );
+		m_hSockets[sock] = s;
+		Wake();
+	}
+}
+
+void CSocketThread::UnwatchSocket( SOCKET s )
+{
+	if ( !s )
+		return;
+
+	AUTO_LOCK( m_SocketsMutex );
+
+	for ( int i = 0; i < MAX_SOCKETS; i++ )
+	{
+		if ( m_hSockets[i] == s )
+		{
+			m_hSockets[i] = 0;
+		}
+	}
+
+	// queued datagrams still name the handle, send them while it's open. The
+	// thread sends under the same lock, so none is left for it to send later
+	// on a closed or reused descriptor.
+	SendQueued();
+}
+
+int CSocketThread::RecvFrom( int sock, char *buf, int len, struct sockaddr *from, int *fromlen )
+{
+	sockdatagram_t *pDatagram;
+
+	for ( ;; )
+	{
+		if ( !m_Received[sock].PopItem( &pDatagram ) )
+		{
+			errno = WSAEWOULDBLOCK;
+			return -1;
+		}
+
+		--m_nReceived[sock];
+
+		// datagrams read from a socket that has been closed in between are stale
+		if ( !m_bRunning || pDatagram->hSocket == m_hSockets[sock] )
+			break;
+
+		FreeDatagram( pDatagram );
+	}
+
+	NET_RecordRecvLatency( true, pDatagram->flKernelTime );
+
+	int nSize = MIN( pDatagram->nSize, len );
+	Q_memcpy( buf, pDatagram->data, nSize );
+	Q_memcpy( from, &pDatagram->addr, MIN( pDatagram->nAddrLen, *fromlen ) );
+	*fromlen = pDatagram->nAddrLen;
+
+	bool bTruncated = pDatagram->bTruncated;
+	FreeDatagram( pDatagram );
+
+	if ( bTruncated )
+		return len; // same as a recvfrom() that filled the whole buffer
+
+	return nSize;
+}
+
+void CSocketThread::Flush()
+{
+	for ( int i = 0; i < MAX_SOCKETS; i++ )
+	{
+		sockdatagram_t *pDatagram;
+		while ( m_Received[i].PopItem( &pDatagram ) )
+		{
+			--m_nReceived[i];
+			FreeDatagram( pDatagram );
+		}
+	}
+}
+
+bool CSocketThread::QueueSend( SOCKET s, const char *buf, int len, const struct sockaddr *to, int tolen, bool bWake )
+{
+	if ( len > NET_THREAD_SLOT_SIZE || tolen > (int)sizeof( struct sockaddr ) || m_nSend >= NET_THREAD_MAX_SENDS )
+		return false;
+
+	// Shutdown() waits for m_nQueueing to drop before its last SendQueued()
+	++m_nQueueing;
+	if ( !m_bRunning )
+	{
+		--m_nQueueing;
+		return false;
+	}
+
+	sockdatagram_t *pDatagram = AllocDatagram();
+	pDatagram->hSocket = s;
+	pDatagram->nSize = len;
+	pDatagram->nAddrLen = tolen;
+	Q_memcpy( pDatagram->data, buf, len );
+	Q_memcpy( &pDatagram->addr, to, tolen );
+
+	++m_nSend;
+	m_Send.PushItem( pDatagram );
+
+	if ( bWake )
+	{
+		Wake();
+	}
+
+	// after Wake(), Shutdown() closes the pipe
+	--m_nQueueing;
+	return true;
+}
+
+void CSocketThread::Wake()
+{
+#ifdef POSIX
+	// one byte in the pipe is enough no matter how many datagrams got queued
+	if ( m_nWakePending.AssignIf( 0, 1 ) )
+	{
+		char c = 0;
+		if ( write( m_hWakePipe[1], &c, 1 ) < 0 )
+		{
+			// pipe is full, so the thread is awake anyway
+		}
+	}
+#endif
+}
+
+void CSocketThread::NotifyReceived()
+{
+#ifdef POSIX
+	if ( m_nNotifyPending.AssignIf( 0, 1 ) )
+	{
+		char c = 0;
+		if ( write( m_hNotifyPipe[1], &c, 1 ) < 0 )
+		{
+			// pipe is full, so the main thread will wake anyway
+		}
+	}
+#endif
+}
+
+void CSocketThread::ClearReceiveNotify()
+{
+#ifdef POSIX
+	m_nNotifyPending = 0;
+	char drain[64];
+	while ( read( m_hNotifyPipe[0], drain, sizeof( drain ) ) > 0 )
+	{
+	}
+#endif
+}
+
+sockdatagram_t *CSocketThread::AllocDatagram()
+{
+	sockdatagram_t *pDatagram;
+	if ( !m_FreeDatagrams.PopItem( &pDatagram ) )
+	{
+		pDatagram = new sockdatagram_t;
+	}
+
+	pDatagram->bTruncated = false;
+	pDatagram->flKernelTime = 0;
+	return pDatagram;
+}
+
+void CSocketThread::SendQueued()
+{
+	sockdatagram_t *pDatagram;
+	while ( m_Send.PopItem( &pDatagram ) )
+	{
+		--m_nSend;
+
+		// like a failed sendto() on the main thread, e.g. EWOULDBLOCK, drop the datagram and go on
+		sendto( pDatagram->hSocket, (const char *)pDatagram->data, pDatagram->nSize, 0, &pDatagram->addr, pDatagram->nAddrLen );
+
+		FreeDatagram( pDatagram );
+	}
+}
+
+void CSocketThread::ReceiveAll( int sock, SOCKET s )
+{
+#ifdef POSIX
+	bool bSample = net_recvlatency.GetBool();
+	int nMaxQueue = net_socketthread_maxqueue.GetInt();
+
+	for ( ;; )
+	{
+		sockdatagram_t *pDatagram = AllocDatagram();
+
+		struct iovec iov;
+		iov.iov_base = pDatagram->data;
+		iov.iov_len = NET_THREAD_SLOT_SIZE;
+
+		struct msghdr hdr;
+		Q_memset( &hdr, 0, sizeof( hdr ) );
+		hdr.msg_name = &pDatagram->addr;
+		hdr.msg_namelen = sizeof( pDatagram->addr );
+		hdr.msg_iov = &iov;
+		hdr.msg_iovlen = 1;
+
+#if defined( LINUX )
+		byte control[NET_RECV_CONTROL_SIZE];
+		if ( bSample )
+		{
+			hdr.msg_control = control;
+			hdr.msg_controllen = sizeof( control );
+		}
+#endif
+
+		int ret = recvmsg( s, &hdr, MSG_DONTWAIT );
+		if ( ret < 0 )
+		{
+			FreeDatagram( pDatagram );
+			return;
+		}
+
+		if ( NET_IsRateLimitedDatagram( sock, pDatagram->data, ret, (struct sockaddr *)&pDatagram->addr ) )
+		{
+			FreeDatagram( pDatagram );
+			continue;
+		}
+
+		if ( m_nReceived[sock] >= nMaxQueue )
+		{
+			// keep draining the socket, the main thread is behind anyway
+			m_nDropped++;
+			FreeDatagram( pDatagram );
+			continue;
+		}
+
+		pDatagram->hSocket = s;
+		pDatagram->nSize = ret;
+		pDatagram->nAddrLen = hdr.msg_namelen;
+		pDatagram->bTruncated = ( hdr.msg_flags & MSG_TRUNC ) != 0;
+#if defined( LINUX )
+		if ( bSample )
+		{
+			pDatagram->flKernelTime = NET_GetRecvTimestamp( &hdr );
+		}
+#endif
+
+		++m_nReceived[sock];
+		m_Received[sock].PushItem( pDatagram );
+	}
+#endif
+}
+
+int CSocketThread::Run()
+{
+#ifdef POSIX
+	struct pollfd fds[MAX_SOCKETS + 1];
+	int nSocketFor[MAX_SOCKETS + 1];
+	SOCKET hStamped[MAX_SOCKETS];
+	Q_memset( hStamped, 0, sizeof( hStamped ) );
+
+	while ( !m_bThreadShouldExit )
+	{
+		int nFds = 0;
+		fds[nFds].fd = m_hWakePipe[0];
+		fds[nFds].events = POLLIN;
+		fds[nFds].revents = 0;
+		nSocketFor[nFds++] = -1;
+
+		{
+			AUTO_LOCK( m_SocketsMutex );
+			for ( int i = 0; i < MAX_SOCKETS; i++ )
+			{
+				SOCKET s = m_hSockets[i];
+				if ( !s )
+					continue;
+
+#if defined( LINUX )
+				if ( net_recvlatency.GetBool() && hStamped[i] != s && NET_EnableRecvTimestamps( s ) )
+				{
+					hStamped[i] = s;
+				}
+#endif
+				fds[nFds].fd = s;
+				fds[nFds].events = POLLIN;
+				fds[nFds].revents = 0;
+				nSocketFor[nFds++] = i;
+			}
+		}
+
+		// Normally wait forever, but we wakeup every 100ms just in case.
+		int nReady = poll( fds, nFds, 100 );
+
+		// clear the flag before draining so a send queued from here on wakes us again
+		if ( fds[0].revents & POLLIN )
+		{
+			m_nWakePending = 0;
+			char drain[64];
+			while ( read( m_hWakePipe[0], drain, sizeof( drain ) ) > 0 )
+			{
+			}
+		}
+
+		{
+			AUTO_LOCK( m_SocketsMutex );
+			SendQueued();
+		}
+
+		if ( nReady <= 0 )
+			continue;
+
+		for ( int i = 1; i < nFds; i++ )
+		{
+			if ( !( fds[i].revents & POLLIN ) )
+				continue;
+
+			AUTO_LOCK( m_SocketsMutex );
+
+			// closed or replaced since we started polling
+			int sock = nSocketFor[i];
+			if ( m_hSockets[sock] != fds[i].fd )
+				continue;
+
+			ReceiveAll( sock, fds[i].fd );
+
+			if ( sock == NS_SERVER
+#ifdef LINUX
+				|| sock == NS_SVLAN
+#endif
+				)
+			{
+				NotifyReceived();
+			}
+		}
+	}
+#endif
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Receive latency histogram. Buckets are powers of two in microseconds, the
+// first holds everything under 2us and the last everything from ~65ms up.
+//-----------------------------------------------------------------------------
+#define NET_LATENCY_BUCKETS		17
+
+struct netlatencyhistogram_t
+{
+	int		nBuckets[NET_LATENCY_BUCKETS];
+	int		nSamples;
+	double	flTotal;
+	double	flMax;
+};
+
+static netlatencyhistogram_t s_RecvLatency[2];	// inline, threaded
+
+#if defined( LINUX )
+bool NET_EnableRecvTimestamps( SOCKET s )
+{
+	int on = 1;
+	return setsockopt( s, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof( on ) ) == 0;
+}
+
+double NET_GetRecvTimestamp( struct msghdr *pHdr )
+{
+	for ( struct cmsghdr *pMsg = CMSG_FIRSTHDR( pHdr ); pMsg; pMsg = CMSG_NXTHDR( pHdr, pMsg ) )
+	{
+		if ( pMsg->cmsg_level == SOL_SOCKET && pMsg->cmsg_type == SCM_TIMESTAMPNS )
+		{
+			struct timespec ts;
+			Q_memcpy( &ts, CMSG_DATA( pMsg ), sizeof( ts ) );
+			return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+		}
+	}
+
+	return 0;
+}
+#endif
+
+void NET_RecordRecvLatency( bool bThreaded, double flKernelTime )
+{
+#if defined( LINUX )
+	if ( !flKernelTime || !net_recvlatency.GetBool() )
+		return;
+
+	Assert( ThreadInMainThread() );
+
+	// kernel timestamps are wall clock
+	struct timespec now;
+	clock_gettime( CLOCK_REALTIME, &now );
+	double flLatency = (double)now.tv_sec + (double)now.tv_nsec * 1e-9 - flKernelTime;
+	if ( flLatency < 0 )
+		flLatency = 0;
+
+	netlatencyhistogram_t &h = s_RecvLatency[bThreaded ? 1 : 0];
+
+	int nBucket = 0;
+	for ( int us = (int)( flLatency * 1e6 ); us > 1 && nBucket < NET_LATENCY_BUCKETS - 1; us >>= 1 )
+	{
+		nBucket++;
+	}
+
+	h.nBuckets[nBucket]++;
+	h.nSamples++;
+	h.flTotal += flLatency;
+	h.flMax = MAX( h.flMax, flLatency );
+#endif
+}
+
+CON_COMMAND( net_recvlatency_report, "Print the UDP receive latency histograms collected with net_recvlatency, 'reset' clears them." )
+{
+	if ( args.ArgC() > 1 && !Q_stricmp( args[1], "reset" ) )
+	{
+		Q_memset( s_RecvLatency, 0, sizeof( s_RecvLatency ) );
+		return;
+	}
+
+	static const char *s_pszModes[] = { "inline", "threaded" };
+
+	for ( int i = 0; i < 2; i++ )
+	{
+		const netlatencyhistogram_t &h = s_RecvLatency[i];
+		if ( !h.nSamples )
+		{
+			ConMsg( "%s: no samples\n", s_pszModes[i] );
+			continue;
+		}
+
+		ConMsg( "%s: %d samples, avg %.1f us, max %.1f us\n", s_pszModes[i], h.nSamples, h.flTotal * 1e6 / h.nSamples, h.flMax * 1e6 );
+
+		int nSum = 0;
+		for ( int j = 0; j < NET_LATENCY_BUCKETS; j++ )
+		{
+			if ( !h.nBuckets[j] )
+				continue;
+
+			nSum += h.nBuckets[j];
+			ConMsg( "  %s %6d us: %8d  %5.1f%%  (cumulative %5.1f%%)\n", j < NET_LATENCY_BUCKETS - 1 ? "< " : ">=",
+				j < NET_LATENCY_BUCKETS - 1 ? 2 << j : 1 << j, h.nBuckets[j], 100.0f * h.nBuckets[j] / h.nSamples, 100.0f * nSum / h.nSamples );
+		}
+	}
+}
@@ -0,0 +1,63 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Optional network I/O thread that owns the UDP sockets
+//
+//=============================================================================
+
+#ifndef NET_WS_SOCKET_THREAD_H
+#define NET_WS_SOCKET_THREAD_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+// The socket thread drains the UDP sockets as soon as datagrams arrive and
+// sends queued datagrams, so the main thread only pops and pushes lock free
+// queues. Datagrams are still decoded (split packets, decompression) on the
+// main thread by NET_GetPacket.
+class ISocketThread
+{
+public:
+	virtual bool Setup() = 0;
+	virtual void Shutdown() = 0;
+	virtual bool IsRunning() = 0;
+
+	// Main thread: keep the thread's UDP handle for a net socket in sync, 0 stops watching it.
+	virtual void WatchSocket( int sock, SOCKET s ) = 0;
+	// Main thread: call before a handle is closed, the thread won't touch it afterwards.
+	virtual void UnwatchSocket( SOCKET s ) = 0;
+
+	// Main thread: next datagram received on a net socket, -1 with EWOULDBLOCK if there is none.
+	virtual int RecvFrom( int sock, char *buf, int len, struct sockaddr *from, int *fromlen ) = 0;
+	virtual bool HasReceived( int sock ) = 0;
+	// Main thread: drop all received datagrams.
+	virtual void Flush() = 0;
+
+	// Any thread: queue a datagram for the thread to send, false if the caller has to send it itself.
+	virtual bool QueueSend( SOCKET s, const char *buf, int len, const struct sockaddr *to, int tolen, bool bWake ) = 0;
+	// Any thread: have the thread send everything queued so far.
+	virtual void Wake() = 0;
+
+	// Main thread: readable once datagrams for the game server arrived, -1 if the thread isn't
+	// running. Clear it before taking the datagrams so nothing that arrives afterwards is missed.
+	virtual int GetReceiveNotifyHandle() = 0;
+	virtual void ClearReceiveNotify() = 0;
+};
+
+extern ISocketThread *g_pSocketThread;
+extern ConVar net_socketthread;
+
+// Receive latency histogram, kernel receive timestamp to the main thread taking the datagram.
+extern ConVar net_recvlatency;
+#if defined( LINUX )
+#define NET_RECV_CONTROL_SIZE	64	// >= CMSG_SPACE( sizeof( struct timespec ) )
+
+bool NET_EnableRecvTimestamps( SOCKET s );
+double NET_GetRecvTimestamp( struct msghdr *pHdr );
+#endif
+void NET_RecordRecvLatency( bool bThreaded, double flKernelTime );
+
+// Server queries over the rate limit, checked while the datagram is still where it was received
+bool NET_IsRateLimitedDatagram( int sock, const byte *pData, int nSize, const struct sockaddr *from );
+bool NET_IsReceiveRateLimitedQuery( int sock, const byte *pData, int nSize );
+
+#endif // NET_WS_SOCKET_THREAD_H
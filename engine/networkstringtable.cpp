@@ -16,6 +16,7 @@
 #include "vprof.h"
 #include <tier1/utlstring.h>
 #include <tier1/utlhashtable.h>
+#include <tier1/fmtstr.h>
 #include <tier0/etwprof.h>
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -23,6 +24,32 @@
 ConVar sv_dumpstringtables( "sv_dumpstringtables", "0", FCVAR_CHEAT );
 ConVar sv_compressstringtablebaselines_threshhold( "sv_compressstringtablebaselines_threshold", "2048", 0, "Minimum size (in bytes) for stringtablebaseline buffer to be compressed." );
 
+#ifndef SHARED_NET_STRING_TABLES
+static ConVar sv_stringtable_updatecache( "sv_stringtable_updatecache", "1", 0, "Encode string table updates once for all clients that need the same update." );
+
+// bits of string table updates encoded and sent since the last tick
+static CInterlockedInt s_nUpdateBitsEncoded;
+static CInterlockedInt s_nUpdateBitsSent;
+static int64 s_nTotalUpdateBytesEncoded = 0;
+static int64 s_nTotalUpdateBytesSent = 0;
+
+CON_COMMAND( sv_stringtable_updatecache_stats, "Print how many string table update bytes were encoded vs. sent to clients." )
+{
+	ConMsg( "string table updates: %lld bytes encoded, %lld bytes sent", s_nTotalUpdateBytesEncoded, s_nTotalUpdateBytesSent );
+	if ( s_nTotalUpdateBytesEncoded > 0 )
+	{
+		ConMsg( " (%.1fx)", (double)s_nTotalUpdateBytesSent / (double)s_nTotalUpdateBytesEncoded );
+	}
+	ConMsg( "\n" );
+
+	if ( args.ArgC() > 1 && !Q_stricmp( args[1], "reset" ) )
+	{
+		s_nTotalUpdateBytesEncoded = 0;
+		s_nTotalUpdateBytesSent = 0;
+	}
+}
+#endif
+
 #define SUBSTRING_BITS	5
 struct StringHistoryEntry
 {
@@ -139,7 +166,9 @@ private:
 };
 
 //-----------------------------------------------------------------------------
-// Implementation for general purpose strings
+// Implementation for general purpose strings. Entries live in a vector in
+// string number order, lookups go through an open addressing index that keeps
+// each string's hash so probing and growing never touch the strings themselves.
 //-----------------------------------------------------------------------------
 class CNetworkStringDict : public INetworkStringDict
 {
@@ -154,46 +183,130 @@ public:
 
 	unsigned int Count()
 	{
-		return m_Lookup.Count();
+		return m_Items.Count();
 	}
 
 	void Purge()
 	{
-		m_Lookup.Purge();
+		m_Items.Purge();
+		m_Index.Purge();
 	}
 
 	const char *String( int index )
 	{
-		return m_Lookup.Key( index ).Get();
+		return m_Items[index].m_String.Get();
 	}
 
 	bool IsValidIndex( int index )
 	{
-		return m_Lookup.IsValidHandle( index );
+		return m_Items.IsValidIndex( index );
 	}
 
 	int Insert( const char *pString )
 	{
-		return m_Lookup.Insert( pString );
+		unsigned int nHash = CaselessStringHashFunctor()( pString );
+
+		int nSlot = FindSlot( pString, nHash );
+		if ( m_Index[nSlot].m_nItem != -1 )
+			return m_Index[nSlot].m_nItem;
+
+		// keep the index at most half full
+		if ( ( m_Items.Count() + 1 ) * 2 > m_Index.Count() )
+		{
+			GrowIndex();
+			nSlot = FindSlot( pString, nHash );
+		}
+
+		int index = m_Items.AddToTail();
+		m_Items[index].m_String.Set( pString );
+
+		m_Index[nSlot].m_nHash = nHash;
+		m_Index[nSlot].m_nItem = index;
+		return index;
 	}
 
 	int Find( const char *pString )
 	{
-		return pString ? m_Lookup.Find( pString ) : m_Lookup.InvalidHandle();
+		if ( !pString || !m_Items.Count() )
+			return m_Items.InvalidIndex();
+
+		return m_Index[ FindSlot( pString, CaselessStringHashFunctor()( pString ) ) ].m_nItem;
 	}
 
 	CNetworkStringTableItem	&Element( int index )
 	{
-		return m_Lookup.Element( index );
+		return m_Items[index].m_Item;
 	}
 
 	const CNetworkStringTableItem &Element( int index ) const
 	{
-		return m_Lookup.Element( index );
+		return m_Items[index].m_Item;
 	}
 
 private:
-	CUtlStableHashtable< CUtlConstString, CNetworkStringTableItem, CaselessStringHashFunctor, UTLConstStringCaselessStringEqualFunctor<char> > m_Lookup;
+	struct Entry_t
+	{
+		CUtlConstString			m_String;
+		CNetworkStringTableItem	m_Item;
+	};
+
+	struct IndexSlot_t
+	{
+		unsigned int	m_nHash;
+		int				m_nItem;	// -1 if the slot is empty
+	};
+
+	// slot holding pString, or the empty slot it would go into
+	int FindSlot( const char *pString, unsigned int nHash )
+	{
+		if ( !m_Index.Count() )
+		{
+			GrowIndex();
+		}
+
+		int nMask = m_Index.Count() - 1;
+		int nSlot = nHash & nMask;
+		for ( ;; )
+		{
+			const IndexSlot_t &slot = m_Index[nSlot];
+			if ( slot.m_nItem == -1 )
+				return nSlot;
+
+			if ( slot.m_nHash == nHash && !V_stricmp( m_Items[slot.m_nItem].m_String.Get(), pString ) )
+				return nSlot;
+
+			nSlot = ( nSlot + 1 ) & nMask;
+		}
+	}
+
+	void GrowIndex()
+	{
+		CUtlVector< IndexSlot_t > oldIndex;
+		oldIndex.Swap( m_Index );
+
+		m_Index.SetCount( MAX( oldIndex.Count() * 2, 64 ) );
+		for ( int i = 0; i < m_Index.Count(); i++ )
+		{
+			m_Index[i].m_nItem = -1;
+		}
+
+		int nMask = m_Index.Count() - 1;
+		for ( int i = 0; i < oldIndex.Count(); i++ )
+		{
+			if ( oldIndex[i].m_nItem == -1 )
+				continue;
+
+			int nSlot = oldIndex[i].m_nHash & nMask;
+			while ( m_Index[nSlot].m_nItem != -1 )
+			{
+				nSlot = ( nSlot + 1 ) & nMask;
+			}
+			m_Index[nSlot] = oldIndex[i];
+		}
+	}
+
+	CUtlVector< Entry_t >		m_Items;	// indexed by string number
+	CUtlVector< IndexSlot_t >	m_Index;	// power of 2 sized
 };
 
 //-----------------------------------------------------------------------------
@@ -221,6 +334,10 @@ CNetworkStringTable::CNetworkStringTable( TABLEID id, const char *tableName, int
 	m_bChangeHistoryEnabled = false;
 	m_bLocked = false;
 
+	m_nChangeSerial = 0;
+	m_nNextCachedUpdate = 0;
+	memset( m_CachedUpdates, 0, sizeof( m_CachedUpdates ) );
+
 	m_nMaxEntries = maxentries;
 	m_nEntryBits = Q_log2( m_nMaxEntries );
 
@@ -320,6 +437,9 @@ int	CNetworkStringTable::GetUserDataSizeBits() const
 //-----------------------------------------------------------------------------
 CNetworkStringTable::~CNetworkStringTable( void )
 {
+#ifndef SHARED_NET_STRING_TABLES
+	FreeCachedUpdates();
+#endif
 	delete[] m_pszTableName;
 	delete m_pItems;
 	delete m_pItemsClientSide;
@@ -330,6 +450,8 @@ CNetworkStringTable::~CNetworkStringTable( void )
 //-----------------------------------------------------------------------------
 void CNetworkStringTable::DeleteAllStrings( void )
 {
+	m_nChangeSerial++;
+
 	delete m_pItems;
 	if ( m_bIsFilenames )
 	{
@@ -439,6 +561,7 @@ void CNetworkStringTable::RestoreTick(int tick)
 {
 	// TODO optimize this, most of the time the tables doens't really change
 
+	m_nChangeSerial++;
 	m_nLastChangedTick = 0;
 
 	int count = m_pItems->Count();
@@ -607,6 +730,122 @@ int CNetworkStringTable::WriteUpdate( CBaseClient *client, bf_write &buf, int ti
 	return entriesUpdated;
 }
 
+void CNetworkStringTable::WriteUpdateMessage( CBaseClient *client, bf_write &buf, int tick_ack, char *msg_buffer, int msg_buffer_size )
+{
+	SVC_UpdateStringTable msg;
+
+	msg.m_DataOut.StartWriting( msg_buffer, msg_buffer_size );
+	msg.m_nTableID = GetTableId();
+	msg.m_nChangedEntries = WriteUpdate( client, msg.m_DataOut, tick_ack );
+
+	Assert( msg.m_nChangedEntries > 0 ); // don't send unnecessary empty updates
+
+	msg.WriteToBuffer( buf );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: An update only depends on which entries were created or changed
+//			after tick_ack, so every ack between the same two changes gets the
+//			same update. Returns the latest change at or before tick_ack.
+//-----------------------------------------------------------------------------
+int CNetworkStringTable::GetUpdateBaseTick( int tick_ack )
+{
+	int nBaseTick = INT_MIN;
+
+	int count = m_pItems->Count();
+
+	for ( int i = 0; i < count; i++ )
+	{
+		CNetworkStringTableItem *p = &m_pItems->Element( i );
+
+		int nTickChanged = p->GetTickChanged();
+		if ( nTickChanged <= tick_ack && nTickChanged > nBaseTick )
+		{
+			nBaseTick = nTickChanged;
+		}
+
+		int nTickCreated = p->GetTickCreated();
+		if ( nTickCreated <= tick_ack && nTickCreated > nBaseTick )
+		{
+			nBaseTick = nTickCreated;
+		}
+	}
+
+	return nBaseTick;
+}
+
+int CNetworkStringTable::WriteCachedUpdateMessage( bf_write &buf, int tick_ack, char *msg_buffer, int msg_buffer_size )
+{
+	// tables only change on the main thread while nobody is sending
+	int nChangeSerial = m_nChangeSerial;
+	int nBaseTick = GetUpdateBaseTick( tick_ack );
+
+	{
+		AUTO_LOCK( m_CachedUpdateMutex );
+
+		for ( int i = 0; i < MAX_CACHED_UPDATES; i++ )
+		{
+			CachedUpdate_t &cached = m_CachedUpdates[i];
+			if ( cached.pData && cached.nChangeSerial == nChangeSerial && cached.nBaseTick == nBaseTick )
+			{
+				buf.WriteBits( cached.pData, cached.nBits );
+				return 0;
+			}
+		}
+	}
+
+	int nStartBit = buf.GetNumBitsWritten();
+	WriteUpdateMessage( NULL, buf, tick_ack, msg_buffer, msg_buffer_size );
+	int nBits = buf.GetNumBitsWritten() - nStartBit;
+
+	if ( buf.IsOverflowed() )
+		return nBits;
+
+	// copy the message back out of the client's buffer
+	int nBytes = PAD_NUMBER( nBits, 8 ) >> 3;
+	byte *pData = new byte[ nBytes ];
+
+	bf_write cacheBuf( pData, nBytes );
+	bf_read readBuf( buf.GetBasePointer(), buf.GetNumBytesWritten() );
+	readBuf.Seek( nStartBit );
+	cacheBuf.WriteBitsFromBuffer( &readBuf, nBits );
+
+	AUTO_LOCK( m_CachedUpdateMutex );
+
+	for ( int i = 0; i < MAX_CACHED_UPDATES; i++ )
+	{
+		CachedUpdate_t &cached = m_CachedUpdates[i];
+		if ( cached.pData && cached.nChangeSerial == nChangeSerial && cached.nBaseTick == nBaseTick )
+		{
+			// another thread encoded the same update meanwhile
+			delete[] pData;
+			return nBits;
+		}
+	}
+
+	CachedUpdate_t &slot = m_CachedUpdates[m_nNextCachedUpdate];
+	m_nNextCachedUpdate = ( m_nNextCachedUpdate + 1 ) % MAX_CACHED_UPDATES;
+
+	delete[] slot.pData;
+	slot.nChangeSerial = nChangeSerial;
+	slot.nBaseTick = nBaseTick;
+	slot.nBits = nBits;
+	slot.pData = pData;
+
+	return nBits;
+}
+
+void CNetworkStringTable::FreeCachedUpdates( void )
+{
+	AUTO_LOCK( m_CachedUpdateMutex );
+
+	for ( int i = 0; i < MAX_CACHED_UPDATES; i++ )
+	{
+		delete[] m_CachedUpdates[i].pData;
+		m_CachedUpdates[i].pData = NULL;
+	}
+}
+
 
 //-----------------------------------------------------------------------------
 // Purpose: Parse string update
@@ -885,9 +1124,7 @@ int CNetworkStringTable::AddString( bool bIsServer, const char *string, int leng
 	}
 	else
 	{
-		// See if it's already there
-		i = m_pItems->Find( string );
-
+		// i is still what the lookup at the top found
 		if ( !m_pItems->IsValidIndex( i ) )
 		{
 			// not in list yet, create it now
@@ -1016,6 +1253,7 @@ void CNetworkStringTable::DataChanged( int stringNumber, CNetworkStringTableItem
 
 	// Mark table as changed
 	m_nLastChangedTick = m_nTickCount;
+	m_nChangeSerial++;
 	
 	// Invoke callback if one was installed
 	
@@ -1205,6 +1443,78 @@ int CNetworkStringTable::FindStringIndex( char const *string )
 	return INVALID_STRING_INDEX;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Replays an entity spawn wave's precaches against a scratch table and
+//			against the hashtable the string dictionary used to be built on.
+//-----------------------------------------------------------------------------
+CON_COMMAND( stringtable_lookup_bench, "Time precache style AddString/FindStringIndex calls for a spawn wave. Usage: stringtable_lookup_bench [entities]" )
+{
+	int nEntities = ( args.ArgC() > 1 ) ? clamp( atoi( args[1] ), 1, 1000000 ) : 20000;
+
+	const int nModels = 1500;
+	const int nSounds = 3000;
+	const int nMaxStrings = 8192;
+
+	CUtlVector< CUtlString > names;
+	for ( int i = 0; i < nModels; i++ )
+	{
+		names.AddToTail( CUtlString( CFmtStr( "models/props_%s/Prop_%04d.mdl", ( i & 1 ) ? "wasteland" : "c17", i ) ) );
+	}
+	for ( int i = 0; i < nSounds; i++ )
+	{
+		names.AddToTail( CUtlString( CFmtStr( "Weapon_Gun.Single_%04d", i ) ) );
+	}
+
+	// every entity precaches its model and two sounds, then looks its model up again
+	CUtlVector< int > calls;
+	unsigned int nSeed = 1;
+	for ( int i = 0; i < nEntities; i++ )
+	{
+		nSeed = nSeed * 1103515245 + 12345;
+		calls.AddToTail( ( nSeed >> 8 ) % nModels );
+		calls.AddToTail( nModels + ( nSeed >> 4 ) % nSounds );
+		calls.AddToTail( nModels + ( nSeed >> 12 ) % nSounds );
+		calls.AddToTail( calls[ calls.Count() - 3 ] );
+	}
+
+	double flStart = Plat_FloatTime();
+	int nFound = 0;
+	{
+		CNetworkStringTable table( 0, "stringtable_lookup_bench", nMaxStrings, 0, 0, false );
+		for ( int i = 0; i < calls.Count(); i += 4 )
+		{
+			table.AddString( true, names[ calls[i] ] );
+			table.AddString( true, names[ calls[i+1] ] );
+			table.AddString( true, names[ calls[i+2] ] );
+			nFound += table.FindStringIndex( names[ calls[i+3] ] ) != INVALID_STRING_INDEX;
+		}
+	}
+	double flIndexed = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	int nFoundLegacy = 0;
+	{
+		CUtlStableHashtable< CUtlConstString, CNetworkStringTableItem, CaselessStringHashFunctor, UTLConstStringCaselessStringEqualFunctor<char> > lookup;
+		for ( int i = 0; i < calls.Count(); i += 4 )
+		{
+			for ( int j = 0; j < 3; j++ )
+			{
+				if ( lookup.Find( names[ calls[i+j] ].Get() ) == lookup.InvalidHandle() )
+				{
+					lookup.Insert( names[ calls[i+j] ].Get() );
+				}
+			}
+			nFoundLegacy += lookup.Find( names[ calls[i+3] ].Get() ) != lookup.InvalidHandle();
+		}
+	}
+	double flLegacy = Plat_FloatTime() - flStart;
+
+	Assert( nFound == nFoundLegacy );
+
+	ConMsg( "%d entities, %d lookups: hash index %.3f ms, stable hashtable %.3f ms (%.2fx)\n",
+		nEntities, calls.Count(), flIndexed * 1000.0, flLegacy * 1000.0, flLegacy / MAX( flIndexed, 1e-9 ) );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
@@ -1490,16 +1800,18 @@ bool CNetworkStringTableContainer::ReadStringTables( bf_read& buf )
 
 		// Find this table by name
 		CNetworkStringTable *table = (CNetworkStringTable*)FindTable( tablename );
-		Assert( table );
+		if ( !table )
+		{
+			// the data of the tables after it can't be found without it
+			Warning( "Could not find table \"%s\"\n", tablename );
+			return false;
+		}
 
 		// Now read the data for the table
-		if ( table && !table->ReadStringTable( buf ) )
+		if ( !table->ReadStringTable( buf ) )
 		{
 			Host_Error( "Error reading string table %s\n", tablename );
-		}
-		else
-		{
-			Warning( "Could not find table \"%s\"\n", tablename );
+			return false;
 		}
 	}
 
@@ -1517,6 +1829,10 @@ void CNetworkStringTableContainer::WriteUpdateMessage( CBaseClient *client, int
 
 	char buffer[NET_MAX_PAYLOAD];
 
+	// tracing wants the per entry breakdown, so those clients always encode their own update
+	bool bTracing = client && client->IsTracing();
+	bool bUseCache = !bTracing && sv_stringtable_updatecache.GetBool();
+
 	// Determine if an update is needed
 	for ( int i = 0; i < m_Tables.Count(); i++ )
 	{
@@ -1528,18 +1844,21 @@ void CNetworkStringTableContainer::WriteUpdateMessage( CBaseClient *client, int
 		if ( !table->ChangedSinceTick( tick_ack ) )
 			continue;
 
-		SVC_UpdateStringTable msg;
-
-		msg.m_DataOut.StartWriting( buffer, NET_MAX_PAYLOAD );
-		msg.m_nTableID = table->GetTableId();
-		msg.m_nChangedEntries = table->WriteUpdate( client, msg.m_DataOut, tick_ack );
+		int nStartBit = buf.GetNumBitsWritten();
 
-		Assert( msg.m_nChangedEntries > 0 ); // don't send unnecessary empty updates
+		if ( bUseCache )
+		{
+			s_nUpdateBitsEncoded += table->WriteCachedUpdateMessage( buf, tick_ack, buffer, NET_MAX_PAYLOAD );
+		}
+		else
+		{
+			table->WriteUpdateMessage( client, buf, tick_ack, buffer, NET_MAX_PAYLOAD );
+			s_nUpdateBitsEncoded += buf.GetNumBitsWritten() - nStartBit;
+		}
 
-		msg.WriteToBuffer( buf );
+		s_nUpdateBitsSent += buf.GetNumBitsWritten() - nStartBit;
 
-		if ( client &&
-			 client->IsTracing() )
+		if ( bTracing )
 		{
 			client->TraceNetworkData( buf, "StringTable %s", table->GetTableName() );
 		}
@@ -1614,6 +1933,18 @@ void CNetworkStringTableContainer::SetTick( int tick_count)
 
 	m_nTickCount = tick_count;
 
+#ifndef SHARED_NET_STRING_TABLES
+	int nBitsEncoded = s_nUpdateBitsEncoded;
+	int nBitsSent = s_nUpdateBitsSent;
+	s_nUpdateBitsEncoded -= nBitsEncoded;
+	s_nUpdateBitsSent -= nBitsSent;
+
+	VPROF_INCREMENT_COUNTER( "SV stringtable bytes encoded", nBitsEncoded >> 3 );
+	VPROF_INCREMENT_COUNTER( "SV stringtable bytes sent", nBitsSent >> 3 );
+	s_nTotalUpdateBytesEncoded += nBitsEncoded >> 3;
+	s_nTotalUpdateBytesSent += nBitsSent >> 3;
+#endif
+
 	// Determine if an update is needed
 	for ( int i = 0; i < m_Tables.Count(); i++ )
 	{
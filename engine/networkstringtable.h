@@ -16,6 +16,7 @@
 #include <utldict.h>
 #include <utlbuffer.h>
 #include "tier1/bitbuf.h"
+#include "tier0/threadtools.h"
 
 class SVC_CreateStringTable;
 class CBaseClient;
@@ -78,6 +79,12 @@ public:
 	int				WriteUpdate( CBaseClient *client, bf_write &buf, int tick_ack );
 	void			ParseUpdate( bf_read &buf, int entries );
 
+	// SVC_UpdateStringTable for clients at tick_ack, msg_buffer is scratch space for the payload
+	void			WriteUpdateMessage( CBaseClient *client, bf_write &buf, int tick_ack, char *msg_buffer, int msg_buffer_size );
+	// Same but shares the encoded message between clients that need the same update,
+	// returns the number of bits that had to be encoded (0 if it was cached)
+	int				WriteCachedUpdateMessage( bf_write &buf, int tick_ack, char *msg_buffer, int msg_buffer_size );
+
 	// HLTV change history & rollback
 	void			EnableRollback();
 	void			RestoreTick(int tick);
@@ -110,6 +117,11 @@ protected:
 	// Destroy string table
 	void			DeleteAllStrings( void );
 
+#ifndef SHARED_NET_STRING_TABLES
+	int				GetUpdateBaseTick( int tick_ack );
+	void			FreeCachedUpdates( void );
+#endif
+
 	CNetworkStringTable( const CNetworkStringTable & ); // not implemented, not allowed
 
 	TABLEID					m_id;
@@ -139,6 +151,23 @@ protected:
 
 	INetworkStringDict		*m_pItems;
 	INetworkStringDict		*m_pItemsClientSide;	 // For m_bAllowClientSideAddString, these items are non-networked and are referenced by a negative string index!!!
+
+	// Bumped on every change, the cached updates below are only valid for the serial they were encoded at
+	int						m_nChangeSerial;
+
+	enum { MAX_CACHED_UPDATES = 8 };
+
+	struct CachedUpdate_t
+	{
+		int		nChangeSerial;
+		int		nBaseTick;
+		int		nBits;
+		byte	*pData;
+	};
+
+	CachedUpdate_t			m_CachedUpdates[MAX_CACHED_UPDATES];
+	int						m_nNextCachedUpdate;
+	CThreadFastMutex		m_CachedUpdateMutex;
 };
 
 //-----------------------------------------------------------------------------
@@ -30,6 +30,7 @@
 PackedEntity::PackedEntity()
 {
 	m_pData = NULL;
+	m_pArena = NULL;
 	m_pChangeFrameList = NULL;
 	m_nSnapshotCreationTick = 0;
 	m_nShouldCheckCreationTick = 0;
@@ -69,6 +70,27 @@ bool PackedEntity::AllocAndCopyPadded( const void *pData, unsigned long size )
 }
 
 
+bool PackedEntity::CopyPaddedToArena( const void *pData, unsigned long size, CPackedEntityArena *pArena )
+{
+	unsigned long nBytes = PAD_NUMBER( size, 4 );
+
+	void *pArenaData = pArena->Alloc( nBytes );
+	if ( !pArenaData )
+		return false;
+
+	FreeData();
+
+	pArena->AddReference();
+	m_pArena = pArena;
+	m_pData = pArenaData;
+
+	Q_memcpy( m_pData, pData, size );
+	SetNumBits( nBytes * 8 );
+
+	return true;
+}
+
+
 int PackedEntity::GetPropsChangedAfterTick( int iTick, int *iOutProps, int nMaxOutProps )
 {
 	if ( m_pChangeFrameList )
@@ -17,6 +17,7 @@
 #include <mempool.h>
 #include <utlvector.h>
 #include <tier0/dbg.h>
+#include <tier0/threadtools.h>
 
 #include "common.h"
 
@@ -51,6 +52,43 @@ class ClientClass;
 class IChangeFrameList;
 
 
+//-----------------------------------------------------------------------------
+// A block the server packs one tick's entities into back to back. Every
+// PackedEntity with data in here holds a reference, and the snapshot manager
+// recycles the whole block when the last one is freed.
+//-----------------------------------------------------------------------------
+class CPackedEntityArena
+{
+public:
+	// Thread safe, returns NULL if the block is full.
+	void*		Alloc( int nBytes );
+
+	void		AddReference();
+	void		ReleaseReference();	// hands the block back to the snapshot manager
+
+public:
+	unsigned char		*m_pBase;
+	int					m_nSize;
+	CInterlockedInt		m_nUsed;
+	CInterlockedInt		m_nReferences;
+	CPackedEntityArena	*m_pNextFree;
+};
+
+inline void* CPackedEntityArena::Alloc( int nBytes )
+{
+	int nStart = m_nUsed.AtomicAdd( nBytes );
+	if ( nStart + nBytes > m_nSize )
+		return NULL;
+
+	return m_pBase + nStart;
+}
+
+inline void CPackedEntityArena::AddReference()
+{
+	++m_nReferences;
+}
+
+
 
 // Replaces entity_state_t.
 // This is what we send to clients.
@@ -76,6 +114,9 @@ public:
 	// an integer multiple of 4.
 	bool		AllocAndCopyPadded( const void *pData, unsigned long size );
 
+	// Same, but the data goes into pArena. Returns false if it doesn't fit.
+	bool		CopyPaddedToArena( const void *pData, unsigned long size, CPackedEntityArena *pArena );
+
 	// These are like Get/Set, except SnagChangeFrameList clears out the
 	// PackedEntity's pointer since the usage model in sv_main is to keep
 	// the same CChangeFrameList in the most recent PackedEntity for the
@@ -110,13 +151,14 @@ public:
 	ClientClass	*m_pClientClass;	// Valid on the client
 		
 	int			m_nEntityIndex;		// Entity index.
-	int			m_ReferenceCount;	// reference count;
+	CInterlockedInt	m_ReferenceCount;	// reference count, may be released from snapshot send threads
 
 private:
 
 	CUtlVector<CSendProxyRecipients>	m_Recipients;
 
 	void				*m_pData;				// Packed data.
+	CPackedEntityArena	*m_pArena;				// Owns m_pData if set, otherwise it was malloc'd.
 	int					m_nBits;				// Number of bits used to encode.
 	IChangeFrameList	*m_pChangeFrameList;	// Only the most current 
 
@@ -160,7 +202,13 @@ inline void* PackedEntity::GetData()
 
 inline void PackedEntity::FreeData()
 {
-	if ( m_pData )
+	if ( m_pArena )
+	{
+		m_pArena->ReleaseReference();
+		m_pArena = NULL;
+		m_pData = NULL;
+	}
+	else if ( m_pData )
 	{
 		free(m_pData);
 		m_pData = NULL;
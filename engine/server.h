@@ -67,6 +67,7 @@ public:
 	void	CopyPureServerWhitelistToStringTable();
 	void 	RemoveClientFromGame( CBaseClient *client );
 	void	SendClientMessages ( bool bSendSnapshots );
+	void	FinishPipelinedSnapshots();	// fence for sv_pipeline_snapshots, sends what the last tick started
 	void	FinishRestore();
 	void	BroadcastSound( SoundInfo_t &sound, IRecipientFilter &filter );
 	bool	IsLevelMainMenuBackground( void )	{ return m_bIsLevelMainMenuBackground; }
@@ -117,6 +118,8 @@ public:
 
 	bool		m_bLoadedPlugins;
 
+	bool		m_bPipelinedSend;		// snapshot jobs from the last SendClientMessages may still be running
+
 public:
 
 	// New style precache lists are done this way
@@ -631,6 +631,13 @@ bool CGameClient::UpdateAcknowledgedFramecount(int tick)
 		if ( sv_maxreplay.GetFloat() > 0 )
 			removeTick -= (sv_maxreplay.GetFloat() / m_Server->GetTickInterval() ); // keep a replay buffer
 
+		// the pipelined snapshot job still deltas from this frame, free it on a later ack
+		CClientFrame *pPipelinedDeltaFrame = GetPipelinedDeltaFrame();
+		if ( pPipelinedDeltaFrame && pPipelinedDeltaFrame->tick_count < removeTick )
+		{
+			removeTick = pPipelinedDeltaFrame->tick_count;
+		}
+
 		if ( removeTick > 0 )
 		{
 			DeleteClientFrames( removeTick );	
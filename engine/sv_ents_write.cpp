@@ -84,6 +84,163 @@ public:
 };
 
 
+//-----------------------------------------------------------------------------
+// Per-tick cache of entity delta bits shared by all clients of the game server.
+// Clients that acked the same tick delta an entity from the same packed entity,
+// so the prop list only has to be encoded once. Entries are keyed on the from
+// and to packed entities and only used if neither has proxy recipients, since
+// the culled prop list then doesn't depend on the receiving client.
+// Lookups and inserts don't lock, snapshot send threads share the cache.
+//-----------------------------------------------------------------------------
+static ConVar sv_deltacache( "sv_deltacache", "4096", 0, "Size in KB of the per-tick entity delta cache shared by all clients (0 = off)." );
+
+class CSendDeltaCache
+{
+	struct DeltaEntry_t
+	{
+		DeltaEntry_t		*pNext;
+		const PackedEntity	*pFrom;
+		const PackedEntity	*pTo;
+		int					nBits;	// 0 = entity didn't change
+	};
+
+public:
+	CSendDeltaCache();
+	~CSendDeltaCache();
+
+	void NewTick( int nTick );
+	bool IsEnabled() const { return m_nMemorySize > 0; }
+
+	const unsigned char *FindDeltaBits( int nEntityIndex, const PackedEntity *pFrom, const PackedEntity *pTo, int &nBits );
+	void AddDeltaBits( int nEntityIndex, const PackedEntity *pFrom, const PackedEntity *pTo, int nBits, bf_write *pBuffer );
+
+private:
+	DeltaEntry_t * volatile m_pEntries[MAX_EDICTS];
+
+	char			*m_pMemory;		// linear allocator, reset every tick
+	int				m_nMemorySize;
+	volatile int32	m_nMemoryUsed;
+	int				m_nTick;
+
+	CInterlockedInt	m_nHits;
+	CInterlockedInt	m_nMisses;
+};
+
+static CSendDeltaCache g_SendDeltaCache;
+
+CSendDeltaCache::CSendDeltaCache()
+{
+	Q_memset( (void *)m_pEntries, 0, sizeof( m_pEntries ) );
+	m_pMemory = NULL;
+	m_nMemorySize = 0;
+	m_nMemoryUsed = 0;
+	m_nTick = -1;
+}
+
+CSendDeltaCache::~CSendDeltaCache()
+{
+	delete [] m_pMemory;
+}
+
+void CSendDeltaCache::NewTick( int nTick )
+{
+	if ( nTick == m_nTick )
+		return;
+
+	m_nTick = nTick;
+
+	VPROF_INCREMENT_COUNTER( "SV delta cache hits", m_nHits );
+	VPROF_INCREMENT_COUNTER( "SV delta cache misses", m_nMisses );
+	m_nHits = 0;
+	m_nMisses = 0;
+
+	int nMemorySize = MAX( sv_deltacache.GetInt(), 0 ) * 1024;
+	if ( nMemorySize != m_nMemorySize )
+	{
+		delete [] m_pMemory;
+		m_pMemory = nMemorySize ? new char[nMemorySize] : NULL;
+		m_nMemorySize = nMemorySize;
+	}
+	else if ( m_nMemoryUsed == 0 )
+	{
+		return; // nothing was added last tick
+	}
+
+	Q_memset( (void *)m_pEntries, 0, sizeof( m_pEntries ) );
+	m_nMemoryUsed = 0;
+}
+
+const unsigned char *CSendDeltaCache::FindDeltaBits( int nEntityIndex, const PackedEntity *pFrom, const PackedEntity *pTo, int &nBits )
+{
+	Assert( nEntityIndex >= 0 && nEntityIndex < MAX_EDICTS );
+
+	for ( DeltaEntry_t *pEntry = m_pEntries[nEntityIndex]; pEntry; pEntry = pEntry->pNext )
+	{
+		if ( pEntry->pFrom == pFrom && pEntry->pTo == pTo )
+		{
+			++m_nHits;
+			nBits = pEntry->nBits;
+			return (const unsigned char *)( pEntry + 1 );
+		}
+	}
+
+	++m_nMisses;
+	nBits = -1;
+	return NULL;
+}
+
+void CSendDeltaCache::AddDeltaBits( int nEntityIndex, const PackedEntity *pFrom, const PackedEntity *pTo, int nBits, bf_write *pBuffer )
+{
+	Assert( nEntityIndex >= 0 && nEntityIndex < MAX_EDICTS );
+
+	int nEntrySize = sizeof( DeltaEntry_t ) + PAD_NUMBER( Bits2Bytes( nBits ), 4 );
+	int nOffset = ThreadInterlockedExchangeAdd( &m_nMemoryUsed, nEntrySize );
+	if ( nOffset + nEntrySize > m_nMemorySize )
+		return; // cache is full for this tick
+
+	DeltaEntry_t *pEntry = (DeltaEntry_t *)( m_pMemory + nOffset );
+	pEntry->pFrom = pFrom;
+	pEntry->pTo = pTo;
+	pEntry->nBits = nBits;
+
+	if ( nBits > 0 )
+	{
+		bf_read inBuffer;
+		inBuffer.StartReading( pBuffer->GetData(), pBuffer->m_nDataBytes, pBuffer->GetNumBitsWritten() );
+		bf_write outBuffer( pEntry + 1, nEntrySize - sizeof( DeltaEntry_t ) );
+		outBuffer.WriteBitsFromBuffer( &inBuffer, nBits );
+	}
+
+	// publish the entry, other send threads may be pushing to the same slot
+	DeltaEntry_t *pHead;
+	do
+	{
+		pHead = m_pEntries[nEntityIndex];
+		pEntry->pNext = pHead;
+	}
+	while ( ThreadInterlockedCompareExchangePointer( (void * volatile *)&m_pEntries[nEntityIndex], pEntry, pHead ) != pHead );
+}
+
+void SV_ResetDeltaEntityCache( int nTickCount )
+{
+	g_SendDeltaCache.NewTick( nTickCount );
+}
+
+
+// The shared delta cache only applies to game server clients and to entities
+// whose prop list isn't culled per client.
+static inline bool SV_UseSendDeltaCache( CEntityWriteInfo &u )
+{
+	if ( !u.m_bCullProps || !g_SendDeltaCache.IsEnabled() || g_bServerDTIEnabled )
+		return false;
+
+	if ( u.m_pServer->IsHLTV() || u.m_pServer->IsReplay() )
+		return false;
+
+	return u.m_pOldPack->GetNumRecipients() == 0 && u.m_pNewPack->GetNumRecipients() == 0;
+}
+
+
 
 //-----------------------------------------------------------------------------
 // Delta timing helpers.
@@ -533,6 +690,30 @@ static inline void SV_DetermineUpdateType( CEntityWriteInfo &u )
 	}
 #endif
 
+	// other clients that acked the same tick may have encoded this delta already
+	bool bUseDeltaCache = SV_UseSendDeltaCache( u );
+	if ( bUseDeltaCache )
+	{
+		int nCachedBits;
+		const unsigned char *pCachedBits = g_SendDeltaCache.FindDeltaBits( u.m_nNewEntity, u.m_pOldPack, u.m_pNewPack, nCachedBits );
+
+		if ( pCachedBits )
+		{
+			if ( nCachedBits > 0 )
+			{
+				SV_WriteDeltaHeader( u, u.m_nNewEntity, FHDR_ZERO );
+				u.m_pBuf->WriteBits( pCachedBits, nCachedBits );
+				u.m_UpdateType = DeltaEnt;
+			}
+			else
+			{
+				u.m_UpdateType = PreserveEnt;
+			}
+
+			return;
+		}
+	}
+
 	int checkProps[MAX_DATATABLE_PROPS];
 	int nCheckProps = u.m_pNewPack->GetPropsChangedAfterTick( u.m_pFromSnapshot->m_nTickCount, checkProps, ARRAYSIZE( checkProps ) );
 	
@@ -590,7 +771,14 @@ static inline void SV_DetermineUpdateType( CEntityWriteInfo &u )
 #if defined( DEBUG_NETWORKING )
 		int startBit = u.m_pBuf->GetNumBitsWritten();
 #endif
+		bf_write bufStart = *u.m_pBuf;
 		SV_WritePropsFromPackedEntity( u, checkProps, nCheckProps );
+
+		if ( bUseDeltaCache && !u.m_pBuf->IsOverflowed() )
+		{
+			int nBits = u.m_pBuf->GetNumBitsWritten() - bufStart.GetNumBitsWritten();
+			g_SendDeltaCache.AddDeltaBits( u.m_nNewEntity, u.m_pOldPack, u.m_pNewPack, nBits, &bufStart );
+		}
 #if defined( DEBUG_NETWORKING )
 		int endBit = u.m_pBuf->GetNumBitsWritten();
 		TRACE_PACKET( ( "    Delta Bits (%d) = %d (%d bytes)\n", u.m_nNewEntity, (endBit - startBit), ( (endBit - startBit) + 7 ) / 8 ) );
@@ -601,6 +789,12 @@ static inline void SV_DetermineUpdateType( CEntityWriteInfo &u )
 	}
 	else
 	{
+		if ( bUseDeltaCache )
+		{
+			// no bits changed, PreserveEnt
+			g_SendDeltaCache.AddDeltaBits( u.m_nNewEntity, u.m_pOldPack, u.m_pNewPack, 0, NULL );
+		}
+
 #ifndef _X360
 		if ( !u.m_bCullProps )
 		{
@@ -909,8 +1103,10 @@ void CBaseServer::WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CCl
 //	u.m_nTotalGap = 0;
 //	u.m_nTotalGapCount = 0;
 
+	bool bCanUpdateBaselines = client->CanUpdateBaselines();
+
 	// set from_baseline pointer if this snapshot may become a baseline update
-	if ( client->m_nBaselineUpdateTick == -1 )
+	if ( bCanUpdateBaselines && client->m_nBaselineUpdateTick == -1 )
 	{
 		client->m_BaselinesSent.ClearAll();
 		to->from_baseline = &client->m_BaselinesSent;
@@ -1017,7 +1213,7 @@ void CBaseServer::WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CCl
 	savepos.WriteUBitLong( u.m_nHeaderCount, MAX_EDICT_BITS );
 	savepos.WriteUBitLong( length, DELTASIZE_BITS );
 
-	bool bUpdateBaseline = ( (client->m_nBaselineUpdateTick == -1) && 
+	bool bUpdateBaseline = bCanUpdateBaselines && ( (client->m_nBaselineUpdateTick == -1) && 
 		(u.m_nFullProps > 0 || !u.m_bAsDelta) );
 
 	if ( bUpdateBaseline && u.m_pBaseline )
@@ -20,6 +20,13 @@
 DEFINE_FIXEDSIZE_ALLOCATOR( CFrameSnapshot, 64, 64 );
 
 
+static ConVar sv_packedentity_arena( "sv_packedentity_arena", "1", 0, "Pack each tick's entities into shared, reference counted blocks instead of allocating every packed entity separately." );
+
+// Big enough for a typical tick's changed entities, small enough that a block kept alive
+// by a single entity that hasn't changed since doesn't waste much.
+#define PACKED_ENTITY_ARENA_SIZE		( 16 * 1024 )
+#define MAX_FREE_PACKED_ENTITY_ARENAS	64
+
 static ConVar sv_creationtickcheck( "sv_creationtickcheck", "1", FCVAR_CHEAT | FCVAR_DEVELOPMENTONLY, "Do extended check for encoding of timestamps against tickcount" );
 extern	CGlobalVars g_ServerGlobalVariables;
 
@@ -34,7 +41,10 @@ CFrameSnapshotManager::CFrameSnapshotManager( void ) : m_PackedEntitiesPool( MAX
 {
 	COMPILE_TIME_ASSERT( INVALID_PACKED_ENTITY_HANDLE == 0 );
 	Q_memset( m_pPackedData, 0x00, MAX_EDICTS * sizeof(PackedEntityHandle_t) );
-
+	m_bDeferDeletes = false;
+	m_pFreeArenas = NULL;
+	m_nFreeArenas = 0;
+	m_nLiveArenas = 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -46,6 +56,14 @@ CFrameSnapshotManager::~CFrameSnapshotManager( void )
 
 	// TODO: This assert has been failing. HenryG says it's a valid assert and that we're probably leaking memory.
 	AssertMsg1( m_PackedEntitiesPool.Count() == 0 || IsInErrorExit(), "Expected m_PackedEntitiesPool to be empty. It had %i items.", m_PackedEntitiesPool.Count() );
+
+	while ( m_pFreeArenas )
+	{
+		CPackedEntityArena *pArena = m_pFreeArenas;
+		m_pFreeArenas = pArena->m_pNextFree;
+		delete [] pArena->m_pBase;
+		delete pArena;
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -68,13 +86,20 @@ CFrameSnapshot*	CFrameSnapshotManager::NextSnapshot( const CFrameSnapshot *pSnap
 	if ( !pSnapshot || ((unsigned short)pSnapshot->m_ListIndex == m_FrameSnapshots.InvalidIndex()) )
 		return NULL;
 
+	// snapshot send threads may walk the list while another one appends a baseline snapshot
+	m_FrameSnapshotsLock.LockForRead();
+
+	CFrameSnapshot *pNext = NULL;
 	int next = m_FrameSnapshots.Next(pSnapshot->m_ListIndex);
+	if ( next != m_FrameSnapshots.InvalidIndex() )
+	{
+		// return next element in list
+		pNext = m_FrameSnapshots[ next ];
+	}
 
-	if ( next == m_FrameSnapshots.InvalidIndex() )
-		return NULL;
+	m_FrameSnapshotsLock.UnlockRead();
 
-	// return next element in list
-	return m_FrameSnapshots[ next ];
+	return pNext;
 }
 
 CFrameSnapshot*	CFrameSnapshotManager::CreateEmptySnapshot( int tickcount, int maxEntities )
@@ -100,7 +125,10 @@ CFrameSnapshot*	CFrameSnapshotManager::CreateEmptySnapshot( int tickcount, int m
 		entry++;
 	}
 
+	m_FrameSnapshotsLock.LockForWrite();
 	snap->m_ListIndex = m_FrameSnapshots.AddToTail( snap );
+	m_FrameSnapshotsLock.UnlockWrite();
+
 	return snap;
 }
 
@@ -180,6 +208,18 @@ CFrameSnapshot* CFrameSnapshotManager::TakeTickSnapshot( int tickcount )
 //-----------------------------------------------------------------------------
 
 void CFrameSnapshotManager::DeleteFrameSnapshot( CFrameSnapshot* pSnapshot )
+{
+	if ( m_bDeferDeletes )
+	{
+		// other send threads may still be walking past this snapshot, free it in EndParallelSend()
+		m_PendingDeletes.PushItem( pSnapshot );
+		return;
+	}
+
+	FreeFrameSnapshot( pSnapshot );
+}
+
+void CFrameSnapshotManager::FreeFrameSnapshot( CFrameSnapshot* pSnapshot )
 {
 	// Decrement reference counts of all packed entities
 	for (int i = 0; i < pSnapshot->m_nNumEntities; ++i)
@@ -190,10 +230,44 @@ void CFrameSnapshotManager::DeleteFrameSnapshot( CFrameSnapshot* pSnapshot )
 		}
 	}
 
+	// The entities packed into these blocks hold their own references
+	FOR_EACH_VEC( pSnapshot->m_PackedEntityArenas, i )
+	{
+		pSnapshot->m_PackedEntityArenas[i]->ReleaseReference();
+	}
+
+	m_FrameSnapshotsLock.LockForWrite();
 	m_FrameSnapshots.Remove( pSnapshot->m_ListIndex );
+	m_FrameSnapshotsLock.UnlockWrite();
+
 	delete pSnapshot;
 }
 
+void CFrameSnapshotManager::BeginParallelSend()
+{
+	Assert( ThreadInMainThread() );
+	Assert( !m_bDeferDeletes );
+	m_bDeferDeletes = true;
+}
+
+void CFrameSnapshotManager::EndParallelSend()
+{
+	Assert( ThreadInMainThread() );
+	m_bDeferDeletes = false;
+
+	CFrameSnapshot *pSnapshot;
+	while ( m_PendingDeletes.PopItem( &pSnapshot ) )
+	{
+		FreeFrameSnapshot( pSnapshot );
+	}
+
+	PackedEntity *pPackedEntity;
+	while ( m_PendingEntityFrees.PopItem( &pPackedEntity ) )
+	{
+		FreePackedEntity( pPackedEntity );
+	}
+}
+
 void CFrameSnapshotManager::RemoveEntityReference( PackedEntityHandle_t handle )
 {
 	Assert( handle != INVALID_PACKED_ENTITY_HANDLE );
@@ -202,20 +276,32 @@ void CFrameSnapshotManager::RemoveEntityReference( PackedEntityHandle_t handle )
 
 	if ( --packedEntity->m_ReferenceCount <= 0)
 	{
-		AUTO_LOCK( m_WriteMutex );
+		if ( m_bDeferDeletes )
+		{
+			// send threads don't wait on the pool lock, EndParallelSend() frees it
+			m_PendingEntityFrees.PushItem( packedEntity );
+			return;
+		}
+
+		FreePackedEntity( packedEntity );
+	}
+}
+
+void CFrameSnapshotManager::FreePackedEntity( PackedEntity *packedEntity )
+{
+	AUTO_LOCK( m_WriteMutex );
 
-		m_PackedEntitiesPool.Free( packedEntity );
+	m_PackedEntitiesPool.Free( packedEntity );
 
-		// if we have a uncompression cache, remove reference too
-		FOR_EACH_VEC( m_PackedEntityCache, i )
+	// if we have a uncompression cache, remove reference too
+	FOR_EACH_VEC( m_PackedEntityCache, i )
+	{
+		UnpackedDataCache_t &pdc = m_PackedEntityCache[i];
+		if ( pdc.pEntity == packedEntity )
 		{
-			UnpackedDataCache_t &pdc = m_PackedEntityCache[i];
-			if ( pdc.pEntity == packedEntity )
-			{
-				pdc.pEntity = NULL;
-				pdc.counter = 0;
-				break;
-			}
+			pdc.pEntity = NULL;
+			pdc.counter = 0;
+			break;
 		}
 	}
 }
@@ -372,6 +458,111 @@ PackedEntity* CFrameSnapshotManager::GetPackedEntity( CFrameSnapshot* pSnapshot,
 
 
 
+//-----------------------------------------------------------------------------
+// Packed entity arenas
+//-----------------------------------------------------------------------------
+
+CPackedEntityArena *CFrameSnapshotManager::AllocPackedEntityArena()
+{
+	CPackedEntityArena *pArena;
+	{
+		AUTO_LOCK( m_ArenaMutex );
+		++m_nLiveArenas;
+		pArena = m_pFreeArenas;
+		if ( pArena )
+		{
+			m_pFreeArenas = pArena->m_pNextFree;
+			--m_nFreeArenas;
+		}
+	}
+
+	if ( !pArena )
+	{
+		pArena = new CPackedEntityArena;
+		pArena->m_pBase = new unsigned char[PACKED_ENTITY_ARENA_SIZE];
+		pArena->m_nSize = PACKED_ENTITY_ARENA_SIZE;
+	}
+
+	pArena->m_nUsed = 0;
+	pArena->m_nReferences = 1;	// for the snapshot
+	pArena->m_pNextFree = NULL;
+	return pArena;
+}
+
+void CFrameSnapshotManager::FreePackedEntityArena( CPackedEntityArena *pArena )
+{
+	Assert( pArena->m_nReferences == 0 );
+
+	{
+		AUTO_LOCK( m_ArenaMutex );
+		--m_nLiveArenas;
+		if ( m_nFreeArenas < MAX_FREE_PACKED_ENTITY_ARENAS )
+		{
+			pArena->m_pNextFree = m_pFreeArenas;
+			m_pFreeArenas = pArena;
+			++m_nFreeArenas;
+			return;
+		}
+	}
+
+	delete [] pArena->m_pBase;
+	delete pArena;
+}
+
+bool CFrameSnapshotManager::AllocAndCopyPackedData( CFrameSnapshot* pSnapshot, PackedEntity *pPackedEntity, const void *pData, int nBytes )
+{
+	if ( sv_packedentity_arena.GetBool() && PAD_NUMBER( nBytes, 4 ) <= PACKED_ENTITY_ARENA_SIZE )
+	{
+		// Entities are packed in parallel, so whoever finds the block full starts the next one
+		for ( ;; )
+		{
+			CPackedEntityArena *pArena = pSnapshot->m_pPackedEntityArena;
+			if ( pArena && pPackedEntity->CopyPaddedToArena( pData, nBytes, pArena ) )
+				return true;
+
+			AUTO_LOCK( m_WriteMutex );
+			if ( pSnapshot->m_pPackedEntityArena == pArena )
+			{
+				CPackedEntityArena *pNewArena = AllocPackedEntityArena();
+				pSnapshot->m_PackedEntityArenas.AddToTail( pNewArena );
+				pSnapshot->m_pPackedEntityArena = pNewArena;
+			}
+		}
+	}
+
+	return pPackedEntity->AllocAndCopyPadded( pData, nBytes );
+}
+
+void CFrameSnapshotManager::PrintPackedEntityArenaStats()
+{
+	int nLiveArenas, nFreeArenas;
+	{
+		AUTO_LOCK( m_ArenaMutex );
+		nLiveArenas = m_nLiveArenas;
+		nFreeArenas = m_nFreeArenas;
+	}
+
+	ConMsg( "Packed entity arenas: %d in use (%d KB), %d free (%d KB), %d packed entities\n",
+		nLiveArenas, nLiveArenas * PACKED_ENTITY_ARENA_SIZE / 1024,
+		nFreeArenas, nFreeArenas * PACKED_ENTITY_ARENA_SIZE / 1024,
+		m_PackedEntitiesPool.Count() );
+}
+
+CON_COMMAND( sv_packedentity_arena_stats, "Shows how many packed entity arena blocks are in use." )
+{
+	framesnapshotmanager->PrintPackedEntityArenaStats();
+}
+
+void CPackedEntityArena::ReleaseReference()
+{
+	Assert( m_nReferences > 0 );
+	if ( --m_nReferences == 0 )
+	{
+		g_FrameSnapshotManager.FreePackedEntityArena( this );
+	}
+}
+
+
 // ------------------------------------------------------------------------------------------------ //
 // purpose: lookup cache if we have an uncompressed version of this packed entity
 // ------------------------------------------------------------------------------------------------ //
@@ -493,8 +684,8 @@ void CFrameSnapshot::ReleaseReference()
 {
 	Assert( m_nReferences > 0 );
 
-	--m_nReferences;
-	if ( m_nReferences == 0 )
+	// decrement and test as one operation, the snapshot may be shared by several send threads
+	if ( --m_nReferences == 0 )
 	{
 		g_FrameSnapshotManager.DeleteFrameSnapshot( this );
 	}
@@ -7,22 +7,59 @@
 #include "sv_ipratelimit.h"
 #include "filesystem.h"
 #include "sv_log.h"
+#include "tier0/threadtools.h"
+#include "tier1/utlrbtree.h"
+#include "tier1/utlvector.h"
+#include "icvar.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
 
 static ConVar	sv_logblocks("sv_logblocks", "0", 0, "If true when log when a query is blocked (can cause very large log files)");
 
+static inline int64 MakeEntry( uint32 ip, uint32 clock, uint32 tokens )
+{
+	return (int64)( ( (uint64)ip << 32 ) | ( ( clock & 0xffff ) << 16 ) | MIN( tokens, 0xffffu ) );
+}
+
+static inline uint32 EntryIP( int64 entry )		{ return (uint32)( (uint64)entry >> 32 ); }
+static inline uint32 EntryClock( int64 entry )	{ return (uint32)( (uint64)entry >> 16 ) & 0xffff; }
+static inline uint32 EntryTokens( int64 entry )	{ return (uint32)entry & 0xffff; }
+
+// Clock ticks since an update. Another thread may have stored a clock later than
+// this thread's curTime, that counts as no time rather than wrapping around.
+static inline uint32 EntryAge( uint32 curTime, int64 entry )	{ return (uint32)MAX( (int)(int16)( curTime - EntryClock( entry ) ), 0 ); }
+static inline uint32 ClockElapsed( uint32 curTime, uint32 clock )	{ return (uint32)MAX( (int32)( curTime - clock ), 0 ); }
+
+//-----------------------------------------------------------------------------
+// Purpose: adds the tokens earned in nElapsed clock ticks. Only the ticks that
+//			turned into whole tokens are used up, the rest count towards the next one.
+//-----------------------------------------------------------------------------
+static uint32 RefillTokens( uint32 nTokens, uint32 nElapsed, double flRate, uint32 nCapacity, uint32 *pUsedTicks )
+{
+	double flEarned = nElapsed * flRate;
+	if ( nTokens + flEarned >= nCapacity )
+	{
+		*pUsedTicks = nElapsed;
+		return MAX( nTokens, nCapacity );
+	}
+
+	uint32 nEarned = (uint32)flEarned;
+	*pUsedTicks = ( flRate > 0 ) ? MIN( (uint32)( nEarned / flRate ), nElapsed ) : nElapsed;
+	return nTokens + nEarned;
+}
 
 //-----------------------------------------------------------------------------
 // Purpose: Constructor
 //-----------------------------------------------------------------------------
 CIPRateLimit::CIPRateLimit(ConVar *maxSec, ConVar *maxWindow, ConVar *maxSecGlobal)
-:	m_IPTree( 0, START_TREE_SIZE, LessIP),
-	m_maxSec( maxSec ),
+:	m_maxSec( maxSec ),
 	m_maxWindow( maxWindow ),
 	m_maxSecGlobal( maxSecGlobal )
 {
-	m_iGlobalCount = 0;
-	m_lLastTime = -1;
-	m_flFlushTime = 0;
+	Q_memset( m_Buckets, 0, sizeof( m_Buckets ) );
+	m_nGlobal = 0;
+	m_nWheelTime = 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -32,21 +69,13 @@ CIPRateLimit::~CIPRateLimit()
 {
 }
 
-//-----------------------------------------------------------------------------
-// Purpose: sort func for rb tree
-//-----------------------------------------------------------------------------
-bool CIPRateLimit::LessIP( const struct CIPRateLimit::iprate_s &lhs, const struct CIPRateLimit::iprate_s &rhs )
-{
-	return ( lhs.ip < rhs.ip );
-}
-
 //-----------------------------------------------------------------------------
 // Purpose: return false and potentially log a warning if this IP has exceeded limits
 //-----------------------------------------------------------------------------
 bool CIPRateLimit::CheckIP( netadr_t adr )
 {
 	bool ret = CheckIPInternal(adr);
-	if ( !ret && sv_logblocks.GetBool() == true )
+	if ( !ret && sv_logblocks.GetBool() == true && ThreadInMainThread() )
 	{
 		g_Log.Printf("Traffic from %s was blocked for exceeding rate limits\n", adr.ToString() );
 	}
@@ -58,82 +87,298 @@ bool CIPRateLimit::CheckIP( netadr_t adr )
 //-----------------------------------------------------------------------------
 bool CIPRateLimit::CheckIPInternal( netadr_t adr )
 {
-	// check the global count first in case we are being spammed
-	m_iGlobalCount++;
-	long curTime = (long)Plat_FloatTime();
+	uint32 curTime = (uint32)( Plat_FloatTime() * CLOCK_RATE );
+	ExpireEntries( curTime );
 
-	if( (curTime - m_lLastTime) > m_maxWindow->GetFloat() )
-	{
-		m_lLastTime = curTime;
-		m_iGlobalCount = 1;
-	}
+	uint32 clientIP;
+	memcpy( &clientIP, adr.ip, sizeof(clientIP) );
 
-	float query_rate = static_cast<float>( m_iGlobalCount ) / m_maxWindow->GetFloat(); // add one so the bottom is never zero
-	if( m_maxSecGlobal->GetFloat() > FLT_EPSILON && query_rate > m_maxSecGlobal->GetFloat() ) 
-	{
-		return false;
-	}
+	// 0.0.0.0 marks free slots, only bots with sv_stressbots use it
+	if ( !clientIP )
+		return CheckGlobal( curTime );
 
-	
-	// check the per ip rate (do this first, so one person dosing doesn't add to the global max rate
-	ip_t clientIP;
-	memcpy( &clientIP, adr.ip, sizeof(ip_t) );
+	float flMaxSec = MAX( m_maxSec->GetFloat(), 0.0f );
+	double flRate = (double)flMaxSec * TOKEN_UNIT / CLOCK_RATE;
+	uint32 nCapacity = (uint32)clamp( (double)flMaxSec * m_maxWindow->GetFloat() * TOKEN_UNIT, (double)TOKEN_UNIT, (double)( MAX_BURST * TOKEN_UNIT ) );
 
-	if( m_IPTree.Count() > MAX_TREE_SIZE && curTime > ( m_flFlushTime + FLUSH_TIMEOUT/4 ) ) // if we have stored too many items
+	volatile iprate_t *pSlots = m_Buckets[ ( ( clientIP * 2654435761u ) >> 16 ) & ( NUM_BUCKETS - 1 ) ].slots;
+
+	// check the per ip rate first, so one person dosing doesn't add to the global max rate
+	for ( int nTries = 0; nTries < 4; nTries++ )
 	{
-		m_flFlushTime = curTime;
-		ip_t tmp = m_IPTree.LastInorder(); // we step BACKWARD's through the tree
-		int i = m_IPTree.FirstInorder();
-		while( (m_IPTree.Count() > (2*MAX_TREE_SIZE)/3) && i < m_IPTree.MaxElement() ) // trim 1/3 the entries from the tree and only traverse the max nodes
-		{ 	
-			if ( !m_IPTree.IsValidIndex( tmp ) )
+		iprate_t entry = 0;
+		int iSlot = -1;
+
+		// otherwise the ip goes to a free slot or the one that was updated longest ago
+		iprate_t victim = 0;
+		int iVictim = -1;
+		uint32 nVictimAge = 0;
+
+		for ( int i = 0; i < BUCKET_SLOTS; i++ )
+		{
+			iprate_t slot = pSlots[i];
+			if ( slot && EntryIP( slot ) == clientIP )
+			{
+				entry = slot;
+				iSlot = i;
 				break;
+			}
+
+			uint32 nAge = slot ? EntryAge( curTime, slot ) : 0x10000;
+			if ( iVictim < 0 || nAge > nVictimAge )
+			{
+				victim = slot;
+				iVictim = i;
+				nVictimAge = nAge;
+			}
+		}
+
+		bool bAllowed = true;
+		iprate_t newEntry;
+
+		if ( iSlot < 0 )
+		{
+			// not found, insert this new guy
+			entry = victim;
+			iSlot = iVictim;
+			newEntry = MakeEntry( clientIP, curTime, nCapacity - TOKEN_UNIT );
+		}
+		else
+		{
+			uint32 nElapsed = EntryAge( curTime, entry );
+			uint32 nClock = curTime;
+			uint32 nTokens = nCapacity;
+
+			if ( nElapsed <= FLUSH_TIMEOUT * CLOCK_RATE )
+			{
+				uint32 nUsed;
+				nTokens = RefillTokens( EntryTokens( entry ), nElapsed, flRate, nCapacity, &nUsed );
+				nClock = EntryClock( entry ) + nUsed;
+			}
 
-			if ( (curTime - m_IPTree[ tmp ].lastTime) > FLUSH_TIMEOUT  &&
-			      m_IPTree[ tmp ].ip != clientIP ) 
+			bAllowed = nTokens >= TOKEN_UNIT;
+			if ( bAllowed )
 			{
-				ip_t removeIPT = tmp;
-				tmp = m_IPTree.PrevInorder( tmp );
-				m_IPTree.RemoveAt( removeIPT );
-				continue;
+				nTokens -= TOKEN_UNIT;
 			}
-			i++;
-			tmp = m_IPTree.PrevInorder( tmp );
+
+			newEntry = MakeEntry( clientIP, nClock, nTokens );
 		}
+
+		if ( newEntry == entry || ThreadInterlockedAssignIf64( &pSlots[iSlot], newEntry, entry ) )
+			return bAllowed && CheckGlobal( curTime );
 	}
 
-	// now find the entry and check if its within our rate limits
-	struct iprate_s findEntry = { clientIP };
-	ip_t entry = m_IPTree.Find( findEntry );
+	// other threads kept changing this bucket, don't spin on it
+	return CheckGlobal( curTime );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: return false if all ips together have exceeded the global limit
+//-----------------------------------------------------------------------------
+bool CIPRateLimit::CheckGlobal( uint32 curTime )
+{
+	float flMaxSec = m_maxSecGlobal->GetFloat();
+	if ( flMaxSec <= FLT_EPSILON )
+		return true;
+
+	double flRate = (double)flMaxSec * TOKEN_UNIT / CLOCK_RATE;
+	uint32 nCapacity = (uint32)clamp( (double)flMaxSec * m_maxWindow->GetFloat() * TOKEN_UNIT, (double)TOKEN_UNIT, (double)0xffffffffu );
 
-	if( m_IPTree.IsValidIndex( entry ) )
+	for ( ;; )
 	{
-		m_IPTree[ entry ].count++; // a new hit
+		int64 nOld = m_nGlobal;
+		uint32 nClock = nOld ? (uint32)( (uint64)nOld >> 32 ) : curTime;
+		uint32 nTokens = nOld ? (uint32)nOld : nCapacity;
+
+		uint32 nUsed;
+		nTokens = RefillTokens( nTokens, ClockElapsed( curTime, nClock ), flRate, nCapacity, &nUsed );
+		nClock += nUsed;
 
-		if( (curTime - m_IPTree[ entry ].lastTime) > m_maxWindow->GetFloat() )
+		bool bAllowed = nTokens >= TOKEN_UNIT;
+		if ( bAllowed )
 		{
-			m_IPTree[ entry ].lastTime = curTime;
-			m_IPTree[ entry ].count = 1;
+			nTokens -= TOKEN_UNIT;
 		}
-		else
+
+		int64 nNew = (int64)( ( (uint64)nClock << 32 ) | nTokens );
+		if ( nNew == nOld || ThreadInterlockedAssignIf64( &m_nGlobal, nNew, nOld ) )
+			return bAllowed;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: the first check in every second frees the entries of the ips that
+//			stopped sending in the buckets of that second's wheel step
+//-----------------------------------------------------------------------------
+void CIPRateLimit::ExpireEntries( uint32 curTime )
+{
+	uint32 nSecond = curTime / CLOCK_RATE;
+	uint32 nLastSecond = m_nWheelTime;
+	if ( nSecond == nLastSecond || !m_nWheelTime.AssignIf( nLastSecond, nSecond ) )
+		return;
+
+	// the 16 bit clocks can't tell how old entries are after this long, but they all expired
+	bool bExpireAll = ( nSecond - nLastSecond ) >= 0x10000 / CLOCK_RATE;
+	uint32 nSteps = MIN( nSecond - nLastSecond, (uint32)WHEEL_STEPS );
+
+	const int nBucketsPerStep = NUM_BUCKETS / WHEEL_STEPS;
+	for ( uint32 nStep = nSecond - nSteps + 1; nStep != nSecond + 1; nStep++ )
+	{
+		iprbucket_t *pBucket = &m_Buckets[ ( nStep % WHEEL_STEPS ) * nBucketsPerStep ];
+		for ( int i = 0; i < nBucketsPerStep; i++, pBucket++ )
 		{
-			float flQueryRate = static_cast<float>( m_IPTree[ entry ].count) / m_maxWindow->GetFloat(); // add one so the bottom is never zero
-			if( flQueryRate > m_maxSec->GetFloat() )
+			for ( int j = 0; j < BUCKET_SLOTS; j++ )
 			{
-				return false;
+				iprate_t entry = pBucket->slots[j];
+				if ( entry && ( bExpireAll || EntryAge( curTime, entry ) > FLUSH_TIMEOUT * CLOCK_RATE ) )
+				{
+					ThreadInterlockedAssignIf64( &pBucket->slots[j], 0, entry );
+				}
 			}
 		}
 	}
-	else
-	{	
-		// not found, insert this new guy
-		struct iprate_s newEntry;
-		newEntry.count = 1;
-		newEntry.lastTime = curTime;
-		newEntry.ip = clientIP;
-		m_IPTree.Insert( newEntry );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The limiter this one replaced: a tree of per ip counts reset every
+//			window, for sv_ipratelimit_bench
+//-----------------------------------------------------------------------------
+struct benchiprate_t
+{
+	uint32 ip;
+	long lastTime;
+	int count;
+};
+
+static bool BenchLessIP( const benchiprate_t &lhs, const benchiprate_t &rhs )
+{
+	return lhs.ip < rhs.ip;
+}
+
+static bool BenchTreeCheckIP( CUtlRBTree< benchiprate_t, int > &tree, uint32 ip, float flMaxSec, float flWindow )
+{
+	long curTime = (long)Plat_FloatTime();
+
+	benchiprate_t findEntry = { ip };
+	int entry = tree.Find( findEntry );
+	if ( !tree.IsValidIndex( entry ) )
+	{
+		benchiprate_t newEntry = { ip, curTime, 1 };
+		tree.Insert( newEntry );
+		return true;
+	}
+
+	tree[entry].count++;
+	if ( ( curTime - tree[entry].lastTime ) > flWindow )
+	{
+		tree[entry].lastTime = curTime;
+		tree[entry].count = 1;
+		return true;
+	}
+
+	return tree[entry].count / flWindow <= flMaxSec;
+}
+
+struct ipratebenchthread_t
+{
+	CIPRateLimit	*pLimit;
+	const uint32	*pIPs;
+	int				nCount;
+	int				nAllowed;
+};
+
+static uintp IPRateBenchThread( void *pParam )
+{
+	ipratebenchthread_t *pThread = (ipratebenchthread_t *)pParam;
+
+	netadr_t adr;
+	for ( int i = 0; i < pThread->nCount; i++ )
+	{
+		adr.SetIP( pThread->pIPs[i] );
+		pThread->nAllowed += pThread->pLimit->CheckIP( adr );
+	}
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Replays a query flood, spoofed sources mixed with a few reflectors
+//			that keep sending, through the limiter with the sv_max_queries
+//			settings on one and on several threads, and through the old tree.
+//-----------------------------------------------------------------------------
+CON_COMMAND( sv_ipratelimit_bench, "Time the query rate limiter against a flood of spoofed and repeating sources. Usage: sv_ipratelimit_bench [packets] [threads]" )
+{
+	int nPackets = ( args.ArgC() > 1 ) ? clamp( atoi( args[1] ), 1000, 100000000 ) : 4000000;
+	int nThreads = ( args.ArgC() > 2 ) ? clamp( atoi( args[2] ), 1, 32 ) : clamp( (int)GetCPUInformation()->m_nLogicalProcessors, 1, 8 );
+
+	ConVar *pMaxSec = g_pCVar->FindVar( "sv_max_queries_sec" );
+	ConVar *pMaxWindow = g_pCVar->FindVar( "sv_max_queries_window" );
+	ConVar *pMaxSecGlobal = g_pCVar->FindVar( "sv_max_queries_sec_global" );
+	if ( !pMaxSec || !pMaxWindow || !pMaxSecGlobal )
+		return;
+
+	// a quarter of the packets come from 256 reflectors, the rest from random addresses
+	const int nReflectors = 256;
+	CUtlVector< uint32 > ips;
+	ips.SetCount( nPackets );
+	unsigned int nSeed = 1;
+	for ( int i = 0; i < nPackets; i++ )
+	{
+		nSeed = nSeed * 1103515245 + 12345;
+		ips[i] = ( ( nSeed >> 16 ) & 3 ) ? ( nSeed | 1 ) : 0x0a000000 + ( ( nSeed >> 8 ) % nReflectors ) + 1;
+	}
+
+	double flStart = Plat_FloatTime();
+	int nTreeAllowed = 0;
+	{
+		CUtlRBTree< benchiprate_t, int > tree( 0, 2048, BenchLessIP );
+		for ( int i = 0; i < nPackets; i++ )
+		{
+			nTreeAllowed += BenchTreeCheckIP( tree, ips[i], pMaxSec->GetFloat(), pMaxWindow->GetFloat() );
+		}
 	}
+	double flTree = Plat_FloatTime() - flStart;
+
+	double flHashed[2];
+	int nHashedAllowed[2];
+	int nRunThreads[2] = { 1, nThreads };
+	for ( int iRun = 0; iRun < 2; iRun++ )
+	{
+		// operator new doesn't honor the buckets' cache line alignment before C++17
+		CIPRateLimit *pLimit = (CIPRateLimit *)MemAlloc_AllocAligned( sizeof( CIPRateLimit ), 64 );
+		Construct( pLimit, pMaxSec, pMaxWindow, pMaxSecGlobal );
+
+		ipratebenchthread_t threads[32];
+		ThreadHandle_t handles[32];
+		int nPerThread = nPackets / nRunThreads[iRun];
 
+		flStart = Plat_FloatTime();
+		for ( int i = 0; i < nRunThreads[iRun]; i++ )
+		{
+			threads[i].pLimit = pLimit;
+			threads[i].pIPs = ips.Base() + i * nPerThread;
+			threads[i].nCount = ( i == nRunThreads[iRun] - 1 ) ? nPackets - i * nPerThread : nPerThread;
+			threads[i].nAllowed = 0;
+			handles[i] = CreateSimpleThread( IPRateBenchThread, &threads[i] );
+		}
+
+		nHashedAllowed[iRun] = 0;
+		for ( int i = 0; i < nRunThreads[iRun]; i++ )
+		{
+			ThreadJoin( handles[i] );
+			ReleaseThreadHandle( handles[i] );
+			nHashedAllowed[iRun] += threads[i].nAllowed;
+		}
+		flHashed[iRun] = Plat_FloatTime() - flStart;
+
+		Destruct( pLimit );
+		MemAlloc_FreeAligned( pLimit );
+	}
 
-	return true;
+	ConMsg( "%d packets: tree %.1f ns/packet (%d allowed, no global limit), hashed %.1f ns/packet (%d allowed), hashed on %d threads %.1f ns/packet wall (%d allowed)\n",
+		nPackets,
+		flTree * 1e9 / nPackets, nTreeAllowed,
+		flHashed[0] * 1e9 / nPackets, nHashedAllowed[0],
+		nThreads, flHashed[1] * 1e9 / nPackets, nHashedAllowed[1] );
 }
@@ -11,10 +11,17 @@
 #endif
 
 #include "netadr.h"
-#include "sv_ipratelimit.h"
 #include "convar.h"
-#include "utlrbtree.h"
+#include "proto_oob.h"
 
+//-----------------------------------------------------------------------------
+// A token bucket per source ip in a fixed size hash table. Every ip may send
+// maxSec packets a second on average and bursts of up to maxSec * maxWindow,
+// at most MAX_BURST packets since an entry holds 16 bits of 1/64th tokens.
+// Entries are single 64 bit words updated with compare and swap, so any thread
+// may check an ip without a lock. Ips that stopped sending are cleared by a time
+// wheel that sweeps a few buckets every second.
+//-----------------------------------------------------------------------------
 class CIPRateLimit
 {
 public:
@@ -26,30 +33,46 @@ public:
 
 private:
 	bool CheckIPInternal( netadr_t ip );
+	bool CheckGlobal( uint32 curTime );
+	void ExpireEntries( uint32 curTime );
 
-	enum { MAX_TREE_SIZE = 32768, START_TREE_SIZE = 2048, FLUSH_TIMEOUT = 120 };
-
-	typedef int ip_t;
-	struct iprate_s
+	enum
 	{
-		ip_t ip;
-		long lastTime;
-		int count;
+		NUM_BUCKETS = 4096,			// power of two
+		BUCKET_SLOTS = 8,			// a bucket fills a cache line
+		FLUSH_TIMEOUT = 120,		// seconds after which an ip's entry may be reused
+		WHEEL_STEPS = 128,			// the wheel sweeps NUM_BUCKETS / WHEEL_STEPS buckets a second
+		CLOCK_RATE = 16,			// clock ticks a second
+		TOKEN_UNIT = 64,			// tokens are stored in 1/64ths
+		MAX_BURST = 0xffff / TOKEN_UNIT,	// packets an ip's bucket holds at most
 	};
 
-	static bool LessIP( const struct CIPRateLimit::iprate_s &lhs, const struct CIPRateLimit::iprate_s &rhs );
+	// ip in the upper 32 bits, then the 16 bit clock of the last update and the tokens left
+	typedef int64 iprate_t;
+
+	struct iprbucket_t
+	{
+		volatile iprate_t	slots[BUCKET_SLOTS];
+	} DECL_ALIGN(64);
+
+	iprbucket_t m_Buckets[NUM_BUCKETS];
 
-	CUtlRBTree< struct iprate_s, ip_t > m_IPTree;
-	int m_iGlobalCount;
-	long m_lLastTime;
-	double m_flFlushTime;
+	volatile int64 m_nGlobal;			// clock in the upper 32 bits, tokens in the lower 32 bits
+	CInterlockedUInt m_nWheelTime;		// second the wheel swept last
 
 	ConVar *m_maxSec;
 	ConVar *m_maxWindow;
 	ConVar *m_maxSecGlobal;
 };
 
-// returns false if this IP exceeds rate limits
+// Query types the network layer checks against the query rate limit as they are
+// received, before the datagram is copied for the main thread
+inline bool IsRateLimitedOnReceive( int type )
+{
+	return type == A2S_INFO || type == A2S_PLAYER || type == A2S_RULES;
+}
+
+// returns false if this IP exceeds rate limits, any thread
 bool CheckConnectionLessRateLimits( netadr_t & adr );
 
 #endif // SVIPRATELIMIT_H
@@ -73,6 +73,8 @@
 #include "host_state.h"
 #include "voice.h"
 #include "cbenchmark.h"
+#include "sv_tickmetrics.h"
+#include "dt_instrumentation_server.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -787,6 +789,9 @@ void SV_InitSendTables( ServerClass *pClasses )
 	int nTables = SV_BuildSendTablesArray( pClasses, pTables, ARRAYSIZE( pTables ) );
 
 	SendTable_Init( pTables, nTables );
+
+	// Only the V1 proxies are used, which every server DLL version provides.
+	SendTable_BuildEncodePrograms( serverGameDLL->GetStandardSendProxies() );
 }
 
 
@@ -1053,6 +1058,8 @@ bool CGameServer::IsPausable( void ) const
 
 void CGameServer::Shutdown( void )
 {
+	FinishPipelinedSnapshots();
+
 	m_bIsLevelMainMenuBackground = false;
 
 	CBaseServer::Shutdown();
@@ -1293,6 +1300,7 @@ CGameServer::CGameServer()
 	m_pPureServerWhitelist = NULL;
 	m_bHibernating = false;
 	m_bLoadedPlugins = false;
+	m_bPipelinedSend = false;
 	V_memset( m_szMapname, 0, sizeof( m_szMapname ) );
 	V_memset( m_szMapFilename, 0, sizeof( m_szMapFilename ) );
 }
@@ -1818,41 +1826,97 @@ void CGameServer::CopyTempEntities( CFrameSnapshot* pSnapshot )
 	}
 }
 
-// If enabled, random crashes start to appear in WriteTempEntities, etc. It looks like
-// one thread can be in WriteDeltaEntities while another is in WriteTempEntities, and both are
-// partying on g_FrameSnapshotManager.m_FrameSnapshots. Bruce sent e-mail from a customer
-// that stated these crashes don't occur when parallel_sendsnapshot is disabled. Zoid said:
-//
-//   Easiest is just turn off parallel snapshots, it's not much of a win on servers where we
-//   are running many instances anyway. It's off in Dota and CSGO dedicated servers.
-//
-// Bruce also had a patch to disable this in //ValveGames/staging/game/tf/cfg/unencrypted/print_instance_config.py
-static ConVar sv_parallel_sendsnapshot( "sv_parallel_sendsnapshot", "0" );
+// Snapshots for regular clients are written on the job thread pool. This used to crash in
+// WriteTempEntities while another thread was in WriteDeltaEntities, because both were walking
+// g_FrameSnapshotManager.m_FrameSnapshots while a released snapshot was removed from it. The
+// snapshot manager now defers those frees, and the frees of packed entities, until the send is
+// done (see BeginParallelSend), failed clients are dropped on the main thread afterwards and
+// HLTV / Replay frame capture happens on the main thread before the workers start. It stays
+// off until sv_parallel_sendsnapshot_bench shows it paying off on a full server of bots.
+static ConVar sv_parallel_sendsnapshot( "sv_parallel_sendsnapshot", "0", 0, "Write and send client snapshots in parallel on the job thread pool." );
 
-static void SV_ParallelSendSnapshot( CGameClient *& pClient )
+static inline bool SV_IsMainThreadSnapshotClient( CGameClient *pClient )
 {
-	// HLTV and replay clients must be handled on the main thread
-	// because they access and modify global state. Skip them.
+	// HLTV and replay clients hand their frame to the proxy server, which is global state
 	if ( pClient->IsHLTV() )
-		return;
+		return true;
 #if defined( REPLAY_ENABLED )
 	if ( pClient->IsReplay() )
-		return;
+		return true;
 #endif
+	return false;
+}
+
+static void SV_SendClientSnapshot( CGameClient *pClient )
+{
 	CClientFrame *pFrame = pClient->GetSendFrame();
 	if ( pFrame )
 	{
 		pClient->SendSnapshot( pFrame );
 		pClient->UpdateSendState();
 	}
-	// Replace this parallel processing array entry with NULL so
-	// that the calling code knows that this entry was handled.
-	pClient = NULL;
+}
+
+static void SV_ParallelSendSnapshot( CGameClient *& pClient )
+{
+	SV_SendClientSnapshot( pClient );
+}
+
+// Pipelined mode: the entity updates for tick N are written on the job thread pool while the
+// game simulates tick N+1 and are sent at the start of the next SendClientMessages. Packing
+// stays on the main thread since it calls into the game DLL, and string table updates are
+// written before the jobs start because the game changes the tables while it simulates.
+// Packets and acks are processed while the jobs run: only baseline acks, full update requests
+// and resets wait for the client's job, and the frame it deltas from is kept until a later ack.
+static ConVar sv_pipeline_snapshots( "sv_pipeline_snapshots", "0", 0, "Write client snapshots on the job thread pool while the next tick is simulated. Adds one tick of latency." );
+
+static void SV_StartPipelinedSnapshot( CGameClient *pClient )
+{
+	CClientFrame *pFrame = pClient->GetSendFrame();
+	if ( !pFrame )
+		return;
+
+	if ( pClient->CanPipelineSnapshot( pFrame ) )
+	{
+		pClient->WriteViewAngleUpdate();
+		pClient->StartPipelinedSnapshot( pFrame );
+	}
+	else
+	{
+		pClient->SendSnapshot( pFrame );
+	}
+
+	pClient->UpdateSendState();
+}
+
+void CGameServer::FinishPipelinedSnapshots()
+{
+	if ( !m_bPipelinedSend )
+		return;
+
+	VPROF_BUDGET( "FinishPipelinedSnapshots", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+
+	m_bPipelinedSend = false;
+
+	for ( int i = 0; i < GetClientCount(); ++i )
+	{
+		Client( i )->WaitForPipelinedSnapshot();
+	}
+
+	framesnapshotmanager->EndParallelSend();
+
+	for ( int i = 0; i < GetClientCount(); ++i )
+	{
+		Client( i )->FinishPipelinedSnapshot();
+	}
 }
 
 void CGameServer::SendClientMessages ( bool bSendSnapshots )
 {
 	VPROF_BUDGET( "SendClientMessages", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+
+	// send the snapshots the last call left to the job threads
+	FinishPipelinedSnapshots();
 	
 	// build individual updates
 	int receivingClientCount = 0;
@@ -1902,27 +1966,70 @@ void CGameServer::SendClientMessages ( bool bSendSnapshots )
 		// copy temp ents references to pSnapshot
 		CopyTempEntities( pSnapshot );
 
+		// entity deltas encoded for one client this tick are reused by all others
+		SV_ResetDeltaEntityCache( pSnapshot->m_nTickCount );
+
 		// Compute the client packs
-		SV_ComputeClientPacks( receivingClientCount, pReceivingClients, pSnapshot );
+		{
+			CTimeAdder metricsTimer( TickMetrics_GetTimer( TICKMETRICS_PACKS ) );
+			SV_ComputeClientPacks( receivingClientCount, pReceivingClients, pSnapshot );
+		}
 
-		if ( receivingClientCount > 1 && sv_parallel_sendsnapshot.GetBool() )
+		if ( sv_pipeline_snapshots.GetBool() )
 		{
-			// SV_ParallelSendSnapshot will not process HLTV or Replay clients as they
-			// must be run on the main thread due to un-threadsafe global state access.
-			// It will replace anything that it does process with a NULL pointer.
-			ParallelProcess( "SV_ParallelSendSnapshot", pReceivingClients, receivingClientCount, &SV_ParallelSendSnapshot );
+			// HLTV and Replay first, they still send right away
+			for (int i = 0; i < receivingClientCount; ++i)
+			{
+				if ( SV_IsMainThreadSnapshotClient( pReceivingClients[i] ) )
+				{
+					SV_SendClientSnapshot( pReceivingClients[i] );
+				}
+			}
+
+			framesnapshotmanager->BeginParallelSend();
+			m_bPipelinedSend = true;
+
+			for (int i = 0; i < receivingClientCount; ++i)
+			{
+				if ( !SV_IsMainThreadSnapshotClient( pReceivingClients[i] ) )
+				{
+					SV_StartPipelinedSnapshot( pReceivingClients[i] );
+				}
+			}
 		}
-		
-		for (int i = 0; i < receivingClientCount; ++i)
+		else if ( receivingClientCount > 1 && sv_parallel_sendsnapshot.GetBool() && !g_bServerDTIEnabled )
 		{
-			CGameClient *pClient = pReceivingClients[i];
-			if ( !pClient )
-				continue;
-			CClientFrame *pFrame = pClient->GetSendFrame();
-			if ( !pFrame )
-				continue;
-			pClient->SendSnapshot( pFrame );
-			pClient->UpdateSendState();
+			// Capture HLTV and Replay frames first, then hand the remaining clients to the job threads
+			int nParallelClients = 0;
+			CGameClient *pParallelClients[ABSOLUTE_PLAYER_LIMIT];
+			for (int i = 0; i < receivingClientCount; ++i)
+			{
+				CGameClient *pClient = pReceivingClients[i];
+				if ( SV_IsMainThreadSnapshotClient( pClient ) )
+				{
+					SV_SendClientSnapshot( pClient );
+				}
+				else
+				{
+					pParallelClients[nParallelClients++] = pClient;
+				}
+			}
+
+			framesnapshotmanager->BeginParallelSend();
+			ParallelProcess( "SV_ParallelSendSnapshot", pParallelClients, nParallelClients, &SV_ParallelSendSnapshot );
+			framesnapshotmanager->EndParallelSend();
+
+			for (int i = 0; i < nParallelClients; ++i)
+			{
+				pParallelClients[i]->FlushPendingDisconnect();
+			}
+		}
+		else
+		{
+			for (int i = 0; i < receivingClientCount; ++i)
+			{
+				SV_SendClientSnapshot( pReceivingClients[i] );
+			}
 		}
 	
 		pSnapshot->ReleaseReference();
@@ -2394,6 +2501,8 @@ bool CGameServer::SpawnServer( const char *szMapName, const char *szMapFile, con
 
 	Assert( serverGameClients );
 
+	FinishPipelinedSnapshots();
+
 	if ( CommandLine()->FindParm( "-NoLoadPluginsForClient" ) != 0 )
 	{
 		if ( !m_bLoadedPlugins )
@@ -2812,6 +2921,7 @@ void SV_Think( bool bIsSimulating )
 {
 	VPROF( "SV_Physics" );
 	tmZone( TELEMETRY_LEVEL1, TMZF_NONE, "SV_Think(%s)", bIsSimulating ? "simulating" : "not simulating" );
+	CTimeAdder metricsTimer( TickMetrics_GetTimer( TICKMETRICS_THINK ) );
 	
 // @FD The staging branch already did away with "frames" and wakes on tick
 // optimally.  Currently the hibernating flag essentially means "is empty
@@ -2892,6 +3002,81 @@ void SV_FrameExecuteThreadDeferred()
 	}
 }
 
+//-----------------------------------------------------------------------------
+// sv_parallel_sendsnapshot_bench times SendClientMessages with the parallel send
+// off and on. The modes take turns every SENDBENCH_BLOCK snapshot ticks so both
+// see the same game, and the first tick after a switch isn't counted.
+//-----------------------------------------------------------------------------
+#define SENDBENCH_BLOCK		32
+
+static int		s_nSendBenchTicks;			// snapshot ticks left, 0 if no bench is running
+static int		s_nSendBenchTick;
+static bool		s_bSendBenchRestore;
+static double	s_flSendBenchTime[2];
+static int		s_nSendBenchSamples[2];
+
+CON_COMMAND( sv_parallel_sendsnapshot_bench, "Time SendClientMessages with sv_parallel_sendsnapshot 0 and 1 over the next snapshot ticks. Fill the server with bots first (sv_stressbots 1). Usage: sv_parallel_sendsnapshot_bench [ticks]" )
+{
+	if ( !sv.IsActive() || sv.GetNumClients() < 2 )
+	{
+		ConMsg( "sv_parallel_sendsnapshot_bench: needs a running server with at least two clients.\n" );
+		return;
+	}
+
+	if ( sv_pipeline_snapshots.GetBool() )
+	{
+		ConMsg( "sv_parallel_sendsnapshot_bench: turn off sv_pipeline_snapshots first.\n" );
+		return;
+	}
+
+	if ( s_nSendBenchTicks )
+	{
+		ConMsg( "sv_parallel_sendsnapshot_bench: already running.\n" );
+		return;
+	}
+
+	int nTicks = ( args.ArgC() > 1 ) ? atoi( args[1] ) : 2048;
+	s_nSendBenchTicks = clamp( nTicks, 4 * SENDBENCH_BLOCK, 1000000 );
+	s_nSendBenchTick = 0;
+	s_bSendBenchRestore = sv_parallel_sendsnapshot.GetBool();
+	s_flSendBenchTime[0] = s_flSendBenchTime[1] = 0;
+	s_nSendBenchSamples[0] = s_nSendBenchSamples[1] = 0;
+	ConMsg( "sv_parallel_sendsnapshot_bench: timing %d snapshot ticks...\n", s_nSendBenchTicks );
+}
+
+// the mode to time this tick with, -1 if none
+static int SV_SendBenchStart( bool bSendSnapshots )
+{
+	if ( !s_nSendBenchTicks || !bSendSnapshots )
+		return -1;
+
+	int iMode = ( s_nSendBenchTick / SENDBENCH_BLOCK ) & 1;
+	if ( sv_parallel_sendsnapshot.GetInt() != iMode )
+	{
+		sv_parallel_sendsnapshot.SetValue( iMode );
+	}
+	return iMode;
+}
+
+static void SV_SendBenchEnd( int iMode, double flTime )
+{
+	if ( s_nSendBenchTick++ % SENDBENCH_BLOCK )
+	{
+		s_flSendBenchTime[iMode] += flTime;
+		s_nSendBenchSamples[iMode]++;
+	}
+
+	if ( --s_nSendBenchTicks )
+		return;
+
+	sv_parallel_sendsnapshot.SetValue( s_bSendBenchRestore );
+
+	double flSerial = s_flSendBenchTime[0] * 1000.0 / MAX( s_nSendBenchSamples[0], 1 );
+	double flParallel = s_flSendBenchTime[1] * 1000.0 / MAX( s_nSendBenchSamples[1], 1 );
+	ConMsg( "sv_parallel_sendsnapshot_bench: %d clients, %d job threads, %d ticks each\n", sv.GetNumClients(), g_pThreadPool->NumThreads(), s_nSendBenchSamples[0] );
+	ConMsg( "  SendClientMessages %.3f ms serial, %.3f ms parallel, %.2fx\n", flSerial, flParallel, flParallel > 0 ? flSerial / flParallel : 0.0 );
+}
+
 void SV_SendClientUpdates( bool bIsSimulating, bool bSendDuringPause )
 {
 	bool bForcedSend = s_bForceSend;
@@ -2900,8 +3085,20 @@ void SV_SendClientUpdates( bool bIsSimulating, bool bSendDuringPause )
 	// ask game.dll to add any debug graphics
 	SV_PreClientUpdate( bIsSimulating );
 
+	int iBenchMode = SV_SendBenchStart( bIsSimulating || bForcedSend );
+	double flBenchStart = Plat_FloatTime();
+
 	// This causes network messages to be sent
+	CTimeAdder metricsTimer( TickMetrics_GetTimer( TICKMETRICS_SEND ) );
+	NET_BeginSendBatch();
 	sv.SendClientMessages( bIsSimulating || bForcedSend );
+	NET_EndSendBatch();
+	metricsTimer.End();
+
+	if ( iBenchMode >= 0 )
+	{
+		SV_SendBenchEnd( iBenchMode, Plat_FloatTime() - flBenchStart );
+	}
 
 	// tricky, increase stringtable tick at least one tick
 	// so changes made after this point are not counted to this server
@@ -2909,6 +3106,31 @@ void SV_SendClientUpdates( bool bIsSimulating, bool bSendDuringPause )
 	networkStringTableContainerServer->SetTick( sv.m_nTickCount + 1 );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: The dedicated frame scheduler woke up for a datagram before the next
+//  tick was due. The server doesn't change until that tick, so handling client
+//  messages now rather than at its start only takes the work off the tick.
+//-----------------------------------------------------------------------------
+bool SV_CanReadPacketsBetweenTicks()
+{
+	return sv.IsActive() && Host_ShouldRun();
+}
+
+void SV_ReadPacketsBetweenTicks( double flRealtime )
+{
+	if ( !SV_CanReadPacketsBetweenTicks() )
+		return;
+
+	VPROF_BUDGET( "SV_ReadPacketsBetweenTicks", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+
+	// net_time moves on with the clock, the next frame catches realtime up again
+	NET_SetTime( flRealtime );
+
+	networkStringTableContainerServer->Lock( false );
+	sv.ReadPackets();
+	networkStringTableContainerServer->Lock( true );
+}
+
 void SV_Frame( bool finalTick )
 {
 	VPROF( "SV_Frame" );
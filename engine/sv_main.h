@@ -29,6 +29,8 @@ extern CUtlVector<int> g_AreasNetworked;
 
 void SV_Frame( bool send_client_updates );
 void SV_FrameExecuteThreadDeferred();
+bool SV_CanReadPacketsBetweenTicks();
+void SV_ReadPacketsBetweenTicks( double flRealtime );
 
 void SV_InitGameDLL( void );
 
@@ -94,6 +96,9 @@ class CClientFrame;
 void SV_InitSendTables( ServerClass *pClasses );
 void SV_TermSendTables( ServerClass *pClasses );
 
+// Drops the entity delta bits shared by clients during the previous tick's snapshot send.
+void SV_ResetDeltaEntityCache( int nTickCount );
+
 // send voice data from cl to other clients
 void SV_BroadcastVoiceData(IClient * cl, int nBytes, char * data, int64 xuid);
 void SV_SendRestoreMsg( bf_write &dest );
@@ -266,7 +266,7 @@ static inline void SV_PackEntity(
 		PackedEntity *pPackedEntity = framesnapshotmanager->CreatePackedEntity( pSnapshot, edictIdx );
 		pPackedEntity->SetChangeFrameList( pChangeFrame );
 		pPackedEntity->SetServerAndClientClass( pServerClass, NULL );
-		pPackedEntity->AllocAndCopyPadded( packedData, writeBuf.GetNumBytesWritten() );
+		framesnapshotmanager->AllocAndCopyPackedData( pSnapshot, pPackedEntity, packedData, writeBuf.GetNumBytesWritten() );
 		pPackedEntity->SetRecipients( recip );
 	}
 
@@ -410,6 +410,15 @@ void PackEntities_Normal(
 
 	CUtlVectorFixed< PackWork_t, MAX_EDICTS > workItems;
 
+	// An entity needs packing if at least one client will be sent it. OR the transmit
+	// bitsets together a dword at a time instead of asking every client about every entity.
+	CBitVec<MAX_EDICTS> packEntities;
+	packEntities.ClearAll();
+	for ( int iClient = 0; iClient < clientCount; ++iClient )
+	{
+		packEntities.Or( clients[iClient]->m_pCurrentFrame->transmit_entity, &packEntities );
+	}
+
 	// check for all active entities, if they are seen by at least on client, if
 	// so, bit pack them 
 	for ( int iValidEdict=0; iValidEdict < snapshot->m_nValidEntities; ++iValidEdict )
@@ -429,22 +438,14 @@ void PackEntities_Normal(
 		// Check to see if the entity changed this frame...
 		//ServerDTI_RegisterNetworkStateChange( pSendTable, ent->m_bStateChanged );
 
-		for ( int iClient = 0; iClient < clientCount; ++iClient )
+		if ( packEntities.Get( index ) )
 		{
-			// entities is seen by at least this client, pack it and exit loop
-			CGameClient *client = clients[iClient];	// update variables cl, pInfo, frame for current client
-			CClientFrame *frame = client->m_pCurrentFrame;
-
-			if( frame->transmit_entity.Get( index ) )
-			{	
-				PackWork_t w;
-				w.nIdx = index;
-				w.pEdict = edict;
-				w.pSnapshot = snapshot;
-
-				workItems.AddToTail( w );
-				break;
-			}
+			PackWork_t w;
+			w.nIdx = index;
+			w.pEdict = edict;
+			w.pSnapshot = snapshot;
+
+			workItems.AddToTail( w );
 		}
 	}
 
@@ -691,3 +692,94 @@ const char* GetObjectClassName( int objectID )
 
 
 
+
+//-----------------------------------------------------------------------------
+// Purpose: Fully encodes every networked entity with both SendTable_Encode paths
+//			and reports the time per entity, see dt_encodeprogram.
+//-----------------------------------------------------------------------------
+CON_COMMAND( dt_encodeprogram_bench, "Time SendTable_Encode over all networked entities with the SendProp walk and the encode programs. Usage: dt_encodeprogram_bench [passes]" )
+{
+	if ( !sv.IsActive() )
+	{
+		ConMsg( "dt_encodeprogram_bench: no server running.\n" );
+		return;
+	}
+
+	int nPasses = ( args.ArgC() > 1 ) ? clamp( atoi( args[1] ), 1, 10000 ) : 100;
+
+	CUtlVector< edict_t* > edicts;
+	for ( int i=0; i < sv.num_edicts; i++ )
+	{
+		edict_t *edict = &sv.edicts[i];
+		if ( edict->IsFree() || !edict->GetUnknown() || ( edict->m_fStateFlags & FL_EDICT_DONTSEND ) )
+			continue;
+
+		if ( !edict->GetNetworkable() || !edict->GetNetworkable()->GetServerClass() )
+			continue;
+
+		edicts.AddToTail( edict );
+	}
+
+	if ( !edicts.Count() )
+	{
+		ConMsg( "dt_encodeprogram_bench: no networked entities.\n" );
+		return;
+	}
+
+	ALIGN4 char walkData[MAX_PACKEDENTITY_DATA] ALIGN4_POST;
+	ALIGN4 char programData[MAX_PACKEDENTITY_DATA] ALIGN4_POST;
+
+	// Make sure both paths agree before timing them.
+	int nMismatches = 0;
+	int nTotalBits = 0;
+	for ( int i=0; i < edicts.Count(); i++ )
+	{
+		edict_t *edict = edicts[i];
+		SendTable *pSendTable = edict->GetNetworkable()->GetServerClass()->m_pTable;
+
+		bf_write walkBuf( "dt_encodeprogram_bench->walkBuf", walkData, sizeof( walkData ) );
+		bf_write programBuf( "dt_encodeprogram_bench->programBuf", programData, sizeof( programData ) );
+		SendTable_EncodeWalk( pSendTable, edict->GetUnknown(), &walkBuf, edict - sv.edicts, NULL, false );
+		SendTable_EncodeProgram( pSendTable, edict->GetUnknown(), &programBuf, edict - sv.edicts, NULL, false );
+
+		nTotalBits += walkBuf.GetNumBitsWritten();
+		if ( !CompareBitArrays( walkData, programData, walkBuf.GetNumBitsWritten(), programBuf.GetNumBitsWritten() ) )
+		{
+			ConMsg( "dt_encodeprogram_bench: %s (ent %d) encodes differently.\n", pSendTable->GetName(), (int)( edict - sv.edicts ) );
+			++nMismatches;
+		}
+	}
+
+	double flTimes[2];
+	for ( int iPath=0; iPath < 2; iPath++ )
+	{
+		double flStart = Plat_FloatTime();
+		for ( int iPass=0; iPass < nPasses; iPass++ )
+		{
+			for ( int i=0; i < edicts.Count(); i++ )
+			{
+				edict_t *edict = edicts[i];
+				SendTable *pSendTable = edict->GetNetworkable()->GetServerClass()->m_pTable;
+
+				bf_write buf( "dt_encodeprogram_bench->buf", walkData, sizeof( walkData ) );
+				if ( iPath == 0 )
+				{
+					SendTable_EncodeWalk( pSendTable, edict->GetUnknown(), &buf, edict - sv.edicts, NULL, false );
+				}
+				else
+				{
+					SendTable_EncodeProgram( pSendTable, edict->GetUnknown(), &buf, edict - sv.edicts, NULL, false );
+				}
+			}
+		}
+		flTimes[iPath] = ( Plat_FloatTime() - flStart ) * 1e9 / ( (double)nPasses * edicts.Count() );
+	}
+
+	ConMsg( "%d entities (%d bits avg), %d passes\n", edicts.Count(), nTotalBits / edicts.Count(), nPasses );
+	ConMsg( "  SendProp walk:  %8.0f ns/entity\n", flTimes[0] );
+	ConMsg( "  encode program: %8.0f ns/entity (%.2fx)\n", flTimes[1], flTimes[0] / MAX( flTimes[1], 1.0 ) );
+	if ( nMismatches )
+	{
+		ConMsg( "  %d entities encoded differently!\n", nMismatches );
+	}
+}
@@ -0,0 +1,444 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-tick breakdown of the server frame as a binary metrics stream
+//
+//=============================================================================
+
+#include "sv_tickmetrics.h"
+#include "server.h"
+#include "net.h"
+#include "filesystem.h"
+#include "filesystem_engine.h"
+#include "tier0/vprof.h"
+#include "tier0/threadtools.h"
+#include "tier1/convar.h"
+#include "tier1/strtools.h"
+#include "tier1/utlbuffer.h"
+#include "tier1/netadr.h"
+
+#if defined( _WIN32 )
+#include "winlite.h"
+#include <winsock.h>
+typedef int socklen_t;
+#elif defined( POSIX )
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#define closesocket close
+#define ioctlsocket ioctl
+#undef SOCKET
+typedef int SOCKET;
+#define INVALID_SOCKET	-1
+#endif
+
+#if defined( PLATFORM_GLIBC )
+#include <malloc.h>
+#endif
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+COMPILE_TIME_ASSERT( sizeof( tickmetrics_t ) == 56 );
+
+static void OnTickMetricsChanged( IConVar *var, const char *pOldValue, float flOldValue );
+
+static ConVar sv_tickmetrics( "sv_tickmetrics", "", 0, "Publish a timing record for every server tick: udp:<host>:<port>, unix:<path> or file:<name>.tickmetrics. Empty to stop.", OnTickMetricsChanged );
+static ConVar sv_tickmetrics_filesize( "sv_tickmetrics_filesize", "64", 0, "Megabytes after which a file:<name> tick metrics stream is moved to <name>.1 and started over.", true, 1, false, 0 );
+
+#define TICKMETRICS_FILE_FLUSH		64		// records buffered before they are written to a file
+#define TICKMETRICS_HEAP_INTERVAL	32		// ticks between two reads of the heap statistics
+
+//-----------------------------------------------------------------------------
+// Where the records go
+//-----------------------------------------------------------------------------
+class CTickMetricsSink
+{
+public:
+	CTickMetricsSink();
+
+	bool Open( const char *pszTarget );
+	void Close();
+	bool IsOpen() const { return m_Socket != INVALID_SOCKET || m_hFile != FILESYSTEM_INVALID_HANDLE; }
+
+	void Write( const tickmetrics_t &record );
+
+private:
+	bool OpenSocket( int nFamily );
+	bool OpenFile( const char *pszName );
+	void FlushFile();
+
+	SOCKET				m_Socket;
+	union
+	{
+		struct sockaddr		m_Addr;
+		struct sockaddr_in	m_AddrIn;
+#if defined( POSIX )
+		struct sockaddr_un	m_AddrUn;
+#endif
+	};
+	socklen_t			m_nAddrLen;
+
+	FileHandle_t		m_hFile;
+	char				m_szFileName[MAX_PATH];
+	uint				m_nFileSize;
+	CUtlBuffer			m_FileBuffer;
+};
+
+CTickMetricsSink::CTickMetricsSink()
+{
+	m_Socket = INVALID_SOCKET;
+	m_nAddrLen = 0;
+	m_hFile = FILESYSTEM_INVALID_HANDLE;
+	m_szFileName[0] = 0;
+	m_nFileSize = 0;
+}
+
+bool CTickMetricsSink::Open( const char *pszTarget )
+{
+	Close();
+
+	if ( !Q_strnicmp( pszTarget, "udp:", 4 ) )
+	{
+		netadr_t adr;
+		if ( !NET_StringToAdr( pszTarget + 4, &adr ) || !adr.GetPort() )
+		{
+			Warning( "sv_tickmetrics: bad address %s.\n", pszTarget + 4 );
+			return false;
+		}
+
+		adr.ToSockadr( &m_Addr );
+		m_nAddrLen = sizeof( m_AddrIn );
+		return OpenSocket( AF_INET );
+	}
+
+#if defined( POSIX )
+	if ( !Q_strnicmp( pszTarget, "unix:", 5 ) )
+	{
+		if ( Q_strlen( pszTarget + 5 ) >= (int)sizeof( m_AddrUn.sun_path ) )
+		{
+			Warning( "sv_tickmetrics: socket path %s is too long.\n", pszTarget + 5 );
+			return false;
+		}
+
+		Q_memset( &m_AddrUn, 0, sizeof( m_AddrUn ) );
+		m_AddrUn.sun_family = AF_UNIX;
+		Q_strncpy( m_AddrUn.sun_path, pszTarget + 5, sizeof( m_AddrUn.sun_path ) );
+		m_nAddrLen = sizeof( m_AddrUn );
+		return OpenSocket( AF_UNIX );
+	}
+#endif
+
+	if ( !Q_strnicmp( pszTarget, "file:", 5 ) )
+		return OpenFile( pszTarget + 5 );
+
+	Warning( "sv_tickmetrics: expected udp:<host>:<port>, unix:<path> or file:<name>.tickmetrics.\n" );
+	return false;
+}
+
+bool CTickMetricsSink::OpenSocket( int nFamily )
+{
+	m_Socket = socket( nFamily, SOCK_DGRAM, 0 );
+	if ( m_Socket == INVALID_SOCKET )
+	{
+		Warning( "sv_tickmetrics: couldn't create a socket.\n" );
+		return false;
+	}
+
+	// a reader that falls behind loses records, the server never waits for it
+	unsigned long nNonBlocking = 1;
+	ioctlsocket( m_Socket, FIONBIO, &nNonBlocking );
+	return true;
+}
+
+bool CTickMetricsSink::OpenFile( const char *pszName )
+{
+	if ( !pszName[0] )
+	{
+		Warning( "sv_tickmetrics: missing file name.\n" );
+		return false;
+	}
+
+	// rcon can set this, so only .tickmetrics files under the write path. The
+	// name is opened, rotated to <name>.1 and the old <name>.1 removed.
+	const char *pszExtension = Q_GetFileExtension( pszName );
+	if ( !COM_IsValidPath( pszName ) || Q_IsAbsolutePath( pszName ) || !pszExtension || Q_stricmp( pszExtension, "tickmetrics" ) )
+	{
+		Warning( "sv_tickmetrics: expected a relative .tickmetrics path, not %s.\n", pszName );
+		return false;
+	}
+
+	Q_strncpy( m_szFileName, pszName, sizeof( m_szFileName ) );
+	Q_FixSlashes( m_szFileName );
+
+	char szDir[MAX_PATH];
+	Q_ExtractFilePath( m_szFileName, szDir, sizeof( szDir ) );
+	if ( szDir[0] )
+	{
+		g_pFileSystem->CreateDirHierarchy( szDir, "DEFAULT_WRITE_PATH" );
+	}
+
+	m_hFile = g_pFileSystem->Open( m_szFileName, "ab", "DEFAULT_WRITE_PATH" );
+	if ( m_hFile == FILESYSTEM_INVALID_HANDLE )
+	{
+		Warning( "sv_tickmetrics: couldn't open %s.\n", m_szFileName );
+		return false;
+	}
+
+	m_nFileSize = g_pFileSystem->Size( m_hFile );
+	m_FileBuffer.EnsureCapacity( TICKMETRICS_FILE_FLUSH * sizeof( tickmetrics_t ) );
+	return true;
+}
+
+void CTickMetricsSink::Close()
+{
+	if ( m_Socket != INVALID_SOCKET )
+	{
+		closesocket( m_Socket );
+		m_Socket = INVALID_SOCKET;
+	}
+
+	if ( m_hFile != FILESYSTEM_INVALID_HANDLE )
+	{
+		FlushFile();
+		g_pFileSystem->Close( m_hFile );
+		m_hFile = FILESYSTEM_INVALID_HANDLE;
+	}
+}
+
+void CTickMetricsSink::Write( const tickmetrics_t &record )
+{
+	if ( m_Socket != INVALID_SOCKET )
+	{
+		sendto( m_Socket, (const char *)&record, sizeof( record ), 0, &m_Addr, m_nAddrLen );
+		return;
+	}
+
+	if ( m_hFile == FILESYSTEM_INVALID_HANDLE )
+		return;
+
+	m_FileBuffer.Put( &record, sizeof( record ) );
+	if ( m_FileBuffer.TellPut() >= TICKMETRICS_FILE_FLUSH * (int)sizeof( tickmetrics_t ) )
+	{
+		FlushFile();
+	}
+
+	if ( m_nFileSize < (uint)sv_tickmetrics_filesize.GetInt() * 1024 * 1024 )
+		return;
+
+	// keep one older file, so at most twice the limit is on disk
+	g_pFileSystem->Close( m_hFile );
+	m_hFile = FILESYSTEM_INVALID_HANDLE;
+
+	char szOldName[MAX_PATH];
+	Q_snprintf( szOldName, sizeof( szOldName ), "%s.1", m_szFileName );
+	g_pFileSystem->RemoveFile( szOldName, "DEFAULT_WRITE_PATH" );
+	g_pFileSystem->RenameFile( m_szFileName, szOldName, "DEFAULT_WRITE_PATH" );
+
+	m_hFile = g_pFileSystem->Open( m_szFileName, "wb", "DEFAULT_WRITE_PATH" );
+	m_nFileSize = 0;
+	if ( m_hFile == FILESYSTEM_INVALID_HANDLE )
+	{
+		Warning( "sv_tickmetrics: couldn't open %s.\n", m_szFileName );
+	}
+}
+
+void CTickMetricsSink::FlushFile()
+{
+	if ( !m_FileBuffer.TellPut() )
+		return;
+
+	g_pFileSystem->Write( m_FileBuffer.Base(), m_FileBuffer.TellPut(), m_hFile );
+	m_nFileSize += m_FileBuffer.TellPut();
+	m_FileBuffer.Clear();
+}
+
+//-----------------------------------------------------------------------------
+// Collects the parts of each tick
+//-----------------------------------------------------------------------------
+class CTickMetrics
+{
+public:
+	CTickMetrics();
+
+	bool IsActive() const { return m_bActive; }
+	void Open( const char *pszTarget );
+	void Close();
+
+	void BeginTick();
+	void EndTick( int nTick );
+
+	CCycleCount *GetTimer( TickMetricsTimer_t timer ) { return m_bActive && ThreadInMainThread() ? &m_Timers[timer] : NULL; }
+
+private:
+	double GetPhysicsTime();
+
+	CTickMetricsSink	m_Sink;
+	bool				m_bActive;
+
+	CCycleCount			m_Timers[TICKMETRICS_NUM_TIMERS];
+	CFastTimer			m_TickTimer;
+	double				m_flTickStart;
+	double				m_flPhysicsStart;
+	uint				m_nBytesSent;
+	uint				m_nHeapKB;
+	int					m_nTicks;
+};
+
+static CTickMetrics g_TickMetrics;
+
+CTickMetrics::CTickMetrics()
+{
+	m_bActive = false;
+	m_flTickStart = 0;
+	m_flPhysicsStart = 0;
+	m_nBytesSent = 0;
+	m_nHeapKB = 0;
+	m_nTicks = 0;
+}
+
+void CTickMetrics::Open( const char *pszTarget )
+{
+	Close();
+
+	if ( !pszTarget[0] || !m_Sink.Open( pszTarget ) )
+		return;
+
+	for ( int i = 0; i < TICKMETRICS_NUM_TIMERS; i++ )
+	{
+		m_Timers[i].Init();
+	}
+	m_nBytesSent = NET_GetBytesSent();
+	m_nTicks = 0;
+	m_bActive = true;
+}
+
+void CTickMetrics::Close()
+{
+	m_bActive = false;
+	m_Sink.Close();
+}
+
+double CTickMetrics::GetPhysicsTime()
+{
+#ifdef VPROF_ENABLED
+	if ( !g_VProfCurrentProfile.IsEnabled() )
+		return -1;
+
+	// the nodes keep this frame's time until the next MarkFrame, so the
+	// difference between the start and the end of the tick is the tick's
+	int nPhysics = g_VProfCurrentProfile.BudgetGroupNameToBudgetGroupIDNoCreate( VPROF_BUDGETGROUP_PHYSICS );
+	if ( nPhysics < 0 )
+		return 0;
+
+	double flTime = 0;
+	CUtlVector<CVProfNode *> nodes;
+	nodes.AddToTail( g_VProfCurrentProfile.GetRoot() );
+	while ( nodes.Count() )
+	{
+		CVProfNode *pNode = nodes.Tail();
+		nodes.RemoveMultipleFromTail( 1 );
+
+		if ( pNode->GetBudgetGroupID() == nPhysics )
+		{
+			flTime += pNode->GetCurTimeLessChildren();
+		}
+
+		for ( CVProfNode *pChild = pNode->GetChild(); pChild; pChild = pChild->GetSibling() )
+		{
+			nodes.AddToTail( pChild );
+		}
+	}
+	return flTime;
+#else
+	return -1;
+#endif
+}
+
+void CTickMetrics::BeginTick()
+{
+	if ( !m_bActive )
+		return;
+
+	m_flTickStart = Plat_FloatTime();
+	m_flPhysicsStart = GetPhysicsTime();
+	m_TickTimer.Start();
+}
+
+void CTickMetrics::EndTick( int nTick )
+{
+	if ( !m_bActive )
+		return;
+
+	m_TickTimer.End();
+
+	tickmetrics_t record;
+	Q_memset( &record, 0, sizeof( record ) );
+	record.version = TICKMETRICS_VERSION;
+	record.size = sizeof( record );
+	record.tick = nTick;
+	record.time = m_flTickStart;
+
+	record.total = m_TickTimer.GetDuration().GetMillisecondsF();
+	record.think = m_Timers[TICKMETRICS_THINK].GetMillisecondsF();
+	record.send = m_Timers[TICKMETRICS_SEND].GetMillisecondsF();
+	record.packs = m_Timers[TICKMETRICS_PACKS].GetMillisecondsF();
+	record.netread = m_Timers[TICKMETRICS_NETREAD].GetMillisecondsF();
+	for ( int i = 0; i < TICKMETRICS_NUM_TIMERS; i++ )
+	{
+		m_Timers[i].Init();
+	}
+
+	double flPhysics = GetPhysicsTime();
+	record.physics = ( flPhysics < 0 || m_flPhysicsStart < 0 ) ? -1 : MAX( flPhysics - m_flPhysicsStart, 0.0 );
+
+	record.edicts = sv.num_edicts - sv.free_edicts;
+	record.players = sv.GetNumClients();
+
+	// unsigned, so the difference is right when the counter wraps
+	uint nBytesSent = NET_GetBytesSent();
+	record.bytesout = nBytesSent - m_nBytesSent;
+	m_nBytesSent = nBytesSent;
+
+	// walking the allocator's bins every tick would cost more than the rest together
+	if ( ( m_nTicks++ % TICKMETRICS_HEAP_INTERVAL ) == 0 )
+	{
+#if defined( PLATFORM_GLIBC ) && ( __GLIBC__ > 2 || __GLIBC_MINOR__ >= 33 )
+		// mallinfo's int fields wrap past 2GB, mallinfo2 has size_t ones
+		struct mallinfo2 memstats = mallinfo2();
+		m_nHeapKB = (uint)( ( memstats.uordblks + memstats.hblkhd ) / 1024 );
+#elif defined( PLATFORM_GLIBC )
+		struct mallinfo memstats = mallinfo();
+		m_nHeapKB = ( (uint)memstats.uordblks + (uint)memstats.hblkhd ) / 1024;
+#endif
+	}
+	record.heapkb = m_nHeapKB;
+
+	m_Sink.Write( record );
+}
+
+static void OnTickMetricsChanged( IConVar *var, const char *pOldValue, float flOldValue )
+{
+	g_TickMetrics.Open( sv_tickmetrics.GetString() );
+}
+
+void TickMetrics_BeginTick()
+{
+	g_TickMetrics.BeginTick();
+}
+
+void TickMetrics_EndTick( int nTick )
+{
+	g_TickMetrics.EndTick( nTick );
+}
+
+CCycleCount *TickMetrics_GetTimer( TickMetricsTimer_t timer )
+{
+	return g_TickMetrics.GetTimer( timer );
+}
+
+void TickMetrics_Shutdown()
+{
+	g_TickMetrics.Close();
+}
@@ -0,0 +1,67 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-tick breakdown of the server frame as a binary metrics stream
+//
+//=============================================================================
+
+#ifndef SV_TICKMETRICS_H
+#define SV_TICKMETRICS_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/fasttimer.h"
+
+// sv_tickmetrics names where one tickmetrics_t per server tick goes:
+//   udp:<host>:<port>	one datagram per tick
+//   unix:<path>		one datagram per tick to a unix domain socket (POSIX only)
+//   file:<name>		appended to a relative .tickmetrics file under the game directory,
+//						which is moved to <name>.1 once it grows past sv_tickmetrics_filesize MB
+// Records are written in the byte order of the server.
+
+#define TICKMETRICS_VERSION		1
+
+struct tickmetrics_t
+{
+	uint16	version;			// TICKMETRICS_VERSION
+	uint16	size;				// sizeof( tickmetrics_t ), newer versions only add fields at the end
+	int32	tick;				// sv.m_nTickCount after the tick
+	float64	time;				// Plat_FloatTime() at the start of the tick
+
+	// milliseconds
+	float32	total;				// the whole of SV_Frame
+	float32	think;				// SV_Think, which includes the game's GameFrame
+	float32	send;				// SendClientMessages on the main thread, including packs
+	float32	packs;				// SV_ComputeClientPacks
+	float32	netread;			// NET_ProcessSocket since the previous record, between ticks too
+	float32	physics;			// VPROF "Physics" budget group, -1 while VPROF is not running
+
+	uint16	edicts;				// edicts in use
+	uint16	players;			// connected clients, bots included
+	uint32	bytesout;			// bytes sent by NET_SendTo since the previous record, any thread
+	uint32	heapkb;				// heap in use, refreshed every few ticks, 0 where unknown
+	uint32	reserved;
+};
+
+enum TickMetricsTimer_t
+{
+	TICKMETRICS_THINK = 0,
+	TICKMETRICS_SEND,
+	TICKMETRICS_PACKS,
+	TICKMETRICS_NETREAD,
+
+	TICKMETRICS_NUM_TIMERS
+};
+
+// Main thread, around each server tick
+void TickMetrics_BeginTick();
+void TickMetrics_EndTick( int nTick );
+
+// What a CTimeAdder around a part of the tick adds to, NULL while no
+// stream is open or off the main thread:
+//	CTimeAdder metricsTimer( TickMetrics_GetTimer( TICKMETRICS_THINK ) );
+CCycleCount *TickMetrics_GetTimer( TickMetricsTimer_t timer );
+
+void TickMetrics_Shutdown();
+
+#endif // SV_TICKMETRICS_H
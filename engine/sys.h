@@ -36,6 +36,7 @@ void Sys_LoadHLTVDLL( void );
 void Sys_UnloadHLTVDLL( void );
 
 void Sys_Sleep ( int msec );
+void Sys_PrintFrameWakeReport( void );	// dedicated frame scheduler stats, see host_timer_report
 void Sys_GetRegKeyValue( const char *pszSubKey, const char *pszElement, OUT_Z_CAP(nReturnLength) char *pszReturnString, int nReturnLength, const char *pszDefaultValue);
 void Sys_GetRegKeyValueInt( const char *pszSubKey, const char *pszElement, long *pulReturnValue, long dwDefaultValue);
 void Sys_SetRegKeyValue( const char *pszSubKey, const char *pszElement,	const char *pszValue );
@@ -35,13 +35,19 @@
 #include "vgui_baseui_interface.h"
 #endif
 #include "tier0/etwprof.h"
-
-// memdbgon must be the last include file in a .cpp file!!!
-#include "tier0/memdbgon.h"
+#include "sv_main.h"
+#include "net.h"
 
 #ifdef POSIX
 #include <signal.h>
 #endif
+#if defined( LINUX )
+#include <poll.h>
+#include <sys/timerfd.h>
+#endif
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
 
 //-----------------------------------------------------------------------------
 // Forward declarations
@@ -104,6 +110,134 @@ extern ConVar host_timer_spin_ms;
 extern float host_nexttick;
 extern IVEngineClient *engineClient;
 
+static ConVar host_timer_event( "host_timer_event", "0", FCVAR_NONE, "Sleep on an absolute timer until the next tick is due and wake early to read client packets, instead of polling (Linux dedicated only)" );
+
+// How late dedicated server frames started after they were due, for host_timer_report
+static float s_flWakeLateness[128];
+static unsigned int s_nWakeLatenessPos = 0;
+static int s_nWakes = 0;
+static int s_nPacketWakes = 0;
+
+static void Sys_RecordWakeLateness( float flLateness )
+{
+	s_flWakeLateness[s_nWakeLatenessPos] = flLateness;
+	s_nWakeLatenessPos = ( s_nWakeLatenessPos + 1 ) % ARRAYSIZE( s_flWakeLateness );
+	++s_nWakes;
+}
+
+void Sys_PrintFrameWakeReport( void )
+{
+	int nSamples = MIN( s_nWakes, (int)ARRAYSIZE( s_flWakeLateness ) );
+	if ( !nSamples )
+		return;
+
+	float flMin = FLT_MAX, flMax = -FLT_MAX;
+	double flSum = 0, flSumSq = 0;
+	for ( int i = 0; i < nSamples; ++i )
+	{
+		float flLateness = s_flWakeLateness[i];
+		flMin = MIN( flMin, flLateness );
+		flMax = MAX( flMax, flLateness );
+		flSum += flLateness;
+		flSumSq += flLateness * flLateness;
+	}
+
+	double flAvg = flSum / nSamples;
+	double flStdDev = sqrt( MAX( flSumSq / nSamples - flAvg * flAvg, 0.0 ) );
+
+	const char *pszMode = host_timer_event.GetBool() ? "host_timer_event" : ( host_timer_spin_ms.GetFloat() != 0 ? "host_timer_spin_ms" : "sleep" );
+	Msg( "wake lateness (%s, last %d frames): min %1.3fms avg %1.3fms max %1.3fms stddev %1.3fms\n",
+		pszMode, nSamples, flMin * 1000, flAvg * 1000, flMax * 1000, flStdDev * 1000 );
+	Msg( "%d frames waited, %d early wakes for client packets\n", s_nWakes, s_nPacketWakes );
+}
+
+#if defined( LINUX )
+//-----------------------------------------------------------------------------
+// Sleeps on a timerfd armed with the absolute tick deadline, which unlike
+// usleep or poll timeouts isn't rounded up by timer slack, together with the
+// server's sockets. Returns true if it woke up for a datagram.
+//-----------------------------------------------------------------------------
+static int s_hFrameTimer = -1;
+
+static bool Sys_WaitForTickOrPacket( double flDeadline, bool bWakeOnPacket )
+{
+	if ( s_hFrameTimer < 0 )
+	{
+		s_hFrameTimer = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+		if ( s_hFrameTimer < 0 )
+		{
+			Warning( "timerfd_create failed (%s), disabling host_timer_event.\n", strerror( errno ) );
+			host_timer_event.SetValue( 0 );
+			return false;
+		}
+	}
+
+	double flRemaining = flDeadline - Sys_FloatTime();
+	if ( flRemaining <= 0.0 )
+		return false;
+
+	// Sys_FloatTime is CLOCK_MONOTONIC as well, just with its own epoch
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	int64 nDeadlineNS = (int64)now.tv_nsec + (int64)( flRemaining * 1e9 );
+
+	struct itimerspec timer;
+	Q_memset( &timer, 0, sizeof( timer ) );
+	timer.it_value.tv_sec = now.tv_sec + (time_t)( nDeadlineNS / 1000000000 );
+	timer.it_value.tv_nsec = (long)( nDeadlineNS % 1000000000 );
+	if ( timerfd_settime( s_hFrameTimer, TFD_TIMER_ABSTIME, &timer, NULL ) != 0 )
+	{
+		Warning( "timerfd_settime failed (%s), disabling host_timer_event.\n", strerror( errno ) );
+		host_timer_event.SetValue( 0 );
+		return false;
+	}
+
+	struct pollfd fds[4];
+	fds[0].fd = s_hFrameTimer;
+	fds[0].events = POLLIN;
+	fds[0].revents = 0;
+	int nFds = 1;
+
+	if ( bWakeOnPacket )
+	{
+		int handles[ARRAYSIZE( fds ) - 1];
+		int nHandles = NET_GetServerWaitHandles( handles, ARRAYSIZE( handles ) );
+		for ( int i = 0; i < nHandles; ++i )
+		{
+			fds[nFds].fd = handles[i];
+			fds[nFds].events = POLLIN;
+			fds[nFds].revents = 0;
+			++nFds;
+		}
+	}
+
+	// the timer does the waking, the timeout is only a backstop
+	int nReady = poll( fds, nFds, (int)( flRemaining * 1000 ) + 2 );
+	if ( nReady <= 0 )
+		return false;
+
+	if ( fds[0].revents & POLLIN )
+	{
+		uint64 nExpirations;
+		if ( read( s_hFrameTimer, &nExpirations, sizeof( nExpirations ) ) < 0 )
+		{
+			// already drained
+		}
+	}
+
+	for ( int i = 1; i < nFds; ++i )
+	{
+		if ( fds[i].revents )
+		{
+			NET_ClearServerWait();
+			return true;
+		}
+	}
+
+	return false;
+}
+#endif
+
 #ifdef WIN32
 static void cpu_frequency_monitoring_callback( IConVar *var, const char *pOldValue, float flOldValue )
 {
@@ -318,6 +452,7 @@ void CEngine::Frame( void )
 
 	// Loop until it is time for our frame. Don't return early because pumping messages
 	// and processing console input is expensive (0.1 ms for each call to ProcessConsoleInput).
+	bool bWaited = false;
 	for (;;)
 	{
 		// Get current time
@@ -338,10 +473,31 @@ void CEngine::Frame( void )
 
 		if ( FilterTime( m_flFrameTime )  )
 		{
+			if ( bWaited && sv.IsDedicated() )
+			{
+				Sys_RecordWakeLateness( m_flFrameTime - m_flMinFrameTime );
+			}
+
 			// Time to render our frame.
 			break;
 		}
 
+		bWaited = true;
+
+#if defined( LINUX )
+		if ( sv.IsDedicated() && host_timer_event.GetBool() )
+		{
+			if ( Sys_WaitForTickOrPacket( m_flPreviousTime + m_flMinFrameTime, SV_CanReadPacketsBetweenTicks() ) )
+			{
+				++s_nPacketWakes;
+				SV_ReadPacketsBetweenTicks( realtime + ( Sys_FloatTime() - m_flPreviousTime ) );
+			}
+
+			// Go back to the top of the loop and see if it is time yet.
+			continue;
+		}
+#endif
+
 		if ( IsPC() && ( !sv.IsDedicated() || host_timer_spin_ms.GetFloat() != 0 ) )
 		{
 			// ThreadSleep may be imprecise. On non-dedicated servers, we busy-sleep
@@ -0,0 +1,432 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Samples the main thread's stack while the server simulates and
+//			writes folded stacks for ticks that took too long
+//
+//=============================================================================
+
+#include "ticksampler.h"
+#include "filesystem.h"
+#include "filesystem_engine.h"
+#include "tier0/vprof.h"
+#include "tier0/threadtools.h"
+#include "tier1/convar.h"
+#include "tier1/strtools.h"
+#include "tier1/utldict.h"
+#include "tier1/utlmap.h"
+#include "tier1/utlstring.h"
+
+#if defined( LINUX )
+#include <signal.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static void OnTickSamplerChanged( IConVar *var, const char *pOldValue, float flOldValue );
+
+static ConVar sv_ticksampler( "sv_ticksampler", "0", 0, "Sample the main thread's stack during server ticks and write the samples of long ticks to ticksamples/ (Linux only).", OnTickSamplerChanged );
+static ConVar sv_ticksampler_interval( "sv_ticksampler_interval", "2", 0, "Milliseconds between stack samples of the tick sampler.", true, 1, true, 100 );
+static ConVar sv_ticksampler_threshold( "sv_ticksampler_threshold", "50", 0, "Ticks that take longer than this many milliseconds get their stack samples written.", true, 1, false, 0 );
+
+#define TICKSAMPLER_MAX_SAMPLES			4096	// must be a power of two, seconds of history at the default interval
+#define TICKSAMPLER_MAX_DEPTH			48
+#define TICKSAMPLER_MIN_DUMP_INTERVAL	5.0		// seconds between two written ticks
+
+struct ticksample_t
+{
+	int			nFrame;			// BeginTick count when the sample was taken
+	int			nDepth;
+	const char	*pszNode;		// VPROF node the main thread was in, NULL without VPROF
+	void		*stack[TICKSAMPLER_MAX_DEPTH];
+};
+
+class CTickSampler : public CThread
+{
+public:
+	CTickSampler();
+
+	bool Setup();
+	void Shutdown();
+
+	void BeginTick();
+	void EndTick( int nTick );
+
+private:
+	// CThread Overrides
+	virtual int Run();
+
+	void SampleMainThread();
+	void WriteTick();
+	const char *GetSymbolName( void *pAddress );
+
+#if defined( LINUX )
+	static void SignalHandler( int nSignal, siginfo_t *pInfo, void *pContext );
+
+	struct sigaction	m_OldAction;
+	pid_t				m_nMainThread;
+#endif
+
+	ticksample_t		*m_pSamples;
+	volatile int		m_nSamples;			// only the signal handler writes samples
+	volatile int		m_nFrame;
+	volatile bool		m_bInTick;
+	double				m_flTickStart;
+
+	// long tick the thread should write, the frame is set last
+	volatile int		m_nWriteFrame;
+	int					m_nWriteTick;
+	float				m_flWriteDuration;
+	double				m_flNextWriteTime;
+
+	volatile bool		m_bThreadShouldExit;
+
+	CUtlMap< void *, CUtlString >	m_Symbols;
+};
+
+static CTickSampler g_TickSampler;
+
+#if defined( LINUX )
+// SIGPROF is left to profilers that use setitimer
+#define TICKSAMPLER_SIGNAL		( SIGRTMIN + 5 )
+// the handler and the kernel's signal trampoline
+#define TICKSAMPLER_SKIP_FRAMES	2
+#endif
+
+CTickSampler::CTickSampler() : m_Symbols( DefLessFunc( void * ) )
+{
+	SetName( "TickSampler" );
+	m_pSamples = NULL;
+	m_nSamples = 0;
+	m_nFrame = 0;
+	m_bInTick = false;
+	m_flTickStart = 0.0;
+	m_nWriteFrame = -1;
+	m_nWriteTick = 0;
+	m_flWriteDuration = 0.0f;
+	m_flNextWriteTime = 0.0;
+	m_bThreadShouldExit = false;
+#if defined( LINUX )
+	m_nMainThread = 0;
+#endif
+}
+
+bool CTickSampler::Setup()
+{
+#if defined( LINUX )
+	if ( IsAlive() )
+		return true;
+
+	if ( !m_pSamples )
+	{
+		m_pSamples = new ticksample_t[TICKSAMPLER_MAX_SAMPLES];
+	}
+
+	// backtrace loads libgcc on its first call, which isn't safe in a signal handler
+	void *stack[4];
+	backtrace( stack, ARRAYSIZE( stack ) );
+
+	m_nMainThread = syscall( SYS_gettid );
+
+	struct sigaction action;
+	V_memset( &action, 0, sizeof( action ) );
+	action.sa_sigaction = SignalHandler;
+	action.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset( &action.sa_mask );
+	if ( sigaction( TICKSAMPLER_SIGNAL, &action, &m_OldAction ) != 0 )
+	{
+		Warning( "Tick sampler: couldn't install the signal handler (%s).\n", strerror( errno ) );
+		return false;
+	}
+
+	m_bThreadShouldExit = false;
+	m_nWriteFrame = -1;
+
+	if ( !Start() )
+	{
+		Warning( "Tick sampler: couldn't start the sampling thread.\n" );
+		sigaction( TICKSAMPLER_SIGNAL, &m_OldAction, NULL );
+		return false;
+	}
+
+	return true;
+#else
+	Warning( "The tick sampler is only implemented on Linux, use dumplongticks instead.\n" );
+	return false;
+#endif
+}
+
+void CTickSampler::Shutdown()
+{
+	if ( !IsAlive() )
+		return;
+
+	m_bThreadShouldExit = true;
+	Join();
+
+#if defined( LINUX )
+	// nothing sends the signal any more, a sample that's still pending finds the handler
+	sigaction( TICKSAMPLER_SIGNAL, &m_OldAction, NULL );
+#endif
+}
+
+void CTickSampler::BeginTick()
+{
+	m_nFrame = m_nFrame + 1;
+	m_flTickStart = Plat_FloatTime();
+
+	ThreadMemoryBarrier();
+	m_bInTick = true;
+}
+
+void CTickSampler::EndTick( int nTick )
+{
+	m_bInTick = false;
+
+	double flNow = Plat_FloatTime();
+	float flDuration = flNow - m_flTickStart;
+	if ( flDuration * 1000.0f < sv_ticksampler_threshold.GetFloat() )
+		return;
+
+	// one at a time, the thread is still writing the last one
+	if ( m_nWriteFrame >= 0 || flNow < m_flNextWriteTime )
+		return;
+
+	m_nWriteTick = nTick;
+	m_flWriteDuration = flDuration;
+	m_flNextWriteTime = flNow + TICKSAMPLER_MIN_DUMP_INTERVAL;
+
+	ThreadMemoryBarrier();
+	m_nWriteFrame = m_nFrame;
+}
+
+#if defined( LINUX )
+void CTickSampler::SignalHandler( int nSignal, siginfo_t *pInfo, void *pContext )
+{
+	CTickSampler *pSampler = &g_TickSampler;
+	int nSavedErrno = errno;
+
+	ticksample_t &sample = pSampler->m_pSamples[pSampler->m_nSamples & ( TICKSAMPLER_MAX_SAMPLES - 1 )];
+	sample.nFrame = pSampler->m_nFrame;
+	sample.nDepth = backtrace( sample.stack, TICKSAMPLER_MAX_DEPTH );
+	sample.pszNode = NULL;
+
+#ifdef VPROF_ENABLED
+	// the main thread is the one VPROF follows, its node is consistent in here
+	if ( g_VProfCurrentProfile.IsEnabled() && g_VProfCurrentProfile.GetCurrentNode() != g_VProfCurrentProfile.GetRoot() )
+	{
+		sample.pszNode = g_VProfCurrentProfile.GetCurrentNode()->GetName();
+	}
+#endif
+
+	ThreadMemoryBarrier();
+	pSampler->m_nSamples = pSampler->m_nSamples + 1;
+
+	errno = nSavedErrno;
+}
+#endif
+
+void CTickSampler::SampleMainThread()
+{
+#if defined( LINUX )
+	int nSamples = m_nSamples;
+	if ( syscall( SYS_tgkill, getpid(), m_nMainThread, TICKSAMPLER_SIGNAL ) != 0 )
+		return;
+
+	// wait for the handler, samples are only ever read on this thread between two of them
+	double flTimeout = Plat_FloatTime() + 0.01;
+	while ( m_nSamples == nSamples && Plat_FloatTime() < flTimeout )
+	{
+		ThreadPause();
+	}
+#endif
+}
+
+const char *CTickSampler::GetSymbolName( void *pAddress )
+{
+	int i = m_Symbols.Find( pAddress );
+	if ( i != m_Symbols.InvalidIndex() )
+		return m_Symbols[i].String();
+
+	char szName[512];
+	V_snprintf( szName, sizeof( szName ), "%p", pAddress );
+
+#if defined( LINUX )
+	// hidden symbols have no name here, module+offset can be resolved with addr2line
+	Dl_info info;
+	if ( dladdr( pAddress, &info ) )
+	{
+		if ( info.dli_sname )
+		{
+			int nStatus;
+			char *pszDemangled = abi::__cxa_demangle( info.dli_sname, NULL, NULL, &nStatus );
+			V_strncpy( szName, pszDemangled ? pszDemangled : info.dli_sname, sizeof( szName ) );
+			free( pszDemangled );
+		}
+		else if ( info.dli_fname )
+		{
+			V_snprintf( szName, sizeof( szName ), "%s+0x%llx", V_UnqualifiedFileName( info.dli_fname ),
+				(unsigned long long)( (uintp)pAddress - (uintp)info.dli_fbase ) );
+		}
+	}
+#endif
+
+	// the frame separator of the folded format
+	for ( char *pch = szName; *pch; pch++ )
+	{
+		if ( *pch == ';' )
+		{
+			*pch = ':';
+		}
+	}
+
+	i = m_Symbols.Insert( pAddress, szName );
+	return m_Symbols[i].String();
+}
+
+void CTickSampler::WriteTick()
+{
+#if defined( LINUX )
+	int nFrame = m_nWriteFrame;
+	int nSamples = m_nSamples;
+
+	// newest first, the samples of older ticks end the search
+	CUtlDict< int, int > stacks;
+	int nFound = 0;
+	bool bComplete = false;
+	int i;
+	for ( i = nSamples - 1; i >= 0 && i >= nSamples - TICKSAMPLER_MAX_SAMPLES; i-- )
+	{
+		const ticksample_t &sample = m_pSamples[i & ( TICKSAMPLER_MAX_SAMPLES - 1 )];
+		if ( sample.nFrame < nFrame )
+		{
+			bComplete = true;
+			break;
+		}
+
+		if ( sample.nFrame != nFrame )
+			continue;
+
+		char szStack[4096];
+		szStack[0] = 0;
+		if ( sample.pszNode )
+		{
+			V_snprintf( szStack, sizeof( szStack ), "[%s]", sample.pszNode );
+		}
+
+		// outermost caller first
+		for ( int iFrame = sample.nDepth - 1; iFrame >= TICKSAMPLER_SKIP_FRAMES; iFrame-- )
+		{
+			if ( szStack[0] )
+			{
+				V_strncat( szStack, ";", sizeof( szStack ) );
+			}
+			V_strncat( szStack, GetSymbolName( sample.stack[iFrame] ), sizeof( szStack ) );
+		}
+
+		int iStack = stacks.Find( szStack );
+		if ( iStack == stacks.InvalidIndex() )
+		{
+			iStack = stacks.Insert( szStack, 0 );
+		}
+		stacks[iStack]++;
+		nFound++;
+	}
+
+	if ( i < 0 )
+	{
+		bComplete = true;
+	}
+
+	if ( !nFound )
+	{
+		Msg( "Long tick %d took %.0f ms, no stack samples were taken.\n", m_nWriteTick, m_flWriteDuration * 1000.0f );
+		return;
+	}
+
+	char szFileName[MAX_PATH];
+	V_snprintf( szFileName, sizeof( szFileName ), "ticksamples/tick%d_%dms.folded", m_nWriteTick, (int)( m_flWriteDuration * 1000.0f ) );
+
+	g_pFileSystem->CreateDirHierarchy( "ticksamples", "DEFAULT_WRITE_PATH" );
+	FileHandle_t hFile = g_pFileSystem->Open( szFileName, "wt", "DEFAULT_WRITE_PATH" );
+	if ( hFile == FILESYSTEM_INVALID_HANDLE )
+	{
+		Warning( "Tick sampler: couldn't write %s.\n", szFileName );
+		return;
+	}
+
+	for ( int iStack = stacks.First(); iStack != stacks.InvalidIndex(); iStack = stacks.Next( iStack ) )
+	{
+		g_pFileSystem->FPrintf( hFile, "%s %d\n", stacks.GetElementName( iStack ), stacks[iStack] );
+	}
+
+	g_pFileSystem->Close( hFile );
+
+	Msg( "Long tick %d took %.0f ms, wrote %d stack samples to %s%s.\n", m_nWriteTick, m_flWriteDuration * 1000.0f, nFound, szFileName,
+		bComplete ? "" : " (the start of the tick was overwritten)" );
+#endif
+}
+
+int CTickSampler::Run()
+{
+	while ( !m_bThreadShouldExit )
+	{
+		ThreadSleep( sv_ticksampler_interval.GetInt() );
+
+		if ( m_bInTick )
+		{
+			SampleMainThread();
+		}
+
+		if ( m_nWriteFrame >= 0 )
+		{
+			ThreadMemoryBarrier();
+			WriteTick();
+			m_nWriteFrame = -1;
+		}
+	}
+
+	return 0;
+}
+
+static void OnTickSamplerChanged( IConVar *var, const char *pOldValue, float flOldValue )
+{
+	if ( sv_ticksampler.GetBool() )
+	{
+		if ( !g_TickSampler.Setup() )
+		{
+			sv_ticksampler.SetValue( 0 );
+		}
+	}
+	else
+	{
+		g_TickSampler.Shutdown();
+	}
+}
+
+void TickSampler_BeginTick()
+{
+	if ( sv_ticksampler.GetBool() )
+	{
+		g_TickSampler.BeginTick();
+	}
+}
+
+void TickSampler_EndTick( int nTick )
+{
+	if ( sv_ticksampler.GetBool() )
+	{
+		g_TickSampler.EndTick( nTick );
+	}
+}
+
+void TickSampler_Shutdown()
+{
+	g_TickSampler.Shutdown();
+}
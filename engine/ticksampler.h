@@ -0,0 +1,26 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Samples the main thread's stack while the server simulates and
+//			writes folded stacks for ticks that took too long
+//
+//=============================================================================
+
+#ifndef TICKSAMPLER_H
+#define TICKSAMPLER_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+// With sv_ticksampler 1 a thread interrupts the main thread every
+// sv_ticksampler_interval ms during server ticks and records its call stack.
+// Every tick longer than sv_ticksampler_threshold ms gets its samples written
+// as folded stacks ("frame;frame;frame count" per line, the input of
+// flamegraph.pl). Only implemented on Linux.
+
+// Main thread, around each server tick
+void TickSampler_BeginTick();
+void TickSampler_EndTick( int nTick );
+
+void TickSampler_Shutdown();
+
+#endif // TICKSAMPLER_H
@@ -15,6 +15,16 @@
 
 extern CTimedEventMgr g_NetworkPropertyEventMgr;
 
+// 0 is never handed out, so caches can use it for "nothing cached".
+static unsigned int s_nLastPVSInfoSerial = 0;
+
+static unsigned int NextPVSInfoSerial()
+{
+	if ( !++s_nLastPVSInfoSerial )
+		++s_nLastPVSInfoSerial;
+	return s_nLastPVSInfoSerial;
+}
+
 
 //-----------------------------------------------------------------------------
 // Save/load
@@ -65,6 +75,7 @@ void CServerNetworkProperty::Init( CBaseEntity *pEntity )
 //	m_pTransmitProxy = NULL;
 	m_bPendingStateChange = false;
 	m_PVSInfo.m_nClusterCount = 0;
+	m_nPVSInfoSerial = NextPVSInfoSerial();
 	m_TimerEvent.Init( &g_NetworkPropertyEventMgr, this );
 }
 
@@ -143,7 +154,25 @@ void CServerNetworkProperty::RecomputePVSInformation()
 	if ( m_pPev && ( ( m_pPev->m_fStateFlags & FL_EDICT_DIRTY_PVS_INFORMATION ) != 0 ) )
 	{
 		m_pPev->m_fStateFlags &= ~FL_EDICT_DIRTY_PVS_INFORMATION;
+
+		// Remember what IsInPVS looks at so we can tell if moving changed any of it
+		PVSInfo_t oldInfo = m_PVSInfo;
+		unsigned short oldClusters[MAX_ENT_CLUSTERS];
+		if ( oldInfo.m_nClusterCount > 0 )
+		{
+			memcpy( oldClusters, oldInfo.m_pClusters, oldInfo.m_nClusterCount * sizeof( unsigned short ) );
+		}
+
 		engine->BuildEntityClusterList( edict(), &m_PVSInfo );
+
+		if ( m_PVSInfo.m_nHeadNode != oldInfo.m_nHeadNode ||
+			m_PVSInfo.m_nClusterCount != oldInfo.m_nClusterCount ||
+			m_PVSInfo.m_nAreaNum != oldInfo.m_nAreaNum ||
+			m_PVSInfo.m_nAreaNum2 != oldInfo.m_nAreaNum2 ||
+			( m_PVSInfo.m_nClusterCount > 0 && memcmp( oldClusters, m_PVSInfo.m_pClusters, m_PVSInfo.m_nClusterCount * sizeof( unsigned short ) ) ) )
+		{
+			m_nPVSInfoSerial = NextPVSInfoSerial();
+		}
 	}
 }
 
@@ -101,6 +101,10 @@ public:
 	// Recomputes PVS information
 	void RecomputePVSInformation();
 
+	// Changes whenever RecomputePVSInformation moves the entity into different clusters or areas,
+	// never the same for two entities. Lets CheckTransmit reuse IsInPVS results.
+	unsigned int GetPVSInfoSerial() const;
+
 private:
 	// Detaches the edict.. should only be called by CBaseNetworkable's destructor.
 	void DetachEdict();
@@ -114,6 +118,7 @@ private:
 	// CBaseTransmitProxy *m_pTransmitProxy;
 	edict_t	*m_pPev;
 	PVSInfo_t m_PVSInfo;
+	unsigned int m_nPVSInfoSerial;
 	ServerClass *m_pServerClass;
 
 	// NOTE: This state is 'owned' by the entity. It's only copied here
@@ -248,6 +253,11 @@ inline void CServerNetworkProperty::SetEdict( edict_t *pEdict )
 }
 
 
+inline unsigned int CServerNetworkProperty::GetPVSInfoSerial() const
+{
+	return m_nPVSInfoSerial;
+}
+
 inline int CServerNetworkProperty::AreaNum() const
 {
 	const_cast<CServerNetworkProperty*>(this)->RecomputePVSInformation();
@@ -203,6 +203,7 @@ static ConVar s_UseNetworkVars( "UseNetworkVars", "1", FCVAR_CHEAT, "For profili
 
 extern ConVar sv_noclipduringpause;
 ConVar sv_massreport( "sv_massreport", "0" );
+ConVar sv_transmit_pvscache( "sv_transmit_pvscache", "1", 0, "Reuse each player's PVS checks from the last CheckTransmit for entities that haven't changed clusters while the player's view of the map stays the same." );
 ConVar sv_force_transmit_ents( "sv_force_transmit_ents", "0", FCVAR_CHEAT | FCVAR_DEVELOPMENTONLY, "Will transmit all entities to client, regardless of PVS conditions (will still skip based on transmit flags, however)." );
 
 ConVar sv_autosave( "sv_autosave", "1", 0, "Set to 1 to autosave game on level transition. Does not affect autosave triggers." );
@@ -2439,6 +2440,102 @@ inline void CServerNetworkProperty::CheckTransmit( CCheckTransmitInfo *pInfo )
 	}
 } */
 
+//-----------------------------------------------------------------------------
+// Remembers each player's IsInPVS() results. They stay valid while the player's PVS,
+// networked areas and area portal flood numbers are the same as in the last CheckTransmit
+// (the engine hands us those in GetPrevCheckTransmitInfo), so for most ticks only the
+// entities that moved into different clusters need to be tested again.
+//-----------------------------------------------------------------------------
+class CTransmitPVSCache : public CAutoGameSystem
+{
+public:
+	CTransmitPVSCache() : CAutoGameSystem( "CTransmitPVSCache" ), m_pCurrent( NULL ) {}
+
+	virtual void LevelShutdownPostEntity()	{ Purge(); }
+	virtual void Shutdown()					{ Purge(); }
+
+	// Picks the recipient's cache, emptying it if what the player can see has changed.
+	void BeginCheckTransmit( const CCheckTransmitInfo *pInfo )
+	{
+		m_pCurrent = NULL;
+		if ( !sv_transmit_pvscache.GetBool() )
+		{
+			// Nothing tracks visibility changes while we're off, so don't keep anything.
+			Purge();
+			return;
+		}
+
+		int iPlayer = ENTINDEX( pInfo->m_pClientEnt );
+		if ( iPlayer >= m_Players.Count() )
+		{
+			int nOldCount = m_Players.Count();
+			m_Players.AddMultipleToTail( iPlayer + 1 - nOldCount );
+			for ( int i = nOldCount; i < m_Players.Count(); i++ )
+			{
+				m_Players[i] = NULL;
+			}
+		}
+
+		PlayerCache_t *pCache = m_Players[iPlayer];
+		if ( !pCache )
+		{
+			pCache = m_Players[iPlayer] = new PlayerCache_t;
+			Q_memset( pCache->m_PVSInfoSerial, 0, sizeof( pCache->m_PVSInfoSerial ) );
+		}
+		else if ( !IsSameVisibility( pInfo, engine->GetPrevCheckTransmitInfo( pInfo->m_pClientEnt ) ) )
+		{
+			Q_memset( pCache->m_PVSInfoSerial, 0, sizeof( pCache->m_PVSInfoSerial ) );
+		}
+		m_pCurrent = pCache;
+	}
+
+	// PVS information must be up to date, like for CServerNetworkProperty::IsInPVS.
+	bool IsInPVS( CServerNetworkProperty *pNetProp, const CCheckTransmitInfo *pInfo )
+	{
+		if ( !m_pCurrent )
+			return pNetProp->IsInPVS( pInfo );
+
+		int iEdict = pNetProp->entindex();
+		unsigned int nSerial = pNetProp->GetPVSInfoSerial();
+		if ( m_pCurrent->m_PVSInfoSerial[iEdict] == nSerial )
+			return m_pCurrent->m_InPVS.IsBitSet( iEdict );
+
+		bool bInPVS = pNetProp->IsInPVS( pInfo );
+		m_pCurrent->m_PVSInfoSerial[iEdict] = nSerial;
+		m_pCurrent->m_InPVS.Set( iEdict, bInPVS );
+		return bInPVS;
+	}
+
+private:
+	struct PlayerCache_t
+	{
+		unsigned int		m_PVSInfoSerial[MAX_EDICTS];	// 0 if nothing is cached
+		CBitVec<MAX_EDICTS>	m_InPVS;
+	};
+
+	static bool IsSameVisibility( const CCheckTransmitInfo *pInfo, const CCheckTransmitInfo *pPrevInfo )
+	{
+		return pPrevInfo &&
+			pInfo->m_nPVSSize == pPrevInfo->m_nPVSSize &&
+			pInfo->m_AreasNetworked == pPrevInfo->m_AreasNetworked &&
+			pInfo->m_nMapAreas == pPrevInfo->m_nMapAreas &&
+			!Q_memcmp( pInfo->m_PVS, pPrevInfo->m_PVS, pInfo->m_nPVSSize ) &&
+			!Q_memcmp( pInfo->m_Areas, pPrevInfo->m_Areas, pInfo->m_AreasNetworked * sizeof( pInfo->m_Areas[0] ) ) &&
+			!Q_memcmp( pInfo->m_AreaFloodNums, pPrevInfo->m_AreaFloodNums, pInfo->m_nMapAreas * sizeof( pInfo->m_AreaFloodNums[0] ) );
+	}
+
+	void Purge()
+	{
+		m_pCurrent = NULL;
+		m_Players.PurgeAndDeleteElements();
+	}
+
+	CUtlVector< PlayerCache_t * > m_Players;	// by player entindex
+	PlayerCache_t *m_pCurrent;
+};
+
+static CTransmitPVSCache g_TransmitPVSCache;
+
 void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned short *pEdictIndices, int nEdicts )
 {
 	// NOTE: for speed's sake, this assumes that all networkables are CBaseEntities and that the edict list
@@ -2447,6 +2544,8 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 	// optimization which would be nice to keep.
 	edict_t *pBaseEdict = engine->PEntityOfEntIndex( 0 );
 
+	g_TransmitPVSCache.BeginCheckTransmit( pInfo );
+
 	// get recipient player's skybox:
 	CBaseEntity *pRecipientEntity = CBaseEntity::Instance( pInfo->m_pClientEnt );
 
@@ -2561,7 +2660,7 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 			continue;
 		}
 
-		bool bInPVS = netProp->IsInPVS( pInfo );
+		bool bInPVS = g_TransmitPVSCache.IsInPVS( netProp, pInfo );
 		if ( bInPVS || sv_force_transmit_ents.GetBool() )
 		{
 			// only send if entity is in PVS
@@ -2616,7 +2715,7 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 			{
 				// Check pvs
 				check->RecomputePVSInformation();
-				bool bMoveParentInPVS = check->IsInPVS( pInfo );
+				bool bMoveParentInPVS = g_TransmitPVSCache.IsInPVS( check, pInfo );
 				if ( bMoveParentInPVS )
 				{
 					orig->SetTransmit( pInfo, true );
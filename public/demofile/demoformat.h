@@ -16,6 +16,18 @@
 
 #define DEMO_HEADER_ID		"HL2DEMO"
 #define DEMO_PROTOCOL		3
+#define DEMO_PROTOCOL_INDEXED	4	// adds dem_keyframe and the trailing keyframe index
+
+#define DEMO_INDEX_ID		"HL2DIDX"
+
+// Compressed demos keep the demoheader_t uncompressed, followed by these four
+// bytes and then blocks of a little endian int size and that many bytes of
+// tier1 compression codec data until the end of the file. Blocks with a
+// negative size are stored, -size bytes follow as they are. A block holds at
+// most DEMO_COMPRESSED_MAX_BLOCK bytes uncompressed, commands bigger than that
+// continue in the next block.
+#define DEMO_COMPRESSED_ID	"DEMZ"
+#define DEMO_COMPRESSED_MAX_BLOCK	(1024*1024)
 
 #if !defined( MAX_OSPATH )
 #define	MAX_OSPATH		260			// max length of a filesystem pathname
@@ -41,8 +53,11 @@ enum
 
 	dem_stringtables,
 
+	// full string table and entity state to start playback from, only in indexed demos
+	dem_keyframe,
+
 	// Last command
-	dem_lastcmd		= dem_stringtables
+	dem_lastcmd		= dem_keyframe
 };
 
 struct demoheader_t
@@ -70,6 +85,21 @@ inline void ByteSwap_demoheader_t( demoheader_t &swap )
 	swap.signonlength = LittleDWord( swap.signonlength );
 }
 
+// Indexed demos end with a table of all keyframes followed by a demoindextrailer_t,
+// so players can find the table from the end of the file. Both are little endian.
+struct demoindexentry_t
+{
+	int		tick;							// recording tick of the keyframe
+	int		fileoffset;						// file position of its dem_keyframe command
+};
+
+struct demoindextrailer_t
+{
+	char	indexfilestamp[8];				// Should be HL2DIDX
+	int		numentries;						// # of demoindexentry_t
+	int		indexoffset;					// file position of the first entry
+};
+
 #define FDEMO_NORMAL		0
 #define FDEMO_USE_ORIGIN2	(1<<0)
 #define FDEMO_USE_ANGLES2	(1<<1)
@@ -85,6 +85,10 @@ public:
 	virtual int		GetMaxRoutablePayloadSize() = 0;
 
 	virtual int		GetProtocolVersion() = 0;
+
+	// Codec (CompressionCodec_t) for the data we compress, the receiver has to support it
+	virtual void	SetCompressionCodec( int nCodec ) = 0;
+	virtual int		GetCompressionCodec() const = 0;
 };
 
 
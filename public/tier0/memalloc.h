@@ -27,6 +27,10 @@
 #endif
 #endif
 
+// Define this to keep MEM_ALLOC_CREDIT in release builds, allocation traces
+// (tier0/memtrace.h) tag their events with it
+//#define USE_MEM_TRACE_CREDIT 1
+
 // Undefine this if using a compiler lacking threadsafe RTTI (like vc6)
 #ifndef COMPILER_MSVC
 #define MEM_DEBUG_CLASSNAME 1
@@ -332,7 +336,7 @@ inline size_t MemAlloc_GetSizeAligned( void *pMemBlock )
 
 //-----------------------------------------------------------------------------
 
-#if (defined(_DEBUG) || defined(USE_MEM_DEBUG))
+#if (defined(_DEBUG) || defined(USE_MEM_DEBUG) || defined(USE_MEM_TRACE_CREDIT))
 #define MEM_ALLOC_CREDIT_JOIN_AGAIN( a, b )							a ## b
 #define MEM_ALLOC_CREDIT_JOIN( a, b )								MEM_ALLOC_CREDIT_JOIN_AGAIN( a, b )
 #define MEM_ALLOC_CREDIT_(tag)										CMemAllocAttributeAlloction MEM_ALLOC_CREDIT_JOIN( memAllocAttributeAlloction, __LINE__ )( tag, __LINE__ )
@@ -0,0 +1,93 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Allocation traces. tier0's allocator can record every alloc,
+//			realloc and free with its size, thread, caller, MEM_ALLOC_CREDIT
+//			context and time; utils/allocreplay reads the traces.
+//
+//=============================================================================//
+
+#ifndef TIER0_MEMTRACE_H
+#define TIER0_MEMTRACE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/platform.h"
+
+#define MEMTRACE_FILE_ID		"MTRC"
+#define MEMTRACE_VERSION		2
+
+//-----------------------------------------------------------------------------
+// A trace file is a memtraceheader_t followed by chunks, each a
+// memtracechunk_t and m_nBytes of data. A trace that reaches its size limit
+// moves the file to <name>.1 and starts over, every file repeats the strings
+// its events refer to.
+//-----------------------------------------------------------------------------
+enum MemTraceChunk_t
+{
+	MEMTRACE_CHUNK_EVENTS = 1,		// memtraceevents_t, then m_nEvents memtraceevent_t
+	MEMTRACE_CHUNK_STRING,			// memtracestring_t, then the string and its terminator
+	MEMTRACE_CHUNK_DROPPED,			// uint32, events lost so far because the writer fell behind
+};
+
+enum MemTraceString_t
+{
+	MEMTRACE_STRING_CALLSITE = 1,	// module!function+offset of the code that called the allocator
+	MEMTRACE_STRING_CREDIT,			// the innermost MEM_ALLOC_CREDIT
+};
+
+struct memtraceheader_t
+{
+	char	m_Id[4];
+	uint32	m_nVersion;
+	uint64	m_nStartTime;			// microseconds since 1970
+};
+
+struct memtracechunk_t
+{
+	uint32	m_nType;
+	uint32	m_nBytes;
+};
+
+// One thread's events, in the order it made them
+struct memtraceevents_t
+{
+	uint32	m_nThread;
+	uint32	m_nEvents;
+	uint64	m_nTime;				// microseconds since the trace started
+};
+
+// Every event takes m_nOldBlock to m_nBlock. Allocations have no old block,
+// frees have no new one. A realloc may also be split in two: the old block with
+// the requested size and no new block before the call, then the new block with
+// no old one from the same thread after it (the old block again if it failed).
+struct memtraceevent_t
+{
+	uint64	m_nBlock;
+	uint64	m_nOldBlock;
+	uint32	m_nSize;				// bytes requested
+	uint32	m_nTime;				// microseconds after memtraceevents_t::m_nTime
+	uint32	m_nCallsite;			// string ids, 0 for none
+	uint32	m_nCredit;
+};
+
+struct memtracestring_t
+{
+	uint32	m_nKind;
+	uint32	m_nId;
+};
+
+#if !defined(STEAM) && !defined(NO_MALLOC_OVERRIDE)
+
+// Starts recording to pszFileName, false if a trace is running already or the
+// file can't be written. Events are buffered per thread and written by a
+// background thread; a thread's events reach the file once its buffer fills,
+// is a second old or the thread exits. pszFileName is opened and rotated as is,
+// callers taking names from the console must validate them.
+PLATFORM_INTERFACE bool MemAlloc_StartTrace( const char *pszFileName, int nMaxFileMB );
+PLATFORM_INTERFACE void MemAlloc_StopTrace();
+PLATFORM_INTERFACE bool MemAlloc_IsTracing();
+
+#endif
+
+#endif // TIER0_MEMTRACE_H
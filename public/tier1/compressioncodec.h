@@ -0,0 +1,53 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Common interface to the buffer compressors in tier1. Compressed
+//			buffers start with the four byte id of their codec, so whoever
+//			decompresses doesn't need to know which codec was used.
+//
+//=============================================================================
+
+#ifndef COMPRESSIONCODEC_H
+#define COMPRESSIONCODEC_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+enum CompressionCodec_t
+{
+	COMPRESSION_CODEC_LZSS = 0,
+	COMPRESSION_CODEC_SNAPPY,
+	COMPRESSION_CODEC_LZ4,
+
+	COMPRESSION_CODEC_COUNT
+};
+
+abstract_class ICompressionCodec
+{
+public:
+	virtual CompressionCodec_t	GetCodec() const = 0;
+	virtual const char			*GetName() const = 0;
+	virtual uint32				GetID() const = 0;
+
+	// Size of a destination buffer that Compress() can always use, including the id.
+	virtual unsigned int		GetMaxCompressedSize( unsigned int nSourceLen ) const = 0;
+
+	// *pDestLen is the size of pDest on input and the compressed size on output.
+	// Fails if the data doesn't fit, LZSS also fails if it can't shrink the data.
+	virtual bool				Compress( void *pDest, unsigned int *pDestLen, const void *pSource, unsigned int nSourceLen ) const = 0;
+
+	// -1 if pSource isn't something this codec compressed.
+	virtual int					GetUncompressedSize( const void *pSource, unsigned int nSourceLen ) const = 0;
+
+	// *pDestLen is the size of pDest on input and the uncompressed size on output.
+	virtual bool				Uncompress( void *pDest, unsigned int *pDestLen, const void *pSource, unsigned int nSourceLen ) const = 0;
+};
+
+const ICompressionCodec *GetCompressionCodec( CompressionCodec_t codec );
+
+// NULL if there is no codec with that name
+const ICompressionCodec *FindCompressionCodec( const char *pszName );
+
+// codec that compressed pSource, NULL if the data doesn't start with a known id
+const ICompressionCodec *FindCompressionCodecForData( const void *pSource, unsigned int nSourceLen );
+
+#endif // COMPRESSIONCODEC_H
@@ -0,0 +1,118 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Reads KeyValues text into a read only tree without copying it
+//
+//=============================================================================//
+
+#ifndef KEYVALUESTREE_H
+#define KEYVALUESTREE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier1/mempool.h"
+#include "tier1/utlvector.h"
+#include "tier1/utlmemory.h"
+
+class KeyValues;
+
+//-----------------------------------------------------------------------------
+// A key in a CKeyValuesTree. The name and value point into the parsed buffer,
+// sections have no value. Values stay text until they're asked for.
+//-----------------------------------------------------------------------------
+class CKeyValuesTreeNode
+{
+public:
+	const char *GetName() const { return m_pszName; }
+	bool IsSection() const { return m_pszValue == NULL; }
+
+	// Finds a subkey, ignoring case. The name can be a path like "a/b/c".
+	const CKeyValuesTreeNode *FindKey( const char *pszKeyName ) const;
+
+	// Data access, converts like KeyValues does for string values.
+	// Sections give the default.
+	const char *GetString( const char *pszKeyName = NULL, const char *pszDefault = "" ) const;
+	int GetInt( const char *pszKeyName = NULL, int nDefault = 0 ) const;
+	float GetFloat( const char *pszKeyName = NULL, float flDefault = 0.0f ) const;
+	bool GetBool( const char *pszKeyName = NULL, bool bDefault = false ) const;
+
+	// Iteration, in file order
+	const CKeyValuesTreeNode *GetFirstSubKey() const { return m_pSub; }
+	const CKeyValuesTreeNode *GetNextKey() const { return m_pPeer; }
+
+	// Only the sections, or only the values
+	const CKeyValuesTreeNode *GetFirstTrueSubKey() const;
+	const CKeyValuesTreeNode *GetNextTrueSubKey() const;
+	const CKeyValuesTreeNode *GetFirstValue() const;
+	const CKeyValuesTreeNode *GetNextValue() const;
+
+private:
+	friend class CKeyValuesTree;
+
+	const char			*m_pszName;
+	const char			*m_pszValue;	// NULL for sections
+	CKeyValuesTreeNode	*m_pSub;
+	CKeyValuesTreeNode	*m_pPeer;
+};
+
+//-----------------------------------------------------------------------------
+// Parses the same text KeyValues::LoadFromBuffer does, but tokens are
+// terminated and unescaped where they lie in the buffer and the nodes come
+// out of a pool the tree owns, so a parse allocates a few blobs and touches
+// no symbol table. Parts of the tree that need to be changed or handed to
+// code taking KeyValues are copied out with MakeKeyValues.
+//
+// #include and #base aren't followed, the tree just lists the files. Unlike
+// LoadFromBuffer, tokens have no length limit and a top level key following
+// one a conditional dropped isn't lost.
+//-----------------------------------------------------------------------------
+class CKeyValuesTree
+{
+public:
+	CKeyValuesTree();
+	~CKeyValuesTree();
+
+	// Same meaning and defaults as on KeyValues
+	void UsesEscapeSequences( bool state ) { m_bEscapeSequences = state; }	// default false
+	void UsesConditionals( bool state ) { m_bEvaluateConditionals = state; }	// default true
+
+	// Parses a null terminated buffer in place. The buffer is modified and
+	// has to outlive the tree. Returns false if there were errors, keys
+	// read before them are kept like KeyValues does.
+	bool Parse( const char *pszResourceName, char *pBuffer );
+
+	// Frees the nodes, the buffer stays the caller's
+	void Purge();
+
+	// The top level keys, in file order
+	const CKeyValuesTreeNode *GetFirstKey() const { return m_Root.m_pSub; }
+	const CKeyValuesTreeNode *FindKey( const char *pszKeyName ) const;
+
+	const CUtlVector< const char * > &GetIncludes() const { return m_Includes; }
+	const CUtlVector< const char * > &GetBases() const { return m_Bases; }
+
+	int GetNodeCount() const { return m_Nodes.Count(); }
+
+	// Copies a node and everything under it into a new KeyValues the caller
+	// deletes. With bSiblings the node's next keys are copied as its peers,
+	// MakeKeyValues( GetFirstKey(), true ) gives what LoadFromBuffer would.
+	KeyValues *MakeKeyValues( const CKeyValuesTreeNode *pNode, bool bSiblings = false ) const;
+
+private:
+	CKeyValuesTreeNode *NewNode( const char *pszName );
+	bool ParseSection( CKeyValuesTreeNode *pSection, class CKeyValuesTreeTokenizer &tokens, int nDepth );
+	void ReportError( const char *pszError );
+	void CopyInto( KeyValues *pKeyValues, const CKeyValuesTreeNode *pNode ) const;
+
+	CUtlMemoryPool			m_Nodes;
+	CKeyValuesTreeNode		m_Root;
+	CUtlVector< const char * > m_Includes;
+	CUtlVector< const char * > m_Bases;
+	CUtlMemory< char >		m_UTF8;		// unicode files are converted into this
+	const char				*m_pszResourceName;
+	bool					m_bEscapeSequences;
+	bool					m_bEvaluateConditionals;
+	bool					m_bErrors;
+};
+
+#endif // KEYVALUESTREE_H
@@ -0,0 +1,40 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+//	LZ4 block format codec. Greedy single probe match finder, much faster than
+//	LZSS at a similar ratio, meant for network payloads compressed every frame.
+//
+//=====================================================================================//
+
+#ifndef _LZ4_H
+#define _LZ4_H
+#pragma once
+
+#define LZ4_ID uint32( BigLong( ('L'<<24)|('Z'<<16)|('4'<<8)|('B') ) )
+
+#define LZ4_HASH_LOG 12
+
+class CLZ4
+{
+public:
+	// Raw LZ4 blocks, no header. Compress returns 0 if the output doesn't fit,
+	// Uncompress returns -1 on malformed input or if the output doesn't fit.
+	unsigned int		Compress( const unsigned char *pInput, unsigned int nInputSize, unsigned char *pOutput, unsigned int nOutputSize );
+	static int			Uncompress( const unsigned char *pInput, unsigned int nInputSize, unsigned char *pOutput, unsigned int nOutputSize );
+
+	// Output buffer size that never makes Compress fail.
+	static unsigned int	GetMaxCompressedSize( unsigned int nInputSize ) { return nInputSize + nInputSize / 255 + 16; }
+
+	// Higher acceleration skips ahead faster on incompressible data, trading ratio for speed.
+	FORCEINLINE CLZ4( int nAcceleration = 1 );
+
+private:
+	unsigned int		m_HashTable[1 << LZ4_HASH_LOG];
+	int					m_nAcceleration;
+};
+
+FORCEINLINE CLZ4::CLZ4( int nAcceleration )
+{
+	m_nAcceleration = nAcceleration < 1 ? 1 : nAcceleration;
+}
+
+#endif
@@ -88,8 +88,8 @@ void CDbgLogger::Disable()
 
 	while( iMsg > 0 )
 	{
-		delete[] pMsgs[iMsg];
 		iMsg--;
+		delete[] pMsgs[iMsg];
 	}
 }
 
@@ -135,8 +135,8 @@ CDbgLogger::~CDbgLogger()
 {
 	while( iMsg > 0 )
 	{
-		delete[] pMsgs[iMsg];
 		iMsg--;
+		delete[] pMsgs[iMsg];
 	}
 
 	if( !file )
@@ -35,4 +35,27 @@ size_t CalcHeapUsed();
 // platforms (Xbox 360, PS3, 32-bit Windows, etc.)
 void ReserveBottomMemory();
 
+// Allocation traces, see tier0/memtrace.h. The allocators report every event
+// while a trace is running, the credit is NULL for the thread's innermost
+// MEM_ALLOC_CREDIT.
+extern volatile bool g_bMemTraceActive;
+void MemTrace_Record( void *pOldBlock, void *pBlock, size_t nSize, const void *pCaller, const char *pszCredit );
+void MemTrace_PushCredit( const char *pszCredit );
+void MemTrace_PopCredit();
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define MemTrace_Caller() _ReturnAddress()
+#else
+#define MemTrace_Caller() __builtin_return_address( 0 )
+#endif
+
+#define MemTrace_Alloc( pMem, nSize ) if ( !g_bMemTraceActive || !(pMem) ) ; else MemTrace_Record( NULL, pMem, nSize, MemTrace_Caller(), NULL )
+// A realloc is two events, the release goes before the call so a thread handed
+// the old block can't record it first. End takes the old block as an integer
+// saved before the call, it is freed by then.
+#define MemTrace_ReallocBegin( pOldMem, nSize ) if ( !g_bMemTraceActive ) ; else MemTrace_Record( pOldMem, NULL, nSize, MemTrace_Caller(), NULL )
+#define MemTrace_ReallocEnd( nOldBlock, pMem, nSize ) if ( !g_bMemTraceActive || ( !(pMem) && !(nSize) ) ) ; else MemTrace_Record( NULL, (pMem) ? (pMem) : (void *)(nOldBlock), nSize, MemTrace_Caller(), NULL )
+#define MemTrace_Free( pMem ) if ( !g_bMemTraceActive ) ; else MemTrace_Record( pMem, NULL, 0, MemTrace_Caller(), NULL )
+
 #endif // MEM_HELPERS_H
@@ -1202,6 +1202,10 @@ void *CDbgMemAlloc::Alloc( size_t nSize, const char *pFileName, int nLine )
 	if ( pMem )
 	{
 		RegisterAllocation( GetAllocatonFileName( pMem ), GetAllocatonLineNumber( pMem ), InternalLogicalSize( pMem ), InternalMSize( pMem ), m_Timer.GetDuration().GetMicroseconds() );
+		if ( g_bMemTraceActive )
+		{
+			MemTrace_Record( NULL, pMem, nSize, MemTrace_Caller(), pFileName );
+		}
 	}
 	else
 	{
@@ -1226,6 +1230,8 @@ void *CDbgMemAlloc::Realloc( void *pMem, size_t nSize, const char *pFileName, in
 
 	GetActualDbgInfo( pFileName, nLine );
 
+	// the heap lock is held until the realloc is recorded, so it can be one event
+	uintp nOldBlock = (uintp)pMem;
 	m_Timer.Start();
 	pMem = InternalRealloc( pMem, nSize, pFileName, nLine );
 	m_Timer.End();
@@ -1233,6 +1239,10 @@ void *CDbgMemAlloc::Realloc( void *pMem, size_t nSize, const char *pFileName, in
 	if ( pMem )
 	{
 		RegisterAllocation( GetAllocatonFileName( pMem ), GetAllocatonLineNumber( pMem ), InternalLogicalSize( pMem), InternalMSize( pMem ), m_Timer.GetDuration().GetMicroseconds() );
+		if ( g_bMemTraceActive )
+		{
+			MemTrace_Record( (void *)nOldBlock, pMem, nSize, MemTrace_Caller(), pFileName );
+		}
 	}
 	else
 	{
@@ -1259,6 +1269,11 @@ void  CDbgMemAlloc::Free( void *pMem, const char * /*pFileName*/, int nLine )
 	const char *pOldFileName = GetAllocatonFileName( pMem );
 	int oldLine = GetAllocatonLineNumber( pMem );
 
+	if ( g_bMemTraceActive )
+	{
+		MemTrace_Record( pMem, NULL, 0, MemTrace_Caller(), pOldFileName );
+	}
+
 	m_Timer.Start();
 	InternalFree( pMem );
  	m_Timer.End();
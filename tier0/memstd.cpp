@@ -18,6 +18,11 @@
 #undef Verify
 #define VA_COMMIT_FLAGS (MEM_COMMIT|MEM_NOZERO|MEM_LARGE_PAGES)
 #define VA_RESERVE_FLAGS (MEM_RESERVE|MEM_LARGE_PAGES)
+#elif defined( LINUX )
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 #endif
 
 #ifdef OSX
@@ -544,13 +549,16 @@ public:
 CInitGlobalMemAllocPtr sg_InitGlobalMemAllocPtr;
 #endif
 
-#ifdef _WIN32
+#if defined( _WIN32 ) || defined( LINUX )
 //-----------------------------------------------------------------------------
 // Small block heap (multi-pool)
 //-----------------------------------------------------------------------------
 
 #ifndef NO_SBH
-#ifdef ALLOW_NOSBH
+#if defined( LINUX )
+static bool g_UsingSBH = false;	// -sbh, see memstd.h
+#define UsingSBH() g_UsingSBH
+#elif defined( ALLOW_NOSBH )
 static bool g_UsingSBH = true;
 #define UsingSBH() g_UsingSBH
 #else
@@ -569,6 +577,104 @@ inline T MemAlign( T val, size_t alignment )
 {
 	return (T)( ( (size_t)val + alignment - 1 ) & ~( alignment - 1 ) );
 }
+//-----------------------------------------------------------------------------
+// Pool regions are reserved up front and committed a page run at a time
+//-----------------------------------------------------------------------------
+#if defined( LINUX )
+static byte *SBHReserve( size_t nBytes )
+{
+	void *p = mmap( NULL, nBytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+	return ( p != MAP_FAILED ) ? (byte *)p : NULL;
+}
+
+static bool SBHCommit( byte *p, size_t nBytes )
+{
+	return ( mprotect( p, nBytes, PROT_READ | PROT_WRITE ) == 0 );
+}
+
+static void SBHDecommit( byte *p, size_t nBytes )
+{
+	madvise( p, nBytes, MADV_DONTNEED );
+	mprotect( p, nBytes, PROT_NONE );
+}
+
+// Runs before anything that could parse the command line for us is constructed
+static bool SBHRequested()
+{
+	int fd = open( "/proc/self/cmdline", O_RDONLY );
+	if ( fd < 0 )
+	{
+		return false;
+	}
+
+	char buf[4096];
+	int nRead = read( fd, buf, sizeof( buf ) - 1 );
+	close( fd );
+	if ( nRead <= 0 )
+	{
+		return false;
+	}
+	buf[nRead] = 0;
+
+	for ( char *pArg = buf; pArg < buf + nRead; pArg += strlen( pArg ) + 1 )
+	{
+		if ( !strcmp( pArg, "-sbh" ) )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+#else
+static byte *SBHReserve( size_t nBytes )
+{
+	return (byte *)VirtualAlloc( NULL, nBytes, VA_RESERVE_FLAGS, PAGE_NOACCESS );
+}
+
+static bool SBHCommit( byte *p, size_t nBytes )
+{
+	return ( VirtualAlloc( p, nBytes, VA_COMMIT_FLAGS, PAGE_READWRITE ) != NULL );
+}
+
+static void SBHDecommit( byte *p, size_t nBytes )
+{
+	VirtualFree( p, nBytes, MEM_DECOMMIT );
+}
+#endif
+
+#ifdef MEM_SBH_MAGAZINES
+//-----------------------------------------------------------------------------
+// Per-thread magazines. A thread allocates from and frees to its own stack of
+// blocks for each pool and only goes to the pool when one runs empty or full,
+// then half a magazine moves at once.
+//-----------------------------------------------------------------------------
+struct SBHMagazines_t
+{
+	void *m_pBlocks[NUM_POOLS][SBH_MAGAZINE_SIZE];
+	int m_nBlocks[NUM_POOLS];
+};
+
+static __thread SBHMagazines_t *s_pMagazines;
+static __thread bool s_bMagazinesReleased;		// thread is exiting, go straight to the pools
+static pthread_key_t s_MagazinesKey;
+static bool s_bMagazinesKey;
+
+static SBHMagazines_t *GetThreadMagazines()
+{
+	SBHMagazines_t *pMagazines = s_pMagazines;
+	if ( !pMagazines && s_bMagazinesKey && !s_bMagazinesReleased )
+	{
+		pMagazines = (SBHMagazines_t *)calloc( 1, sizeof( SBHMagazines_t ) );
+		if ( pMagazines )
+		{
+			s_pMagazines = pMagazines;
+			pthread_setspecific( s_MagazinesKey, pMagazines );
+		}
+	}
+	return pMagazines;
+}
+#endif
+
 //-----------------------------------------------------------------------------
 // 
 //-----------------------------------------------------------------------------
@@ -585,7 +691,7 @@ void CSmallBlockPool::Init( unsigned nBlockSize, byte *pBase, unsigned initialCo
 	if ( initialCommit )
 	{
 		initialCommit = MemAlign( initialCommit, SBH_PAGE_SIZE );
-		if ( !VirtualAlloc( m_pCommitLimit, initialCommit, VA_COMMIT_FLAGS, PAGE_READWRITE ) )
+		if ( !SBHCommit( m_pCommitLimit, initialCommit ) )
 		{
 			Assert( 0 );
 			return;
@@ -631,7 +737,7 @@ void *CSmallBlockPool::Alloc()
 							{
 					if ( pCommitLimit + COMMIT_SIZE <= m_pAllocLimit )
 								{
-						if ( !VirtualAlloc( pCommitLimit, COMMIT_SIZE, VA_COMMIT_FLAGS, PAGE_READWRITE ) )
+						if ( !SBHCommit( pCommitLimit, COMMIT_SIZE ) )
 								{
 							Assert( 0 );
 							return NULL;
@@ -657,10 +763,54 @@ void CSmallBlockPool::Free( void *p )
 	m_FreeList.Push( p );
 }
 
-// Count the free blocks.  
+#ifdef MEM_SBH_MAGAZINES
+// Blocks in the depot are chained through their second word, the first
+// belongs to the list
+int CSmallBlockPool::AllocMagazine( void **ppBlocks )
+{
+	FreeBlock_t *pBlock = m_Depot.Pop();
+	if ( pBlock )
+	{
+		for ( int i = 0; i < SBH_MAGAZINE_SIZE / 2; i++ )
+		{
+			ppBlocks[i] = pBlock;
+			pBlock = ((FreeBlock_t **)pBlock)[1];
+		}
+		return SBH_MAGAZINE_SIZE / 2;
+	}
+
+	int nBlocks = 0;
+	while ( nBlocks < SBH_MAGAZINE_SIZE / 2 )
+	{
+		void *p = Alloc();
+		if ( !p )
+		{
+			break;
+		}
+		ppBlocks[nBlocks++] = p;
+	}
+	return nBlocks;
+}
+
+void CSmallBlockPool::FreeMagazine( void **ppBlocks )
+{
+	for ( int i = 0; i < SBH_MAGAZINE_SIZE / 2; i++ )
+	{
+		Assert( IsOwner( ppBlocks[i] ) );
+		((void **)ppBlocks[i])[1] = ( i + 1 < SBH_MAGAZINE_SIZE / 2 ) ? ppBlocks[i + 1] : NULL;
+	}
+	m_Depot.Push( (FreeBlock_t *)ppBlocks[0] );
+}
+#endif
+
+// Count the free blocks.  Blocks cached by threads count as allocated
 int CSmallBlockPool::CountFreeBlocks()
 {
+#ifdef MEM_SBH_MAGAZINES
+	return m_FreeList.Count() + m_Depot.Count() * ( SBH_MAGAZINE_SIZE / 2 );
+#else
 	return m_FreeList.Count();
+#endif
 }
 
 // Size of committed memory managed by this heap:
@@ -687,6 +837,17 @@ int CSmallBlockPool::CountAllocatedBlocks()
 int CSmallBlockPool::Compact()
 {
 	int nBytesFreed = 0;
+#ifdef MEM_SBH_MAGAZINES
+	while ( FreeBlock_t *pBlock = m_Depot.Pop() )
+	{
+		for ( int i = 0; i < SBH_MAGAZINE_SIZE / 2; i++ )
+		{
+			FreeBlock_t *pNext = ((FreeBlock_t **)pBlock)[1];
+			m_FreeList.Push( pBlock );
+			pBlock = pNext;
+		}
+	}
+#endif
 	if ( m_FreeList.Count() )
 {
 	int i;
@@ -727,7 +888,7 @@ int CSmallBlockPool::Compact()
 			if ( pNewCommitLimit < m_pCommitLimit )
 		{
 				nBytesFreed = m_pCommitLimit - pNewCommitLimit;
-				VirtualFree( pNewCommitLimit, nBytesFreed, MEM_DECOMMIT );
+				SBHDecommit( pNewCommitLimit, nBytesFreed );
 				m_pCommitLimit = pNewCommitLimit;
 		}
 	}
@@ -761,13 +922,28 @@ CSmallBlockHeap::CSmallBlockHeap()
 	// Make sure that we return 64-bit addresses in 64-bit builds.
 	ReserveBottomMemory();
 
+#if defined( LINUX ) && !defined( NO_SBH )
+	g_UsingSBH = SBHRequested();
+#endif
+
 	if ( !UsingSBH() )
 	{
 		return;
 	}
 
-	m_pBase = (byte *)VirtualAlloc( NULL, NUM_POOLS * MAX_POOL_REGION, VA_RESERVE_FLAGS, PAGE_NOACCESS );
-	m_pLimit = m_pBase + NUM_POOLS * MAX_POOL_REGION;
+	m_pBase = SBHReserve( (size_t)NUM_POOLS * MAX_POOL_REGION );
+#if defined( LINUX ) && !defined( NO_SBH )
+	if ( !m_pBase )
+	{
+		g_UsingSBH = false;
+		return;
+	}
+#endif
+	m_pLimit = m_pBase + (size_t)NUM_POOLS * MAX_POOL_REGION;
+
+#ifdef MEM_SBH_MAGAZINES
+	s_bMagazinesKey = ( pthread_key_create( &s_MagazinesKey, &CSmallBlockHeap::ReleaseThreadMagazines ) == 0 );
+#endif
 
 	// Build a lookup table used to find the correct pool based on size
 	const int MAX_TABLE = MAX_SBH_BLOCK >> 2;
@@ -777,7 +953,7 @@ CSmallBlockHeap::CSmallBlockHeap()
 	CSmallBlockPool *pCurPool = NULL;
 	int iCurPool = 0;
 
-#if _M_X64
+#if _M_X64 || defined( PLATFORM_64BITS )
 	// Blocks sized 0 - 256 are in pools in increments of 16
 	for ( ; i < 64 && i < MAX_TABLE; i++ )
 	{
@@ -927,7 +1103,7 @@ void *CSmallBlockHeap::Alloc( size_t nBytes )
 	Assert( ShouldUse( nBytes ) );
 	CSmallBlockPool *pPool = FindPool( nBytes );
 	
-	void *p = pPool->Alloc();
+	void *p = PoolAlloc( pPool );
 	if ( p )
 	{
 		return p;
@@ -935,7 +1111,7 @@ void *CSmallBlockHeap::Alloc( size_t nBytes )
 
 	if ( s_StdMemAlloc.CallAllocFailHandler( nBytes ) >= nBytes )
 	{
-		p = pPool->Alloc();
+		p = PoolAlloc( pPool );
 		if ( p )
 		{
 	return p;
@@ -969,13 +1145,13 @@ void *CSmallBlockHeap::Realloc( void *p, size_t nBytes )
 
 	if ( pNewPool )
 	{
-		pNewBlock = pNewPool->Alloc();
+		pNewBlock = PoolAlloc( pNewPool );
 
 	if ( !pNewBlock )
 	{
 			if ( s_StdMemAlloc.CallAllocFailHandler( nBytes ) >= nBytes )
 			{
-				pNewBlock = pNewPool->Alloc();
+				pNewBlock = PoolAlloc( pNewPool );
 			}
 		}
 	}
@@ -991,11 +1167,11 @@ void *CSmallBlockHeap::Realloc( void *p, size_t nBytes )
 
 	if ( pNewBlock )
 	{
-		int nBytesCopy = min( nBytes, pOldPool->GetBlockSize() );
+		int nBytesCopy = MIN( nBytes, pOldPool->GetBlockSize() );
 		memcpy( pNewBlock, p, nBytesCopy );
 	} 
 
-	pOldPool->Free( p );
+	PoolFree( pOldPool, p );
 
 	return pNewBlock;
 }
@@ -1003,7 +1179,7 @@ void *CSmallBlockHeap::Realloc( void *p, size_t nBytes )
 void CSmallBlockHeap::Free( void *p )
 	{
 	CSmallBlockPool *pPool = FindPool( p );
-		pPool->Free( p );
+	PoolFree( pPool, p );
 	}
 
 size_t CSmallBlockHeap::GetSize( void *p )
@@ -1070,6 +1246,72 @@ CSmallBlockPool *CSmallBlockHeap::FindPool( void *p )
 	return &m_Pools[i];
 }
 
+void *CSmallBlockHeap::PoolAlloc( CSmallBlockPool *pPool )
+{
+#ifdef MEM_SBH_MAGAZINES
+	SBHMagazines_t *pMagazines = GetThreadMagazines();
+	if ( pMagazines )
+	{
+		int iPool = pPool - m_Pools;
+		int nBlocks = pMagazines->m_nBlocks[iPool];
+		if ( !nBlocks )
+		{
+			nBlocks = pPool->AllocMagazine( pMagazines->m_pBlocks[iPool] );
+			if ( !nBlocks )
+			{
+				return NULL;
+			}
+		}
+		pMagazines->m_nBlocks[iPool] = --nBlocks;
+		return pMagazines->m_pBlocks[iPool][nBlocks];
+	}
+#endif
+	return pPool->Alloc();
+}
+
+void CSmallBlockHeap::PoolFree( CSmallBlockPool *pPool, void *p )
+{
+#ifdef MEM_SBH_MAGAZINES
+	SBHMagazines_t *pMagazines = GetThreadMagazines();
+	if ( pMagazines )
+	{
+		int iPool = pPool - m_Pools;
+		void **ppBlocks = pMagazines->m_pBlocks[iPool];
+		int nBlocks = pMagazines->m_nBlocks[iPool];
+		if ( nBlocks == SBH_MAGAZINE_SIZE )
+		{
+			// give back the older half, the recently freed blocks are still in cache
+			pPool->FreeMagazine( ppBlocks );
+			memmove( ppBlocks, ppBlocks + SBH_MAGAZINE_SIZE / 2, ( SBH_MAGAZINE_SIZE / 2 ) * sizeof( void * ) );
+			nBlocks = SBH_MAGAZINE_SIZE / 2;
+		}
+		ppBlocks[nBlocks] = p;
+		pMagazines->m_nBlocks[iPool] = nBlocks + 1;
+		return;
+	}
+#endif
+	pPool->Free( p );
+}
+
+#ifdef MEM_SBH_MAGAZINES
+void CSmallBlockHeap::ReleaseThreadMagazines( void *p )
+{
+	SBHMagazines_t *pMagazines = (SBHMagazines_t *)p;
+	s_pMagazines = NULL;
+	s_bMagazinesReleased = true;
+
+	CSmallBlockHeap &heap = s_StdMemAlloc.m_SmallBlockHeap;
+	for ( int i = 0; i < NUM_POOLS; i++ )
+	{
+		for ( int j = 0; j < pMagazines->m_nBlocks[i]; j++ )
+		{
+			heap.m_Pools[i].Free( pMagazines->m_pBlocks[i][j] );
+		}
+	}
+	free( pMagazines );
+}
+#endif
+
 
 #endif
 
@@ -1469,12 +1711,13 @@ void *CStdMemAlloc::Alloc( size_t nSize )
 	
 	void *pMem;
 
-#ifdef _WIN32
+#if defined( _WIN32 ) || defined( LINUX )
 #ifdef USE_PHYSICAL_SMALL_BLOCK_HEAP
 	if ( m_LargePageSmallBlockHeap.ShouldUse( nSize ) )
 		{
 		pMem = m_LargePageSmallBlockHeap.Alloc( nSize );
 			ApplyMemoryInitializations( pMem, nSize );
+			MemTrace_Alloc( pMem, nSize );
 			return pMem;
 		}
 #endif
@@ -1483,6 +1726,7 @@ void *CStdMemAlloc::Alloc( size_t nSize )
 	{
 		pMem = m_SmallBlockHeap.Alloc( nSize );
 	ApplyMemoryInitializations( pMem, nSize );
+	MemTrace_Alloc( pMem, nSize );
 	return pMem;
 }
 
@@ -1494,6 +1738,7 @@ void *CStdMemAlloc::Alloc( size_t nSize )
 		{
 			SetCRTAllocFailed( nSize );
 		}
+	MemTrace_Alloc( pMem, nSize );
 	return pMem;
 }
 
@@ -1506,17 +1751,24 @@ void *CStdMemAlloc::Realloc( void *pMem, size_t nSize )
 
 	PROFILE_ALLOC(Realloc);
 
+	uintp nOldBlock = (uintp)pMem;
+	MemTrace_ReallocBegin( pMem, nSize );
+
 #ifdef MEM_SBH_ENABLED
 #ifdef USE_PHYSICAL_SMALL_BLOCK_HEAP
 	if ( m_LargePageSmallBlockHeap.IsOwner( pMem ) )
 	{
-		return m_LargePageSmallBlockHeap.Realloc( pMem, nSize );
+		void *pRet = m_LargePageSmallBlockHeap.Realloc( pMem, nSize );
+		MemTrace_ReallocEnd( nOldBlock, pRet, nSize );
+		return pRet;
 	}
 #endif
 
 	if ( m_SmallBlockHeap.IsOwner( pMem ) )
 	{
-		return m_SmallBlockHeap.Realloc( pMem, nSize );
+		void *pRet = m_SmallBlockHeap.Realloc( pMem, nSize );
+		MemTrace_ReallocEnd( nOldBlock, pRet, nSize );
+		return pRet;
 	}
 #endif
 
@@ -1525,6 +1777,7 @@ void *CStdMemAlloc::Realloc( void *pMem, size_t nSize )
 		{
 			SetCRTAllocFailed( nSize );
 		}
+	MemTrace_ReallocEnd( nOldBlock, pRet, nSize );
 	return pRet;
 }
 
@@ -1537,6 +1790,9 @@ void CStdMemAlloc::Free( void *pMem )
 
 	PROFILE_ALLOC(Free);
 
+	// before the block can be handed out again, so its free comes first in the trace
+	MemTrace_Free( pMem );
+
 #ifdef MEM_SBH_ENABLED
 #ifdef USE_PHYSICAL_SMALL_BLOCK_HEAP
 	if ( m_LargePageSmallBlockHeap.IsOwner( pMem ) )
@@ -1614,7 +1870,11 @@ size_t CStdMemAlloc::GetSize( void *pMem )
 		{
 			return m_SmallBlockHeap.GetSize( pMem );
 		}
+#ifdef _WIN32
 		return _msize( pMem );
+#else
+		return malloc_usable_size( pMem );
+#endif
 	}
 #else
 	return malloc_usable_size( pMem );
@@ -1627,10 +1887,12 @@ size_t CStdMemAlloc::GetSize( void *pMem )
 //-----------------------------------------------------------------------------
 void CStdMemAlloc::PushAllocDbgInfo( const char *pFileName, int nLine )
 {
+	MemTrace_PushCredit( pFileName );
 }
 
 void CStdMemAlloc::PopAllocDbgInfo()
 {
+	MemTrace_PopCredit();
 }
 
 //-----------------------------------------------------------------------------
@@ -1703,7 +1965,7 @@ void CStdMemAlloc::DumpStats()
 
 void CStdMemAlloc::DumpStatsFileBase( char const *pchFileBase )
 {
-#ifdef _WIN32
+#if defined( _WIN32 ) || defined( LINUX )
 	char filename[ 512 ];
 	_snprintf( filename, sizeof( filename ) - 1, ( IsX360() ) ? "D:\\%s.txt" : "%s.txt", pchFileBase );
 	filename[ sizeof( filename ) - 1 ] = 0;
@@ -1761,7 +2023,7 @@ void CStdMemAlloc::GlobalMemoryStatus( size_t *pUsedMemory, size_t *pFreeMemory
 
 void CStdMemAlloc::CompactHeap()
 {
-#if !defined( NO_SBH ) && defined( _WIN32 )
+#if !defined( NO_SBH ) && ( defined( _WIN32 ) || defined( LINUX ) )
 	int nBytesRecovered = m_SmallBlockHeap.Compact();
 	Msg( "Compact freed %d bytes\n", nBytesRecovered );
 #endif
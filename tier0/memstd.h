@@ -30,7 +30,10 @@
 #include "tier0/tslist.h"
 #include "mem_helpers.h"
 
+// GCC lets pack() win over the 16 byte alignment the SBH free lists need
+#ifndef POSIX
 #pragma pack(4)
+#endif
 
 #ifdef _X360
 #define USE_PHYSICAL_SMALL_BLOCK_HEAP 1
@@ -43,7 +46,11 @@
 #define MIN_SBH_BLOCK	8
 #define MIN_SBH_ALIGN	8
 #define MAX_SBH_BLOCK	2048
+#if defined( LINUX ) && defined( PLATFORM_64BITS )
+#define MAX_POOL_REGION (32*1024*1024)	// address space is only reserved, pages are committed as pools grow
+#else
 #define MAX_POOL_REGION (4*1024*1024)
+#endif
 #if !defined(_X360)
 #define SBH_PAGE_SIZE		(4*1024)
 #define COMMIT_SIZE		(16*SBH_PAGE_SIZE)
@@ -51,28 +58,33 @@
 #define SBH_PAGE_SIZE		(64*1024)
 #define COMMIT_SIZE		(SBH_PAGE_SIZE)
 #endif
-#if _M_X64
+#if _M_X64 || defined( PLATFORM_64BITS )
 #define NUM_POOLS		34
 #else
 #define NUM_POOLS		42
 #endif
 
-// SBH not enabled for LINUX right now. Unlike on Windows, we can't globally hook malloc. Well,
+// SBH is opt-in on LINUX, run with -sbh. Unlike on Windows, we can't globally hook malloc. Well,
 //  we can and did in override_init_hook(), but that unfortunately causes all malloc functions
 //	to get hooked - including the nVidia driver, etc. And these hooks appear to happen after
 //	nVidia has alloc'd some memory and it crashes when they try to free that.
 // So we need things to work without this global hook - which means we rely on memdbgon.h / memdbgoff.h.
 //  Unfortunately, that stuff always comes in source files after the headers are included, and
-//  that means any alloc calls in the header files call the real libc functions. It's a mess.
-// I believe I've cleaned most of it up, and it appears to be working. However right now we are totally
-// 	gated on other performance issues, and the SBH doesn't give us any win, so I've disabled it for now.
-// Once those perf issues are worked out, it might make sense to do perf tests with SBH, libc, and tcmalloc.
+//  that means any alloc calls in the header files call the real libc functions. Blocks that libc
+//  allocated are fine, IsOwner() sends them back to libc, but a block from the SBH that reaches the
+//  real free() is not. Use utils/allocreplay to compare SBH, libc and preloaded allocators.
 //
-//$ #if defined( _WIN32 ) || defined( _PS3 ) || defined( LINUX )
-#if defined( _WIN32 ) || defined( _PS3 )
+// On LINUX the pools are mmap'd regions and every thread keeps a magazine of free blocks per pool,
+//  so most allocations and frees don't touch the shared free lists at all.
+#if defined( _WIN32 ) || defined( _PS3 ) || defined( LINUX )
 #define MEM_SBH_ENABLED 1
 #endif
 
+#if defined( LINUX )
+#define MEM_SBH_MAGAZINES 1
+#define SBH_MAGAZINE_SIZE	32		// blocks a thread keeps per pool, half of them move to or from the pool at once
+#endif
+
 class ALIGN16 CSmallBlockPool
 {
 public:
@@ -87,6 +99,12 @@ public:
 	int CountAllocatedBlocks();
 	int Compact();
 
+#ifdef MEM_SBH_MAGAZINES
+	// SBH_MAGAZINE_SIZE / 2 blocks for or from a thread's magazine
+	int AllocMagazine( void **ppBlocks );
+	void FreeMagazine( void **ppBlocks );
+#endif
+
 private:
 
 	typedef TSLNodeBase_t FreeBlock_t;
@@ -97,6 +115,9 @@ private:
 	};
 
 	CFreeList		m_FreeList;
+#ifdef MEM_SBH_MAGAZINES
+	CTSListBase		m_Depot;		// half magazines threads gave back, chained through their blocks
+#endif
 
 	unsigned		m_nBlockSize;
 
@@ -122,10 +143,17 @@ public:
 	void DumpStats( FILE *pFile = NULL );
 	int Compact();
 
+#ifdef MEM_SBH_MAGAZINES
+	static void ReleaseThreadMagazines( void *pMagazines );	// thread exit, returns its blocks to the pools
+#endif
+
 private:
 	CSmallBlockPool *FindPool( size_t nBytes );
 	CSmallBlockPool *FindPool( void *p );
 
+	void *PoolAlloc( CSmallBlockPool *pPool );
+	void PoolFree( CSmallBlockPool *pPool, void *p );
+
 	CSmallBlockPool *m_PoolLookup[MAX_SBH_BLOCK >> 2];
 	CSmallBlockPool m_Pools[NUM_POOLS];
 	byte *m_pBase;
@@ -0,0 +1,642 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Records allocation traces, see tier0/memtrace.h
+//
+//=============================================================================//
+
+#include "pch_tier0.h"
+
+#if !defined(STEAM) && !defined(NO_MALLOC_OVERRIDE)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef POSIX
+#include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#endif
+#include "tier0/dbg.h"
+#include "tier0/threadtools.h"
+#include "tier0/memtrace.h"
+#include "mem_helpers.h"
+
+// No memdbgon, everything in here comes from libc so it stays out of the trace
+
+COMPILE_TIME_ASSERT( sizeof( memtraceheader_t ) == 16 );
+COMPILE_TIME_ASSERT( sizeof( memtraceevents_t ) == 16 );
+COMPILE_TIME_ASSERT( sizeof( memtraceevent_t ) == 32 );
+
+volatile bool g_bMemTraceActive = false;
+
+#ifdef POSIX
+
+#define MEMTRACE_BUFFER_EVENTS	2048
+#define MEMTRACE_MAX_QUEUED		256			// buffers waiting for the writer, the events of any more are dropped
+#define MEMTRACE_WAKE_QUEUED	32			// buffers that wake the writer before its next poll
+#define MEMTRACE_BUFFER_AGE		1000000		// microseconds a buffer holds events before they go to the writer
+#define MEMTRACE_CREDIT_DEPTH	32
+
+struct MemTraceRawEvent_t
+{
+	void		*m_pBlock;
+	void		*m_pOldBlock;
+	const void	*m_pCaller;
+	const char	*m_pszCredit;
+	uint32		m_nSize;
+	uint32		m_nTime;
+};
+
+// A thread's events until the writer turns them into a memtraceevents_t chunk
+struct MemTraceBuffer_t
+{
+	MemTraceBuffer_t *m_pNext;
+	uint32		m_nGeneration;		// of the trace the events belong to
+	uint32		m_nThread;
+	uint32		m_nEvents;
+	uint64		m_nTime;
+	MemTraceRawEvent_t m_Events[MEMTRACE_BUFFER_EVENTS];
+};
+
+// A string the trace refers to by id
+struct MemTraceName_t
+{
+	const void	*m_pKey;
+	uint32		m_nKind;
+	uint32		m_nId;
+};
+
+static __thread MemTraceBuffer_t *s_pThreadBuffer;
+static __thread bool s_bThreadKeySet;
+static __thread bool s_bThreadExiting;
+static __thread const char *s_pszCredits[MEMTRACE_CREDIT_DEPTH];
+static __thread int s_nCredits;
+
+static CThreadFastMutex s_BufferMutex;		// the queue and the free buffers
+static MemTraceBuffer_t *s_pQueueHead;
+static MemTraceBuffer_t *s_pQueueTail;
+static int s_nQueued;
+static MemTraceBuffer_t *s_pFreeBuffers;
+static uint32 s_nDropped;
+
+static CThreadMutex s_ControlMutex;			// start and stop
+static volatile uint32 s_nGeneration;
+static uint64 s_nStartTime;
+static pthread_key_t s_ThreadKey;
+static bool s_bThreadKey;
+
+// only the writer thread touches these while a trace runs
+static ThreadHandle_t s_hWriter;
+static CThreadEvent s_WriterEvent;
+static volatile bool s_bStopWriter;
+static FILE *s_pFile;
+static char s_szFileName[MAX_PATH];
+static int64 s_nMaxFileBytes;
+static uint32 s_nDroppedWritten;
+static MemTraceName_t *s_pNames;
+static uint32 s_nNameSlots;
+static uint32 s_nNames;
+static memtraceevent_t s_WriteEvents[MEMTRACE_BUFFER_EVENTS];
+
+static uint64 MemTraceTime()
+{
+	timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//-----------------------------------------------------------------------------
+// Buffers
+//-----------------------------------------------------------------------------
+static MemTraceBuffer_t *AllocBuffer()
+{
+	MemTraceBuffer_t *pBuffer;
+	{
+		AUTO_LOCK( s_BufferMutex );
+		pBuffer = s_pFreeBuffers;
+		if ( pBuffer )
+		{
+			s_pFreeBuffers = pBuffer->m_pNext;
+		}
+	}
+
+	if ( !pBuffer )
+	{
+		pBuffer = (MemTraceBuffer_t *)malloc( sizeof( MemTraceBuffer_t ) );
+	}
+	return pBuffer;
+}
+
+static void QueueBuffer( MemTraceBuffer_t *pBuffer )
+{
+	bool bWake;
+	{
+		AUTO_LOCK( s_BufferMutex );
+		if ( pBuffer->m_nGeneration != s_nGeneration || s_nQueued >= MEMTRACE_MAX_QUEUED )
+		{
+			if ( pBuffer->m_nGeneration == s_nGeneration )
+			{
+				s_nDropped += pBuffer->m_nEvents;
+			}
+			pBuffer->m_pNext = s_pFreeBuffers;
+			s_pFreeBuffers = pBuffer;
+			return;
+		}
+
+		pBuffer->m_pNext = NULL;
+		if ( s_pQueueTail )
+		{
+			s_pQueueTail->m_pNext = pBuffer;
+		}
+		else
+		{
+			s_pQueueHead = pBuffer;
+		}
+		s_pQueueTail = pBuffer;
+		bWake = ( ++s_nQueued == MEMTRACE_WAKE_QUEUED );
+	}
+
+	if ( bWake )
+	{
+		s_WriterEvent.Set();
+	}
+}
+
+// pthread key destructor, hands the exiting thread's events to the writer
+static void ReleaseThreadBuffer( void * )
+{
+	s_bThreadExiting = true;
+
+	MemTraceBuffer_t *pBuffer = s_pThreadBuffer;
+	s_pThreadBuffer = NULL;
+	if ( pBuffer )
+	{
+		QueueBuffer( pBuffer );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Called by the allocators while a trace runs, any thread
+//-----------------------------------------------------------------------------
+void MemTrace_Record( void *pOldBlock, void *pBlock, size_t nSize, const void *pCaller, const char *pszCredit )
+{
+	if ( s_bThreadExiting )
+		return;
+
+	uint32 nGeneration = s_nGeneration;
+	uint64 nNow = MemTraceTime();
+
+	MemTraceBuffer_t *pBuffer = s_pThreadBuffer;
+	if ( pBuffer && ( pBuffer->m_nGeneration != nGeneration || nNow - pBuffer->m_nTime >= MEMTRACE_BUFFER_AGE ) )
+	{
+		s_pThreadBuffer = NULL;
+		QueueBuffer( pBuffer );
+		pBuffer = NULL;
+	}
+
+	if ( !pBuffer )
+	{
+		pBuffer = AllocBuffer();
+		if ( !pBuffer )
+			return;
+
+		pBuffer->m_nGeneration = nGeneration;
+		pBuffer->m_nThread = ThreadGetCurrentId();
+		pBuffer->m_nEvents = 0;
+		pBuffer->m_nTime = nNow;
+		s_pThreadBuffer = pBuffer;
+
+		if ( !s_bThreadKeySet && s_bThreadKey )
+		{
+			// any non NULL value gets the destructor called
+			pthread_setspecific( s_ThreadKey, (void *)1 );
+			s_bThreadKeySet = true;
+		}
+	}
+
+	if ( !pszCredit && s_nCredits )
+	{
+		pszCredit = s_pszCredits[MIN( s_nCredits, MEMTRACE_CREDIT_DEPTH ) - 1];
+	}
+
+	MemTraceRawEvent_t &event = pBuffer->m_Events[pBuffer->m_nEvents++];
+	event.m_pBlock = pBlock;
+	event.m_pOldBlock = pOldBlock;
+	event.m_pCaller = pCaller;
+	event.m_pszCredit = pszCredit;
+	event.m_nSize = (uint32)MIN( nSize, (size_t)0xffffffff );
+	event.m_nTime = (uint32)( nNow - pBuffer->m_nTime );
+
+	if ( pBuffer->m_nEvents == MEMTRACE_BUFFER_EVENTS )
+	{
+		s_pThreadBuffer = NULL;
+		QueueBuffer( pBuffer );
+	}
+}
+
+void MemTrace_PushCredit( const char *pszCredit )
+{
+	if ( s_nCredits < MEMTRACE_CREDIT_DEPTH )
+	{
+		s_pszCredits[s_nCredits] = pszCredit;
+	}
+	s_nCredits++;
+}
+
+void MemTrace_PopCredit()
+{
+	if ( s_nCredits > 0 )
+	{
+		s_nCredits--;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Writer thread
+//-----------------------------------------------------------------------------
+static void GetName( const MemTraceName_t &name, char *pszName, int nSize )
+{
+	if ( name.m_nKind == MEMTRACE_STRING_CREDIT )
+	{
+		snprintf( pszName, nSize, "%s", (const char *)name.m_pKey );
+		return;
+	}
+
+	// module!symbol+offset, or module+offset for code without a dynamic symbol
+	Dl_info info;
+	if ( !dladdr( name.m_pKey, &info ) || !info.dli_fname )
+	{
+		snprintf( pszName, nSize, "%p", name.m_pKey );
+		return;
+	}
+
+	const char *pszModule = strrchr( info.dli_fname, '/' );
+	pszModule = pszModule ? pszModule + 1 : info.dli_fname;
+	if ( info.dli_sname && info.dli_saddr )
+	{
+		snprintf( pszName, nSize, "%s!%s+0x%x", pszModule, info.dli_sname, (unsigned)( (const byte *)name.m_pKey - (const byte *)info.dli_saddr ) );
+	}
+	else
+	{
+		snprintf( pszName, nSize, "%s+0x%llx", pszModule, (unsigned long long)( (const byte *)name.m_pKey - (const byte *)info.dli_fbase ) );
+	}
+}
+
+static void WriteChunk( uint32 nType, const void *pHeader, uint32 nHeaderBytes, const void *pData, uint32 nDataBytes )
+{
+	if ( !s_pFile )
+		return;
+
+	memtracechunk_t chunk;
+	chunk.m_nType = nType;
+	chunk.m_nBytes = nHeaderBytes + nDataBytes;
+
+	if ( fwrite( &chunk, sizeof( chunk ), 1, s_pFile ) != 1 ||
+		fwrite( pHeader, nHeaderBytes, 1, s_pFile ) != 1 ||
+		( nDataBytes && fwrite( pData, nDataBytes, 1, s_pFile ) != 1 ) )
+	{
+		Warning( "Couldn't write allocation trace %s, stopped writing.\n", s_szFileName );
+		fclose( s_pFile );
+		s_pFile = NULL;
+	}
+}
+
+static void WriteName( const MemTraceName_t &name )
+{
+	char szName[1024];
+	GetName( name, szName, sizeof( szName ) );
+
+	memtracestring_t string;
+	string.m_nKind = name.m_nKind;
+	string.m_nId = name.m_nId;
+	WriteChunk( MEMTRACE_CHUNK_STRING, &string, sizeof( string ), szName, strlen( szName ) + 1 );
+}
+
+static bool WriteHeader()
+{
+	timeval tv;
+	gettimeofday( &tv, NULL );
+
+	memtraceheader_t header;
+	memcpy( header.m_Id, MEMTRACE_FILE_ID, sizeof( header.m_Id ) );
+	header.m_nVersion = MEMTRACE_VERSION;
+	header.m_nStartTime = (uint64)tv.tv_sec * 1000000 + tv.tv_usec;
+	return fwrite( &header, sizeof( header ), 1, s_pFile ) == 1;
+}
+
+static inline uint32 HashName( const void *pKey, uint32 nKind )
+{
+	uint64 nHash = ( (uint64)(uintp)pKey ^ nKind ) * 0x9E3779B97F4A7C15ull;
+	return (uint32)( nHash >> 32 );
+}
+
+static void AddName( MemTraceName_t *pNames, uint32 nSlots, const MemTraceName_t &name )
+{
+	uint32 i = HashName( name.m_pKey, name.m_nKind ) & ( nSlots - 1 );
+	while ( pNames[i].m_nId )
+	{
+		i = ( i + 1 ) & ( nSlots - 1 );
+	}
+	pNames[i] = name;
+}
+
+// The id of a callsite or credit, written to the trace the first time it's seen
+static uint32 FindOrAddName( uint32 nKind, const void *pKey )
+{
+	if ( !pKey )
+		return 0;
+
+	if ( s_nNameSlots )
+	{
+		uint32 i = HashName( pKey, nKind ) & ( s_nNameSlots - 1 );
+		while ( s_pNames[i].m_nId )
+		{
+			if ( s_pNames[i].m_pKey == pKey && s_pNames[i].m_nKind == nKind )
+				return s_pNames[i].m_nId;
+			i = ( i + 1 ) & ( s_nNameSlots - 1 );
+		}
+	}
+
+	// keep the table at most half full
+	if ( ( s_nNames + 1 ) * 2 > s_nNameSlots )
+	{
+		uint32 nSlots = s_nNameSlots ? s_nNameSlots * 2 : 4096;
+		MemTraceName_t *pNames = (MemTraceName_t *)calloc( nSlots, sizeof( MemTraceName_t ) );
+		if ( !pNames )
+			return 0;
+
+		for ( uint32 i = 0; i < s_nNameSlots; i++ )
+		{
+			if ( s_pNames[i].m_nId )
+			{
+				AddName( pNames, nSlots, s_pNames[i] );
+			}
+		}
+		free( s_pNames );
+		s_pNames = pNames;
+		s_nNameSlots = nSlots;
+	}
+
+	MemTraceName_t name;
+	name.m_pKey = pKey;
+	name.m_nKind = nKind;
+	name.m_nId = ++s_nNames;
+	AddName( s_pNames, s_nNameSlots, name );
+	WriteName( name );
+	return name.m_nId;
+}
+
+// Continues in a new file, the old one is kept as <name>.1
+static void RotateFile()
+{
+	fclose( s_pFile );
+
+	char szOldName[MAX_PATH + 2];
+	snprintf( szOldName, sizeof( szOldName ), "%s.1", s_szFileName );
+	rename( s_szFileName, szOldName );
+
+	s_pFile = fopen( s_szFileName, "wb" );
+	if ( !s_pFile || !WriteHeader() )
+	{
+		Warning( "Couldn't write allocation trace %s, stopped writing.\n", s_szFileName );
+		if ( s_pFile )
+		{
+			fclose( s_pFile );
+			s_pFile = NULL;
+		}
+		return;
+	}
+
+	for ( uint32 i = 0; i < s_nNameSlots; i++ )
+	{
+		if ( s_pNames[i].m_nId )
+		{
+			WriteName( s_pNames[i] );
+		}
+	}
+	s_nDroppedWritten = 0;
+}
+
+static void WriteBuffer( const MemTraceBuffer_t *pBuffer )
+{
+	for ( uint32 i = 0; i < pBuffer->m_nEvents; i++ )
+	{
+		const MemTraceRawEvent_t &raw = pBuffer->m_Events[i];
+		memtraceevent_t &event = s_WriteEvents[i];
+		event.m_nBlock = (uint64)(uintp)raw.m_pBlock;
+		event.m_nOldBlock = (uint64)(uintp)raw.m_pOldBlock;
+		event.m_nSize = raw.m_nSize;
+		event.m_nTime = raw.m_nTime;
+		event.m_nCallsite = FindOrAddName( MEMTRACE_STRING_CALLSITE, raw.m_pCaller );
+		event.m_nCredit = FindOrAddName( MEMTRACE_STRING_CREDIT, raw.m_pszCredit );
+	}
+
+	memtraceevents_t events;
+	events.m_nThread = pBuffer->m_nThread;
+	events.m_nEvents = pBuffer->m_nEvents;
+	events.m_nTime = pBuffer->m_nTime - s_nStartTime;
+	WriteChunk( MEMTRACE_CHUNK_EVENTS, &events, sizeof( events ), s_WriteEvents, pBuffer->m_nEvents * sizeof( memtraceevent_t ) );
+
+	if ( s_pFile && ftell( s_pFile ) >= s_nMaxFileBytes )
+	{
+		RotateFile();
+	}
+}
+
+static void WriteQueuedBuffers()
+{
+	MemTraceBuffer_t *pBuffers;
+	uint32 nDropped;
+	{
+		AUTO_LOCK( s_BufferMutex );
+		pBuffers = s_pQueueHead;
+		s_pQueueHead = s_pQueueTail = NULL;
+		s_nQueued = 0;
+		nDropped = s_nDropped;
+	}
+
+	while ( pBuffers )
+	{
+		MemTraceBuffer_t *pNext = pBuffers->m_pNext;
+		WriteBuffer( pBuffers );
+
+		AUTO_LOCK( s_BufferMutex );
+		pBuffers->m_pNext = s_pFreeBuffers;
+		s_pFreeBuffers = pBuffers;
+		pBuffers = pNext;
+	}
+
+	if ( nDropped != s_nDroppedWritten )
+	{
+		WriteChunk( MEMTRACE_CHUNK_DROPPED, &nDropped, sizeof( nDropped ), NULL, 0 );
+		s_nDroppedWritten = nDropped;
+	}
+
+	if ( s_pFile )
+	{
+		fflush( s_pFile );
+	}
+}
+
+static uintp MemTraceWriterThread( void * )
+{
+	ThreadSetDebugName( "MemTraceWriter" );
+
+	for ( ;; )
+	{
+		bool bStop = s_bStopWriter;
+		WriteQueuedBuffers();
+		if ( bStop )
+			break;
+
+		s_WriterEvent.Wait( 100 );
+	}
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Starts recording every allocation to pszFileName
+//-----------------------------------------------------------------------------
+bool MemAlloc_StartTrace( const char *pszFileName, int nMaxFileMB )
+{
+	AUTO_LOCK( s_ControlMutex );
+
+	if ( g_bMemTraceActive )
+	{
+		Warning( "An allocation trace is running already.\n" );
+		return false;
+	}
+
+	s_pFile = fopen( pszFileName, "wb" );
+	if ( !s_pFile )
+	{
+		Warning( "Couldn't open allocation trace %s.\n", pszFileName );
+		return false;
+	}
+
+	snprintf( s_szFileName, sizeof( s_szFileName ), "%s", pszFileName );
+	s_nMaxFileBytes = (int64)MAX( nMaxFileMB, 1 ) * 1024 * 1024;
+
+	if ( !s_bThreadKey )
+	{
+		s_bThreadKey = ( pthread_key_create( &s_ThreadKey, ReleaseThreadBuffer ) == 0 );
+	}
+
+	free( s_pNames );
+	s_pNames = NULL;
+	s_nNameSlots = s_nNames = 0;
+	s_nDroppedWritten = 0;
+
+	{
+		// buffers a thread queued after the last trace stopped are stale
+		AUTO_LOCK( s_BufferMutex );
+		while ( s_pQueueHead )
+		{
+			MemTraceBuffer_t *pNext = s_pQueueHead->m_pNext;
+			s_pQueueHead->m_pNext = s_pFreeBuffers;
+			s_pFreeBuffers = s_pQueueHead;
+			s_pQueueHead = pNext;
+		}
+		s_pQueueTail = NULL;
+		s_nQueued = 0;
+		s_nDropped = 0;
+		s_nGeneration++;
+	}
+
+	s_nStartTime = MemTraceTime();
+	if ( !WriteHeader() )
+	{
+		Warning( "Couldn't write allocation trace %s.\n", pszFileName );
+		fclose( s_pFile );
+		s_pFile = NULL;
+		return false;
+	}
+
+	s_bStopWriter = false;
+	s_hWriter = CreateSimpleThread( MemTraceWriterThread, NULL );
+	if ( !s_hWriter )
+	{
+		fclose( s_pFile );
+		s_pFile = NULL;
+		return false;
+	}
+
+	g_bMemTraceActive = true;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Stops recording. Events other threads still buffer are lost.
+//-----------------------------------------------------------------------------
+void MemAlloc_StopTrace()
+{
+	AUTO_LOCK( s_ControlMutex );
+
+	if ( !g_bMemTraceActive )
+		return;
+
+	g_bMemTraceActive = false;
+
+	MemTraceBuffer_t *pBuffer = s_pThreadBuffer;
+	if ( pBuffer )
+	{
+		s_pThreadBuffer = NULL;
+		QueueBuffer( pBuffer );
+	}
+
+	s_bStopWriter = true;
+	s_WriterEvent.Set();
+	ThreadJoin( s_hWriter );
+	ReleaseThreadHandle( s_hWriter );
+	s_hWriter = NULL;
+
+	if ( s_pFile )
+	{
+		fclose( s_pFile );
+		s_pFile = NULL;
+	}
+
+	uint32 nDropped;
+	{
+		AUTO_LOCK( s_BufferMutex );
+		nDropped = s_nDropped;
+	}
+	if ( nDropped )
+	{
+		Warning( "Allocation trace %s dropped %u events.\n", s_szFileName, nDropped );
+	}
+}
+
+#else
+
+void MemTrace_Record( void *pOldBlock, void *pBlock, size_t nSize, const void *pCaller, const char *pszCredit )
+{
+}
+
+void MemTrace_PushCredit( const char *pszCredit )
+{
+}
+
+void MemTrace_PopCredit()
+{
+}
+
+bool MemAlloc_StartTrace( const char *pszFileName, int nMaxFileMB )
+{
+	Warning( "Allocation traces aren't supported on this platform.\n" );
+	return false;
+}
+
+void MemAlloc_StopTrace()
+{
+}
+
+#endif // POSIX
+
+bool MemAlloc_IsTracing()
+{
+	return g_bMemTraceActive;
+}
+
+#endif // !STEAM && !NO_MALLOC_OVERRIDE
@@ -2502,75 +2502,7 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 				break;
 			}
 			
-			if (dat->m_sValue)
-			{
-				delete[] dat->m_sValue;
-				dat->m_sValue = NULL;
-			}
-
-			int len = Q_strlen( value );
-
-			// Here, let's determine if we got a float or an int....
-			char* pIEnd;	// pos where int scan ended
-			char* pFEnd;	// pos where float scan ended
-			const char* pSEnd = value + len ; // pos where token ends
-
-			int ival = strtol( value, &pIEnd, 10 );
-			float fval = (float)strtod( value, &pFEnd );
-			bool bOverflow = ( ival == LONG_MAX || ival == LONG_MIN ) && errno == ERANGE;
-#ifdef POSIX
-			// strtod supports hex representation in strings under posix but we DON'T
-			// want that support in keyvalues, so undo it here if needed
-			if ( len > 1 &&  tolower(value[1]) == 'x' )
-			{
-				fval = 0.0f;
-				pFEnd = (char *)value;
-			}
-#endif
-				
-			if ( *value == 0 )
-			{
-				dat->m_iDataType = TYPE_STRING;	
-			}
-			else if ( ( 18 == len ) && ( value[0] == '0' ) && ( value[1] == 'x' ) )
-			{
-				// an 18-byte value prefixed with "0x" (followed by 16 hex digits) is an int64 value
-				int64 retVal = 0;
-				for( int i=2; i < 2 + 16; i++ )
-				{
-					char digit = value[i];
-					if ( digit >= 'a' ) 
-						digit -= 'a' - ( '9' + 1 );
-					else
-						if ( digit >= 'A' )
-							digit -= 'A' - ( '9' + 1 );
-					retVal = ( retVal * 16 ) + ( digit - '0' );
-				}
-				dat->m_sValue = new char[sizeof(uint64)];
-				*((uint64 *)dat->m_sValue) = retVal;
-				dat->m_iDataType = TYPE_UINT64;
-			}
-			else if ( (pFEnd > pIEnd) && (pFEnd == pSEnd) )
-			{
-				dat->m_flValue = fval; 
-				dat->m_iDataType = TYPE_FLOAT;
-			}
-			else if (pIEnd == pSEnd && !bOverflow)
-			{
-				dat->m_iValue = ival; 
-				dat->m_iDataType = TYPE_INT;
-			}
-			else
-			{
-				dat->m_iDataType = TYPE_STRING;
-			}
-
-			if (dat->m_iDataType == TYPE_STRING)
-			{
-				// copy in the string information
-				dat->m_sValue = new char[len+1];
-				Q_memcpy( dat->m_sValue, value, len+1 );
-			}
+			dat->SetValueFromToken( value );
 
 			// Look ahead one token for a conditional tag
 			int prevPos = buf.TellGet();
@@ -2613,6 +2545,84 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Sets the value from a parsed token, typing it as an int, float,
+//			uint64 or string the way it was written
+//-----------------------------------------------------------------------------
+void KeyValues::SetValueFromToken( const char *value )
+{
+	if (m_sValue)
+	{
+		delete[] m_sValue;
+		m_sValue = NULL;
+	}
+
+	int len = Q_strlen( value );
+
+	// Here, let's determine if we got a float or an int....
+	char* pIEnd;	// pos where int scan ended
+	char* pFEnd;	// pos where float scan ended
+	const char* pSEnd = value + len ; // pos where token ends
+
+	int ival = strtol( value, &pIEnd, 10 );
+	float fval = (float)strtod( value, &pFEnd );
+	bool bOverflow = ( ival == LONG_MAX || ival == LONG_MIN ) && errno == ERANGE;
+#ifdef POSIX
+	// strtod supports hex representation in strings under posix but we DON'T
+	// want that support in keyvalues, so undo it here if needed
+	if ( len > 1 &&  tolower(value[1]) == 'x' )
+	{
+		fval = 0.0f;
+		pFEnd = (char *)value;
+	}
+#endif
+
+	if ( *value == 0 )
+	{
+		m_iDataType = TYPE_STRING;	
+	}
+	else if ( ( 18 == len ) && ( value[0] == '0' ) && ( value[1] == 'x' ) )
+	{
+		// an 18-byte value prefixed with "0x" (followed by 16 hex digits) is an int64 value
+		int64 retVal = 0;
+		for( int i=2; i < 2 + 16; i++ )
+		{
+			char digit = value[i];
+			if ( digit >= 'a' ) 
+				digit -= 'a' - ( '9' + 1 );
+			else
+				if ( digit >= 'A' )
+					digit -= 'A' - ( '9' + 1 );
+			retVal = ( retVal * 16 ) + ( digit - '0' );
+		}
+		m_sValue = new char[sizeof(uint64)];
+		*((uint64 *)m_sValue) = retVal;
+		m_iDataType = TYPE_UINT64;
+	}
+	else if ( (pFEnd > pIEnd) && (pFEnd == pSEnd) )
+	{
+		m_flValue = fval; 
+		m_iDataType = TYPE_FLOAT;
+	}
+	else if (pIEnd == pSEnd && !bOverflow)
+	{
+		m_iValue = ival; 
+		m_iDataType = TYPE_INT;
+	}
+	else
+	{
+		m_iDataType = TYPE_STRING;
+	}
+
+	if (m_iDataType == TYPE_STRING)
+	{
+		// copy in the string information
+		m_sValue = new char[len+1];
+		Q_memcpy( m_sValue, value, len+1 );
+	}
+}
+
+
 // writes KeyValue as binary data to buffer
 bool KeyValues::WriteAsBinary( CUtlBuffer &buffer )
 {
@@ -0,0 +1,282 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Common interface to the buffer compressors in tier1
+//
+//=============================================================================
+
+#include "tier0/platform.h"
+#include "tier0/dbg.h"
+#include "tier1/strtools.h"
+#include "tier1/compressioncodec.h"
+#include "tier1/lzss.h"
+#include "tier1/lz4.h"
+#include "tier1/snappy.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static uint32 ReadCodecID( const void *pSource, unsigned int nSourceLen )
+{
+	if ( nSourceLen < sizeof( uint32 ) )
+		return 0;
+
+	uint32 id;
+	V_memcpy( &id, pSource, sizeof( id ) );
+	return id;
+}
+
+//-----------------------------------------------------------------------------
+// LZSS: id, little endian uncompressed size, LZSS stream
+//-----------------------------------------------------------------------------
+class CLZSSCompressionCodec : public ICompressionCodec
+{
+public:
+	virtual CompressionCodec_t GetCodec() const { return COMPRESSION_CODEC_LZSS; }
+	virtual const char *GetName() const { return "lzss"; }
+	virtual uint32 GetID() const { return LZSS_ID; }
+
+	virtual unsigned int GetMaxCompressedSize( unsigned int nSourceLen ) const
+	{
+		// LZSS gives up as soon as it can't save anything
+		return nSourceLen;
+	}
+
+	virtual bool Compress( void *pDest, unsigned int *pDestLen, const void *pSource, unsigned int nSourceLen ) const
+	{
+		CLZSS s;
+		unsigned int nCompressedLen = 0;
+
+		if ( *pDestLen >= GetMaxCompressedSize( nSourceLen ) )
+		{
+			if ( !s.CompressNoAlloc( (const unsigned char *)pSource, nSourceLen, (unsigned char *)pDest, &nCompressedLen ) )
+				return false;
+		}
+		else
+		{
+			unsigned char *pTemp = s.Compress( (const unsigned char *)pSource, nSourceLen, &nCompressedLen );
+			if ( !pTemp )
+				return false;
+
+			bool bFits = nCompressedLen <= *pDestLen;
+			if ( bFits )
+			{
+				V_memcpy( pDest, pTemp, nCompressedLen );
+			}
+			free( pTemp );
+
+			if ( !bFits )
+				return false;
+		}
+
+		*pDestLen = nCompressedLen;
+		return true;
+	}
+
+	virtual int GetUncompressedSize( const void *pSource, unsigned int nSourceLen ) const
+	{
+		const lzss_header_t *pHeader = (const lzss_header_t *)pSource;
+		if ( nSourceLen < sizeof( lzss_header_t ) || ReadCodecID( pSource, nSourceLen ) != LZSS_ID )
+			return -1;
+
+		return LittleLong( pHeader->actualSize );
+	}
+
+	virtual bool Uncompress( void *pDest, unsigned int *pDestLen, const void *pSource, unsigned int nSourceLen ) const
+	{
+		int nSize = GetUncompressedSize( pSource, nSourceLen );
+		if ( nSize < 0 || (unsigned int)nSize > *pDestLen )
+			return false;
+
+		CLZSS s;
+		if ( (int)s.SafeUncompress( (const unsigned char *)pSource, nSourceLen, (unsigned char *)pDest, *pDestLen ) != nSize )
+			return false;
+
+		*pDestLen = nSize;
+		return true;
+	}
+};
+
+//-----------------------------------------------------------------------------
+// Snappy: id, raw snappy stream (which starts with the uncompressed size)
+//-----------------------------------------------------------------------------
+class CSnappyCompressionCodec : public ICompressionCodec
+{
+public:
+	virtual CompressionCodec_t GetCodec() const { return COMPRESSION_CODEC_SNAPPY; }
+	virtual const char *GetName() const { return "snappy"; }
+	virtual uint32 GetID() const { return SNAPPY_ID; }
+
+	virtual unsigned int GetMaxCompressedSize( unsigned int nSourceLen ) const
+	{
+		return sizeof( uint32 ) + snappy::MaxCompressedLength( nSourceLen );
+	}
+
+	virtual bool Compress( void *pDest, unsigned int *pDestLen, const void *pSource, unsigned int nSourceLen ) const
+	{
+		unsigned int nMaxCompressedLen = GetMaxCompressedSize( nSourceLen );
+
+		// snappy doesn't bounds check its output, so go through a temp buffer if dest is short
+		char *pTemp = NULL;
+		char *pOutput = (char *)pDest;
+		if ( *pDestLen < nMaxCompressedLen )
+		{
+			pTemp = pOutput = (char *)malloc( nMaxCompressedLen );
+			if ( !pTemp )
+				return false;
+		}
+
+		uint32 id = SNAPPY_ID;
+		V_memcpy( pOutput, &id, sizeof( id ) );
+
+		size_t nCompressedLen;
+		snappy::RawCompress( (const char *)pSource, nSourceLen, pOutput + sizeof( uint32 ), &nCompressedLen );
+		nCompressedLen += sizeof( uint32 );
+		Assert( nCompressedLen <= nMaxCompressedLen );
+
+		bool bFits = nCompressedLen <= *pDestLen;
+		if ( pTemp )
+		{
+			if ( bFits )
+			{
+				V_memcpy( pDest, pTemp, nCompressedLen );
+			}
+			free( pTemp );
+		}
+
+		if ( !bFits )
+			return false;
+
+		*pDestLen = nCompressedLen;
+		return true;
+	}
+
+	virtual int GetUncompressedSize( const void *pSource, unsigned int nSourceLen ) const
+	{
+		if ( nSourceLen <= sizeof( uint32 ) || ReadCodecID( pSource, nSourceLen ) != SNAPPY_ID )
+			return -1;
+
+		size_t nSize;
+		if ( !snappy::GetUncompressedLength( (const char *)pSource + sizeof( uint32 ), nSourceLen - sizeof( uint32 ), &nSize ) )
+			return -1;
+
+		return (int)nSize;
+	}
+
+	virtual bool Uncompress( void *pDest, unsigned int *pDestLen, const void *pSource, unsigned int nSourceLen ) const
+	{
+		int nSize = GetUncompressedSize( pSource, nSourceLen );
+		if ( nSize < 0 || (unsigned int)nSize > *pDestLen )
+			return false;
+
+		if ( !snappy::RawUncompress( (const char *)pSource + sizeof( uint32 ), nSourceLen - sizeof( uint32 ), (char *)pDest ) )
+			return false;
+
+		*pDestLen = nSize;
+		return true;
+	}
+};
+
+//-----------------------------------------------------------------------------
+// LZ4: id, little endian uncompressed size, raw LZ4 block
+//-----------------------------------------------------------------------------
+struct lz4_header_t
+{
+	unsigned int	id;
+	unsigned int	actualSize;	// always little endian
+};
+
+class CLZ4CompressionCodec : public ICompressionCodec
+{
+public:
+	virtual CompressionCodec_t GetCodec() const { return COMPRESSION_CODEC_LZ4; }
+	virtual const char *GetName() const { return "lz4"; }
+	virtual uint32 GetID() const { return LZ4_ID; }
+
+	virtual unsigned int GetMaxCompressedSize( unsigned int nSourceLen ) const
+	{
+		return sizeof( lz4_header_t ) + CLZ4::GetMaxCompressedSize( nSourceLen );
+	}
+
+	virtual bool Compress( void *pDest, unsigned int *pDestLen, const void *pSource, unsigned int nSourceLen ) const
+	{
+		if ( *pDestLen <= sizeof( lz4_header_t ) )
+			return false;
+
+		lz4_header_t header;
+		header.id = LZ4_ID;
+		header.actualSize = LittleLong( nSourceLen );
+		V_memcpy( pDest, &header, sizeof( header ) );
+
+		CLZ4 lz4;
+		unsigned int nCompressedLen = lz4.Compress( (const unsigned char *)pSource, nSourceLen, (unsigned char *)pDest + sizeof( header ), *pDestLen - sizeof( header ) );
+		if ( !nCompressedLen )
+			return false;
+
+		*pDestLen = sizeof( header ) + nCompressedLen;
+		return true;
+	}
+
+	virtual int GetUncompressedSize( const void *pSource, unsigned int nSourceLen ) const
+	{
+		if ( nSourceLen <= sizeof( lz4_header_t ) || ReadCodecID( pSource, nSourceLen ) != LZ4_ID )
+			return -1;
+
+		lz4_header_t header;
+		V_memcpy( &header, pSource, sizeof( header ) );
+		return LittleLong( header.actualSize );
+	}
+
+	virtual bool Uncompress( void *pDest, unsigned int *pDestLen, const void *pSource, unsigned int nSourceLen ) const
+	{
+		int nSize = GetUncompressedSize( pSource, nSourceLen );
+		if ( nSize < 0 || (unsigned int)nSize > *pDestLen )
+			return false;
+
+		int nActualSize = CLZ4::Uncompress( (const unsigned char *)pSource + sizeof( lz4_header_t ), nSourceLen - sizeof( lz4_header_t ), (unsigned char *)pDest, nSize );
+		if ( nActualSize != nSize )
+			return false;
+
+		*pDestLen = nSize;
+		return true;
+	}
+};
+
+static CLZSSCompressionCodec s_LZSSCodec;
+static CSnappyCompressionCodec s_SnappyCodec;
+static CLZ4CompressionCodec s_LZ4Codec;
+
+static const ICompressionCodec *s_pCompressionCodecs[COMPRESSION_CODEC_COUNT] =
+{
+	&s_LZSSCodec,
+	&s_SnappyCodec,
+	&s_LZ4Codec,
+};
+
+const ICompressionCodec *GetCompressionCodec( CompressionCodec_t codec )
+{
+	Assert( codec >= 0 && codec < COMPRESSION_CODEC_COUNT );
+	return s_pCompressionCodecs[codec];
+}
+
+const ICompressionCodec *FindCompressionCodec( const char *pszName )
+{
+	for ( int i = 0; i < COMPRESSION_CODEC_COUNT; i++ )
+	{
+		if ( !V_stricmp( pszName, s_pCompressionCodecs[i]->GetName() ) )
+			return s_pCompressionCodecs[i];
+	}
+
+	return NULL;
+}
+
+const ICompressionCodec *FindCompressionCodecForData( const void *pSource, unsigned int nSourceLen )
+{
+	uint32 id = ReadCodecID( pSource, nSourceLen );
+	for ( int i = 0; i < COMPRESSION_CODEC_COUNT; i++ )
+	{
+		if ( id == s_pCompressionCodecs[i]->GetID() )
+			return s_pCompressionCodecs[i];
+	}
+
+	return NULL;
+}
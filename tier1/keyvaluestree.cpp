@@ -0,0 +1,578 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Reads KeyValues text into a read only tree without copying it
+//
+//=============================================================================//
+
+#include "tier1/keyvaluestree.h"
+#include "tier1/KeyValues.h"
+#include "tier1/strtools.h"
+#include "tier0/dbg.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+// Same limit RecursiveLoadFromBuffer has
+#define KEYVALUESTREE_MAX_DEPTH		100
+
+//-----------------------------------------------------------------------------
+// Splits a buffer into the tokens KeyValues::ReadToken would return. Every
+// token is null terminated where it lies, so an unquoted token ended by a
+// control character remembers that character for the next read.
+//-----------------------------------------------------------------------------
+class CKeyValuesTreeTokenizer
+{
+public:
+	CKeyValuesTreeTokenizer( char *pBuffer, bool bEscapeSequences ) :
+		m_pCur( pBuffer ), m_chPending( 0 ), m_bEscapeSequences( bEscapeSequences ), m_bUnread( false ),
+		m_pszLast( NULL ), m_bLastQuoted( false ), m_bLastConditional( false )
+	{
+	}
+
+	// NULL at the end of the buffer
+	const char *Next( bool &bQuoted, bool &bConditional );
+
+	// Makes Next return the last token again, for looking ahead
+	void Unread() { m_bUnread = true; }
+
+private:
+	const char *Read( bool &bQuoted, bool &bConditional );
+	const char *ReadQuoted();
+
+	char		*m_pCur;
+	char		m_chPending;
+	bool		m_bEscapeSequences;
+	bool		m_bUnread;
+	const char	*m_pszLast;
+	bool		m_bLastQuoted;
+	bool		m_bLastConditional;
+};
+
+const char *CKeyValuesTreeTokenizer::Next( bool &bQuoted, bool &bConditional )
+{
+	if ( !m_bUnread )
+	{
+		m_pszLast = Read( m_bLastQuoted, m_bLastConditional );
+	}
+	m_bUnread = false;
+
+	bQuoted = m_bLastQuoted;
+	bConditional = m_bLastConditional;
+	return m_pszLast;
+}
+
+const char *CKeyValuesTreeTokenizer::Read( bool &bQuoted, bool &bConditional )
+{
+	bQuoted = false;
+	bConditional = false;
+
+	char c = m_chPending;
+	m_chPending = 0;
+	if ( !c )
+	{
+		// eat white space and comments
+		while ( true )
+		{
+			while ( V_isspace( *m_pCur ) )
+			{
+				m_pCur++;
+			}
+
+			if ( m_pCur[0] != '/' || m_pCur[1] != '/' )
+				break;
+
+			m_pCur += 2;
+			while ( *m_pCur && *m_pCur++ != '\n' )
+				;
+		}
+
+		c = *m_pCur;
+		if ( !c )
+			return NULL;
+		m_pCur++;
+	}
+
+	if ( c == '\"' )
+	{
+		bQuoted = true;
+		return ReadQuoted();
+	}
+
+	if ( c == '{' )
+		return "{";
+
+	if ( c == '}' )
+		return "}";
+
+	// read in the token until we hit a whitespace or a control character
+	char *pszToken = m_pCur - 1;
+	bool bConditionalStart = ( c == '[' );
+	for ( ;; m_pCur++ )
+	{
+		c = *m_pCur;
+		if ( !c )
+			break;
+
+		if ( c == '\"' || c == '{' || c == '}' )
+		{
+			m_chPending = c;
+			*m_pCur++ = 0;
+			break;
+		}
+
+		if ( V_isspace( c ) )
+		{
+			*m_pCur++ = 0;
+			break;
+		}
+
+		if ( c == '[' )
+		{
+			bConditionalStart = true;
+		}
+		else if ( c == ']' && bConditionalStart )
+		{
+			bConditional = true;
+		}
+	}
+
+	return pszToken;
+}
+
+//-----------------------------------------------------------------------------
+// Escape sequences GetCStringCharConversion knows. Unknown ones become a
+// null and leave the next character alone, like CUtlBuffer does.
+//-----------------------------------------------------------------------------
+static char KeyValuesTreeEscapedChar( char c )
+{
+	switch ( c )
+	{
+	case 'n':	return '\n';
+	case 't':	return '\t';
+	case 'v':	return '\v';
+	case 'b':	return '\b';
+	case 'r':	return '\r';
+	case 'f':	return '\f';
+	case 'a':	return '\a';
+	case '\\':	return '\\';
+	case '?':	return '\?';
+	case '\'':	return '\'';
+	case '\"':	return '\"';
+	default:	return 0;
+	}
+}
+
+const char *CKeyValuesTreeTokenizer::ReadQuoted()
+{
+	// unescaping only ever shortens the string, so it's done in place
+	char *pszToken = m_pCur;
+	char *pOut = m_pCur;
+	while ( *m_pCur )
+	{
+		char c = *m_pCur++;
+		if ( c == '\"' )
+			break;
+
+		if ( c == '\\' && m_bEscapeSequences )
+		{
+			c = KeyValuesTreeEscapedChar( *m_pCur );
+			if ( c )
+			{
+				m_pCur++;
+			}
+		}
+		*pOut++ = c;
+	}
+	*pOut = 0;
+	return pszToken;
+}
+
+
+//-----------------------------------------------------------------------------
+// CKeyValuesTreeNode
+//-----------------------------------------------------------------------------
+const CKeyValuesTreeNode *CKeyValuesTreeNode::FindKey( const char *pszKeyName ) const
+{
+	if ( !pszKeyName || !*pszKeyName )
+		return this;
+
+	const char *pszSubKey = strchr( pszKeyName, '/' );
+	int nLen = pszSubKey ? pszSubKey - pszKeyName : V_strlen( pszKeyName );
+	for ( const CKeyValuesTreeNode *pNode = m_pSub; pNode; pNode = pNode->m_pPeer )
+	{
+		if ( !V_strnicmp( pNode->m_pszName, pszKeyName, nLen ) && !pNode->m_pszName[nLen] )
+			return pszSubKey ? pNode->FindKey( pszSubKey + 1 ) : pNode;
+	}
+	return NULL;
+}
+
+const char *CKeyValuesTreeNode::GetString( const char *pszKeyName, const char *pszDefault ) const
+{
+	const CKeyValuesTreeNode *pNode = FindKey( pszKeyName );
+	return ( pNode && pNode->m_pszValue ) ? pNode->m_pszValue : pszDefault;
+}
+
+int CKeyValuesTreeNode::GetInt( const char *pszKeyName, int nDefault ) const
+{
+	const CKeyValuesTreeNode *pNode = FindKey( pszKeyName );
+	return ( pNode && pNode->m_pszValue ) ? atoi( pNode->m_pszValue ) : nDefault;
+}
+
+float CKeyValuesTreeNode::GetFloat( const char *pszKeyName, float flDefault ) const
+{
+	const CKeyValuesTreeNode *pNode = FindKey( pszKeyName );
+	return ( pNode && pNode->m_pszValue ) ? (float)atof( pNode->m_pszValue ) : flDefault;
+}
+
+bool CKeyValuesTreeNode::GetBool( const char *pszKeyName, bool bDefault ) const
+{
+	const CKeyValuesTreeNode *pNode = FindKey( pszKeyName );
+	return ( pNode && pNode->m_pszValue ) ? atoi( pNode->m_pszValue ) != 0 : bDefault;
+}
+
+const CKeyValuesTreeNode *CKeyValuesTreeNode::GetFirstTrueSubKey() const
+{
+	const CKeyValuesTreeNode *pNode = m_pSub;
+	while ( pNode && pNode->m_pszValue )
+	{
+		pNode = pNode->m_pPeer;
+	}
+	return pNode;
+}
+
+const CKeyValuesTreeNode *CKeyValuesTreeNode::GetNextTrueSubKey() const
+{
+	const CKeyValuesTreeNode *pNode = m_pPeer;
+	while ( pNode && pNode->m_pszValue )
+	{
+		pNode = pNode->m_pPeer;
+	}
+	return pNode;
+}
+
+const CKeyValuesTreeNode *CKeyValuesTreeNode::GetFirstValue() const
+{
+	const CKeyValuesTreeNode *pNode = m_pSub;
+	while ( pNode && !pNode->m_pszValue )
+	{
+		pNode = pNode->m_pPeer;
+	}
+	return pNode;
+}
+
+const CKeyValuesTreeNode *CKeyValuesTreeNode::GetNextValue() const
+{
+	const CKeyValuesTreeNode *pNode = m_pPeer;
+	while ( pNode && !pNode->m_pszValue )
+	{
+		pNode = pNode->m_pPeer;
+	}
+	return pNode;
+}
+
+
+//-----------------------------------------------------------------------------
+// CKeyValuesTree
+//-----------------------------------------------------------------------------
+CKeyValuesTree::CKeyValuesTree() :
+	m_Nodes( sizeof( CKeyValuesTreeNode ), 1024, CUtlMemoryPool::GROW_FAST, "CKeyValuesTree::m_Nodes" )
+{
+	m_Root.m_pszName = "";
+	m_Root.m_pszValue = NULL;
+	m_Root.m_pSub = NULL;
+	m_Root.m_pPeer = NULL;
+	m_pszResourceName = "";
+	m_bEscapeSequences = false;
+	m_bEvaluateConditionals = true;
+	m_bErrors = false;
+}
+
+CKeyValuesTree::~CKeyValuesTree()
+{
+	Purge();
+}
+
+void CKeyValuesTree::Purge()
+{
+	m_Nodes.Clear();
+	m_Root.m_pSub = NULL;
+	m_Includes.RemoveAll();
+	m_Bases.RemoveAll();
+	m_UTF8.Purge();
+}
+
+const CKeyValuesTreeNode *CKeyValuesTree::FindKey( const char *pszKeyName ) const
+{
+	if ( !pszKeyName || !*pszKeyName )
+		return NULL;
+	return m_Root.FindKey( pszKeyName );
+}
+
+CKeyValuesTreeNode *CKeyValuesTree::NewNode( const char *pszName )
+{
+	CKeyValuesTreeNode *pNode = (CKeyValuesTreeNode *)m_Nodes.Alloc();
+	pNode->m_pszName = pszName;
+	pNode->m_pszValue = NULL;
+	pNode->m_pSub = NULL;
+	pNode->m_pPeer = NULL;
+	return pNode;
+}
+
+void CKeyValuesTree::ReportError( const char *pszError )
+{
+	Warning( "KeyValues Error: %s in file %s\n", pszError, m_pszResourceName );
+	m_bErrors = true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Mirrors KeyValues::LoadFromBuffer
+//-----------------------------------------------------------------------------
+bool CKeyValuesTree::Parse( const char *pszResourceName, char *pBuffer )
+{
+	Purge();
+	m_pszResourceName = pszResourceName ? pszResourceName : "";
+	m_bErrors = false;
+
+	if ( !pBuffer )
+		return true;
+
+	// Translate Unicode files into UTF-8 before proceeding
+	if ( (uint8)pBuffer[0] == 0xFF && (uint8)pBuffer[1] == 0xFE )
+	{
+		int nUTF8Len = V_UnicodeToUTF8( (wchar_t *)( pBuffer + 2 ), NULL, 0 );
+		m_UTF8.EnsureCapacity( nUTF8Len );
+		V_UnicodeToUTF8( (wchar_t *)( pBuffer + 2 ), m_UTF8.Base(), nUTF8Len );
+		pBuffer = m_UTF8.Base();
+	}
+
+	CKeyValuesTreeTokenizer tokens( pBuffer, m_bEscapeSequences );
+	CKeyValuesTreeNode *pLastKey = NULL;
+	bool bQuoted;
+	bool bConditional;
+	while ( true )
+	{
+		// the first thing must be a key
+		const char *pszName = tokens.Next( bQuoted, bConditional );
+		if ( !pszName || !*pszName )
+			break;
+
+		bool bInclude = !V_stricmp( pszName, "#include" );
+		if ( bInclude || !V_stricmp( pszName, "#base" ) )
+		{
+			const char *pszFile = tokens.Next( bQuoted, bConditional );
+			if ( !pszFile || !*pszFile )
+			{
+				ReportError( bInclude ? "#include is NULL " : "#base is NULL " );
+			}
+			else
+			{
+				( bInclude ? m_Includes : m_Bases ).AddToTail( pszFile );
+			}
+			continue;
+		}
+
+		CKeyValuesTreeNode *pKey = NewNode( pszName );
+		bool bAccepted = true;
+
+		// get the '{'
+		const char *pszToken = tokens.Next( bQuoted, bConditional );
+		if ( bConditional )
+		{
+			bAccepted = !m_bEvaluateConditionals || EvaluateConditional( pszToken );
+
+			// Now get the '{'
+			pszToken = tokens.Next( bQuoted, bConditional );
+		}
+
+		if ( pszToken && *pszToken == '{' && !bQuoted )
+		{
+			if ( !ParseSection( pKey, tokens, 1 ) )
+				break;
+		}
+		else
+		{
+			ReportError( "LoadFromBuffer: missing {" );
+		}
+
+		if ( bAccepted )
+		{
+			if ( pLastKey )
+			{
+				pLastKey->m_pPeer = pKey;
+			}
+			else
+			{
+				m_Root.m_pSub = pKey;
+			}
+			pLastKey = pKey;
+		}
+	}
+
+	m_pszResourceName = "";
+	return !m_bErrors;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Mirrors KeyValues::RecursiveLoadFromBuffer. Returns false if the
+//			sections nest too deep to go on.
+//-----------------------------------------------------------------------------
+bool CKeyValuesTree::ParseSection( CKeyValuesTreeNode *pSection, CKeyValuesTreeTokenizer &tokens, int nDepth )
+{
+	if ( nDepth > KEYVALUESTREE_MAX_DEPTH )
+	{
+		ReportError( "RecursiveLoadFromBuffer:  recursion overflow" );
+		return false;
+	}
+
+	CKeyValuesTreeNode *pLastChild = NULL;
+	bool bQuoted;
+	bool bConditional;
+
+	// Keep parsing until we hit the closing brace which terminates this block, or a parse error
+	while ( true )
+	{
+		bool bAccepted = true;
+
+		// get the key name
+		const char *pszName = tokens.Next( bQuoted, bConditional );
+		if ( !pszName )
+		{
+			ReportError( "RecursiveLoadFromBuffer:  got EOF instead of keyname" );
+			break;
+		}
+
+		if ( !*pszName )
+		{
+			ReportError( "RecursiveLoadFromBuffer:  got empty keyname" );
+			break;
+		}
+
+		if ( *pszName == '}' && !bQuoted )	// top level closed, stop reading
+			break;
+
+		// The key is linked before its value is read, so a key that ends in
+		// an error stays in the tree as an empty section, as it does in KeyValues
+		CKeyValuesTreeNode *pKey = NewNode( pszName );
+		if ( pLastChild )
+		{
+			pLastChild->m_pPeer = pKey;
+		}
+		else
+		{
+			pSection->m_pSub = pKey;
+		}
+
+		// get the value
+		const char *pszValue = tokens.Next( bQuoted, bConditional );
+		if ( bConditional && pszValue )
+		{
+			bAccepted = !m_bEvaluateConditionals || EvaluateConditional( pszValue );
+
+			// get the real value
+			pszValue = tokens.Next( bQuoted, bConditional );
+		}
+
+		if ( !pszValue )
+		{
+			ReportError( "RecursiveLoadFromBuffer:  got NULL key" );
+			break;
+		}
+
+		if ( *pszValue == '}' && !bQuoted )
+		{
+			ReportError( "RecursiveLoadFromBuffer:  got } in key" );
+			break;
+		}
+
+		if ( *pszValue == '{' && !bQuoted )
+		{
+			// this isn't a key, it's a section
+			if ( !ParseSection( pKey, tokens, nDepth + 1 ) )
+				return false;
+		}
+		else
+		{
+			if ( bConditional )
+			{
+				ReportError( "RecursiveLoadFromBuffer:  got conditional between key and value" );
+				break;
+			}
+
+			pKey->m_pszValue = pszValue;
+
+			// Look ahead one token for a conditional tag
+			const char *pszPeek = tokens.Next( bQuoted, bConditional );
+			if ( bConditional )
+			{
+				bAccepted = !m_bEvaluateConditionals || EvaluateConditional( pszPeek );
+			}
+			else
+			{
+				tokens.Unread();
+			}
+		}
+
+		if ( bAccepted )
+		{
+			pLastChild = pKey;
+		}
+		else if ( pLastChild )
+		{
+			pLastChild->m_pPeer = NULL;
+		}
+		else
+		{
+			pSection->m_pSub = NULL;
+		}
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Copies nodes out into KeyValues, typing the values the way
+//			LoadFromBuffer does
+//-----------------------------------------------------------------------------
+KeyValues *CKeyValuesTree::MakeKeyValues( const CKeyValuesTreeNode *pNode, bool bSiblings ) const
+{
+	KeyValues *pFirst = NULL;
+	KeyValues *pLast = NULL;
+	for ( ; pNode; pNode = pNode->m_pPeer )
+	{
+		KeyValues *pKeyValues = new KeyValues( pNode->m_pszName );
+		pKeyValues->UsesEscapeSequences( m_bEscapeSequences );
+		pKeyValues->UsesConditionals( m_bEvaluateConditionals );
+		CopyInto( pKeyValues, pNode );
+
+		if ( pLast )
+		{
+			pLast->SetNextKey( pKeyValues );
+		}
+		else
+		{
+			pFirst = pKeyValues;
+		}
+		pLast = pKeyValues;
+
+		if ( !bSiblings )
+			break;
+	}
+	return pFirst;
+}
+
+void CKeyValuesTree::CopyInto( KeyValues *pKeyValues, const CKeyValuesTreeNode *pNode ) const
+{
+	if ( pNode->m_pszValue )
+	{
+		pKeyValues->SetValueFromToken( pNode->m_pszValue );
+		return;
+	}
+
+	KeyValues *pLastChild = NULL;
+	for ( const CKeyValuesTreeNode *pSub = pNode->m_pSub; pSub; pSub = pSub->m_pPeer )
+	{
+		KeyValues *pChild = pKeyValues->CreateKeyUsingKnownLastChild( pSub->m_pszName, pLastChild );
+		CopyInto( pChild, pSub );
+		pLastChild = pChild;
+	}
+}
@@ -0,0 +1,270 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+//	LZ4 block format codec. Greedy single probe match finder, much faster than
+//	LZSS at a similar ratio, meant for network payloads compressed every frame.
+//
+//=====================================================================================//
+
+#include "tier0/platform.h"
+#include "tier0/dbg.h"
+#include "tier1/lz4.h"
+#include <string.h>
+
+#define LZ4_MINMATCH		4
+#define LZ4_LASTLITERALS	5		// the last 5 bytes are always literals
+#define LZ4_MFLIMIT			12		// and the last match starts at least 12 bytes before the end
+#define LZ4_MAX_DISTANCE	65535
+#define LZ4_ML_MASK			15
+#define LZ4_RUN_MASK		15
+#define LZ4_SKIP_TRIGGER	6		// misses before the search step grows
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static FORCEINLINE uint32 LZ4_Read32( const unsigned char *p )
+{
+	uint32 v;
+	memcpy( &v, p, sizeof( v ) );
+	return v;
+}
+
+static FORCEINLINE uint32 LZ4_Hash( const unsigned char *p )
+{
+	return ( LZ4_Read32( p ) * 2654435761U ) >> ( 32 - LZ4_HASH_LOG );
+}
+
+static FORCEINLINE unsigned char *LZ4_WriteLength( unsigned char *pOutput, unsigned int nLength )
+{
+	while ( nLength >= 255 )
+	{
+		*pOutput++ = 255;
+		nLength -= 255;
+	}
+	*pOutput++ = (unsigned char)nLength;
+	return pOutput;
+}
+
+//-----------------------------------------------------------------------------
+// Compresses into a raw LZ4 block, returns the block size or 0 if it
+// doesn't fit into nOutputSize bytes.
+//-----------------------------------------------------------------------------
+unsigned int CLZ4::Compress( const unsigned char *pInput, unsigned int nInputSize, unsigned char *pOutput, unsigned int nOutputSize )
+{
+	const unsigned char *ip = pInput;
+	const unsigned char *pAnchor = pInput;
+	const unsigned char *pEnd = pInput + nInputSize;
+	unsigned char *op = pOutput;
+	unsigned char *pOutEnd = pOutput + nOutputSize;
+
+	if ( nInputSize > LZ4_MFLIMIT )
+	{
+		const unsigned char *pMatchStartLimit = pEnd - LZ4_MFLIMIT;
+		const unsigned char *pMatchEndLimit = pEnd - LZ4_LASTLITERALS;
+
+		memset( m_HashTable, 0, sizeof( m_HashTable ) );
+		ip++;
+
+		while ( ip < pMatchStartLimit )
+		{
+			// find a match, stepping further ahead the longer we miss
+			const unsigned char *pRef;
+			unsigned int nAttempts = m_nAcceleration << LZ4_SKIP_TRIGGER;
+			for ( ;; )
+			{
+				uint32 h = LZ4_Hash( ip );
+				pRef = pInput + m_HashTable[h];
+				m_HashTable[h] = (unsigned int)( ip - pInput );
+
+				if ( pRef < ip && ip - pRef <= LZ4_MAX_DISTANCE && LZ4_Read32( pRef ) == LZ4_Read32( ip ) )
+					break;
+
+				ip += nAttempts++ >> LZ4_SKIP_TRIGGER;
+				if ( ip >= pMatchStartLimit )
+					goto lastLiterals;
+			}
+
+			// extend backwards into the pending literals
+			while ( ip > pAnchor && pRef > pInput && ip[-1] == pRef[-1] )
+			{
+				ip--;
+				pRef--;
+			}
+
+			// and forwards
+			const unsigned char *pMatchEnd = ip + LZ4_MINMATCH;
+			const unsigned char *pRefEnd = pRef + LZ4_MINMATCH;
+			while ( pMatchEnd < pMatchEndLimit && *pMatchEnd == *pRefEnd )
+			{
+				pMatchEnd++;
+				pRefEnd++;
+			}
+
+			unsigned int nLiterals = (unsigned int)( ip - pAnchor );
+			unsigned int nMatch = (unsigned int)( pMatchEnd - ip ) - LZ4_MINMATCH;
+
+			// token, literal length, literals, offset, match length
+			if ( op + 1 + nLiterals / 255 + 1 + nLiterals + 2 + nMatch / 255 + 1 > pOutEnd )
+				return 0;
+
+			unsigned char *pToken = op++;
+			if ( nLiterals >= LZ4_RUN_MASK )
+			{
+				*pToken = LZ4_RUN_MASK << 4;
+				op = LZ4_WriteLength( op, nLiterals - LZ4_RUN_MASK );
+			}
+			else
+			{
+				*pToken = (unsigned char)( nLiterals << 4 );
+			}
+			memcpy( op, pAnchor, nLiterals );
+			op += nLiterals;
+
+			unsigned int nOffset = (unsigned int)( ip - pRef );
+			*op++ = (unsigned char)( nOffset & 0xff );
+			*op++ = (unsigned char)( nOffset >> 8 );
+
+			if ( nMatch >= LZ4_ML_MASK )
+			{
+				*pToken |= LZ4_ML_MASK;
+				op = LZ4_WriteLength( op, nMatch - LZ4_ML_MASK );
+			}
+			else
+			{
+				*pToken |= (unsigned char)nMatch;
+			}
+
+			ip = pAnchor = pMatchEnd;
+
+			// the position just before the next search helps the following match
+			if ( ip < pMatchStartLimit )
+			{
+				m_HashTable[LZ4_Hash( ip - 2 )] = (unsigned int)( ip - 2 - pInput );
+			}
+		}
+	}
+
+lastLiterals:
+	unsigned int nLiterals = (unsigned int)( pEnd - pAnchor );
+	if ( op + 1 + nLiterals / 255 + 1 + nLiterals > pOutEnd )
+		return 0;
+
+	if ( nLiterals >= LZ4_RUN_MASK )
+	{
+		*op++ = LZ4_RUN_MASK << 4;
+		op = LZ4_WriteLength( op, nLiterals - LZ4_RUN_MASK );
+	}
+	else
+	{
+		*op++ = (unsigned char)( nLiterals << 4 );
+	}
+	memcpy( op, pAnchor, nLiterals );
+	op += nLiterals;
+
+	return (unsigned int)( op - pOutput );
+}
+
+//-----------------------------------------------------------------------------
+// Decompresses a raw LZ4 block, every read and write is bounds checked so it
+// is safe on untrusted input. Returns the uncompressed size or -1.
+//-----------------------------------------------------------------------------
+int CLZ4::Uncompress( const unsigned char *pInput, unsigned int nInputSize, unsigned char *pOutput, unsigned int nOutputSize )
+{
+	const unsigned char *ip = pInput;
+	const unsigned char *pEnd = pInput + nInputSize;
+	unsigned char *op = pOutput;
+	unsigned char *pOutEnd = pOutput + nOutputSize;
+
+	if ( !nInputSize )
+		return -1;
+
+	while ( ip < pEnd )
+	{
+		unsigned int nToken = *ip++;
+
+		size_t nLiterals = nToken >> 4;
+		if ( nLiterals == LZ4_RUN_MASK )
+		{
+			unsigned int s;
+			do
+			{
+				if ( ip >= pEnd )
+					return -1;
+				s = *ip++;
+				nLiterals += s;
+			} while ( s == 255 );
+		}
+
+		if ( nLiterals > (size_t)( pEnd - ip ) || nLiterals > (size_t)( pOutEnd - op ) )
+			return -1;
+
+		// short runs are the common case, copy them in fixed 16 byte chunks while there is slack
+		if ( nLiterals <= 16 && pEnd - ip >= 16 && pOutEnd - op >= 16 )
+		{
+			memcpy( op, ip, 16 );
+		}
+		else
+		{
+			memcpy( op, ip, nLiterals );
+		}
+		op += nLiterals;
+		ip += nLiterals;
+
+		// the last sequence has no match
+		if ( ip >= pEnd )
+			break;
+
+		if ( pEnd - ip < 2 )
+			return -1;
+
+		size_t nOffset = ip[0] | ( ip[1] << 8 );
+		ip += 2;
+		if ( !nOffset || nOffset > (size_t)( op - pOutput ) )
+			return -1;
+
+		size_t nMatch = nToken & LZ4_ML_MASK;
+		if ( nMatch == LZ4_ML_MASK )
+		{
+			unsigned int s;
+			do
+			{
+				if ( ip >= pEnd )
+					return -1;
+				s = *ip++;
+				nMatch += s;
+			} while ( s == 255 );
+		}
+		nMatch += LZ4_MINMATCH;
+
+		if ( nMatch > (size_t)( pOutEnd - op ) )
+			return -1;
+
+		const unsigned char *pMatch = op - nOffset;
+		if ( nOffset >= 8 && (size_t)( pOutEnd - op ) >= nMatch + 8 )
+		{
+			// 8 byte steps never read bytes they haven't written yet, may overrun into the slack
+			unsigned char *pMatchEnd = op + nMatch;
+			do
+			{
+				memcpy( op, pMatch, 8 );
+				op += 8;
+				pMatch += 8;
+			} while ( op < pMatchEnd );
+			op = pMatchEnd;
+		}
+		else if ( nOffset >= nMatch )
+		{
+			memcpy( op, pMatch, nMatch );
+			op += nMatch;
+		}
+		else
+		{
+			// overlapping copy repeats the last nOffset bytes
+			for ( size_t i = 0; i < nMatch; i++ )
+			{
+				*op++ = *pMatch++;
+			}
+		}
+	}
+
+	return (int)( op - pOutput );
+}
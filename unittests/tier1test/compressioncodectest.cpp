@@ -0,0 +1,185 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Unit test program for the tier1 compression codecs
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "unitlib/unitlib.h"
+#include "tier0/platform.h"
+#include "tier1/compressioncodec.h"
+#include "tier1/lz4.h"
+#include "tier1/strtools.h"
+#include "tier1/utlvector.h"
+
+DEFINE_TESTSUITE( CompressionCodecTestSuite )
+
+// Looks roughly like entity deltas: a few fields that change, lots that repeat.
+static void FillNetworkLikePayload( unsigned char *pData, int nSize, unsigned int nSeed )
+{
+	for ( int i = 0; i < nSize; i++ )
+	{
+		nSeed = nSeed * 1103515245 + 12345;
+		int nField = i % 24;
+		if ( nField < 4 )
+			pData[i] = (unsigned char)( i / 24 );
+		else if ( nField < 6 )
+			pData[i] = (unsigned char)( nSeed >> 16 );
+		else
+			pData[i] = (unsigned char)( "player_origin_angles_hp"[nField - 6] );
+	}
+}
+
+static void FillRandom( unsigned char *pData, int nSize, unsigned int nSeed )
+{
+	for ( int i = 0; i < nSize; i++ )
+	{
+		nSeed = nSeed * 1103515245 + 12345;
+		pData[i] = (unsigned char)( nSeed >> 16 );
+	}
+}
+
+static void RoundTrip( const ICompressionCodec *pCodec, const unsigned char *pData, unsigned int nSize, bool bMustCompress )
+{
+	CUtlVector< unsigned char > compressed;
+	compressed.SetCount( pCodec->GetMaxCompressedSize( nSize ) + 1 );
+
+	unsigned int nCompressedSize = compressed.Count();
+	bool bCompressed = pCodec->Compress( compressed.Base(), &nCompressedSize, pData, nSize );
+	Shipping_Assert( bCompressed || !bMustCompress );
+	if ( !bCompressed )
+		return;
+
+	Shipping_Assert( nCompressedSize <= (unsigned int)compressed.Count() );
+	Shipping_Assert( FindCompressionCodecForData( compressed.Base(), nCompressedSize ) == pCodec );
+	Shipping_Assert( pCodec->GetUncompressedSize( compressed.Base(), nCompressedSize ) == (int)nSize );
+
+	CUtlVector< unsigned char > uncompressed;
+	uncompressed.SetCount( nSize + 1 );
+	unsigned int nUncompressedSize = uncompressed.Count();
+	Shipping_Assert( pCodec->Uncompress( uncompressed.Base(), &nUncompressedSize, compressed.Base(), nCompressedSize ) );
+	Shipping_Assert( nUncompressedSize == nSize );
+	Shipping_Assert( !nSize || V_memcmp( uncompressed.Base(), pData, nSize ) == 0 );
+
+	// a destination that is too short must fail rather than overrun
+	if ( nSize > 0 )
+	{
+		nUncompressedSize = nSize - 1;
+		Shipping_Assert( !pCodec->Uncompress( uncompressed.Base(), &nUncompressedSize, compressed.Base(), nCompressedSize ) );
+	}
+}
+
+DEFINE_TESTCASE( CompressionCodecRoundTrip, CompressionCodecTestSuite )
+{
+	Msg( "Running compression codec round trip tests\n" );
+
+	static const unsigned int s_nSizes[] = { 0, 1, 12, 13, 17, 64, 255, 1000, 4096, 70000, 300000 };
+
+	for ( int c = 0; c < COMPRESSION_CODEC_COUNT; c++ )
+	{
+		const ICompressionCodec *pCodec = GetCompressionCodec( (CompressionCodec_t)c );
+		Shipping_Assert( pCodec->GetCodec() == c );
+		Shipping_Assert( FindCompressionCodec( pCodec->GetName() ) == pCodec );
+
+		// LZSS refuses anything it can't shrink
+		bool bAlwaysCompresses = ( c != COMPRESSION_CODEC_LZSS );
+
+		for ( int i = 0; i < (int)ARRAYSIZE( s_nSizes ); i++ )
+		{
+			unsigned int nSize = s_nSizes[i];
+			CUtlVector< unsigned char > data;
+			data.SetCount( nSize + 1 );
+
+			FillNetworkLikePayload( data.Base(), nSize, i );
+			RoundTrip( pCodec, data.Base(), nSize, bAlwaysCompresses );
+
+			V_memset( data.Base(), 0, nSize );
+			RoundTrip( pCodec, data.Base(), nSize, bAlwaysCompresses );
+
+			FillRandom( data.Base(), nSize, i );
+			RoundTrip( pCodec, data.Base(), nSize, bAlwaysCompresses );
+		}
+	}
+
+	Shipping_Assert( FindCompressionCodec( "bzip2" ) == NULL );
+	Shipping_Assert( FindCompressionCodecForData( "NOPE", 4 ) == NULL );
+	Shipping_Assert( FindCompressionCodecForData( "LZ", 2 ) == NULL );
+}
+
+DEFINE_TESTCASE( LZ4MalformedInput, CompressionCodecTestSuite )
+{
+	Msg( "Running CLZ4::Uncompress malformed input tests\n" );
+
+	unsigned char out[256];
+
+	// empty input
+	Shipping_Assert( CLZ4::Uncompress( out, 0, out, sizeof( out ) ) == -1 );
+
+	// literal run longer than the input
+	const unsigned char longLiterals[] = { 0x50, 'a', 'b' };
+	Shipping_Assert( CLZ4::Uncompress( longLiterals, sizeof( longLiterals ), out, sizeof( out ) ) == -1 );
+
+	// unterminated literal length
+	const unsigned char openLength[] = { 0xf0, 0xff, 0xff };
+	Shipping_Assert( CLZ4::Uncompress( openLength, sizeof( openLength ), out, sizeof( out ) ) == -1 );
+
+	// offset pointing before the start of the output
+	const unsigned char badOffset[] = { 0x10, 'a', 0x02, 0x00, 0x00 };
+	Shipping_Assert( CLZ4::Uncompress( badOffset, sizeof( badOffset ), out, sizeof( out ) ) == -1 );
+
+	// zero offset
+	const unsigned char zeroOffset[] = { 0x10, 'a', 0x00, 0x00, 0x00 };
+	Shipping_Assert( CLZ4::Uncompress( zeroOffset, sizeof( zeroOffset ), out, sizeof( out ) ) == -1 );
+
+	// truncated offset
+	const unsigned char shortOffset[] = { 0x10, 'a', 0x01 };
+	Shipping_Assert( CLZ4::Uncompress( shortOffset, sizeof( shortOffset ), out, sizeof( out ) ) == -1 );
+
+	// match running past the end of the output
+	const unsigned char longMatch[] = { 0x1f, 'a', 0x01, 0x00, 0xff, 0xff, 0x00 };
+	Shipping_Assert( CLZ4::Uncompress( longMatch, sizeof( longMatch ), out, sizeof( out ) ) == -1 );
+
+	// valid: "a" then an overlapping match of 8 repeating it, then "b"
+	const unsigned char valid[] = { 0x14, 'a', 0x01, 0x00, 0x10, 'b' };
+	Shipping_Assert( CLZ4::Uncompress( valid, sizeof( valid ), out, sizeof( out ) ) == 10 );
+	Shipping_Assert( V_memcmp( out, "aaaaaaaaab", 10 ) == 0 );
+	Shipping_Assert( CLZ4::Uncompress( valid, sizeof( valid ), out, 9 ) == -1 );
+}
+
+DEFINE_TESTCASE( CompressionCodecThroughput, CompressionCodecTestSuite )
+{
+	const int nSize = 256 * 1024;
+	const int nPasses = 8;
+
+	CUtlVector< unsigned char > data, compressed, uncompressed;
+	data.SetCount( nSize );
+	uncompressed.SetCount( nSize );
+	FillNetworkLikePayload( data.Base(), nSize, 0 );
+
+	for ( int c = 0; c < COMPRESSION_CODEC_COUNT; c++ )
+	{
+		const ICompressionCodec *pCodec = GetCompressionCodec( (CompressionCodec_t)c );
+		compressed.SetCount( pCodec->GetMaxCompressedSize( nSize ) );
+
+		unsigned int nCompressedSize = 0;
+		double flStart = Plat_FloatTime();
+		for ( int i = 0; i < nPasses; i++ )
+		{
+			nCompressedSize = compressed.Count();
+			Shipping_Assert( pCodec->Compress( compressed.Base(), &nCompressedSize, data.Base(), nSize ) );
+		}
+		double flCompress = Plat_FloatTime() - flStart;
+
+		flStart = Plat_FloatTime();
+		for ( int i = 0; i < nPasses; i++ )
+		{
+			unsigned int nUncompressedSize = nSize;
+			Shipping_Assert( pCodec->Uncompress( uncompressed.Base(), &nUncompressedSize, compressed.Base(), nCompressedSize ) );
+		}
+		double flUncompress = Plat_FloatTime() - flStart;
+
+		double flMB = (double)nSize * nPasses / ( 1024.0 * 1024.0 );
+		Msg( "%-8s ratio %5.2f  compress %8.1f MB/s  uncompress %8.1f MB/s\n", pCodec->GetName(),
+			(double)nSize / nCompressedSize, flMB / MAX( flCompress, 1e-6 ), flMB / MAX( flUncompress, 1e-6 ) );
+	}
+}
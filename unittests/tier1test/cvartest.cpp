@@ -0,0 +1,248 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Unit test program for the ConVar/ConCommand registry
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "unitlib/unitlib.h"
+#include "tier0/platform.h"
+#include "tier1/convar.h"
+#include "tier1/strtools.h"
+#include "tier1/utlvector.h"
+#include "vstdlib/cvar.h"
+#include "icvar.h"
+
+DEFINE_TESTSUITE( CvarTestSuite )
+
+// About what a game registers between the engine, client and server
+#define CVARTEST_VARS		3000
+#define CVARTEST_COMMANDS	1000
+#define CVARTEST_TOTAL		( CVARTEST_VARS + CVARTEST_COMMANDS )
+
+static int s_nCommandsRun;
+
+static void CvarTestCommand( const CCommand &args )
+{
+	s_nCommandsRun++;
+}
+
+//-----------------------------------------------------------------------------
+// Registers the test's commands with vstdlib's registry. g_pCVar points at it
+// while the test runs so setting the vars works like in a game.
+//-----------------------------------------------------------------------------
+class CCvarTestRegistry
+{
+public:
+	CCvarTestRegistry()
+	{
+		m_pCvar = (ICvar *)VStdLib_GetICVarFactory()( CVAR_INTERFACE_VERSION, NULL );
+		m_pOldCvar = g_pCVar;
+		g_pCVar = m_pCvar;
+
+		for ( int i = 0; i < CVARTEST_TOTAL; i++ )
+		{
+			ConCommandBase *pCommand;
+			if ( i < CVARTEST_VARS )
+			{
+				V_snprintf( m_szNames[i], sizeof( m_szNames[i] ), "cvartest_var_%04d", i );
+				pCommand = new ConVar( m_szNames[i], "0", FCVAR_UNREGISTERED | FCVAR_REPLICATED );
+			}
+			else
+			{
+				V_snprintf( m_szNames[i], sizeof( m_szNames[i] ), "cvartest_cmd_%04d", i );
+				pCommand = new ConCommand( m_szNames[i], CvarTestCommand, "", FCVAR_UNREGISTERED );
+			}
+			m_pCvar->RegisterConCommand( pCommand );
+			m_Commands.AddToTail( pCommand );
+		}
+	}
+
+	~CCvarTestRegistry()
+	{
+		FOR_EACH_VEC( m_Commands, i )
+		{
+			m_pCvar->UnregisterConCommand( m_Commands[i] );
+			delete m_Commands[i];
+		}
+		g_pCVar = m_pOldCvar;
+	}
+
+	// The test's commands in the order the registry iterates them
+	void GetIterationOrder( CUtlVector<int> &order )
+	{
+		order.RemoveAll();
+		ICvar::Iterator iter( m_pCvar );
+		for ( iter.SetFirst(); iter.IsValid(); iter.Next() )
+		{
+			int i = m_Commands.Find( iter.Get() );
+			if ( i != m_Commands.InvalidIndex() )
+			{
+				order.AddToTail( i );
+			}
+		}
+	}
+
+	// What FindCommandBase did before it was hashed
+	const ConCommandBase *FindLinear( const char *pName )
+	{
+		for ( const ConCommandBase *pCommand = m_pCvar->GetCommands(); pCommand; pCommand = pCommand->GetNext() )
+		{
+			if ( !Q_stricmp( pName, pCommand->GetName() ) )
+				return pCommand;
+		}
+		return NULL;
+	}
+
+	ICvar *m_pCvar;
+	ICvar *m_pOldCvar;
+	CUtlVector<ConCommandBase *> m_Commands;
+	char m_szNames[CVARTEST_TOTAL][32];
+};
+
+static unsigned int CvarTestRandom( unsigned int &nSeed )
+{
+	nSeed = nSeed * 1103515245 + 12345;
+	return nSeed >> 8;
+}
+
+DEFINE_TESTCASE( CvarTestFind, CvarTestSuite )
+{
+	Msg( "Running ConVar registry tests\n" );
+
+	CCvarTestRegistry *pRegistry = new CCvarTestRegistry;
+	ICvar *pCvar = pRegistry->m_pCvar;
+	CUtlVector<ConCommandBase *> &commands = pRegistry->m_Commands;
+
+	// names are case insensitive, and each kind is only found as itself
+	Shipping_Assert( pCvar->FindVar( "cvartest_var_0042" ) == commands[42] );
+	Shipping_Assert( pCvar->FindVar( "CVARTEST_Var_0042" ) == commands[42] );
+	Shipping_Assert( pCvar->FindCommand( "cvartest_var_0042" ) == NULL );
+	Shipping_Assert( pCvar->FindCommand( "cvartest_cmd_3007" ) == commands[3007] );
+	Shipping_Assert( pCvar->FindVar( "cvartest_cmd_3007" ) == NULL );
+	Shipping_Assert( pCvar->FindCommandBase( "cvartest_var_004" ) == NULL );
+	Shipping_Assert( pCvar->FindCommandBase( "cvartest_var_00420" ) == NULL );
+	Shipping_Assert( pCvar->FindCommandBase( "" ) == NULL );
+
+	// iteration stays in registration order, newest first
+	CUtlVector<int> order;
+	pRegistry->GetIterationOrder( order );
+	Shipping_Assert( order.Count() == CVARTEST_TOTAL );
+	for ( int i = 1; i < order.Count(); i++ )
+	{
+		Shipping_Assert( order[i] == order[i - 1] - 1 );
+	}
+
+	// unregistering takes commands out of lookups and leaves the order alone
+	for ( int i = 0; i < CVARTEST_TOTAL; i += 3 )
+	{
+		pCvar->UnregisterConCommand( commands[i] );
+	}
+	for ( int i = 0; i < CVARTEST_TOTAL; i++ )
+	{
+		const ConCommandBase *pFound = pCvar->FindCommandBase( pRegistry->m_szNames[i] );
+		Shipping_Assert( pFound == ( ( i % 3 ) ? commands[i] : NULL ) );
+	}
+	pRegistry->GetIterationOrder( order );
+	Shipping_Assert( order.Count() == CVARTEST_TOTAL - ( CVARTEST_TOTAL + 2 ) / 3 );
+	for ( int i = 1; i < order.Count(); i++ )
+	{
+		Shipping_Assert( order[i] < order[i - 1] );
+	}
+
+	// two commands with one name, the newest wins until it goes away
+	ConCommand *pFirst = new ConCommand( "cvartest_dup", CvarTestCommand, "", FCVAR_UNREGISTERED );
+	ConCommand *pSecond = new ConCommand( "cvartest_dup", CvarTestCommand, "", FCVAR_UNREGISTERED );
+	pCvar->RegisterConCommand( pFirst );
+	pCvar->RegisterConCommand( pSecond );
+	Shipping_Assert( pCvar->FindCommand( "cvartest_dup" ) == pSecond );
+	pCvar->UnregisterConCommand( pSecond );
+	Shipping_Assert( pCvar->FindCommand( "cvartest_dup" ) == pFirst );
+	pCvar->UnregisterConCommand( pFirst );
+	Shipping_Assert( pCvar->FindCommand( "cvartest_dup" ) == NULL );
+	delete pFirst;
+	delete pSecond;
+
+	delete pRegistry;
+	Shipping_Assert( pCvar->FindVar( "cvartest_var_0043" ) == NULL );
+}
+
+DEFINE_TESTCASE( CvarTestThroughput, CvarTestSuite )
+{
+	CCvarTestRegistry *pRegistry = new CCvarTestRegistry;
+	ICvar *pCvar = pRegistry->m_pCvar;
+
+	// A config file: mostly settings, some commands, like exec'ing a
+	// server.cfg or a client's config.cfg
+	const int nLines = 5000;
+	CUtlVector<char> config;
+	unsigned int nSeed = 1;
+	for ( int i = 0; i < nLines; i++ )
+	{
+		char szLine[64];
+		int nName = CvarTestRandom( nSeed ) % CVARTEST_TOTAL;
+		int nLen = V_snprintf( szLine, sizeof( szLine ), "%s \"%d\"\n", pRegistry->m_szNames[nName], CvarTestRandom( nSeed ) % 100 );
+		config.AddMultipleToTail( nLen, szLine );
+	}
+	config.AddToTail( 0 );
+
+	s_nCommandsRun = 0;
+	double flStart = Plat_FloatTime();
+	int nExecuted = 0;
+	for ( const char *pLine = config.Base(); *pLine; )
+	{
+		const char *pEnd = V_strstr( pLine, "\n" );
+		char szLine[64];
+		V_strncpy( szLine, pLine, MIN( (int)( pEnd - pLine ) + 1, (int)sizeof( szLine ) ) );
+		pLine = pEnd + 1;
+
+		CCommand args;
+		args.Tokenize( szLine );
+		ConCommandBase *pCommand = pCvar->FindCommandBase( args[0] );
+		Shipping_Assert( pCommand );
+		if ( pCommand->IsCommand() )
+		{
+			static_cast<ConCommand *>( pCommand )->Dispatch( args );
+		}
+		else
+		{
+			static_cast<ConVar *>( pCommand )->SetValue( args[1] );
+		}
+		nExecuted++;
+	}
+	double flExec = Plat_FloatTime() - flStart;
+	Shipping_Assert( nExecuted == nLines && s_nCommandsRun > 0 );
+
+	// The server's replicated cvars arriving at a client, every one looked up
+	// by name. The linear walk is what FindCommandBase used to do.
+	const int nLookups = 200000;
+	const int nLinearLookups = 5000;
+
+	nSeed = 2;
+	int nFound = 0;
+	flStart = Plat_FloatTime();
+	for ( int i = 0; i < nLookups; i++ )
+	{
+		const ConVar *pVar = pCvar->FindVar( pRegistry->m_szNames[CvarTestRandom( nSeed ) % CVARTEST_VARS] );
+		nFound += pVar ? 1 : 0;
+	}
+	double flHashed = Plat_FloatTime() - flStart;
+	Shipping_Assert( nFound == nLookups );
+
+	nSeed = 2;
+	nFound = 0;
+	flStart = Plat_FloatTime();
+	for ( int i = 0; i < nLinearLookups; i++ )
+	{
+		const ConCommandBase *pVar = pRegistry->FindLinear( pRegistry->m_szNames[CvarTestRandom( nSeed ) % CVARTEST_VARS] );
+		nFound += pVar ? 1 : 0;
+	}
+	double flLinear = Plat_FloatTime() - flStart;
+	Shipping_Assert( nFound == nLinearLookups );
+
+	Msg( "cvar exec     %d lines    %8.3f us a line\n", nLines, flExec * 1000000.0 / nLines );
+	Msg( "cvar lookup   %d commands  hashed %8.1f ns  linear %8.1f ns\n", CVARTEST_TOTAL,
+		flHashed * 1e9 / nLookups, flLinear * 1e9 / nLinearLookups );
+
+	delete pRegistry;
+}
@@ -0,0 +1,177 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Unit test program for the KeyValues symbol table
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "unitlib/unitlib.h"
+#include "tier0/platform.h"
+#include "tier0/threadtools.h"
+#include "tier1/strtools.h"
+#include "vstdlib/IKeyValuesSystem.h"
+
+DEFINE_TESTSUITE( KeyValuesSymbolTestSuite )
+
+// The strings are never freed, so keep the names well inside the 4MB the
+// system reserves for them
+#define KVSYMBOLTEST_THREADS		4
+#define KVSYMBOLTEST_NAMES			8000
+#define KVSYMBOLTEST_BENCH_NAMES	16000
+
+struct KeyValuesSymbolTestThread_t
+{
+	int m_iThread;
+	HKeySymbol m_Symbols[KVSYMBOLTEST_NAMES];
+	bool m_bOk;
+};
+
+static void KeyValuesSymbolTestName( char *pszName, int nSize, const char *pszPrefix, int i, bool bUpper )
+{
+	V_snprintf( pszName, nSize, bUpper ? "%s_NAME_%d" : "%s_name_%d", pszPrefix, i );
+}
+
+// Every thread adds the same names in its own order and case, and checks
+// lookups for names no one adds
+static uintp KeyValuesSymbolTestThread( void *pParam )
+{
+	KeyValuesSymbolTestThread_t *pData = (KeyValuesSymbolTestThread_t *)pParam;
+	IKeyValuesSystem *pSystem = KeyValuesSystem();
+	pData->m_bOk = true;
+
+	char szName[64];
+	for ( int n = 0; n < KVSYMBOLTEST_NAMES; n++ )
+	{
+		int i = ( n * 7 + pData->m_iThread * 1999 ) % KVSYMBOLTEST_NAMES;
+		KeyValuesSymbolTestName( szName, sizeof( szName ), "kvsymtest", i, ( i + pData->m_iThread ) & 1 );
+		HKeySymbol symbol = pSystem->GetSymbolForString( szName );
+		pData->m_Symbols[i] = symbol;
+
+		if ( symbol <= 0 || V_stricmp( pSystem->GetStringForSymbol( symbol ), szName ) )
+		{
+			pData->m_bOk = false;
+		}
+
+		KeyValuesSymbolTestName( szName, sizeof( szName ), "kvsymmiss", i, false );
+		if ( pSystem->GetSymbolForString( szName, false ) != -1 )
+		{
+			pData->m_bOk = false;
+		}
+	}
+	return 0;
+}
+
+DEFINE_TESTCASE( KeyValuesSymbolTestThreads, KeyValuesSymbolTestSuite )
+{
+	Msg( "Running KeyValues symbol table tests\n" );
+
+	IKeyValuesSystem *pSystem = KeyValuesSystem();
+	Shipping_Assert( pSystem->GetSymbolForString( NULL ) == -1 );
+	Shipping_Assert( pSystem->GetSymbolForString( "" ) == 0 );
+	Shipping_Assert( !V_strcmp( pSystem->GetStringForSymbol( 0 ), "" ) );
+
+	HKeySymbol symbol = pSystem->GetSymbolForString( "KvSymTest_Case" );
+	Shipping_Assert( pSystem->GetSymbolForString( "kvsymtest_case", false ) == symbol );
+	Shipping_Assert( pSystem->GetSymbolForString( "KVSYMTEST_CASE" ) == symbol );
+	Shipping_Assert( !V_strcmp( pSystem->GetStringForSymbol( symbol ), "KvSymTest_Case" ) );
+
+	static KeyValuesSymbolTestThread_t s_Threads[KVSYMBOLTEST_THREADS];
+	ThreadHandle_t hThreads[KVSYMBOLTEST_THREADS];
+	for ( int i = 0; i < KVSYMBOLTEST_THREADS; i++ )
+	{
+		s_Threads[i].m_iThread = i;
+		hThreads[i] = CreateSimpleThread( KeyValuesSymbolTestThread, &s_Threads[i] );
+	}
+
+	for ( int i = 0; i < KVSYMBOLTEST_THREADS; i++ )
+	{
+		ThreadJoin( hThreads[i] );
+		ReleaseThreadHandle( hThreads[i] );
+		Shipping_Assert( s_Threads[i].m_bOk );
+	}
+
+	// everyone got the same symbol for a name, and different names got different symbols
+	char szName[64];
+	for ( int i = 0; i < KVSYMBOLTEST_NAMES; i++ )
+	{
+		for ( int j = 1; j < KVSYMBOLTEST_THREADS; j++ )
+		{
+			Shipping_Assert( s_Threads[j].m_Symbols[i] == s_Threads[0].m_Symbols[i] );
+		}
+
+		KeyValuesSymbolTestName( szName, sizeof( szName ), "kvsymtest", i, true );
+		Shipping_Assert( pSystem->GetSymbolForString( szName, false ) == s_Threads[0].m_Symbols[i] );
+		if ( i )
+		{
+			Shipping_Assert( s_Threads[0].m_Symbols[i] != s_Threads[0].m_Symbols[i - 1] );
+		}
+	}
+}
+
+static uintp KeyValuesSymbolBenchThread( void *pParam )
+{
+	IKeyValuesSystem *pSystem = KeyValuesSystem();
+	char szName[64];
+	for ( int i = 0; i < KVSYMBOLTEST_BENCH_NAMES; i++ )
+	{
+		KeyValuesSymbolTestName( szName, sizeof( szName ), "kvsymbench", i, false );
+		pSystem->GetSymbolForString( szName );
+	}
+	return 0;
+}
+
+DEFINE_TESTCASE( KeyValuesSymbolTestThroughput, KeyValuesSymbolTestSuite )
+{
+	IKeyValuesSystem *pSystem = KeyValuesSystem();
+	char szName[64];
+
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < KVSYMBOLTEST_BENCH_NAMES; i++ )
+	{
+		KeyValuesSymbolTestName( szName, sizeof( szName ), "kvsymbench", i, false );
+		pSystem->GetSymbolForString( szName );
+	}
+	double flInsert = Plat_FloatTime() - flStart;
+
+	const int nPasses = 10;
+	flStart = Plat_FloatTime();
+	for ( int n = 0; n < nPasses; n++ )
+	{
+		for ( int i = 0; i < KVSYMBOLTEST_BENCH_NAMES; i++ )
+		{
+			KeyValuesSymbolTestName( szName, sizeof( szName ), "kvsymbench", i, true );
+			pSystem->GetSymbolForString( szName );
+		}
+	}
+	double flHit = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	for ( int n = 0; n < nPasses; n++ )
+	{
+		for ( int i = 0; i < KVSYMBOLTEST_BENCH_NAMES; i++ )
+		{
+			KeyValuesSymbolTestName( szName, sizeof( szName ), "kvsymbenchmiss", i, false );
+			pSystem->GetSymbolForString( szName, false );
+		}
+	}
+	double flMiss = Plat_FloatTime() - flStart;
+
+	// all the threads looking up the names loaded above, like async loads parsing at once
+	ThreadHandle_t hThreads[KVSYMBOLTEST_THREADS];
+	flStart = Plat_FloatTime();
+	for ( int i = 0; i < KVSYMBOLTEST_THREADS; i++ )
+	{
+		hThreads[i] = CreateSimpleThread( KeyValuesSymbolBenchThread, NULL );
+	}
+	for ( int i = 0; i < KVSYMBOLTEST_THREADS; i++ )
+	{
+		ThreadJoin( hThreads[i] );
+		ReleaseThreadHandle( hThreads[i] );
+	}
+	double flThreaded = Plat_FloatTime() - flStart;
+
+	double flLookups = (double)KVSYMBOLTEST_BENCH_NAMES * nPasses;
+	Msg( "kv symbols  %d names  insert %6.1f ns  hit %6.1f ns  miss %6.1f ns  %d threads %6.1f ns a lookup\n",
+		KVSYMBOLTEST_BENCH_NAMES, flInsert * 1e9 / KVSYMBOLTEST_BENCH_NAMES, flHit * 1e9 / flLookups, flMiss * 1e9 / flLookups,
+		KVSYMBOLTEST_THREADS, flThreaded * 1e9 / ( (double)KVSYMBOLTEST_BENCH_NAMES * KVSYMBOLTEST_THREADS ) );
+}
@@ -0,0 +1,237 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Unit test program for the in place KeyValues parser
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "unitlib/unitlib.h"
+#include "tier0/platform.h"
+#include "tier1/KeyValues.h"
+#include "tier1/keyvaluestree.h"
+#include "tier1/strtools.h"
+#include "tier1/utlvector.h"
+
+DEFINE_TESTSUITE( KeyValuesTreeTestSuite )
+
+static const char s_szKeyValuesTreeTest[] =
+	"// a comment\n"
+	"\"Root\"\n"
+	"{\n"
+	"	\"name\"		\"value\"		// trailing comment\n"
+	"	\"int\"		\"42\"\n"
+	"	\"float\"		\"1.5\"\n"
+	"	\"neg\"		\"-7\"\n"
+	"	\"big\"		\"0x0123456789abcdef\"\n"
+	"	\"hexish\"	\"0x10\"\n"
+	"	\"numstr\"	\"12abc\"\n"
+	"	\"empty\"		\"\"\n"
+	"	unquoted	value\n"
+	"	\"sub\"\n"
+	"	{\n"
+	"		\"a\"	\"1\"\n"
+	"		\"b\"	\"2\"	[$X360]\n"
+	"		\"c\"	\"3\"	[!$X360]\n"
+	"		\"dup\"	\"x\"\n"
+	"		\"dup\"	\"y\"\n"
+	"		\"nested\" { \"deep\" { \"x\" \"y\" } }\n"
+	"	}\n"
+	"	\"xbox\"	[$X360]\n"
+	"	{\n"
+	"		\"gone\"	\"1\"\n"
+	"	}\n"
+	"	\"adjacent\"{\"k\"\"v\"}\n"
+	"	\"tight\"{k v}\n"
+	"	\"slash\"	\"a//b\"\n"
+	"	url	http://x\n"
+	"}\n"
+	"\"Second\" { \"k\" \"v\" }\n"
+	"Fourth{k v}\n"
+	"\"Third\" [$X360] { \"k\" \"v\" }";
+
+static const char s_szKeyValuesTreeEscapes[] =
+	"\"Strings\"\n"
+	"{\n"
+	"	\"esc\"		\"tab\\there \\\"quoted\\\" back\\\\slash\"\n"
+	"	\"nl\"		\"line\\nbreak\"\n"
+	"	\"unknown\"	\"a\\qb\"\n"
+	"	\"after\"		\"1\"\n"
+	"}\n";
+
+static bool KeyValuesMatch( KeyValues *pA, KeyValues *pB )
+{
+	for ( ; pA && pB; pA = pA->GetNextKey(), pB = pB->GetNextKey() )
+	{
+		if ( V_strcmp( pA->GetName(), pB->GetName() ) || pA->GetDataType() != pB->GetDataType() )
+			return false;
+
+		switch ( pA->GetDataType() )
+		{
+		case KeyValues::TYPE_NONE:
+			if ( !KeyValuesMatch( pA->GetFirstSubKey(), pB->GetFirstSubKey() ) )
+				return false;
+			break;
+		case KeyValues::TYPE_UINT64:
+			if ( pA->GetUint64() != pB->GetUint64() )
+				return false;
+			break;
+		case KeyValues::TYPE_FLOAT:
+			if ( pA->GetFloat() != pB->GetFloat() )
+				return false;
+			break;
+		default:
+			if ( V_strcmp( pA->GetString(), pB->GetString() ) )
+				return false;
+			break;
+		}
+	}
+	return !pA && !pB;
+}
+
+// Parses the text both ways and checks the tree copies out into what
+// KeyValues loaded
+static bool KeyValuesTreeMatches( const char *pszText, bool bEscapeSequences )
+{
+	KeyValues *pLoaded = new KeyValues( "" );
+	pLoaded->UsesEscapeSequences( bEscapeSequences );
+	pLoaded->LoadFromBuffer( "test", pszText );
+
+	CUtlVector< char > buffer;
+	buffer.CopyArray( pszText, V_strlen( pszText ) + 1 );
+	CKeyValuesTree tree;
+	tree.UsesEscapeSequences( bEscapeSequences );
+	tree.Parse( "test", buffer.Base() );
+	KeyValues *pCopied = tree.MakeKeyValues( tree.GetFirstKey(), true );
+
+	bool bMatch = KeyValuesMatch( pLoaded, pCopied );
+	pLoaded->deleteThis();
+	if ( pCopied )
+	{
+		pCopied->deleteThis();
+	}
+	return bMatch;
+}
+
+DEFINE_TESTCASE( KeyValuesTreeTestParse, KeyValuesTreeTestSuite )
+{
+	Msg( "Running KeyValues tree tests\n" );
+
+	Shipping_Assert( KeyValuesTreeMatches( s_szKeyValuesTreeTest, false ) );
+	Shipping_Assert( KeyValuesTreeMatches( s_szKeyValuesTreeTest, true ) );
+	Shipping_Assert( KeyValuesTreeMatches( s_szKeyValuesTreeEscapes, false ) );
+	Shipping_Assert( KeyValuesTreeMatches( s_szKeyValuesTreeEscapes, true ) );
+
+	CUtlVector< char > buffer;
+	buffer.CopyArray( s_szKeyValuesTreeTest, sizeof( s_szKeyValuesTreeTest ) );
+	CKeyValuesTree tree;
+	Shipping_Assert( tree.Parse( "test", buffer.Base() ) );
+
+	// names and values are slices of the buffer
+	const CKeyValuesTreeNode *pRoot = tree.GetFirstKey();
+	Shipping_Assert( pRoot && !V_strcmp( pRoot->GetName(), "Root" ) && pRoot->IsSection() );
+	Shipping_Assert( pRoot->GetName() > buffer.Base() && pRoot->GetName() < buffer.Base() + buffer.Count() );
+	Shipping_Assert( pRoot->GetFirstSubKey()->GetString() > buffer.Base() );
+
+	Shipping_Assert( !V_strcmp( pRoot->GetString( "name" ), "value" ) );
+	Shipping_Assert( pRoot->GetInt( "INT" ) == 42 );
+	Shipping_Assert( pRoot->GetFloat( "float" ) == 1.5f );
+	Shipping_Assert( pRoot->GetInt( "neg" ) == -7 );
+	Shipping_Assert( pRoot->GetBool( "int" ) && !pRoot->GetBool( "missing" ) );
+	Shipping_Assert( pRoot->GetInt( "missing", 3 ) == 3 );
+	Shipping_Assert( !V_strcmp( pRoot->GetString( "unquoted" ), "value" ) );
+	Shipping_Assert( !V_strcmp( pRoot->GetString( "sub", "default" ), "default" ) );
+	Shipping_Assert( !V_strcmp( pRoot->GetString( "sub/dup" ), "x" ) );
+	Shipping_Assert( !V_strcmp( pRoot->GetString( "sub/nested/deep/x" ), "y" ) );
+	Shipping_Assert( !V_strcmp( pRoot->GetString( "tight/k" ), "v" ) );
+	Shipping_Assert( !V_strcmp( pRoot->GetString( "url" ), "http://x" ) );
+	Shipping_Assert( !pRoot->FindKey( "xbox" ) && !pRoot->FindKey( "sub/b" ) && pRoot->FindKey( "sub/c" ) );
+	Shipping_Assert( tree.FindKey( "Second/k" ) && !tree.FindKey( "Third" ) && tree.FindKey( "fourth" ) );
+
+	int nSections = 0;
+	for ( const CKeyValuesTreeNode *pNode = pRoot->GetFirstTrueSubKey(); pNode; pNode = pNode->GetNextTrueSubKey() )
+	{
+		nSections++;
+	}
+	Shipping_Assert( nSections == 3 );
+
+	// copying out one key leaves its peers alone
+	KeyValues *pSub = tree.MakeKeyValues( pRoot->FindKey( "sub" ) );
+	Shipping_Assert( pSub && !pSub->GetNextKey() && pSub->GetInt( "a" ) == 1 );
+	Shipping_Assert( pSub->GetDataType( "a" ) == KeyValues::TYPE_INT );
+	pSub->SetInt( "a", 5 );
+	Shipping_Assert( pSub->GetInt( "a" ) == 5 && pRoot->GetInt( "sub/a" ) == 1 );
+	pSub->deleteThis();
+
+	// includes are listed, not loaded
+	char szIncludes[] = "#base \"base.res\"\n#include \"inc.res\"\n\"Key\" { \"k\" \"v\" }\n";
+	Shipping_Assert( tree.Parse( "test", szIncludes ) );
+	Shipping_Assert( tree.GetBases().Count() == 1 && !V_strcmp( tree.GetBases()[0], "base.res" ) );
+	Shipping_Assert( tree.GetIncludes().Count() == 1 && !V_strcmp( tree.GetIncludes()[0], "inc.res" ) );
+	Shipping_Assert( !V_strcmp( tree.GetFirstKey()->GetName(), "Key" ) && tree.GetNodeCount() == 2 );
+}
+
+// Looks like items_game: lots of small sections of short quoted values
+static void BuildItemsLikeText( CUtlVector< char > &text, int nItems )
+{
+	text.RemoveAll();
+	char szLine[256];
+	int nLen = V_snprintf( szLine, sizeof( szLine ), "\"items_game\"\n{\n\t\"items\"\n\t{\n" );
+	text.AddMultipleToTail( nLen, szLine );
+	for ( int i = 0; i < nItems; i++ )
+	{
+		nLen = V_snprintf( szLine, sizeof( szLine ),
+			"\t\t\"%d\"\n\t\t{\n"
+			"\t\t\t\"name\"\t\t\"Item %d\"\n"
+			"\t\t\t\"item_class\"\t\"tf_wearable\"\n"
+			"\t\t\t\"model_player\"\t\"models/player/items/hat_%04d.mdl\"\n"
+			"\t\t\t\"min_ilevel\"\t\"%d\"\n"
+			"\t\t\t\"attributes\"\n\t\t\t{\n"
+			"\t\t\t\t\"mult_dmg\"\t{ \"attribute_class\" \"mult_dmg\" \"value\" \"%d.25\" }\n"
+			"\t\t\t}\n\t\t}\n",
+			i, i, i, i % 100, i % 3 );
+		text.AddMultipleToTail( nLen, szLine );
+	}
+	text.AddMultipleToTail( 6, "\t}\n}\n" );
+	text.AddToTail( 0 );
+}
+
+DEFINE_TESTCASE( KeyValuesTreeTestThroughput, KeyValuesTreeTestSuite )
+{
+	CUtlVector< char > text;
+	BuildItemsLikeText( text, 20000 );
+	const int nPasses = 3;
+	double flMB = (double)text.Count() * nPasses / ( 1024.0 * 1024.0 );
+
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < nPasses; i++ )
+	{
+		KeyValues *pKeyValues = new KeyValues( "" );
+		pKeyValues->LoadFromBuffer( "items_game", text.Base() );
+		pKeyValues->deleteThis();
+	}
+	double flLoad = Plat_FloatTime() - flStart;
+
+	// The tree needs its own writable copy of the text, that copy is timed too
+	CUtlVector< char > buffer;
+	CKeyValuesTree tree;
+	flStart = Plat_FloatTime();
+	for ( int i = 0; i < nPasses; i++ )
+	{
+		buffer.CopyArray( text.Base(), text.Count() );
+		Shipping_Assert( tree.Parse( "items_game", buffer.Base() ) );
+	}
+	double flTree = Plat_FloatTime() - flStart;
+	Shipping_Assert( tree.FindKey( "items_game/items/19999/attributes/mult_dmg/value" ) );
+
+	flStart = Plat_FloatTime();
+	for ( int i = 0; i < nPasses; i++ )
+	{
+		buffer.CopyArray( text.Base(), text.Count() );
+		tree.Parse( "items_game", buffer.Base() );
+		tree.MakeKeyValues( tree.GetFirstKey(), true )->deleteThis();
+	}
+	double flCopied = Plat_FloatTime() - flStart;
+
+	Msg( "keyvalues  %d nodes  load %8.1f MB/s  tree %8.1f MB/s  tree + copy %8.1f MB/s\n",
+		tree.GetNodeCount(), flMB / flLoad, flMB / flTree, flMB / flCopied );
+}
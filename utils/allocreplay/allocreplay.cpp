@@ -0,0 +1,512 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Runs a synthetic server tick allocation workload, or replays an
+//			allocation trace recorded with mem_trace_start, against several
+//			allocators, each in its own process, and compares throughput and
+//			resident memory. -churn lists the trace's busiest callsites.
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef POSIX
+#include <unistd.h>
+#endif
+#include "tier0/dbg.h"
+#include "tier0/platform.h"
+#include "tier0/threadtools.h"
+#include "tier0/icommandline.h"
+#include "tier1/strtools.h"
+#include "tier1/utlvector.h"
+#include "replayallocators.h"
+#include "tracereplay.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+#define ALLOCREPLAY_MAX_THREADS	64
+#define ALLOCREPLAY_BUFFERS		4		// growing buffers a tick, like a CUtlVector filled up
+
+static bool verbose = false;
+
+struct WorkloadParams_t
+{
+	int		m_nTicks;
+	int		m_nEntities;		// long lived blocks, a few are replaced every tick
+	int		m_nTransient;		// blocks allocated and freed within a tick
+	int		m_nThreads;
+	uint32	m_nSeed;
+};
+
+//-----------------------------------------------------------------------------
+// One thread's share of the workload. All bookkeeping is allocated up front
+// so the ticks only measure the allocator.
+//-----------------------------------------------------------------------------
+class CTickWorkload
+{
+public:
+	CTickWorkload( IReplayAllocator *pAllocator, const WorkloadParams_t &params, uint32 nSeed );
+	~CTickWorkload();
+
+	void RunTick();
+	int64 GetNumOps() const { return m_nOps; }
+
+private:
+	uint32 Random();
+	size_t RandomSize();
+	void *Alloc( size_t nSize );
+
+	IReplayAllocator	*m_pAllocator;
+	const WorkloadParams_t &m_Params;
+	uint32				m_nRandom;
+	int64				m_nOps;
+
+	CUtlVector<void *>	m_Entities;
+	CUtlVector<void *>	m_Transient;
+};
+
+CTickWorkload::CTickWorkload( IReplayAllocator *pAllocator, const WorkloadParams_t &params, uint32 nSeed ) :
+	m_pAllocator( pAllocator ), m_Params( params ), m_nRandom( nSeed | 1 ), m_nOps( 0 )
+{
+	m_Transient.EnsureCapacity( params.m_nTransient );
+	m_Entities.SetCount( params.m_nEntities );
+	FOR_EACH_VEC( m_Entities, i )
+	{
+		m_Entities[i] = Alloc( RandomSize() );
+	}
+}
+
+CTickWorkload::~CTickWorkload()
+{
+	FOR_EACH_VEC( m_Entities, i )
+	{
+		m_pAllocator->Free( m_Entities[i] );
+	}
+}
+
+uint32 CTickWorkload::Random()
+{
+	// xorshift, the same sequence for every allocator
+	m_nRandom ^= m_nRandom << 13;
+	m_nRandom ^= m_nRandom >> 17;
+	m_nRandom ^= m_nRandom << 5;
+	return m_nRandom;
+}
+
+// Mostly small blocks, like the strings, vectors and nodes a tick creates
+size_t CTickWorkload::RandomSize()
+{
+	uint32 nKind = Random() % 100;
+	if ( nKind < 55 )
+		return 8 + Random() % 57;
+	if ( nKind < 85 )
+		return 65 + Random() % 192;
+	if ( nKind < 97 )
+		return 257 + Random() % 1792;
+	return 2049 + Random() % 30720;
+}
+
+void *CTickWorkload::Alloc( size_t nSize )
+{
+	byte *p = (byte *)m_pAllocator->Alloc( nSize );
+	if ( !p )
+	{
+		Error( "%s couldn't allocate %u bytes\n", m_pAllocator->GetName(), (unsigned)nSize );
+	}
+
+	// touch it so the pages count as resident
+	p[0] = p[nSize - 1] = 0;
+	m_nOps++;
+	return p;
+}
+
+void CTickWorkload::RunTick()
+{
+	for ( int i = 0; i < m_Params.m_nTransient; i++ )
+	{
+		m_Transient.AddToTail( Alloc( RandomSize() ) );
+	}
+
+	void *pBuffers[ALLOCREPLAY_BUFFERS];
+	for ( int i = 0; i < ALLOCREPLAY_BUFFERS; i++ )
+	{
+		size_t nSize = 32;
+		pBuffers[i] = Alloc( nSize );
+		while ( nSize < 4096 )
+		{
+			nSize *= 2;
+			pBuffers[i] = m_pAllocator->Realloc( pBuffers[i], nSize );
+			((byte *)pBuffers[i])[nSize - 1] = 0;
+			m_nOps++;
+		}
+	}
+
+	// entities that were removed and spawned this tick
+	int nReplace = m_Entities.Count() / 100 + 1;
+	for ( int i = 0; i < nReplace && m_Entities.Count(); i++ )
+	{
+		int iEntity = Random() % m_Entities.Count();
+		m_pAllocator->Free( m_Entities[iEntity] );
+		m_nOps++;
+		m_Entities[iEntity] = Alloc( RandomSize() );
+	}
+
+	for ( int i = 0; i < ALLOCREPLAY_BUFFERS; i++ )
+	{
+		m_pAllocator->Free( pBuffers[i] );
+		m_nOps++;
+	}
+
+	// the tick's temporaries go away in no particular order
+	while ( m_Transient.Count() )
+	{
+		int iBlock = Random() % m_Transient.Count();
+		m_pAllocator->Free( m_Transient[iBlock] );
+		m_nOps++;
+		m_Transient.FastRemove( iBlock );
+	}
+}
+
+struct WorkloadThread_t
+{
+	CTickWorkload	*m_pWorkload;
+	int				m_nTicks;
+	ThreadHandle_t	m_hThread;
+};
+
+static uintp WorkloadThreadFunc( void *pParam )
+{
+	WorkloadThread_t *pThread = (WorkloadThread_t *)pParam;
+	for ( int i = 0; i < pThread->m_nTicks; i++ )
+	{
+		pThread->m_pWorkload->RunTick();
+	}
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Peak and current resident set in kb
+//-----------------------------------------------------------------------------
+static void GetResidentSize( int &nPeakKB, int &nCurrentKB )
+{
+	nPeakKB = nCurrentKB = 0;
+#ifdef LINUX
+	FILE *fp = fopen( "/proc/self/status", "r" );
+	if ( !fp )
+		return;
+
+	char szLine[256];
+	while ( fgets( szLine, sizeof( szLine ), fp ) )
+	{
+		sscanf( szLine, "VmHWM: %d", &nPeakKB );
+		sscanf( szLine, "VmRSS: %d", &nCurrentKB );
+	}
+	fclose( fp );
+#endif
+}
+
+// Peak resident set starts over from the current one
+static void ResetPeakResidentSize()
+{
+#ifdef LINUX
+	FILE *fp = fopen( "/proc/self/clear_refs", "w" );
+	if ( fp )
+	{
+		fputs( "5", fp );
+		fclose( fp );
+	}
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs the workload in this process and prints one result line
+//-----------------------------------------------------------------------------
+static int RunWorkload( const char *pszAllocator, const WorkloadParams_t &params )
+{
+	IReplayAllocator *pAllocator = FindReplayAllocator( pszAllocator );
+	if ( !pAllocator )
+	{
+		Msg( "Unknown allocator %s.\n", pszAllocator );
+		return 1;
+	}
+
+	WorkloadThread_t threads[ALLOCREPLAY_MAX_THREADS];
+	for ( int i = 0; i < params.m_nThreads; i++ )
+	{
+		threads[i].m_pWorkload = new CTickWorkload( pAllocator, params, params.m_nSeed + i * 7919 );
+		threads[i].m_nTicks = params.m_nTicks;
+		threads[i].m_hThread = NULL;
+	}
+
+	double flStartTime = Plat_FloatTime();
+
+	for ( int i = 1; i < params.m_nThreads; i++ )
+	{
+		threads[i].m_hThread = CreateSimpleThread( WorkloadThreadFunc, &threads[i], 256 * 1024 );
+	}
+	WorkloadThreadFunc( &threads[0] );
+
+	int64 nOps = 0;
+	for ( int i = 0; i < params.m_nThreads; i++ )
+	{
+		if ( threads[i].m_hThread )
+		{
+			ThreadJoin( threads[i].m_hThread );
+			ReleaseThreadHandle( threads[i].m_hThread );
+		}
+		nOps += threads[i].m_pWorkload->GetNumOps();
+	}
+
+	double flTime = MAX( Plat_FloatTime() - flStartTime, 0.001 );
+
+	// the entities are still alive, this is the steady state of a running server
+	int nPeakKB, nCurrentKB;
+	GetResidentSize( nPeakKB, nCurrentKB );
+
+	for ( int i = 0; i < params.m_nThreads; i++ )
+	{
+		delete threads[i].m_pWorkload;
+	}
+
+	printf( "allocreplay: %lld %f %d %d\n", nOps, flTime, nPeakKB, nCurrentKB );
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Replays a trace in this process and prints one result line. The
+//			resident sizes leave out the replay's own data.
+//-----------------------------------------------------------------------------
+static int RunTrace( const char *pszAllocator, const char *pszTrace )
+{
+	IReplayAllocator *pAllocator = FindReplayAllocator( pszAllocator );
+	if ( !pAllocator )
+	{
+		Msg( "Unknown allocator %s.\n", pszAllocator );
+		return 1;
+	}
+
+	CAllocTrace trace;
+	if ( !trace.Load( pszTrace, 0 ) )
+		return 1;
+	trace.PurgeSites();
+
+	CUtlVector<void *> blocks;
+	blocks.SetCount( trace.GetNumSlots() );
+	blocks.FillWithValue( NULL );
+
+	ResetPeakResidentSize();
+	int nBasePeakKB, nBaseKB;
+	GetResidentSize( nBasePeakKB, nBaseKB );
+
+	double flStartTime = Plat_FloatTime();
+	int64 nOps = trace.Replay( pAllocator, blocks.Base() );
+	double flTime = MAX( Plat_FloatTime() - flStartTime, 0.001 );
+
+	// what the trace never freed is still alive, like on the server
+	int nPeakKB, nCurrentKB;
+	GetResidentSize( nPeakKB, nCurrentKB );
+
+	FOR_EACH_VEC( blocks, i )
+	{
+		if ( blocks[i] )
+		{
+			pAllocator->Free( blocks[i] );
+		}
+	}
+
+	printf( "allocreplay: %lld %f %d %d\n", nOps, flTime, MAX( nPeakKB - nBaseKB, 0 ), MAX( nCurrentKB - nBaseKB, 0 ) );
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs the workload in a child process so every allocator starts with
+//			a fresh heap and its own resident set
+//-----------------------------------------------------------------------------
+static bool RunChild( const char *pszLabel, const char *pszAllocator, const char *pszArgs, const char *pszPreload, const char *pszWorkload )
+{
+#ifdef POSIX
+	char szExe[MAX_PATH];
+	int nLen = readlink( "/proc/self/exe", szExe, sizeof( szExe ) - 1 );
+	if ( nLen <= 0 )
+	{
+		Msg( "Couldn't find the allocreplay executable.\n" );
+		return false;
+	}
+	szExe[nLen] = 0;
+
+	char szPreload[MAX_PATH + 16] = "";
+	if ( pszPreload )
+	{
+		Q_snprintf( szPreload, sizeof( szPreload ), "LD_PRELOAD='%s' ", pszPreload );
+	}
+
+	char szCommand[3 * MAX_PATH + 256];
+	Q_snprintf( szCommand, sizeof( szCommand ), "%s'%s' -run %s %s %s", szPreload, szExe, pszAllocator, pszWorkload, pszArgs );
+	if ( verbose )
+	{
+		Msg( "%s\n", szCommand );
+	}
+
+	FILE *fp = popen( szCommand, "r" );
+	if ( !fp )
+	{
+		Msg( "Couldn't run %s.\n", pszLabel );
+		return false;
+	}
+
+	bool bOk = false;
+	char szLine[256];
+	while ( fgets( szLine, sizeof( szLine ), fp ) )
+	{
+		long long nOps;
+		double flTime;
+		int nPeakKB, nCurrentKB;
+		if ( sscanf( szLine, "allocreplay: %lld %lf %d %d", &nOps, &flTime, &nPeakKB, &nCurrentKB ) == 4 )
+		{
+			Msg( "%-40s %10.2f %10.3f %12.1f %10.1f\n", pszLabel, nOps / flTime / 1000000.0, flTime, nPeakKB / 1024.0, nCurrentKB / 1024.0 );
+			bOk = true;
+		}
+		else
+		{
+			Msg( "%s", szLine );
+		}
+	}
+
+	if ( pclose( fp ) != 0 || !bOk )
+	{
+		Msg( "%s failed.\n", pszLabel );
+		return false;
+	}
+	return true;
+#else
+	Msg( "Comparing allocators needs /proc, use -run <allocator>.\n" );
+	return false;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Warning/Msg call back through this API
+//-----------------------------------------------------------------------------
+SpewRetval_t SpewFunc( SpewType_t type, char const *pMsg )
+{
+	switch ( type )
+	{
+	default:
+	case SPEW_MESSAGE:
+	case SPEW_ASSERT:
+	case SPEW_LOG:
+		printf( "%s", pMsg );
+		break;
+	case SPEW_WARNING:
+		if ( verbose )
+		{
+			printf( "%s", pMsg );
+		}
+		break;
+	case SPEW_ERROR:
+		printf( "%s\n", pMsg );
+		break;
+	}
+
+	return SPEW_CONTINUE;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Shows usage information
+//-----------------------------------------------------------------------------
+void printusage( void )
+{
+	printf( "usage:  allocreplay [options]\n\
+		\t-ticks <n> = ticks to run, default 20000\n\
+		\t-entities <n> = long lived blocks, default 4000\n\
+		\t-transient <n> = blocks allocated and freed every tick, default 500\n\
+		\t-threads <n> = threads running the workload, default 1\n\
+		\t-seed <n> = random seed\n\
+		\t-preload <lib.so>[,<lib.so>...] = also measure these mallocs\n\
+		\t-trace <file> = replay an allocation trace instead, see mem_trace_start\n\
+		\t-churn = list the trace's callsites by allocations a second instead\n\
+		\t-top <n> = callsites to list, default 30\n\
+		\t-tick <ms> = blocks freed sooner are freed within a tick, default 15\n\
+		\t-run <tier0|libc> = run the workload in this process only\n\
+		\t-v = verbose output\n\
+		\ne.g.:  allocreplay -threads 4 -preload /usr/lib/libjemalloc.so.2\n\
+		\n       allocreplay -trace memtrace.mtr -churn\n" );
+
+	// Exit app
+	exit( 1 );
+}
+
+int main( int argc, char* argv[] )
+{
+	SpewOutputFunc( SpewFunc );
+	SpewActivate( "allocreplay", 2 );
+	CommandLine()->CreateCmdLine( argc, argv );
+
+	if ( CommandLine()->FindParm( "-?" ) || CommandLine()->FindParm( "-help" ) )
+	{
+		printusage();
+	}
+
+	verbose = CommandLine()->FindParm( "-v" ) != 0;
+
+	WorkloadParams_t params;
+	params.m_nTicks = MAX( CommandLine()->ParmValue( "-ticks", 20000 ), 1 );
+	params.m_nEntities = MAX( CommandLine()->ParmValue( "-entities", 4000 ), 0 );
+	params.m_nTransient = MAX( CommandLine()->ParmValue( "-transient", 500 ), 0 );
+	params.m_nThreads = clamp( CommandLine()->ParmValue( "-threads", 1 ), 1, ALLOCREPLAY_MAX_THREADS );
+	params.m_nSeed = (uint32)CommandLine()->ParmValue( "-seed", 1 );
+
+	const char *pszTrace = CommandLine()->ParmValue( "-trace", (const char *)NULL );
+	const char *pszRun = CommandLine()->ParmValue( "-run", (const char *)NULL );
+	if ( pszRun )
+	{
+		return pszTrace ? RunTrace( pszRun, pszTrace ) : RunWorkload( pszRun, params );
+	}
+
+	char szWorkload[MAX_PATH + 256];
+	if ( pszTrace )
+	{
+		CAllocTrace trace;
+		if ( !trace.Load( pszTrace, 1000 * MAX( CommandLine()->ParmValue( "-tick", 15 ), 1 ) ) )
+			return 1;
+
+		Msg( "%s: %d ops from %d threads over %.1f seconds, %d blocks live at most\n",
+			pszTrace, trace.GetNumOps(), trace.GetNumThreads(), trace.GetDuration(), trace.GetNumSlots() );
+		if ( trace.GetDropped() || trace.GetUnmatched() )
+		{
+			Msg( "%u events dropped while tracing, %lld frees and reallocs of unknown blocks\n",
+				trace.GetDropped(), (long long)trace.GetUnmatched() );
+		}
+		Msg( "\n" );
+
+		if ( CommandLine()->FindParm( "-churn" ) )
+		{
+			trace.PrintChurn( MAX( CommandLine()->ParmValue( "-top", 30 ), 1 ) );
+			return 0;
+		}
+
+		Q_snprintf( szWorkload, sizeof( szWorkload ), "-trace '%s'", pszTrace );
+	}
+	else
+	{
+		Msg( "%d ticks, %d entities, %d transient blocks a tick, %d threads\n\n",
+			params.m_nTicks, params.m_nEntities, params.m_nTransient, params.m_nThreads );
+		Q_snprintf( szWorkload, sizeof( szWorkload ), "-ticks %d -entities %d -transient %d -threads %d -seed %u",
+			params.m_nTicks, params.m_nEntities, params.m_nTransient, params.m_nThreads, params.m_nSeed );
+	}
+
+	Msg( "%-40s %10s %10s %12s %10s\n", "allocator", "Mops/s", "seconds", "peak RSS MB", "RSS MB" );
+
+	bool bOk = RunChild( "libc", "libc", "", NULL, szWorkload );
+	bOk = RunChild( "tier0", "tier0", "", NULL, szWorkload ) && bOk;
+	bOk = RunChild( "tier0 -sbh", "tier0", "-sbh", NULL, szWorkload ) && bOk;
+
+	CUtlStringList preloads;
+	V_SplitString( CommandLine()->ParmValue( "-preload", "" ), ",", preloads );
+	FOR_EACH_VEC( preloads, i )
+	{
+		bOk = RunChild( preloads[i], "libc", "", preloads[i], szWorkload ) && bOk;
+	}
+
+	return bOk ? 0 : 1;
+}
@@ -0,0 +1,56 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: The allocators allocreplay can measure. Other mallocs are measured
+//			as "libc" with the allocator preloaded into the process.
+//
+//=============================================================================
+
+#include <stdlib.h>
+#include "tier0/memalloc.h"
+#include "tier1/strtools.h"
+#include "replayallocators.h"
+
+// No memdbgon here, the libc allocator must reach the real malloc
+
+//-----------------------------------------------------------------------------
+// tier0's allocator, with the small block heap when run with -sbh
+//-----------------------------------------------------------------------------
+class CTier0ReplayAllocator : public IReplayAllocator
+{
+public:
+	virtual const char *GetName() { return "tier0"; }
+	virtual void *Alloc( size_t nSize ) { return g_pMemAlloc->Alloc( nSize ); }
+	virtual void *Realloc( void *p, size_t nSize ) { return g_pMemAlloc->Realloc( p, nSize ); }
+	virtual void Free( void *p ) { g_pMemAlloc->Free( p ); }
+};
+
+//-----------------------------------------------------------------------------
+// Whatever malloc the process has
+//-----------------------------------------------------------------------------
+class CLibcReplayAllocator : public IReplayAllocator
+{
+public:
+	virtual const char *GetName() { return "libc"; }
+	virtual void *Alloc( size_t nSize ) { return malloc( nSize ); }
+	virtual void *Realloc( void *p, size_t nSize ) { return realloc( p, nSize ); }
+	virtual void Free( void *p ) { free( p ); }
+};
+
+static CTier0ReplayAllocator s_Tier0Allocator;
+static CLibcReplayAllocator s_LibcAllocator;
+
+static IReplayAllocator *s_pAllocators[] =
+{
+	&s_Tier0Allocator,
+	&s_LibcAllocator,
+};
+
+IReplayAllocator *FindReplayAllocator( const char *pszName )
+{
+	for ( int i = 0; i < (int)ARRAYSIZE( s_pAllocators ); i++ )
+	{
+		if ( !V_stricmp( s_pAllocators[i]->GetName(), pszName ) )
+			return s_pAllocators[i];
+	}
+	return NULL;
+}
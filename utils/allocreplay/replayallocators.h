@@ -0,0 +1,27 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: The allocators allocreplay can measure
+//
+//=============================================================================
+
+#ifndef REPLAYALLOCATORS_H
+#define REPLAYALLOCATORS_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/platform.h"
+
+abstract_class IReplayAllocator
+{
+public:
+	virtual const char *GetName() = 0;
+	virtual void *Alloc( size_t nSize ) = 0;
+	virtual void *Realloc( void *p, size_t nSize ) = 0;
+	virtual void Free( void *p ) = 0;
+};
+
+// NULL if there is no allocator by that name
+IReplayAllocator *FindReplayAllocator( const char *pszName );
+
+#endif // REPLAYALLOCATORS_H
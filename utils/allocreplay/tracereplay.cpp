@@ -0,0 +1,545 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Reads allocation traces written by tier0, replays them and
+//			reports which callsites churn the heap
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#ifdef POSIX
+#include <cxxabi.h>
+#endif
+#include "tier0/dbg.h"
+#include "tier0/memtrace.h"
+#include "tier1/strtools.h"
+#include "tier1/utlhashtable.h"
+#include "replayallocators.h"
+#include "tracereplay.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+struct TraceEvent_t
+{
+	uint64			m_nTime;			// microseconds since the trace started
+	uint32			m_nThread;
+	memtraceevent_t	m_Event;
+};
+
+static bool TraceEventThreadLess( const TraceEvent_t &a, const TraceEvent_t &b )
+{
+	return a.m_nThread < b.m_nThread;
+}
+
+// Orders the next events of two threads. A free and an allocation in the same
+// microsecond may be a block changing hands, the free has to go first.
+static bool TraceEventLess( const TraceEvent_t &a, const TraceEvent_t &b )
+{
+	if ( a.m_nTime != b.m_nTime )
+		return a.m_nTime < b.m_nTime;
+	return ( a.m_Event.m_nBlock == 0 ) > ( b.m_Event.m_nBlock == 0 );
+}
+
+struct TraceThread_t
+{
+	int		m_iNext;
+	int		m_iEnd;
+};
+
+struct TraceSlot_t
+{
+	uint64	m_nTime;
+	int		m_iSite;
+	uint32	m_nSize;
+};
+
+//-----------------------------------------------------------------------------
+// Turns the ordered events into ops, giving every live block a slot, and
+// totals up the sites as it goes
+//-----------------------------------------------------------------------------
+class CTraceBuilder
+{
+public:
+	CTraceBuilder( CUtlVector<TraceOp_t> &ops, CUtlVector<TraceSite_t> &sites, uint64 nTickMicroseconds );
+
+	void AddEvent( const TraceEvent_t &event );
+	void Finish();
+
+	int GetNumSlots() const { return m_Slots.Count(); }
+	int64 GetUnmatched() const { return m_nUnmatched; }
+
+private:
+	int FindOrAddSite( uint32 nCallsite, uint32 nCredit );
+	uint32 AllocSlot( uint64 nBlock, uint64 nTime, int iSite, uint32 nSize );
+	void FreeSlot( uint32 nSlot, uint64 nTime, bool bCount );
+	void AddOp( TraceOpType_t type, uint32 nSlot, uint32 nSize );
+
+	CUtlVector<TraceOp_t>			&m_Ops;
+	CUtlVector<TraceSite_t>			&m_Sites;
+	uint64							m_nTickMicroseconds;
+	CUtlHashtable<uint64, int>		m_SiteIndex;	// callsite << 32 | credit
+	CUtlHashtable<uint64, uint32>	m_Live;			// address to slot
+	CUtlHashtable<uint32, uint32>	m_Reallocs;		// thread to the slot of the block it is reallocating, ~0 for an unknown block
+	CUtlVector<TraceSlot_t>			m_Slots;
+	CUtlVector<uint32>				m_FreeSlots;
+	int64							m_nUnmatched;
+};
+
+CTraceBuilder::CTraceBuilder( CUtlVector<TraceOp_t> &ops, CUtlVector<TraceSite_t> &sites, uint64 nTickMicroseconds ) :
+	m_Ops( ops ), m_Sites( sites ), m_nTickMicroseconds( nTickMicroseconds ), m_nUnmatched( 0 )
+{
+}
+
+int CTraceBuilder::FindOrAddSite( uint32 nCallsite, uint32 nCredit )
+{
+	uint64 nKey = ( (uint64)nCallsite << 32 ) | nCredit;
+	UtlHashHandle_t h = m_SiteIndex.Find( nKey );
+	if ( h != m_SiteIndex.InvalidHandle() )
+		return m_SiteIndex[h];
+
+	int iSite = m_Sites.AddToTail();
+	TraceSite_t &site = m_Sites[iSite];
+	V_memset( &site, 0, sizeof( site ) );
+	site.m_nCallsite = nCallsite;
+	site.m_nCredit = nCredit;
+	m_SiteIndex.Insert( nKey, iSite );
+	return iSite;
+}
+
+void CTraceBuilder::AddOp( TraceOpType_t type, uint32 nSlot, uint32 nSize )
+{
+	TraceOp_t &op = m_Ops[m_Ops.AddToTail()];
+	op.m_nType = type;
+	op.m_nSlot = nSlot;
+	op.m_nSize = nSize;
+}
+
+uint32 CTraceBuilder::AllocSlot( uint64 nBlock, uint64 nTime, int iSite, uint32 nSize )
+{
+	uint32 nSlot;
+	if ( m_FreeSlots.Count() )
+	{
+		nSlot = m_FreeSlots.Tail();
+		m_FreeSlots.RemoveMultipleFromTail( 1 );
+	}
+	else
+	{
+		nSlot = m_Slots.AddToTail();
+	}
+
+	m_Slots[nSlot].m_nTime = nTime;
+	m_Slots[nSlot].m_iSite = iSite;
+	m_Slots[nSlot].m_nSize = nSize;
+	m_Live.Insert( nBlock, nSlot );
+	return nSlot;
+}
+
+void CTraceBuilder::FreeSlot( uint32 nSlot, uint64 nTime, bool bCount )
+{
+	if ( bCount )
+	{
+		const TraceSlot_t &slot = m_Slots[nSlot];
+		TraceSite_t &site = m_Sites[slot.m_iSite];
+		uint64 nLifetime = nTime - slot.m_nTime;
+		site.m_nFrees++;
+		site.m_nLifetime += nLifetime;
+		if ( nLifetime < m_nTickMicroseconds )
+		{
+			site.m_nShortLived++;
+		}
+	}
+
+	AddOp( TRACEOP_FREE, nSlot, 0 );
+	m_FreeSlots.AddToTail( nSlot );
+}
+
+void CTraceBuilder::AddEvent( const TraceEvent_t &event )
+{
+	const memtraceevent_t &e = event.m_Event;
+
+	// the second half of a split realloc is the thread's next event
+	uint32 nReallocSlot = ~0u;
+	bool bReallocEnd = false;
+	UtlHashHandle_t hRealloc = m_Reallocs.Find( event.m_nThread );
+	if ( hRealloc != m_Reallocs.InvalidHandle() )
+	{
+		nReallocSlot = m_Reallocs[hRealloc];
+		m_Reallocs.Remove( event.m_nThread );
+		bReallocEnd = ( !e.m_nOldBlock && e.m_nBlock );
+		if ( !bReallocEnd && nReallocSlot != ~0u )
+		{
+			FreeSlot( nReallocSlot, event.m_nTime, true );
+		}
+	}
+
+	if ( e.m_nOldBlock )
+	{
+		UtlHashHandle_t h = m_Live.Find( e.m_nOldBlock );
+		if ( h == m_Live.InvalidHandle() )
+		{
+			// allocated before the trace started, or its allocation was
+			// dropped. A realloc of it still makes a block.
+			m_nUnmatched++;
+			if ( !e.m_nBlock )
+			{
+				if ( e.m_nSize )
+				{
+					m_Reallocs.Insert( event.m_nThread, ~0u );
+				}
+				return;
+			}
+		}
+		else
+		{
+			uint32 nSlot = m_Live[h];
+			m_Live.Remove( e.m_nOldBlock );
+
+			if ( !e.m_nBlock )
+			{
+				// a release with a size is the first half of a realloc
+				if ( e.m_nSize )
+				{
+					m_Reallocs.Insert( event.m_nThread, nSlot );
+				}
+				else
+				{
+					FreeSlot( nSlot, event.m_nTime, true );
+				}
+				return;
+			}
+
+			nReallocSlot = nSlot;
+			bReallocEnd = true;
+		}
+	}
+
+	if ( bReallocEnd && nReallocSlot != ~0u )
+	{
+		// the block keeps its slot and its age through a realloc
+		UtlHashHandle_t h = m_Live.Find( e.m_nBlock );
+		if ( h != m_Live.InvalidHandle() )
+		{
+			m_nUnmatched++;
+			uint32 nSlot = m_Live[h];
+			m_Live.Remove( e.m_nBlock );
+			FreeSlot( nSlot, event.m_nTime, false );
+		}
+
+		int iSite = FindOrAddSite( e.m_nCallsite, e.m_nCredit );
+		m_Sites[iSite].m_nReallocs++;
+		m_Sites[iSite].m_nBytes += e.m_nSize;
+		m_Slots[nReallocSlot].m_nSize = e.m_nSize;
+		m_Live.Insert( e.m_nBlock, nReallocSlot );
+		AddOp( TRACEOP_REALLOC, nReallocSlot, e.m_nSize );
+		return;
+	}
+
+	// the trace lost this address's free, free it here so the replay
+	// doesn't leak it
+	UtlHashHandle_t h = m_Live.Find( e.m_nBlock );
+	if ( h != m_Live.InvalidHandle() )
+	{
+		m_nUnmatched++;
+		uint32 nSlot = m_Live[h];
+		m_Live.Remove( e.m_nBlock );
+		FreeSlot( nSlot, event.m_nTime, false );
+	}
+
+	int iSite = FindOrAddSite( e.m_nCallsite, e.m_nCredit );
+	m_Sites[iSite].m_nAllocs++;
+	m_Sites[iSite].m_nBytes += e.m_nSize;
+	AddOp( TRACEOP_ALLOC, AllocSlot( e.m_nBlock, event.m_nTime, iSite, e.m_nSize ), e.m_nSize );
+}
+
+void CTraceBuilder::Finish()
+{
+	FOR_EACH_HASHTABLE( m_Live, h )
+	{
+		const TraceSlot_t &slot = m_Slots[m_Live[h]];
+		m_Sites[slot.m_iSite].m_nLive++;
+		m_Sites[slot.m_iSite].m_nLiveBytes += slot.m_nSize;
+	}
+
+	// reallocs the trace ended in the middle of
+	FOR_EACH_HASHTABLE( m_Reallocs, h )
+	{
+		if ( m_Reallocs[h] == ~0u )
+			continue;
+
+		const TraceSlot_t &slot = m_Slots[m_Reallocs[h]];
+		m_Sites[slot.m_iSite].m_nLive++;
+		m_Sites[slot.m_iSite].m_nLiveBytes += slot.m_nSize;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// CAllocTrace
+//-----------------------------------------------------------------------------
+CAllocTrace::CAllocTrace() :
+	m_nSlots( 0 ), m_nThreads( 0 ), m_nDuration( 0 ), m_nDropped( 0 ), m_nUnmatched( 0 )
+{
+}
+
+bool CAllocTrace::Load( const char *pszFileName, int nTickMicroseconds )
+{
+	FILE *fp = fopen( pszFileName, "rb" );
+	if ( !fp )
+	{
+		Msg( "Couldn't open %s.\n", pszFileName );
+		return false;
+	}
+
+	CUtlVector<byte> data;
+	fseek( fp, 0, SEEK_END );
+	long nFileBytes = ftell( fp );
+	fseek( fp, 0, SEEK_SET );
+	data.SetCount( MAX( nFileBytes, 0L ) );
+	bool bRead = data.Count() && fread( data.Base(), data.Count(), 1, fp ) == 1;
+	fclose( fp );
+
+	memtraceheader_t header;
+	if ( !bRead || data.Count() < (int)sizeof( header ) )
+	{
+		Msg( "Couldn't read %s.\n", pszFileName );
+		return false;
+	}
+
+	V_memcpy( &header, data.Base(), sizeof( header ) );
+	if ( V_memcmp( header.m_Id, MEMTRACE_FILE_ID, sizeof( header.m_Id ) ) || header.m_nVersion != MEMTRACE_VERSION )
+	{
+		Msg( "%s isn't a version %d allocation trace.\n", pszFileName, MEMTRACE_VERSION );
+		return false;
+	}
+
+	// chunks after a string aren't aligned, everything is copied out
+	CUtlVector<TraceEvent_t> events;
+	uint32 nPos = sizeof( header );
+	uint32 nEnd = data.Count();
+	while ( nEnd - nPos >= sizeof( memtracechunk_t ) )
+	{
+		memtracechunk_t chunk;
+		V_memcpy( &chunk, &data[nPos], sizeof( chunk ) );
+		nPos += sizeof( chunk );
+
+		// the trace was still being written
+		if ( chunk.m_nBytes > nEnd - nPos )
+			break;
+
+		const byte *pData = &data[nPos];
+		nPos += chunk.m_nBytes;
+
+		switch ( chunk.m_nType )
+		{
+		case MEMTRACE_CHUNK_EVENTS:
+			if ( chunk.m_nBytes >= sizeof( memtraceevents_t ) )
+			{
+				memtraceevents_t events_header;
+				V_memcpy( &events_header, pData, sizeof( events_header ) );
+				pData += sizeof( events_header );
+
+				uint32 nEvents = MIN( events_header.m_nEvents, ( chunk.m_nBytes - sizeof( events_header ) ) / sizeof( memtraceevent_t ) );
+				int iFirst = events.AddMultipleToTail( nEvents );
+				for ( uint32 i = 0; i < nEvents; i++ )
+				{
+					TraceEvent_t &event = events[iFirst + i];
+					V_memcpy( &event.m_Event, pData + i * sizeof( memtraceevent_t ), sizeof( memtraceevent_t ) );
+					event.m_nTime = events_header.m_nTime + event.m_Event.m_nTime;
+					event.m_nThread = events_header.m_nThread;
+				}
+			}
+			break;
+
+		case MEMTRACE_CHUNK_STRING:
+			if ( chunk.m_nBytes > sizeof( memtracestring_t ) )
+			{
+				memtracestring_t string;
+				V_memcpy( &string, pData, sizeof( string ) );
+				if ( string.m_nId < 0x1000000 )
+				{
+					const char *pszString = (const char *)( pData + sizeof( string ) );
+					uint32 nMaxChars = chunk.m_nBytes - sizeof( string );
+					const char *pszEnd = (const char *)memchr( pszString, 0, nMaxChars );
+					m_Strings.EnsureCount( string.m_nId + 1 );
+					m_Strings[string.m_nId].SetDirect( pszString, pszEnd ? pszEnd - pszString : nMaxChars );
+				}
+			}
+			break;
+
+		case MEMTRACE_CHUNK_DROPPED:
+			if ( chunk.m_nBytes >= sizeof( uint32 ) )
+			{
+				V_memcpy( &m_nDropped, pData, sizeof( m_nDropped ) );
+			}
+			break;
+
+		default:
+			// newer chunk types are skipped
+			break;
+		}
+	}
+
+	data.Purge();
+
+	// every thread's events are in the order it made them, the threads are
+	// merged by time without reordering any one thread
+	std::stable_sort( events.Base(), events.Base() + events.Count(), TraceEventThreadLess );
+
+	CUtlVector<TraceThread_t> threads;
+	FOR_EACH_VEC( events, i )
+	{
+		if ( !threads.Count() || events[i].m_nThread != events[i - 1].m_nThread )
+		{
+			TraceThread_t &thread = threads[threads.AddToTail()];
+			thread.m_iNext = i;
+		}
+		threads.Tail().m_iEnd = i + 1;
+	}
+
+	m_Ops.EnsureCapacity( events.Count() + events.Count() / 8 );
+	CTraceBuilder builder( m_Ops, m_Sites, nTickMicroseconds );
+	uint64 nFirstTime = 0, nLastTime = 0;
+	for ( int nEvents = 0; nEvents < events.Count(); nEvents++ )
+	{
+		TraceThread_t *pNext = NULL;
+		FOR_EACH_VEC( threads, i )
+		{
+			TraceThread_t &thread = threads[i];
+			if ( thread.m_iNext < thread.m_iEnd && ( !pNext || TraceEventLess( events[thread.m_iNext], events[pNext->m_iNext] ) ) )
+			{
+				pNext = &thread;
+			}
+		}
+
+		const TraceEvent_t &event = events[pNext->m_iNext++];
+		nFirstTime = nEvents ? MIN( nFirstTime, event.m_nTime ) : event.m_nTime;
+		nLastTime = MAX( nLastTime, event.m_nTime );
+		builder.AddEvent( event );
+	}
+	builder.Finish();
+
+	m_nSlots = builder.GetNumSlots();
+	m_nUnmatched = builder.GetUnmatched();
+	m_nThreads = threads.Count();
+	m_nDuration = nLastTime - nFirstTime;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs the ops. ppBlocks has a pointer for every slot and holds the
+//			blocks still allocated at the end.
+//-----------------------------------------------------------------------------
+int64 CAllocTrace::Replay( IReplayAllocator *pAllocator, void **ppBlocks ) const
+{
+	FOR_EACH_VEC( m_Ops, i )
+	{
+		const TraceOp_t &op = m_Ops[i];
+		void *&pBlock = ppBlocks[op.m_nSlot];
+		switch ( op.m_nType )
+		{
+		case TRACEOP_ALLOC:
+			pBlock = pAllocator->Alloc( op.m_nSize );
+			break;
+		case TRACEOP_REALLOC:
+			pBlock = pAllocator->Realloc( pBlock, op.m_nSize );
+			break;
+		default:
+			pAllocator->Free( pBlock );
+			pBlock = NULL;
+			continue;
+		}
+
+		if ( !pBlock && op.m_nSize )
+		{
+			Error( "%s couldn't allocate %u bytes\n", pAllocator->GetName(), op.m_nSize );
+		}
+
+		// touch it so the pages count as resident
+		if ( op.m_nSize )
+		{
+			( (byte *)pBlock )[0] = ( (byte *)pBlock )[op.m_nSize - 1] = 0;
+		}
+	}
+
+	return m_Ops.Count();
+}
+
+void CAllocTrace::PurgeSites()
+{
+	m_Sites.Purge();
+	m_Strings.Purge();
+}
+
+const char *CAllocTrace::GetString( uint32 nId ) const
+{
+	if ( !nId )
+		return "";
+	if ( nId >= (uint32)m_Strings.Count() || m_Strings[nId].IsEmpty() )
+		return "?";
+	return m_Strings[nId].Get();
+}
+
+static bool SiteAllocsGreater( const TraceSite_t &a, const TraceSite_t &b )
+{
+	return a.m_nAllocs + a.m_nReallocs > b.m_nAllocs + b.m_nReallocs;
+}
+
+// module!symbol+0x10 with the symbol demangled
+static void GetCallsiteName( const char *pszCallsite, char *pszName, int nSize )
+{
+	V_strncpy( pszName, pszCallsite, nSize );
+
+#ifdef POSIX
+	const char *pszSymbol = V_strstr( pszCallsite, "!" );
+	const char *pszOffset = pszSymbol ? V_strstr( pszSymbol, "+0x" ) : NULL;
+	if ( !pszOffset )
+		return;
+
+	char szMangled[1024];
+	V_strncpy( szMangled, pszSymbol + 1, MIN( (int)( pszOffset - pszSymbol ), (int)sizeof( szMangled ) ) );
+
+	int nStatus = 0;
+	char *pszDemangled = abi::__cxa_demangle( szMangled, NULL, NULL, &nStatus );
+	if ( pszDemangled && nStatus == 0 )
+	{
+		V_snprintf( pszName, nSize, "%.*s!%s%s", (int)( pszSymbol - pszCallsite ), pszCallsite, pszDemangled, pszOffset );
+	}
+
+	free( pszDemangled );
+#endif
+}
+
+void CAllocTrace::PrintChurn( int nTop ) const
+{
+	CUtlVector<TraceSite_t> sites;
+	sites.CopyArray( m_Sites.Base(), m_Sites.Count() );
+	std::sort( sites.Base(), sites.Base() + sites.Count(), SiteAllocsGreater );
+
+	double flDuration = MAX( GetDuration(), 0.001 );
+	Msg( "%10s %10s %8s %7s %9s %8s %9s  %s\n", "allocs/s", "reallocs/s", "MB/s", "tick %", "life ms", "live", "live KB", "callsite [credit]" );
+
+	for ( int i = 0; i < sites.Count() && i < nTop; i++ )
+	{
+		const TraceSite_t &site = sites[i];
+
+		char szCallsite[2048];
+		GetCallsiteName( GetString( site.m_nCallsite ), szCallsite, sizeof( szCallsite ) );
+
+		char szCredit[MAX_PATH] = "";
+		if ( site.m_nCredit )
+		{
+			V_snprintf( szCredit, sizeof( szCredit ), " [%s]", GetString( site.m_nCredit ) );
+		}
+
+		Msg( "%10.0f %10.0f %8.2f %7.1f %9.2f %8lld %9.1f  %s%s\n",
+			site.m_nAllocs / flDuration,
+			site.m_nReallocs / flDuration,
+			site.m_nBytes / flDuration / ( 1024.0 * 1024.0 ),
+			site.m_nFrees ? 100.0 * site.m_nShortLived / site.m_nFrees : 0.0,
+			site.m_nFrees ? site.m_nLifetime / 1000.0 / site.m_nFrees : 0.0,
+			(long long)site.m_nLive,
+			site.m_nLiveBytes / 1024.0,
+			szCallsite, szCredit );
+	}
+}
@@ -0,0 +1,91 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Reads allocation traces written by tier0 (see tier0/memtrace.h),
+//			replays them and reports which callsites churn the heap
+//
+//=============================================================================
+
+#ifndef TRACEREPLAY_H
+#define TRACEREPLAY_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/platform.h"
+#include "tier1/utlvector.h"
+#include "tier1/utlstring.h"
+
+class IReplayAllocator;
+
+enum TraceOpType_t
+{
+	TRACEOP_ALLOC = 0,
+	TRACEOP_REALLOC,
+	TRACEOP_FREE,
+};
+
+// The trace's events in replay order, with the addresses replaced by slots
+// so replaying doesn't have to look anything up
+struct TraceOp_t
+{
+	uint32	m_nType;
+	uint32	m_nSlot;
+	uint32	m_nSize;
+};
+
+// What one callsite (and credit) did over the whole trace
+struct TraceSite_t
+{
+	uint32	m_nCallsite;			// string ids
+	uint32	m_nCredit;
+	int64	m_nAllocs;
+	int64	m_nReallocs;
+	int64	m_nFrees;
+	int64	m_nBytes;				// requested by allocs and reallocs
+	int64	m_nShortLived;			// frees of blocks younger than a tick
+	int64	m_nLifetime;			// microseconds, summed over the freed blocks
+	int64	m_nLive;				// blocks still allocated at the end
+	int64	m_nLiveBytes;
+};
+
+class CAllocTrace
+{
+public:
+	CAllocTrace();
+
+	// Reads a trace and orders its events. Blocks freed less than
+	// nTickMicroseconds after their allocation count as short lived.
+	bool Load( const char *pszFileName, int nTickMicroseconds );
+
+	// Runs every op against the allocator, returns how many it ran.
+	// ppBlocks needs GetNumSlots() NULL pointers and is left holding the
+	// blocks the trace never freed.
+	int64 Replay( IReplayAllocator *pAllocator, void **ppBlocks ) const;
+
+	// Prints the nTop sites with the most allocations a second
+	void PrintChurn( int nTop ) const;
+
+	// Only the ops are needed to replay
+	void PurgeSites();
+
+	int GetNumOps() const { return m_Ops.Count(); }
+	int GetNumSlots() const { return m_nSlots; }
+	int GetNumThreads() const { return m_nThreads; }
+	double GetDuration() const { return m_nDuration / 1000000.0; }
+	uint32 GetDropped() const { return m_nDropped; }
+	int64 GetUnmatched() const { return m_nUnmatched; }
+
+private:
+	const char *GetString( uint32 nId ) const;
+
+	CUtlVector<TraceOp_t>	m_Ops;
+	CUtlVector<TraceSite_t>	m_Sites;
+	CUtlVector<CUtlString>	m_Strings;	// by id
+	int						m_nSlots;
+	int						m_nThreads;
+	uint64					m_nDuration;
+	uint32					m_nDropped;
+	int64					m_nUnmatched;	// frees and reallocs of blocks the trace never saw allocated
+};
+
+#endif // TRACEREPLAY_H
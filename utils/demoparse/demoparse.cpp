@@ -0,0 +1,311 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Decodes the entities of a demo into one column file per server
+//			class, see propcolumns.h for the format. Indexed demos are split
+//			at their keyframes and parsed on several threads.
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+#include "tier0/dbg.h"
+#include "tier0/platform.h"
+#include "tier0/threadtools.h"
+#include "tier0/icommandline.h"
+#include "tier1/strtools.h"
+#include "demoparser.h"
+#include "propcolumns.h"
+#include "dt.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+#define DEMOPARSE_MAX_THREADS	64
+
+static bool verbose = false;
+
+//-----------------------------------------------------------------------------
+// One part of the demo, parsed by its own thread into its own columns
+//-----------------------------------------------------------------------------
+struct DemoSegment_t
+{
+	int					m_nStart;
+	int					m_nEnd;
+	CDemoParser			*m_pParser;
+	CPropColumns		m_Columns;
+	ThreadHandle_t		m_hThread;
+	bool				m_bOk;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Warning/Msg call back through this API
+//-----------------------------------------------------------------------------
+SpewRetval_t SpewFunc( SpewType_t type, char const *pMsg )
+{
+	switch ( type )
+	{
+	default:
+	case SPEW_MESSAGE:
+	case SPEW_ASSERT:
+	case SPEW_LOG:
+		printf( "%s", pMsg );
+		break;
+	case SPEW_WARNING:
+		if ( verbose )
+		{
+			printf( "%s", pMsg );
+		}
+		break;
+	case SPEW_ERROR:
+		printf( "%s\n", pMsg );
+		break;
+	}
+
+	return SPEW_CONTINUE;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Shows usage information
+//-----------------------------------------------------------------------------
+void printusage( void )
+{
+	printf( "usage:  demoparse [options] <.dem file>\n\
+		\t-threads <n> = parse with n threads, default is one per logical processor\n\
+		\t-out <dir> = directory for the .dpc files, default is the demo name\n\
+		\t-v = verbose output\n\
+		\ne.g.:  demoparse -threads 4 -out /tmp/match1 match1.dem\n" );
+
+	// Exit app
+	exit( 1 );
+}
+
+static uintp SegmentThreadFunc( void *pParam )
+{
+	DemoSegment_t *pSegment = (DemoSegment_t *)pParam;
+
+	// string tables and entity state of the signon, the datatables are loaded already
+	pSegment->m_bOk = pSegment->m_pParser->ParseSignon( false ) &&
+		pSegment->m_pParser->ParseRange( pSegment->m_nStart, pSegment->m_nEnd );
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Splits the demo after the signon into about equally sized ranges.
+//			Every range but the first starts at a keyframe so it can be parsed
+//			without the ones before it.
+//-----------------------------------------------------------------------------
+static void SplitDemo( const CDemoData &demo, int nThreads, CUtlVector<int> &starts )
+{
+	const CUtlVector<demoindexentry_t> &keyframes = demo.GetKeyframes();
+	int nSignonEnd = demo.GetSignonEnd();
+	int64 nLength = demo.GetSize() - nSignonEnd;
+
+	starts.AddToTail( nSignonEnd );
+
+	int iKeyframe = 0;
+	for ( int i = 1; i < nThreads; i++ )
+	{
+		int nSplit = nSignonEnd + (int)( nLength * i / nThreads );
+
+		while ( iKeyframe < keyframes.Count() && keyframes[iKeyframe].fileoffset < nSplit )
+		{
+			iKeyframe++;
+		}
+
+		if ( iKeyframe >= keyframes.Count() )
+			break;
+
+		if ( keyframes[iKeyframe].fileoffset > starts.Tail() )
+		{
+			starts.AddToTail( keyframes[iKeyframe].fileoffset );
+		}
+	}
+}
+
+static void CreateOutputDirectory( const char *pszDir )
+{
+#ifdef _WIN32
+	_mkdir( pszDir );
+#else
+	mkdir( pszDir, 0777 );
+#endif
+}
+
+static bool WriteClassFile( const char *pszDir, const CDemoServerClasses &classes, int iClass, const CUtlVector<DemoSegment_t *> &segments )
+{
+	int64 nSize = 0;
+	FOR_EACH_VEC( segments, i )
+	{
+		nSize += segments[i]->m_Columns.GetChunks( iClass ).TellPut();
+	}
+
+	// classes that never had an entity get no file
+	if ( !nSize )
+		return true;
+
+	CUtlBuffer header;
+	header.SetBigEndian( false );
+	header.Put( DPC_FILE_ID, 4 );
+	header.PutInt( DPC_VERSION );
+	header.PutString( classes.GetClassName( iClass ) );
+	header.PutString( classes.GetTableName( iClass ) );
+
+	const CSendTablePrecalc *pPrecalc = classes.GetPrecalc( iClass );
+	header.PutInt( pPrecalc->GetNumProps() );
+	for ( int iProp = 0; iProp < pPrecalc->GetNumProps(); iProp++ )
+	{
+		const SendProp *pProp = pPrecalc->GetProp( iProp );
+		header.PutUnsignedChar( pProp->GetType() );
+		header.PutUnsignedChar( pProp->GetType() == DPT_Array ? pProp->GetArrayProp()->GetType() : DPC_NO_ARRAY );
+		header.PutString( pProp->GetName() );
+	}
+
+	char szFileName[MAX_PATH];
+	Q_snprintf( szFileName, sizeof( szFileName ), "%s%c%s.dpc", pszDir, CORRECT_PATH_SEPARATOR, classes.GetClassName( iClass ) );
+
+	FILE *fp = fopen( szFileName, "wb" );
+	if ( !fp )
+	{
+		Warning( "Couldn't write %s.\n", szFileName );
+		return false;
+	}
+
+	bool bOk = fwrite( header.Base(), 1, header.TellPut(), fp ) == (size_t)header.TellPut();
+	FOR_EACH_VEC( segments, i )
+	{
+		const CUtlBuffer &chunks = segments[i]->m_Columns.GetChunks( iClass );
+		if ( bOk && chunks.TellPut() )
+		{
+			bOk = fwrite( chunks.Base(), 1, chunks.TellPut(), fp ) == (size_t)chunks.TellPut();
+		}
+	}
+
+	if ( fclose( fp ) != 0 || !bOk )
+	{
+		Warning( "Couldn't write %s.\n", szFileName );
+		return false;
+	}
+
+	return true;
+}
+
+int main( int argc, char* argv[] )
+{
+	SpewOutputFunc( SpewFunc );
+	SpewActivate( "demoparse", 2 );
+	CommandLine()->CreateCmdLine( argc, argv );
+
+	if ( argc < 2 || argv[argc - 1][0] == '-' )
+	{
+		printusage();
+	}
+
+	verbose = CommandLine()->FindParm( "-v" ) != 0;
+
+	const char *pszDemoName = argv[argc - 1];
+
+	int nThreads = CommandLine()->ParmValue( "-threads", (int)GetCPUInformation()->m_nLogicalProcessors );
+	nThreads = clamp( nThreads, 1, DEMOPARSE_MAX_THREADS );
+
+	char szOutDir[MAX_PATH];
+	V_StripExtension( pszDemoName, szOutDir, sizeof( szOutDir ) );
+	Q_strncpy( szOutDir, CommandLine()->ParmValue( "-out", szOutDir ), sizeof( szOutDir ) );
+	V_StripTrailingSlash( szOutDir );
+
+	double flStartTime = Plat_FloatTime();
+
+	CDemoData demo;
+	if ( !demo.Load( pszDemoName ) )
+	{
+		Msg( "Couldn't load %s.\n", pszDemoName );
+		return 1;
+	}
+
+	CUtlVector<int> starts;
+	SplitDemo( demo, nThreads, starts );
+
+	CDemoServerClasses classes;
+	CUtlVector<DemoSegment_t *> segments;
+	FOR_EACH_VEC( starts, i )
+	{
+		DemoSegment_t *pSegment = new DemoSegment_t;
+		pSegment->m_nStart = starts[i];
+		pSegment->m_nEnd = ( i + 1 < starts.Count() ) ? starts[i + 1] : demo.GetSize();
+		pSegment->m_pParser = new CDemoParser( &demo, &classes, &pSegment->m_Columns );
+		pSegment->m_hThread = NULL;
+		pSegment->m_bOk = false;
+		segments.AddToTail( pSegment );
+	}
+
+	// the first parser loads the classes all others decode with
+	bool bOk = segments[0]->m_pParser->ParseSignon( true );
+	if ( bOk )
+	{
+		FOR_EACH_VEC( segments, i )
+		{
+			segments[i]->m_Columns.Init( classes.GetNumClasses() );
+		}
+
+		for ( int i = 1; i < segments.Count(); i++ )
+		{
+			segments[i]->m_hThread = CreateSimpleThread( SegmentThreadFunc, segments[i], 1024 * 1024 );
+		}
+
+		segments[0]->m_bOk = segments[0]->m_pParser->ParseRange( segments[0]->m_nStart, segments[0]->m_nEnd );
+
+		FOR_EACH_VEC( segments, i )
+		{
+			if ( segments[i]->m_hThread )
+			{
+				ThreadJoin( segments[i]->m_hThread );
+				ReleaseThreadHandle( segments[i]->m_hThread );
+			}
+
+			segments[i]->m_Columns.Flush();
+			bOk = bOk && segments[i]->m_bOk;
+		}
+	}
+
+	if ( !bOk )
+	{
+		Msg( "Error parsing %s.\n", pszDemoName );
+	}
+	else
+	{
+		CreateOutputDirectory( szOutDir );
+
+		for ( int iClass = 0; iClass < classes.GetNumClasses() && bOk; iClass++ )
+		{
+			bOk = WriteClassFile( szOutDir, classes, iClass, segments );
+		}
+	}
+
+	if ( bOk )
+	{
+		int64 nRows = 0;
+		int nPackets = 0;
+		FOR_EACH_VEC( segments, i )
+		{
+			nRows += segments[i]->m_Columns.GetNumRows();
+			nPackets += segments[i]->m_pParser->GetNumPackets();
+		}
+
+		double flTime = MAX( Plat_FloatTime() - flStartTime, 0.001 );
+		Msg( "%s: %d packets, %lld rows, %d segments in %.2f seconds (%.1f MB/s) -> %s\n",
+			pszDemoName, nPackets, nRows, segments.Count(), flTime, demo.GetSize() / ( 1024.0 * 1024.0 ) / flTime, szOutDir );
+	}
+
+	FOR_EACH_VEC( segments, i )
+	{
+		delete segments[i]->m_pParser;
+	}
+	segments.PurgeAndDeleteElements();
+
+	return bOk ? 0 : 1;
+}
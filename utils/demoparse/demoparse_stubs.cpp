@@ -0,0 +1,78 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Engine functions the SendTable and string table code refers to,
+//			demoparse only reads data and needs none of them
+//
+//=============================================================================
+
+#include <stdarg.h>
+#include "tier0/dbg.h"
+#include "tier1/strtools.h"
+#include "host.h"
+#include "sys.h"
+#include "common.h"
+#include "filesystem_engine.h"
+#include "baseclient.h"
+#include "dt_send.h"
+#include "dt_common_eng.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+IFileSystem *g_pFileSystem = NULL;
+
+void Host_Error( const char *error, ... )
+{
+	char string[1024];
+	va_list argptr;
+	va_start( argptr, error );
+	Q_vsnprintf( string, sizeof( string ), error, argptr );
+	va_end( argptr );
+
+	Error( "%s", string );
+}
+
+void Sys_Error( const char *error, ... )
+{
+	char string[1024];
+	va_list argptr;
+	va_start( argptr, error );
+	Q_vsnprintf( string, sizeof( string ), error, argptr );
+	va_end( argptr );
+
+	Error( "%s", string );
+}
+
+char *tmpstr512()
+{
+	// only the filenames dictionary uses these, demoparse creates no such tables
+	static char	string[32][512];
+	static int	curstring = 0;
+	curstring = ( curstring + 1 ) & 31;
+	return string[curstring];
+}
+
+bool COM_BufferToBufferCompress_Snappy( void *dest, unsigned int *destLen, const void *source, unsigned int sourceLen )
+{
+	// only servers compress string tables
+	return false;
+}
+
+const char *GetObjectClassName( int objectID )
+{
+	return "[unknown]";
+}
+
+bool DataTable_SetupReceiveTableFromSendTable( SendTable *sendTable, bool bNeedsDecoder )
+{
+	// entities are decoded with the SendTables, see CDemoServerClasses
+	return false;
+}
+
+void CBaseClient::TraceNetworkData( bf_write &msg, char const *fmt, ... )
+{
+}
+
+void CBaseClient::TraceNetworkMsg( int nBits, char const *fmt, ... )
+{
+}
@@ -0,0 +1,1161 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Reads demos without an engine, entities are decoded with the
+//			engine's SendTable and string table code
+//
+//=============================================================================
+
+#include <stdio.h>
+#include "demoparser.h"
+#include "propcolumns.h"
+#include "net.h"
+#include "protocol.h"
+#include "netmessages.h"
+#include "networkstringtable.h"
+#include "dt.h"
+#include "tier1/compressioncodec.h"
+#include "tier1/strtools.h"
+#include "mathlib/mathlib.h"
+#include "tier0/dbg.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+// dt_recv_eng.cpp
+extern SendTable *RecvTable_ReadInfos( bf_read *pBuf, int nDemoProtocol );
+extern void RecvTable_FreeSendTable( SendTable *pTable );
+
+//-----------------------------------------------------------------------------
+// CDemoData
+//-----------------------------------------------------------------------------
+CDemoData::CDemoData()
+{
+	m_szFileName[0] = 0;
+	Q_memset( &m_Header, 0, sizeof( m_Header ) );
+	m_Data.SetBigEndian( false );
+}
+
+bool CDemoData::Load( const char *pszFileName )
+{
+	Q_strncpy( m_szFileName, pszFileName, sizeof( m_szFileName ) );
+
+	FILE *fp = fopen( pszFileName, "rb" );
+	if ( !fp )
+	{
+		Warning( "Couldn't open %s.\n", pszFileName );
+		return false;
+	}
+
+	fseek( fp, 0, SEEK_END );
+	long nSize = ftell( fp );
+	fseek( fp, 0, SEEK_SET );
+
+	if ( nSize < (long)sizeof( demoheader_t ) || nSize > INT_MAX / 2 )
+	{
+		Warning( "%s is not a demo.\n", pszFileName );
+		fclose( fp );
+		return false;
+	}
+
+	m_Data.Clear();
+	m_Data.EnsureCapacity( nSize );
+	bool bOk = fread( m_Data.Base(), 1, nSize, fp ) == (size_t)nSize;
+	fclose( fp );
+
+	if ( !bOk )
+	{
+		Warning( "Couldn't read %s.\n", pszFileName );
+		return false;
+	}
+
+	m_Data.SeekPut( CUtlBuffer::SEEK_HEAD, nSize );
+
+	Q_memcpy( &m_Header, m_Data.Base(), sizeof( demoheader_t ) );
+	ByteSwap_demoheader_t( m_Header );
+
+	if ( Q_strncmp( m_Header.demofilestamp, DEMO_HEADER_ID, sizeof( m_Header.demofilestamp ) ) )
+	{
+		Warning( "%s has invalid demo header ID.\n", pszFileName );
+		return false;
+	}
+
+	if ( m_Header.demoprotocol < 2 || m_Header.demoprotocol > DEMO_PROTOCOL_INDEXED )
+	{
+		Warning( "%s has unknown demo protocol %i.\n", pszFileName, m_Header.demoprotocol );
+		return false;
+	}
+
+	if ( !Uncompress() )
+	{
+		Warning( "%s is compressed and corrupt.\n", pszFileName );
+		return false;
+	}
+
+	if ( m_Header.signonlength < 0 || GetSignonEnd() > GetSize() )
+	{
+		Warning( "%s has invalid signon length %i.\n", pszFileName, m_Header.signonlength );
+		return false;
+	}
+
+	ReadKeyframeIndex();
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Replaces a compressed demo with the uncompressed stream, same as
+//			CDemoFile::UncompressDemo. Uncompressed demos are left alone.
+//-----------------------------------------------------------------------------
+bool CDemoData::Uncompress()
+{
+	const int nHeaderSize = sizeof( demoheader_t );
+	int nSize = GetSize();
+
+	if ( nSize < nHeaderSize + 4 || V_memcmp( Base() + nHeaderSize, DEMO_COMPRESSED_ID, 4 ) )
+		return true;
+
+	CUtlBuffer uncompressed( 0, nSize * 2, 0 );
+	uncompressed.SetBigEndian( false );
+	uncompressed.Put( Base(), nHeaderSize );
+
+	m_Data.SeekGet( CUtlBuffer::SEEK_HEAD, nHeaderSize + 4 );
+
+	CUtlMemory<byte> block;
+	bool bOk = true;
+	while ( bOk && m_Data.TellGet() < nSize )
+	{
+		int nBlockSize = m_Data.GetInt();
+		bool bStored = nBlockSize < 0;
+		if ( bStored )
+		{
+			nBlockSize = -nBlockSize;
+		}
+
+		if ( !m_Data.IsValid() || nBlockSize <= 0 || nBlockSize > nSize - m_Data.TellGet() )
+		{
+			bOk = false;
+			break;
+		}
+
+		const byte *pBlock = Base() + m_Data.TellGet();
+		m_Data.SeekGet( CUtlBuffer::SEEK_CURRENT, nBlockSize );
+
+		if ( bStored )
+		{
+			uncompressed.Put( pBlock, nBlockSize );
+			continue;
+		}
+
+		const ICompressionCodec *pCodec = FindCompressionCodecForData( pBlock, nBlockSize );
+		int nUncompressedSize = pCodec ? pCodec->GetUncompressedSize( pBlock, nBlockSize ) : -1;
+		if ( nUncompressedSize <= 0 || nUncompressedSize > DEMO_COMPRESSED_MAX_BLOCK )
+		{
+			bOk = false;
+			break;
+		}
+
+		block.EnsureCapacity( nUncompressedSize );
+		unsigned int nUncompressedLen = nUncompressedSize;
+		bOk = pCodec->Uncompress( block.Base(), &nUncompressedLen, pBlock, nBlockSize );
+		uncompressed.Put( block.Base(), nUncompressedLen );
+	}
+
+	if ( !bOk || !uncompressed.IsValid() )
+		return false;
+
+	m_Data.Swap( uncompressed );
+	m_Data.SeekGet( CUtlBuffer::SEEK_HEAD, 0 );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Loads the keyframe index, validated like CDemoFile::ReadKeyframeIndex
+//-----------------------------------------------------------------------------
+void CDemoData::ReadKeyframeIndex()
+{
+	m_Keyframes.RemoveAll();
+
+	int nSize = GetSize();
+	if ( m_Header.demoprotocol < DEMO_PROTOCOL_INDEXED || nSize < (int)( sizeof( demoheader_t ) + sizeof( demoindextrailer_t ) ) )
+		return;
+
+	demoindextrailer_t trailer;
+	m_Data.SeekGet( CUtlBuffer::SEEK_HEAD, nSize - sizeof( demoindextrailer_t ) );
+	m_Data.Get( trailer.indexfilestamp, sizeof( trailer.indexfilestamp ) );
+	trailer.numentries = m_Data.GetInt();
+	trailer.indexoffset = m_Data.GetInt();
+
+	bool bValid = m_Data.IsValid() &&
+		!Q_strncmp( trailer.indexfilestamp, DEMO_INDEX_ID, sizeof( trailer.indexfilestamp ) ) &&
+		trailer.numentries >= 0 && trailer.indexoffset >= GetSignonEnd() &&
+		trailer.indexoffset + trailer.numentries * (int)sizeof( demoindexentry_t ) == nSize - (int)sizeof( demoindextrailer_t );
+
+	if ( bValid )
+	{
+		m_Data.SeekGet( CUtlBuffer::SEEK_HEAD, trailer.indexoffset );
+		m_Keyframes.EnsureCapacity( trailer.numentries );
+
+		for ( int i = 0; i < trailer.numentries && bValid; i++ )
+		{
+			demoindexentry_t entry;
+			entry.tick = m_Data.GetInt();
+			entry.fileoffset = m_Data.GetInt();
+
+			bValid = m_Data.IsValid() &&
+				entry.fileoffset >= GetSignonEnd() && entry.fileoffset < trailer.indexoffset &&
+				( !m_Keyframes.Count() || ( m_Keyframes.Tail().tick <= entry.tick && m_Keyframes.Tail().fileoffset < entry.fileoffset ) );
+
+			m_Keyframes.AddToTail( entry );
+		}
+	}
+
+	if ( !bValid )
+	{
+		Warning( "%s has no valid keyframe index.\n", m_szFileName );
+		m_Keyframes.RemoveAll();
+	}
+
+	m_Data.SeekGet( CUtlBuffer::SEEK_HEAD, 0 );
+}
+
+//-----------------------------------------------------------------------------
+// CDemoServerClasses
+//-----------------------------------------------------------------------------
+CDemoServerClasses::CDemoServerClasses()
+{
+}
+
+CDemoServerClasses::~CDemoServerClasses()
+{
+	Purge();
+}
+
+void CDemoServerClasses::Purge()
+{
+	FOR_EACH_VEC( m_Classes, i )
+	{
+		delete [] m_Classes[i].m_pszName;
+	}
+	m_Classes.Purge();
+
+	// the precalcs unlink themselves from their tables
+	m_Precalcs.PurgeAndDeleteElements();
+
+	FOR_EACH_VEC( m_Tables, i )
+	{
+		delete [] m_Tables[i]->m_pNetTableName;
+		RecvTable_FreeSendTable( m_Tables[i] );
+	}
+	m_Tables.Purge();
+}
+
+SendTable *CDemoServerClasses::FindTable( const char *pszName ) const
+{
+	FOR_EACH_VEC( m_Tables, i )
+	{
+		if ( !Q_stricmp( m_Tables[i]->GetName(), pszName ) )
+			return m_Tables[i];
+	}
+
+	return NULL;
+}
+
+const char *CDemoServerClasses::GetTableName( int iClass ) const
+{
+	return m_Classes[iClass].m_pPrecalc->GetSendTable()->GetName();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads a dem_datatables blob, see DataTable_LoadDataTablesFromBuffer.
+//			There are no RecvTables here, the SendTables are flattened the way
+//			the server does it and decoded with the SendProps directly.
+//-----------------------------------------------------------------------------
+bool CDemoServerClasses::ReadDataTables( bf_read &buf, int nDemoProtocol )
+{
+	Purge();
+
+	while ( buf.ReadOneBit() != 0 )
+	{
+		buf.ReadOneBit(); // needs decoder, every table can be decoded here
+
+		SendTable *pTable = RecvTable_ReadInfos( &buf, nDemoProtocol );
+		if ( !pTable )
+			return false;
+
+		m_Tables.AddToTail( pTable );
+
+		if ( buf.IsOverflowed() )
+		{
+			Warning( "CDemoServerClasses::ReadDataTables: overflowed reading %s.\n", pTable->GetName() );
+			return false;
+		}
+	}
+
+	// link datatable props to their tables, the name was sent in place of the exclude name
+	FOR_EACH_VEC( m_Tables, i )
+	{
+		SendTable *pTable = m_Tables[i];
+		for ( int iProp = 0; iProp < pTable->m_nProps; iProp++ )
+		{
+			SendProp *pProp = &pTable->m_pProps[iProp];
+			if ( pProp->GetType() != DPT_DataTable )
+				continue;
+
+			SendTable *pChild = pProp->m_pExcludeDTName ? FindTable( pProp->m_pExcludeDTName ) : NULL;
+			if ( !pChild )
+			{
+				Warning( "CDemoServerClasses::ReadDataTables: missing SendTable '%s' (referenced by '%s').\n", pProp->m_pExcludeDTName, pTable->GetName() );
+				return false;
+			}
+
+			pProp->SetDataTable( pChild );
+		}
+	}
+
+	int nClasses = buf.ReadShort();
+	if ( nClasses <= 0 || buf.IsOverflowed() )
+	{
+		Warning( "CDemoServerClasses::ReadDataTables: invalid number of classes (%d).\n", nClasses );
+		return false;
+	}
+
+	m_Classes.SetCount( nClasses );
+	FOR_EACH_VEC( m_Classes, i )
+	{
+		m_Classes[i].m_pszName = NULL;
+		m_Classes[i].m_pPrecalc = NULL;
+	}
+
+	for ( int i = 0; i < nClasses; i++ )
+	{
+		int classID = buf.ReadShort();
+		char *pszClassName = buf.ReadAndAllocateString();
+		char *pszTableName = buf.ReadAndAllocateString();
+
+		SendTable *pTable = FindTable( pszTableName );
+		delete [] pszTableName;
+
+		if ( classID < 0 || classID >= nClasses || m_Classes[classID].m_pszName || !pTable )
+		{
+			Warning( "CDemoServerClasses::ReadDataTables: invalid class %d (%s).\n", classID, pszClassName );
+			delete [] pszClassName;
+			return false;
+		}
+
+		m_Classes[classID].m_pszName = pszClassName;
+
+		// classes sharing a table share its flat property list
+		if ( !pTable->m_pPrecalc )
+		{
+			CSendTablePrecalc *pPrecalc = new CSendTablePrecalc;
+			pPrecalc->m_pSendTable = pTable;
+			pTable->m_pPrecalc = pPrecalc;
+			m_Precalcs.AddToTail( pPrecalc );
+
+			if ( !pPrecalc->SetupFlatPropertyArray() )
+			{
+				Warning( "CDemoServerClasses::ReadDataTables: couldn't flatten %s.\n", pTable->GetName() );
+				return false;
+			}
+		}
+
+		m_Classes[classID].m_pPrecalc = pTable->m_pPrecalc;
+	}
+
+	return !buf.IsOverflowed();
+}
+
+//-----------------------------------------------------------------------------
+// CDemoParser
+//-----------------------------------------------------------------------------
+// inetmsghandler.h's versions register with a net channel, the parser has none
+#undef REGISTER_NET_MSG
+#undef REGISTER_SVC_MSG
+
+#define REGISTER_NET_MSG( name )				\
+	NET_##name * p##name = new NET_##name();	\
+	p##name->m_pMessageHandler = this;			\
+	RegisterMessage( p##name );					\
+
+#define REGISTER_SVC_MSG( name )				\
+	SVC_##name * p##name = new SVC_##name();	\
+	p##name->m_pMessageHandler = this;			\
+	RegisterMessage( p##name );					\
+
+CDemoParser::CDemoParser( const CDemoData *pDemo, CDemoServerClasses *pClasses, CPropColumns *pColumns )
+{
+	m_pDemo = pDemo;
+	m_pClasses = pClasses;
+	m_pColumns = pColumns;
+	m_pStringTables = new CNetworkStringTableContainer;
+
+	m_nServerClassBits = 0;
+	m_nServerTick = 0;
+	m_nPackets = 0;
+	m_bSilent = false;
+	m_bReadDataTables = false;
+
+	for ( int i = 0; i < MAX_EDICTS; i++ )
+	{
+		m_EntityClass[i] = -1;
+		m_EntityBaselines[0][i].m_iClass = -1;
+		m_EntityBaselines[1][i].m_iClass = -1;
+	}
+
+	m_MergedData.EnsureCapacity( MAX_PACKEDENTITY_DATA );
+
+	Q_memset( &m_DecodeInfo, 0, sizeof( m_DecodeInfo ) );
+	m_DecodeInfo.m_ObjectID = -1;
+
+	Q_memset( m_pMessages, 0, sizeof( m_pMessages ) );
+
+	// svc_CreateStringTable is read by ReadCreateStringTable, the message needs a net channel
+	REGISTER_NET_MSG( Tick );
+	REGISTER_NET_MSG( StringCmd );
+	REGISTER_NET_MSG( SetConVar );
+	REGISTER_NET_MSG( SignonState );
+
+	REGISTER_SVC_MSG( Print );
+	REGISTER_SVC_MSG( ServerInfo );
+	REGISTER_SVC_MSG( SendTable );
+	REGISTER_SVC_MSG( ClassInfo );
+	REGISTER_SVC_MSG( SetPause );
+	REGISTER_SVC_MSG( UpdateStringTable );
+	REGISTER_SVC_MSG( VoiceInit );
+	REGISTER_SVC_MSG( VoiceData );
+	REGISTER_SVC_MSG( Sounds );
+	REGISTER_SVC_MSG( SetView );
+	REGISTER_SVC_MSG( FixAngle );
+	REGISTER_SVC_MSG( CrosshairAngle );
+	REGISTER_SVC_MSG( BSPDecal );
+	REGISTER_SVC_MSG( GameEvent );
+	REGISTER_SVC_MSG( UserMessage );
+	REGISTER_SVC_MSG( EntityMessage );
+	REGISTER_SVC_MSG( PacketEntities );
+	REGISTER_SVC_MSG( TempEntities );
+	REGISTER_SVC_MSG( Prefetch );
+	REGISTER_SVC_MSG( Menu );
+	REGISTER_SVC_MSG( GameEventList );
+	REGISTER_SVC_MSG( GetCvarValue );
+	REGISTER_SVC_MSG( CmdKeyValues );
+	REGISTER_SVC_MSG( SetPauseTimed );
+}
+
+CDemoParser::~CDemoParser()
+{
+	for ( int i = 0; i < (int)ARRAYSIZE( m_pMessages ); i++ )
+	{
+		delete m_pMessages[i];
+	}
+
+	delete m_pStringTables;
+}
+
+void CDemoParser::RegisterMessage( INetMessage *pMessage )
+{
+	Assert( pMessage->GetType() >= 0 && pMessage->GetType() < ARRAYSIZE( m_pMessages ) );
+	Assert( !m_pMessages[pMessage->GetType()] );
+	m_pMessages[pMessage->GetType()] = pMessage;
+}
+
+bool CDemoParser::ParseSignon( bool bReadDataTables )
+{
+	CUtlBuffer buf( m_pDemo->Base(), m_pDemo->GetSize(), CUtlBuffer::READ_ONLY );
+	buf.SetBigEndian( false );
+	buf.SeekGet( CUtlBuffer::SEEK_HEAD, m_pDemo->GetSignonStart() );
+
+	m_bReadDataTables = bReadDataTables;
+
+	bool bOk = true;
+	while ( bOk && buf.TellGet() < m_pDemo->GetSignonEnd() )
+	{
+		bOk = ParseCommand( buf, false );
+	}
+
+	m_bReadDataTables = false;
+
+	if ( bOk && !m_pClasses->IsLoaded() )
+	{
+		Warning( "Demo has no network data tables.\n" );
+		return false;
+	}
+
+	return bOk;
+}
+
+bool CDemoParser::ParseRange( int nStart, int nEnd )
+{
+	CUtlBuffer buf( m_pDemo->Base(), m_pDemo->GetSize(), CUtlBuffer::READ_ONLY );
+	buf.SetBigEndian( false );
+	buf.SeekGet( CUtlBuffer::SEEK_HEAD, nStart );
+
+	bool bFirst = true;
+	while ( buf.TellGet() < nEnd )
+	{
+		if ( !ParseCommand( buf, bFirst ) )
+			return false;
+
+		bFirst = false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads one command. Returns false on errors and at dem_stop.
+//-----------------------------------------------------------------------------
+bool CDemoParser::ParseCommand( CUtlBuffer &buf, bool bFirst )
+{
+	unsigned char cmd = buf.GetUnsignedChar();
+	buf.GetInt(); // tick, rows use the server tick from the packets
+
+	if ( !buf.IsValid() )
+	{
+		Warning( "Missing end tag in demo file.\n" );
+		return false;
+	}
+
+	bf_read data;
+
+	switch ( cmd )
+	{
+	case dem_signon:
+		return ReadPacket( buf );
+
+	case dem_packet:
+		m_nPackets++;
+		return ReadPacket( buf );
+
+	case dem_synctick:
+		return true;
+
+	case dem_stop:
+		// the end of the demo, nothing follows but the keyframe index
+		buf.SeekGet( CUtlBuffer::SEEK_HEAD, m_pDemo->GetSize() );
+		return true;
+
+	case dem_consolecmd:
+		return ReadRawData( buf, data );
+
+	case dem_usercmd:
+		buf.GetInt(); // outgoing sequence
+		return ReadRawData( buf, data );
+
+	case dem_datatables:
+		if ( !ReadRawData( buf, data ) )
+			return false;
+
+		if ( !m_bReadDataTables )
+			return true;
+
+		if ( !m_pClasses->ReadDataTables( data, m_pDemo->GetHeader().demoprotocol ) )
+		{
+			Warning( "Error parsing network data tables.\n" );
+			return false;
+		}
+		return true;
+
+	case dem_stringtables:
+		return ReadRawData( buf, data ) && ReadStringTables( data );
+
+	case dem_keyframe:
+		if ( !bFirst )
+		{
+			// the packets around it carry the same state as deltas
+			if ( !ReadRawData( buf, data ) )
+				return false;
+			buf.SeekGet( CUtlBuffer::SEEK_CURRENT, sizeof( democmdinfo_t ) + 2 * sizeof( int ) );
+			return ReadRawData( buf, data );
+		}
+		else
+		{
+			// the range before this one ended with the packet the keyframe holds the state of
+			m_bSilent = true;
+			bool bOk = ReadRawData( buf, data ) && ReadStringTables( data ) && ReadPacket( buf );
+			m_bSilent = false;
+			return bOk;
+		}
+
+	default:
+		Warning( "Unexpected command token [%d] in demo file.\n", cmd );
+		return false;
+	}
+}
+
+bool CDemoParser::ReadRawData( CUtlBuffer &buf, bf_read &data )
+{
+	int nSize = buf.GetInt();
+	if ( !buf.IsValid() || nSize < 0 || nSize > buf.GetBytesRemaining() )
+	{
+		Warning( "Error reading demo message data.\n" );
+		return false;
+	}
+
+	// bf_read wants whole words it can read from
+	m_PacketData.EnsureCapacity( PAD_NUMBER( nSize, 4 ) + 4 );
+	buf.Get( m_PacketData.Base(), nSize );
+
+	data.StartReading( m_PacketData.Base(), nSize );
+	return true;
+}
+
+bool CDemoParser::ReadPacket( CUtlBuffer &buf )
+{
+	// view info and sequence numbers only matter for playback
+	buf.SeekGet( CUtlBuffer::SEEK_CURRENT, sizeof( democmdinfo_t ) + 2 * sizeof( int ) );
+
+	bf_read data;
+	if ( !ReadRawData( buf, data ) )
+		return false;
+
+	return ProcessMessages( data );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Same loop as CNetChan::ProcessMessages
+//-----------------------------------------------------------------------------
+bool CDemoParser::ProcessMessages( bf_read &buf )
+{
+	char string[1024];
+
+	while ( true )
+	{
+		if ( buf.IsOverflowed() )
+		{
+			Warning( "Buffer overflow in net message.\n" );
+			return false;
+		}
+
+		if ( buf.GetNumBitsLeft() < NETMSG_TYPE_BITS )
+			break;
+
+		unsigned char cmd = buf.ReadUBitLong( NETMSG_TYPE_BITS );
+
+		if ( cmd == net_NOP )
+			continue;
+
+		if ( cmd == net_Disconnect )
+		{
+			buf.ReadString( string, sizeof( string ) );
+			continue;
+		}
+
+		if ( cmd == net_File )
+		{
+			buf.ReadUBitLong( 32 );
+			buf.ReadString( string, sizeof( string ) );
+			buf.ReadOneBit();
+			continue;
+		}
+
+		if ( cmd == svc_CreateStringTable )
+		{
+			if ( !ReadCreateStringTable( buf ) )
+				return false;
+			continue;
+		}
+
+		INetMessage *netmsg = m_pMessages[cmd];
+		if ( !netmsg )
+		{
+			Warning( "Unknown net message %i in demo.\n", cmd );
+			return false;
+		}
+
+		if ( !netmsg->ReadFromBuffer( buf ) )
+		{
+			Warning( "Failed reading message %s.\n", netmsg->GetName() );
+			return false;
+		}
+
+		if ( !netmsg->Process() )
+		{
+			Warning( "Failed processing message %s.\n", netmsg->GetName() );
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: SVC_CreateStringTable::ReadFromBuffer and ProcessCreateStringTable
+//			in one, the message asks its net channel for the protocol version
+//-----------------------------------------------------------------------------
+bool CDemoParser::ReadCreateStringTable( bf_read &buf )
+{
+	char szTableName[256];
+
+	if ( buf.PeekUBitLong( 8 ) == ':' )
+	{
+		// filenames, the dictionary for them needs a file system, plain strings do as well
+		buf.ReadByte();
+	}
+
+	buf.ReadString( szTableName, sizeof( szTableName ) );
+	int nMaxEntries = buf.ReadWord();
+	int nNumEntries = buf.ReadUBitLong( Q_log2( nMaxEntries ) + 1 );
+
+	int nLength;
+	if ( m_pDemo->GetHeader().networkprotocol > PROTOCOL_VERSION_23 )
+		nLength = buf.ReadVarInt32();
+	else
+		nLength = buf.ReadUBitLong( NET_MAX_PAYLOAD_BITS_V23 + 3 );
+
+	int nUserDataSize = 0;
+	int nUserDataSizeBits = 0;
+	if ( buf.ReadOneBit() )
+	{
+		nUserDataSize = buf.ReadUBitLong( 12 );
+		nUserDataSizeBits = buf.ReadUBitLong( 4 );
+	}
+
+	bool bDataCompressed = false;
+	if ( GetDemoProtocolVersion() > PROTOCOL_VERSION_14 )
+	{
+		bDataCompressed = buf.ReadOneBit() != 0;
+	}
+
+	if ( buf.IsOverflowed() || nLength < 0 || nLength > buf.GetNumBitsLeft() )
+	{
+		Warning( "Malformed string table %s.\n", szTableName );
+		return false;
+	}
+
+	bf_read data = buf;
+	buf.SeekRelative( nLength );
+
+	if ( m_pStringTables->FindTable( szTableName ) )
+	{
+		// a new map in the same demo, nothing after this is parsed correctly anyway
+		Warning( "String table %s created twice.\n", szTableName );
+		return false;
+	}
+
+	m_pStringTables->AllowCreation( true );
+	CNetworkStringTable *table = (CNetworkStringTable*)
+		m_pStringTables->CreateStringTableEx( szTableName, nMaxEntries, nUserDataSize, nUserDataSizeBits, false );
+	m_pStringTables->AllowCreation( false );
+
+	if ( !bDataCompressed )
+	{
+		table->ParseUpdate( data, nNumEntries );
+		return true;
+	}
+
+	unsigned int nUncompressedSize = data.ReadLong();
+	unsigned int nCompressedSize = data.ReadLong();
+	if ( data.IsOverflowed() || nCompressedSize > (unsigned int)data.TotalBytesAvailable() || nUncompressedSize > NET_MAX_PAYLOAD * 16 )
+	{
+		Warning( "Malformed string table %s.\n", szTableName );
+		return false;
+	}
+
+	CUtlMemory<byte> compressed( 0, PAD_NUMBER( nCompressedSize, 4 ) + 4 );
+	CUtlMemory<byte> uncompressed( 0, PAD_NUMBER( nUncompressedSize, 4 ) + 4 );
+	data.ReadBits( compressed.Base(), nCompressedSize * 8 );
+
+	const ICompressionCodec *pCodec = FindCompressionCodecForData( compressed.Base(), nCompressedSize );
+	unsigned int nLen = nUncompressedSize;
+	if ( !pCodec || !pCodec->Uncompress( uncompressed.Base(), &nLen, compressed.Base(), nCompressedSize ) || nLen != nUncompressedSize )
+	{
+		Warning( "Malformed string table %s.\n", szTableName );
+		return false;
+	}
+
+	bf_read tabledata( uncompressed.Base(), nUncompressedSize );
+	table->ParseUpdate( tabledata, nNumEntries );
+	return true;
+}
+
+bool CDemoParser::ReadStringTables( bf_read &buf )
+{
+	// the tables are rebuilt, baseline indices may change
+	m_BaselineIndex.RemoveAll();
+
+	return m_pStringTables->ReadStringTables( buf );
+}
+
+bool CDemoParser::ProcessTick( NET_Tick *msg )
+{
+	m_nServerTick = msg->m_nTick;
+	return true;
+}
+
+bool CDemoParser::ProcessServerInfo( SVC_ServerInfo *msg )
+{
+	m_nServerClassBits = Q_log2( msg->m_nMaxClasses ) + 1;
+	return true;
+}
+
+bool CDemoParser::ProcessUpdateStringTable( SVC_UpdateStringTable *msg )
+{
+	CNetworkStringTable *table = (CNetworkStringTable*)m_pStringTables->GetTable( msg->m_nTableID );
+	if ( !table )
+	{
+		Warning( "Update for unknown string table %i.\n", msg->m_nTableID );
+		return false;
+	}
+
+	table->ParseUpdate( msg->m_DataIn, msg->m_nChangedEntries );
+	return true;
+}
+
+bool CDemoParser::GetClassBaseline( int iClass, const void **ppData, int *pnBytes )
+{
+	INetworkStringTable *pBaselineTable = m_pStringTables->FindTable( INSTANCE_BASELINE_TABLENAME );
+	if ( !pBaselineTable )
+		return false;
+
+	while ( m_BaselineIndex.Count() <= iClass )
+	{
+		m_BaselineIndex.AddToTail( INVALID_STRING_INDEX );
+	}
+
+	if ( m_BaselineIndex[iClass] == INVALID_STRING_INDEX )
+	{
+		// the key is the class index, classes can get theirs later than others
+		char str[64];
+		Q_snprintf( str, sizeof( str ), "%d", iClass );
+		m_BaselineIndex[iClass] = pBaselineTable->FindStringIndex( str );
+
+		if ( m_BaselineIndex[iClass] == INVALID_STRING_INDEX )
+			return false;
+	}
+
+	*ppData = pBaselineTable->GetStringUserData( m_BaselineIndex[iClass], pnBytes );
+	return *ppData != NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads the entity headers the way CBaseClientState::ReadPacketEntities
+//			does. Entities are only tracked by class, the client frames that
+//			deltas refer to aren't needed to read the changes.
+//-----------------------------------------------------------------------------
+bool CDemoParser::ProcessPacketEntities( SVC_PacketEntities *msg )
+{
+	if ( !m_nServerClassBits )
+	{
+		Warning( "Received packet entities before server info.\n" );
+		return false;
+	}
+
+	if ( msg->m_nBaseline < 0 || msg->m_nBaseline > 1 )
+		return false;
+
+	if ( msg->m_bUpdateBaseline )
+	{
+		// the other baseline starts as a copy, entering entities replace theirs below
+		int iTo = msg->m_nBaseline ? 0 : 1;
+		for ( int i = 0; i < MAX_EDICTS; i++ )
+		{
+			EntityBaseline_t &from = m_EntityBaselines[msg->m_nBaseline][i];
+			EntityBaseline_t &to = m_EntityBaselines[iTo][i];
+			to.m_iClass = from.m_iClass;
+			to.m_Data = from.m_Data;
+		}
+	}
+
+	CBitVec<MAX_EDICTS> entered;
+	entered.ClearAll();
+
+	bf_read &buf = msg->m_DataIn;
+	int nHeaderBase = -1;
+
+	for ( int i = 0; i < msg->m_nUpdatedEntries; i++ )
+	{
+		int nEntity = nHeaderBase + 1 + buf.ReadUBitVar();
+		nHeaderBase = nEntity;
+
+		if ( nEntity < 0 || nEntity >= MAX_EDICTS || buf.IsOverflowed() )
+		{
+			Warning( "ProcessPacketEntities: entity out of bounds (%i).\n", nEntity );
+			return false;
+		}
+
+		if ( buf.ReadOneBit() == 0 )
+		{
+			if ( buf.ReadOneBit() != 0 )
+			{
+				if ( !ReadEnterPVS( buf, msg, nEntity ) )
+					return false;
+
+				entered.Set( nEntity );
+			}
+			else
+			{
+				int iClass = m_EntityClass[nEntity];
+				if ( iClass < 0 )
+				{
+					Warning( "ProcessPacketEntities: delta for unknown entity %i.\n", nEntity );
+					return false;
+				}
+
+				if ( !ReadProps( buf, iClass, nEntity ) )
+					return false;
+			}
+		}
+		else
+		{
+			bool bDelete = buf.ReadOneBit() != 0;
+			ReadLeavePVS( nEntity, bDelete );
+		}
+	}
+
+	if ( msg->m_bIsDelta )
+	{
+		while ( buf.ReadOneBit() != 0 )
+		{
+			ReadLeavePVS( buf.ReadUBitLong( MAX_EDICT_BITS ), true );
+		}
+	}
+	else
+	{
+		// a full update, everything it didn't send is gone
+		for ( int i = 0; i < MAX_EDICTS; i++ )
+		{
+			if ( m_EntityClass[i] >= 0 && !entered.IsBitSet( i ) )
+			{
+				ReadLeavePVS( i, true );
+			}
+		}
+	}
+
+	if ( buf.IsOverflowed() )
+	{
+		Warning( "ProcessPacketEntities: buffer read overflow.\n" );
+		return false;
+	}
+
+	return true;
+}
+
+bool CDemoParser::ReadEnterPVS( bf_read &buf, SVC_PacketEntities *msg, int nEntity )
+{
+	int iClass = buf.ReadUBitLong( m_nServerClassBits );
+	int nSerial = buf.ReadUBitLong( NUM_NETWORKED_EHANDLE_SERIAL_NUMBER_BITS );
+
+	if ( iClass >= m_pClasses->GetNumClasses() )
+	{
+		Warning( "ReadEnterPVS: invalid class index (%d).\n", iClass );
+		return false;
+	}
+
+	// either the entity's own or the class baseline, see CL_CopyNewEntity
+	const void *pFromData;
+	int nFromBytes;
+
+	EntityBaseline_t &baseline = m_EntityBaselines[msg->m_nBaseline][nEntity];
+	if ( msg->m_bIsDelta && baseline.m_iClass == iClass )
+	{
+		pFromData = baseline.m_Data.Base();
+		nFromBytes = baseline.m_Data.Count();
+	}
+	else if ( !GetClassBaseline( iClass, &pFromData, &nFromBytes ) )
+	{
+		Warning( "ReadEnterPVS: no baseline for class %s.\n", m_pClasses->GetClassName( iClass ) );
+		return false;
+	}
+
+	// the merged state has every prop that isn't zero, rows for all of them
+	// make the entity complete from here on
+	bf_read fromBuf( "CDemoParser::ReadEnterPVS", pFromData, nFromBytes );
+	bf_write mergedBuf( "CDemoParser::ReadEnterPVS", m_MergedData.Base(), m_MergedData.Count() );
+
+	if ( !MergeProps( m_pClasses->GetPrecalc( iClass ), &fromBuf, &buf, &mergedBuf ) )
+	{
+		Warning( "ReadEnterPVS: error reading %s (%d).\n", m_pClasses->GetClassName( iClass ), nEntity );
+		return false;
+	}
+
+	if ( msg->m_bUpdateBaseline )
+	{
+		EntityBaseline_t &newBaseline = m_EntityBaselines[msg->m_nBaseline ? 0 : 1][nEntity];
+		newBaseline.m_iClass = iClass;
+		newBaseline.m_Data.CopyArray( m_MergedData.Base(), mergedBuf.GetNumBytesWritten() );
+	}
+
+	m_EntityClass[nEntity] = iClass;
+
+	if ( !m_bSilent )
+	{
+		m_pColumns->AddRow( iClass, m_nServerTick, nEntity, DPC_PROP_ENTER );
+		m_pColumns->AddInt( iClass, nSerial );
+	}
+
+	bf_read mergedRead( "CDemoParser::ReadEnterPVS", m_MergedData.Base(), mergedBuf.GetNumBytesWritten() );
+	return ReadProps( mergedRead, iClass, nEntity );
+}
+
+void CDemoParser::ReadLeavePVS( int nEntity, bool bDelete )
+{
+	int iClass = m_EntityClass[nEntity];
+	if ( iClass < 0 )
+		return;
+
+	if ( !m_bSilent )
+	{
+		m_pColumns->AddRow( iClass, m_nServerTick, nEntity, bDelete ? DPC_PROP_DELETE : DPC_PROP_LEAVE );
+	}
+
+	if ( bDelete )
+	{
+		m_EntityClass[nEntity] = -1;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: RecvTable_MergeDeltas without a RecvTable, props come from the
+//			flattened SendTable
+//-----------------------------------------------------------------------------
+bool CDemoParser::MergeProps( const CSendTablePrecalc *pPrecalc, bf_read *pOldState, bf_read *pNewState, bf_write *pOut )
+{
+	const unsigned int nProps = pPrecalc->GetNumProps();
+
+	CDeltaBitsReader oldStateReader( pOldState );
+	CDeltaBitsReader newStateReader( pNewState );
+
+	{
+		// writes the end marker when it goes out of scope
+		CDeltaBitsWriter deltaBitsWriter( pOut );
+
+		unsigned int iOldProp = oldStateReader.ReadNextPropIndex();
+		unsigned int iNewProp = newStateReader.ReadNextPropIndex();
+
+		while ( 1 )
+		{
+			while ( iOldProp < iNewProp )
+			{
+				if ( iOldProp >= nProps )
+				{
+					oldStateReader.ForceFinished();
+					newStateReader.ForceFinished();
+					return false;
+				}
+
+				deltaBitsWriter.WritePropIndex( iOldProp );
+				oldStateReader.CopyPropData( deltaBitsWriter.GetBitBuf(), pPrecalc->GetProp( iOldProp ) );
+				iOldProp = oldStateReader.ReadNextPropIndex();
+			}
+
+			if ( iNewProp >= MAX_DATATABLE_PROPS )
+				break;
+
+			if ( iNewProp >= nProps )
+			{
+				oldStateReader.ForceFinished();
+				newStateReader.ForceFinished();
+				return false;
+			}
+
+			if ( iOldProp == iNewProp )
+			{
+				oldStateReader.SkipPropData( pPrecalc->GetProp( iOldProp ) );
+				iOldProp = oldStateReader.ReadNextPropIndex();
+			}
+
+			deltaBitsWriter.WritePropIndex( iNewProp );
+			newStateReader.CopyPropData( deltaBitsWriter.GetBitBuf(), pPrecalc->GetProp( iNewProp ) );
+
+			iNewProp = newStateReader.ReadNextPropIndex();
+		}
+	}
+
+	return !pOldState->IsOverflowed() && !pNewState->IsOverflowed() && !pOut->IsOverflowed();
+}
+
+bool CDemoParser::ReadProps( bf_read &buf, int iClass, int nEntity )
+{
+	const CSendTablePrecalc *pPrecalc = m_pClasses->GetPrecalc( iClass );
+
+	CDeltaBitsReader reader( &buf );
+
+	unsigned int iProp;
+	while ( ( iProp = reader.ReadNextPropIndex() ) < MAX_DATATABLE_PROPS )
+	{
+		if ( (int)iProp >= pPrecalc->GetNumProps() )
+		{
+			reader.ForceFinished();
+			Warning( "ReadProps: invalid prop %u for %s.\n", iProp, m_pClasses->GetClassName( iClass ) );
+			return false;
+		}
+
+		const SendProp *pProp = pPrecalc->GetProp( iProp );
+
+		if ( m_bSilent )
+		{
+			reader.SkipPropData( pProp );
+			continue;
+		}
+
+		m_pColumns->AddRow( iClass, m_nServerTick, nEntity, iProp );
+		ReadPropValue( buf, pProp, iClass );
+	}
+
+	return !buf.IsOverflowed();
+}
+
+void CDemoParser::ReadPropValue( bf_read &buf, const SendProp *pProp, int iClass )
+{
+	switch ( pProp->GetType() )
+	{
+	case DPT_String:
+		{
+			// String_Decode names the RecvProp when the length is bad, there is none
+			char str[DT_MAX_STRING_BUFFERSIZE];
+			int len = buf.ReadUBitLong( DT_MAX_STRING_BITS );
+			if ( len >= DT_MAX_STRING_BUFFERSIZE )
+			{
+				len = DT_MAX_STRING_BUFFERSIZE - 1;
+			}
+
+			buf.ReadBits( str, len * 8 );
+			str[len] = 0;
+			m_pColumns->AddString( iClass, str );
+		}
+		break;
+
+	case DPT_Array:
+		{
+			const SendProp *pElementProp = pProp->GetArrayProp();
+			int nElements = buf.ReadUBitLong( pProp->GetNumArrayLengthBits() );
+
+			m_pColumns->AddInt( iClass, nElements );
+			for ( int i = 0; i < nElements; i++ )
+			{
+				ReadPropValue( buf, pElementProp, iClass );
+			}
+		}
+		break;
+
+	default:
+		{
+			m_DecodeInfo.m_pProp = pProp;
+			m_DecodeInfo.m_pIn = &buf;
+			g_PropTypeFns[pProp->GetType()].Decode( &m_DecodeInfo );
+
+			const DVariant &value = m_DecodeInfo.m_Value;
+			switch ( pProp->GetType() )
+			{
+			case DPT_Int:
+				m_pColumns->AddInt( iClass, value.m_Int );
+				break;
+			case DPT_Float:
+				m_pColumns->AddFloat( iClass, value.m_Float );
+				break;
+			case DPT_Vector:
+				m_pColumns->AddFloat( iClass, value.m_Vector[0] );
+				m_pColumns->AddFloat( iClass, value.m_Vector[1] );
+				m_pColumns->AddFloat( iClass, value.m_Vector[2] );
+				break;
+			case DPT_VectorXY:
+				m_pColumns->AddFloat( iClass, value.m_Vector[0] );
+				m_pColumns->AddFloat( iClass, value.m_Vector[1] );
+				break;
+			default:
+				break;
+			}
+		}
+		break;
+	}
+}
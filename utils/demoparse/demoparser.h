@@ -0,0 +1,188 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Reads demos without an engine, entities are decoded with the
+//			engine's SendTable and string table code
+//
+//=============================================================================
+
+#ifndef DEMOPARSER_H
+#define DEMOPARSER_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier1/utlbuffer.h"
+#include "tier1/utlvector.h"
+#include "tier1/utlmemory.h"
+#include "tier1/bitbuf.h"
+#include "demofile/demoformat.h"
+#include "inetmsghandler.h"
+#include "const.h"
+#include "dt_encode.h"
+
+class CSendTablePrecalc;
+class CNetworkStringTableContainer;
+class INetMessage;
+class CPropColumns;
+
+//-----------------------------------------------------------------------------
+// A whole demo file in memory, uncompressed, with its keyframe index
+//-----------------------------------------------------------------------------
+class CDemoData
+{
+public:
+	CDemoData();
+
+	bool	Load( const char *pszFileName );
+
+	const demoheader_t	&GetHeader() const { return m_Header; }
+	const byte	*Base() const { return (const byte *)m_Data.Base(); }
+	int			GetSize() const { return m_Data.TellPut(); }
+	int			GetSignonStart() const { return sizeof( demoheader_t ); }
+	int			GetSignonEnd() const { return sizeof( demoheader_t ) + m_Header.signonlength; }
+
+	// sorted by file offset, empty if the demo isn't indexed
+	const CUtlVector<demoindexentry_t> &GetKeyframes() const { return m_Keyframes; }
+
+private:
+	bool	Uncompress();
+	void	ReadKeyframeIndex();
+
+	char						m_szFileName[MAX_PATH];
+	demoheader_t				m_Header;
+	CUtlBuffer					m_Data;
+	CUtlVector<demoindexentry_t> m_Keyframes;
+};
+
+//-----------------------------------------------------------------------------
+// Server classes and their flattened SendTables from dem_datatables. Loaded
+// once, all parsers share them read only.
+//-----------------------------------------------------------------------------
+class CDemoServerClasses
+{
+public:
+	CDemoServerClasses();
+	~CDemoServerClasses();
+
+	bool	ReadDataTables( bf_read &buf, int nDemoProtocol );
+	bool	IsLoaded() const { return m_Classes.Count() > 0; }
+
+	int		GetNumClasses() const { return m_Classes.Count(); }
+	const char *GetClassName( int iClass ) const { return m_Classes[iClass].m_pszName; }
+	const char *GetTableName( int iClass ) const;
+	const CSendTablePrecalc *GetPrecalc( int iClass ) const { return m_Classes[iClass].m_pPrecalc; }
+
+private:
+	SendTable *FindTable( const char *pszName ) const;
+	void	Purge();
+
+	struct ServerClass_t
+	{
+		char				*m_pszName;
+		CSendTablePrecalc	*m_pPrecalc;
+	};
+
+	CUtlVector<SendTable *>				m_Tables;
+	CUtlVector<CSendTablePrecalc *>		m_Precalcs;
+	CUtlVector<ServerClass_t>			m_Classes;	// by class ID
+};
+
+//-----------------------------------------------------------------------------
+// Parses one range of a demo. Each parser has its own string tables and
+// entity state, so several can run on different threads.
+//-----------------------------------------------------------------------------
+class CDemoParser : public IServerMessageHandler
+{
+public:
+	CDemoParser( const CDemoData *pDemo, CDemoServerClasses *pClasses, CPropColumns *pColumns );
+	~CDemoParser();
+
+	// Reads the signon data. Only the first parser loads the datatables, the others
+	// must not start before that is done.
+	bool	ParseSignon( bool bReadDataTables );
+
+	// Parses commands from nStart up to nEnd. A range starting at a dem_keyframe
+	// takes its state from it without writing rows, that was the end of the range before.
+	bool	ParseRange( int nStart, int nEnd );
+
+	int		GetNumPackets() const { return m_nPackets; }
+
+public: // IServerMessageHandler
+	PROCESS_NET_MESSAGE( Tick );
+	PROCESS_NET_MESSAGE( StringCmd ) { return true; }
+	PROCESS_NET_MESSAGE( SetConVar ) { return true; }
+	PROCESS_NET_MESSAGE( SignonState ) { return true; }
+
+	virtual int GetDemoProtocolVersion() const { return m_pDemo->GetHeader().networkprotocol; }
+
+	PROCESS_SVC_MESSAGE( Print ) { return true; }
+	PROCESS_SVC_MESSAGE( ServerInfo );
+	PROCESS_SVC_MESSAGE( SendTable ) { return true; }
+	PROCESS_SVC_MESSAGE( ClassInfo ) { return true; }
+	PROCESS_SVC_MESSAGE( SetPause ) { return true; }
+	PROCESS_SVC_MESSAGE( CreateStringTable ) { return true; }	// see ReadCreateStringTable
+	PROCESS_SVC_MESSAGE( UpdateStringTable );
+	PROCESS_SVC_MESSAGE( VoiceInit ) { return true; }
+	PROCESS_SVC_MESSAGE( VoiceData ) { return true; }
+	PROCESS_SVC_MESSAGE( Sounds ) { return true; }
+	PROCESS_SVC_MESSAGE( SetView ) { return true; }
+	PROCESS_SVC_MESSAGE( FixAngle ) { return true; }
+	PROCESS_SVC_MESSAGE( CrosshairAngle ) { return true; }
+	PROCESS_SVC_MESSAGE( BSPDecal ) { return true; }
+	PROCESS_SVC_MESSAGE( GameEvent ) { return true; }
+	PROCESS_SVC_MESSAGE( UserMessage ) { return true; }
+	PROCESS_SVC_MESSAGE( EntityMessage ) { return true; }
+	PROCESS_SVC_MESSAGE( PacketEntities );
+	PROCESS_SVC_MESSAGE( TempEntities ) { return true; }
+	PROCESS_SVC_MESSAGE( Prefetch ) { return true; }
+	PROCESS_SVC_MESSAGE( Menu ) { return true; }
+	PROCESS_SVC_MESSAGE( GameEventList ) { return true; }
+	PROCESS_SVC_MESSAGE( GetCvarValue ) { return true; }
+	PROCESS_SVC_MESSAGE( CmdKeyValues ) { return true; }
+	PROCESS_SVC_MESSAGE( SetPauseTimed ) { return true; }
+
+private:
+	void	RegisterMessage( INetMessage *pMessage );
+	bool	ParseCommand( CUtlBuffer &buf, bool bFirst );
+	bool	ReadPacket( CUtlBuffer &buf );
+	bool	ReadRawData( CUtlBuffer &buf, bf_read &data );
+	bool	ProcessMessages( bf_read &buf );
+	bool	ReadCreateStringTable( bf_read &buf );
+	bool	ReadStringTables( bf_read &buf );
+
+	bool	MergeProps( const CSendTablePrecalc *pPrecalc, bf_read *pOldState, bf_read *pNewState, bf_write *pOut );
+	bool	ReadEnterPVS( bf_read &buf, SVC_PacketEntities *msg, int nEntity );
+	void	ReadLeavePVS( int nEntity, bool bDelete );
+	bool	ReadProps( bf_read &buf, int iClass, int nEntity );
+	void	ReadPropValue( bf_read &buf, const SendProp *pProp, int iClass );
+	bool	GetClassBaseline( int iClass, const void **ppData, int *pnBytes );
+
+private:
+	struct EntityBaseline_t
+	{
+		int					m_iClass;
+		CUtlVector<byte>	m_Data;
+	};
+
+	const CDemoData					*m_pDemo;
+	CDemoServerClasses				*m_pClasses;
+	CPropColumns					*m_pColumns;
+	CNetworkStringTableContainer	*m_pStringTables;
+	INetMessage						*m_pMessages[64];	// by type, 2^NETMSG_TYPE_BITS
+
+	int				m_nServerClassBits;
+	int				m_nServerTick;
+	int				m_nPackets;
+	bool			m_bSilent;		// loading a keyframe, don't write rows
+	bool			m_bReadDataTables;
+
+	CUtlVector<int>	m_BaselineIndex;	// instance baseline string per class
+	short			m_EntityClass[MAX_EDICTS];	// -1 if the entity doesn't exist
+	EntityBaseline_t m_EntityBaselines[2][MAX_EDICTS];	// per entity baselines the server may switch to
+
+	CUtlMemory<byte>	m_PacketData;
+	CUtlMemory<byte>	m_MergedData;
+	DecodeInfo			m_DecodeInfo;
+};
+
+#endif // DEMOPARSER_H
@@ -0,0 +1,123 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Column store for decoded entity properties, one table per server class
+//
+//=============================================================================
+
+#include "propcolumns.h"
+#include "tier0/dbg.h"
+#include "tier1/strtools.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+template < class T >
+static void PutColumn( CUtlBuffer &buf, const CUtlVector<T> &column )
+{
+#ifdef VALVE_BIG_ENDIAN
+	// the buffer is set to little endian and swaps each value
+	for ( int i = 0; i < column.Count(); i++ )
+	{
+		T value = column[i];
+		if ( sizeof( T ) == 4 )
+		{
+			buf.PutUnsignedInt( *(uint32 *)&value );
+		}
+		else
+		{
+			buf.PutUnsignedShort( *(uint16 *)&value );
+		}
+	}
+#else
+	// the file is little endian just like memory, copy the whole column
+	buf.Put( column.Base(), column.Count() * sizeof( T ) );
+#endif
+}
+
+CPropColumns::CPropColumns()
+{
+	m_nRows = 0;
+}
+
+CPropColumns::~CPropColumns()
+{
+	m_Classes.PurgeAndDeleteElements();
+}
+
+void CPropColumns::Init( int nClasses )
+{
+	m_Classes.PurgeAndDeleteElements();
+	m_Classes.EnsureCapacity( nClasses );
+	for ( int i = 0; i < nClasses; i++ )
+	{
+		ClassColumns_t *pColumns = new ClassColumns_t;
+		pColumns->m_Chunks.SetBigEndian( false );
+		m_Classes.AddToTail( pColumns );
+	}
+
+	m_nRows = 0;
+}
+
+void CPropColumns::AddRow( int iClass, int nTick, int nEntity, int iProp )
+{
+	ClassColumns_t *pColumns = m_Classes[iClass];
+	if ( pColumns->m_Ticks.Count() >= DPC_CHUNK_ROWS )
+	{
+		FlushChunk( pColumns );
+	}
+
+	pColumns->m_Ticks.AddToTail( nTick );
+	pColumns->m_Entities.AddToTail( (unsigned short)nEntity );
+	pColumns->m_Props.AddToTail( (unsigned short)iProp );
+	m_nRows++;
+}
+
+void CPropColumns::AddInt( int iClass, int nValue )
+{
+	m_Classes[iClass]->m_Ints.AddToTail( nValue );
+}
+
+void CPropColumns::AddFloat( int iClass, float flValue )
+{
+	m_Classes[iClass]->m_Floats.AddToTail( flValue );
+}
+
+void CPropColumns::AddString( int iClass, const char *pszValue )
+{
+	m_Classes[iClass]->m_Strings.AddMultipleToTail( V_strlen( pszValue ) + 1, pszValue );
+}
+
+void CPropColumns::Flush()
+{
+	FOR_EACH_VEC( m_Classes, i )
+	{
+		FlushChunk( m_Classes[i] );
+	}
+}
+
+void CPropColumns::FlushChunk( ClassColumns_t *pColumns )
+{
+	if ( !pColumns->m_Ticks.Count() )
+		return;
+
+	CUtlBuffer &buf = pColumns->m_Chunks;
+	buf.PutInt( pColumns->m_Ticks.Count() );
+	buf.PutInt( pColumns->m_Ints.Count() );
+	buf.PutInt( pColumns->m_Floats.Count() );
+	buf.PutInt( pColumns->m_Strings.Count() );
+
+	PutColumn( buf, pColumns->m_Ticks );
+	PutColumn( buf, pColumns->m_Entities );
+	PutColumn( buf, pColumns->m_Props );
+	PutColumn( buf, pColumns->m_Ints );
+	PutColumn( buf, pColumns->m_Floats );
+	buf.Put( pColumns->m_Strings.Base(), pColumns->m_Strings.Count() );
+
+	// keep the memory, the next chunk is likely just as big
+	pColumns->m_Ticks.RemoveAll();
+	pColumns->m_Entities.RemoveAll();
+	pColumns->m_Props.RemoveAll();
+	pColumns->m_Ints.RemoveAll();
+	pColumns->m_Floats.RemoveAll();
+	pColumns->m_Strings.RemoveAll();
+}
@@ -0,0 +1,81 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Column store for decoded entity properties, one table per server class
+//
+//=============================================================================
+
+#ifndef PROPCOLUMNS_H
+#define PROPCOLUMNS_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier1/utlvector.h"
+#include "tier1/utlbuffer.h"
+
+//-----------------------------------------------------------------------------
+// A .dpc file holds the rows of one server class:
+//
+//	"DPC1", int version, class name, datatable name, int #props,
+//	per prop: byte type, byte array element type (0xff if no array), name
+//
+// followed by chunks until the end of the file:
+//
+//	int #rows, int #ints, int #floats, int #string bytes,
+//	int tick[#rows], ushort entity[#rows], ushort prop[#rows],
+//	int ints[#ints], float floats[#floats], char strings[#string bytes]
+//
+// Each row is one property change, its value is the next one in the stream of
+// its type: ints, floats (3 for vectors, 2 for xy vectors) or NUL terminated
+// strings. Arrays put their element count into ints, then their elements.
+// Everything is little endian. Ticks are server ticks.
+//-----------------------------------------------------------------------------
+#define DPC_FILE_ID			"DPC1"
+#define DPC_VERSION			1
+#define DPC_NO_ARRAY		0xff
+
+#define DPC_PROP_ENTER		0xfffd	// entity entered the PVS, ints has its serial number, its props follow
+#define DPC_PROP_LEAVE		0xfffe	// entity left the PVS, no value
+#define DPC_PROP_DELETE		0xffff	// entity was deleted, no value
+
+#define DPC_CHUNK_ROWS		65536
+
+class CPropColumns
+{
+public:
+	CPropColumns();
+	~CPropColumns();
+
+	void	Init( int nClasses );
+
+	void	AddRow( int iClass, int nTick, int nEntity, int iProp );
+	void	AddInt( int iClass, int nValue );
+	void	AddFloat( int iClass, float flValue );
+	void	AddString( int iClass, const char *pszValue );
+
+	// Closes all partially filled chunks
+	void	Flush();
+
+	// Finished chunks of a class, empty if it had no rows
+	const CUtlBuffer &GetChunks( int iClass ) const { return m_Classes[iClass]->m_Chunks; }
+	int64	GetNumRows() const { return m_nRows; }
+
+private:
+	struct ClassColumns_t
+	{
+		CUtlVector<int>				m_Ticks;
+		CUtlVector<unsigned short>	m_Entities;
+		CUtlVector<unsigned short>	m_Props;
+		CUtlVector<int>				m_Ints;
+		CUtlVector<float>			m_Floats;
+		CUtlVector<char>			m_Strings;
+		CUtlBuffer					m_Chunks;
+	};
+
+	void	FlushChunk( ClassColumns_t *pColumns );
+
+	CUtlVector<ClassColumns_t *>	m_Classes;
+	int64							m_nRows;
+};
+
+#endif // PROPCOLUMNS_H
@@ -0,0 +1,376 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Times KeyValues::LoadFromBuffer against CKeyValuesTree over the
+//			.txt, .res and .vmt files under a game directory. -verify checks
+//			the trees copy out into what KeyValues loads.
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef WIN32
+#include <windows.h>
+#elif POSIX
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+#include "tier0/dbg.h"
+#include "tier0/platform.h"
+#include "tier0/icommandline.h"
+#include "tier1/KeyValues.h"
+#include "tier1/keyvaluestree.h"
+#include "tier1/strtools.h"
+#include "tier1/utlvector.h"
+#include "tier1/utlstring.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+static bool verbose = false;
+
+static const char *s_pszExtensions[] = { "txt", "res", "vmt" };
+#define KVBENCH_EXTENSIONS	( (int)ARRAYSIZE( s_pszExtensions ) )
+
+struct BenchFile_t
+{
+	CUtlString			m_Name;
+	CUtlVector< char >	m_Text;		// null terminated
+	int					m_nExtension;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads a whole file, null terminated
+//-----------------------------------------------------------------------------
+static bool ReadBenchFile( const char *pszPath, CUtlVector< char > &text )
+{
+	FILE *fp = fopen( pszPath, "rb" );
+	if ( !fp )
+		return false;
+
+	fseek( fp, 0, SEEK_END );
+	long nSize = ftell( fp );
+	fseek( fp, 0, SEEK_SET );
+
+	text.SetCount( nSize + 1 );
+	bool bOk = nSize >= 0 && fread( text.Base(), 1, nSize, fp ) == (size_t)nSize;
+	text[nSize] = 0;
+	fclose( fp );
+	return bOk;
+}
+
+static void AddBenchFile( const char *pszPath, CUtlVector< BenchFile_t > &files )
+{
+	const char *pszExtension = V_GetFileExtension( pszPath );
+	if ( !pszExtension )
+		return;
+
+	for ( int i = 0; i < KVBENCH_EXTENSIONS; i++ )
+	{
+		if ( V_stricmp( pszExtension, s_pszExtensions[i] ) )
+			continue;
+
+		BenchFile_t &file = files[files.AddToTail()];
+		file.m_Name = pszPath;
+		file.m_nExtension = i;
+		if ( !ReadBenchFile( pszPath, file.m_Text ) )
+		{
+			Warning( "can't read %s\n", pszPath );
+			files.RemoveMultipleFromTail( 1 );
+		}
+		return;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Collects the files to parse under a directory
+//-----------------------------------------------------------------------------
+static void FindBenchFiles( const char *pszDir, CUtlVector< BenchFile_t > &files )
+{
+	char szPath[MAX_PATH];
+#ifdef WIN32
+	V_snprintf( szPath, sizeof( szPath ), "%s\\*", pszDir );
+	WIN32_FIND_DATA findFileData;
+	HANDLE hFind = FindFirstFile( szPath, &findFileData );
+	if ( hFind == INVALID_HANDLE_VALUE )
+		return;
+
+	do
+	{
+		if ( findFileData.cFileName[0] == '.' )
+			continue;
+
+		V_snprintf( szPath, sizeof( szPath ), "%s\\%s", pszDir, findFileData.cFileName );
+		if ( findFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY )
+		{
+			FindBenchFiles( szPath, files );
+		}
+		else
+		{
+			AddBenchFile( szPath, files );
+		}
+	} while ( FindNextFile( hFind, &findFileData ) );
+	FindClose( hFind );
+#elif POSIX
+	DIR *d = opendir( pszDir );
+	if ( !d )
+		return;
+
+	struct dirent *dir;
+	while ( ( dir = readdir( d ) ) != NULL )
+	{
+		if ( dir->d_name[0] == '.' )
+			continue;
+
+		V_snprintf( szPath, sizeof( szPath ), "%s/%s", pszDir, dir->d_name );
+		struct stat st;
+		if ( stat( szPath, &st ) != 0 )
+			continue;
+
+		if ( S_ISDIR( st.st_mode ) )
+		{
+			FindBenchFiles( szPath, files );
+		}
+		else if ( S_ISREG( st.st_mode ) )
+		{
+			AddBenchFile( szPath, files );
+		}
+	}
+	closedir( d );
+#else
+#error "Implement me!"
+#endif
+}
+
+static bool KeyValuesMatch( KeyValues *pA, KeyValues *pB )
+{
+	for ( ; pA && pB; pA = pA->GetNextKey(), pB = pB->GetNextKey() )
+	{
+		if ( V_strcmp( pA->GetName(), pB->GetName() ) || pA->GetDataType() != pB->GetDataType() )
+			return false;
+
+		switch ( pA->GetDataType() )
+		{
+		case KeyValues::TYPE_NONE:
+			if ( !KeyValuesMatch( pA->GetFirstSubKey(), pB->GetFirstSubKey() ) )
+				return false;
+			break;
+		case KeyValues::TYPE_UINT64:
+			if ( pA->GetUint64() != pB->GetUint64() )
+				return false;
+			break;
+		case KeyValues::TYPE_FLOAT:
+			if ( pA->GetFloat() != pB->GetFloat() )
+				return false;
+			break;
+		default:
+			if ( V_strcmp( pA->GetString(), pB->GetString() ) )
+				return false;
+			break;
+		}
+	}
+	return !pA && !pB;
+}
+
+enum BenchParser_t
+{
+	BENCH_KEYVALUES = 0,	// KeyValues::LoadFromBuffer
+	BENCH_TREE,				// copy the text, CKeyValuesTree::Parse
+	BENCH_TREE_COPY,		// and copy the whole tree out into KeyValues
+
+	BENCH_PARSER_COUNT
+};
+
+static const char *s_pszParsers[BENCH_PARSER_COUNT] = { "keyvalues", "tree", "tree + copy" };
+
+//-----------------------------------------------------------------------------
+// Purpose: Parses every file nPasses times, adds up the time by extension
+//-----------------------------------------------------------------------------
+static void RunBench( const CUtlVector< BenchFile_t > &files, BenchParser_t parser, int nPasses, double *pflTimes )
+{
+	CUtlVector< char > buffer;
+	CKeyValuesTree tree;
+	for ( int nPass = 0; nPass < nPasses; nPass++ )
+	{
+		FOR_EACH_VEC( files, i )
+		{
+			const BenchFile_t &file = files[i];
+			double flStart = Plat_FloatTime();
+			if ( parser == BENCH_KEYVALUES )
+			{
+				KeyValues *pKeyValues = new KeyValues( "" );
+				pKeyValues->LoadFromBuffer( file.m_Name, file.m_Text.Base() );
+				pKeyValues->deleteThis();
+			}
+			else
+			{
+				buffer.CopyArray( file.m_Text.Base(), file.m_Text.Count() );
+				tree.Parse( file.m_Name, buffer.Base() );
+				if ( parser == BENCH_TREE_COPY )
+				{
+					KeyValues *pKeyValues = tree.MakeKeyValues( tree.GetFirstKey(), true );
+					if ( pKeyValues )
+					{
+						pKeyValues->deleteThis();
+					}
+				}
+			}
+			pflTimes[file.m_nExtension] += Plat_FloatTime() - flStart;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns how many files the tree parses differently. Files where a
+//			conditional drops a top level key that isn't the last one, or with
+//			tokens over 4K, differ on purpose, see keyvaluestree.h.
+//-----------------------------------------------------------------------------
+static int VerifyFiles( const CUtlVector< BenchFile_t > &files )
+{
+	int nMismatched = 0;
+	CUtlVector< char > buffer;
+	CKeyValuesTree tree;
+	FOR_EACH_VEC( files, i )
+	{
+		const BenchFile_t &file = files[i];
+		KeyValues *pLoaded = new KeyValues( "" );
+		pLoaded->LoadFromBuffer( file.m_Name, file.m_Text.Base() );
+
+		buffer.CopyArray( file.m_Text.Base(), file.m_Text.Count() );
+		tree.Parse( file.m_Name, buffer.Base() );
+		KeyValues *pCopied = tree.MakeKeyValues( tree.GetFirstKey(), true );
+
+		// an empty file leaves KeyValues with just the name it was made with
+		bool bEmpty = !pCopied && !pLoaded->GetFirstSubKey() && !pLoaded->GetNextKey();
+		if ( !bEmpty && !KeyValuesMatch( pLoaded, pCopied ) )
+		{
+			printf( "mismatch: %s\n", file.m_Name.Get() );
+			nMismatched++;
+		}
+
+		pLoaded->deleteThis();
+		if ( pCopied )
+		{
+			pCopied->deleteThis();
+		}
+	}
+	return nMismatched;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Warning/Msg call back through this API
+//-----------------------------------------------------------------------------
+SpewRetval_t SpewFunc( SpewType_t type, char const *pMsg )
+{
+	switch ( type )
+	{
+	default:
+	case SPEW_MESSAGE:
+	case SPEW_ASSERT:
+	case SPEW_LOG:
+		printf( "%s", pMsg );
+		break;
+	case SPEW_WARNING:
+		if ( verbose )
+		{
+			printf( "%s", pMsg );
+		}
+		break;
+	case SPEW_ERROR:
+		printf( "%s\n", pMsg );
+		break;
+	}
+
+	return SPEW_CONTINUE;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Shows usage information
+//-----------------------------------------------------------------------------
+void printusage( void )
+{
+	printf( "usage:  kvbench -dir <path> [options]\n\
+		\t-dir <path> = parse the .txt, .res and .vmt files under this directory\n\
+		\t-passes <n> = times each file is parsed, default 5\n\
+		\t-verify = check the trees copy out into what KeyValues loads\n\
+		\t-v = verbose output, shows parse errors\n\
+		\ne.g.:  kvbench -dir ~/tf2/tf -verify\n" );
+
+	// Exit app
+	exit( 1 );
+}
+
+int main( int argc, char* argv[] )
+{
+	SpewOutputFunc( SpewFunc );
+	SpewActivate( "kvbench", 2 );
+	CommandLine()->CreateCmdLine( argc, argv );
+
+	const char *pszDir = CommandLine()->ParmValue( "-dir", (const char *)NULL );
+	if ( !pszDir || CommandLine()->FindParm( "-?" ) || CommandLine()->FindParm( "-help" ) )
+	{
+		printusage();
+	}
+
+	verbose = CommandLine()->FindParm( "-v" ) != 0;
+	int nPasses = MAX( CommandLine()->ParmValue( "-passes", 5 ), 1 );
+
+	CUtlVector< BenchFile_t > files;
+	FindBenchFiles( pszDir, files );
+	if ( !files.Count() )
+	{
+		printf( "kvbench: no .txt, .res or .vmt files under %s\n", pszDir );
+		return 1;
+	}
+
+	int nFiles[KVBENCH_EXTENSIONS] = {};
+	double flMB[KVBENCH_EXTENSIONS + 1] = {};
+	FOR_EACH_VEC( files, i )
+	{
+		nFiles[files[i].m_nExtension]++;
+		flMB[files[i].m_nExtension] += ( files[i].m_Text.Count() - 1 ) * (double)nPasses / ( 1024.0 * 1024.0 );
+	}
+	for ( int i = 0; i < KVBENCH_EXTENSIONS; i++ )
+	{
+		flMB[KVBENCH_EXTENSIONS] += flMB[i];
+	}
+
+	int nMismatched = 0;
+	if ( CommandLine()->FindParm( "-verify" ) )
+	{
+		nMismatched = VerifyFiles( files );
+		printf( "kvbench: %d of %d files parse differently\n", nMismatched, files.Count() );
+	}
+
+	printf( "%-8s %7s %9s", "files", "count", "MB" );
+	for ( int p = 0; p < BENCH_PARSER_COUNT; p++ )
+	{
+		printf( "  %11s MB/s", s_pszParsers[p] );
+	}
+	printf( "\n" );
+
+	double flTimes[BENCH_PARSER_COUNT][KVBENCH_EXTENSIONS + 1] = {};
+	for ( int p = 0; p < BENCH_PARSER_COUNT; p++ )
+	{
+		RunBench( files, (BenchParser_t)p, nPasses, flTimes[p] );
+		for ( int i = 0; i < KVBENCH_EXTENSIONS; i++ )
+		{
+			flTimes[p][KVBENCH_EXTENSIONS] += flTimes[p][i];
+		}
+	}
+
+	for ( int i = 0; i <= KVBENCH_EXTENSIONS; i++ )
+	{
+		int nCount = ( i < KVBENCH_EXTENSIONS ) ? nFiles[i] : files.Count();
+		if ( !nCount )
+			continue;
+
+		printf( "%-8s %7d %9.2f", ( i < KVBENCH_EXTENSIONS ) ? s_pszExtensions[i] : "all", nCount, flMB[i] / nPasses );
+		for ( int p = 0; p < BENCH_PARSER_COUNT; p++ )
+		{
+			printf( "  %16.1f", flTimes[p][i] > 0.0 ? flMB[i] / flTimes[p][i] : 0.0 );
+		}
+		printf( "\n" );
+	}
+
+	return nMismatched ? 1 : 0;
+}
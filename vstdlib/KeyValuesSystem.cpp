@@ -14,6 +14,7 @@
 #include "tier1/utlmap.h"
 #include "tier1/utlstring.h"
 #include "tier1/fmtstr.h"
+#include "tier1/generichash.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include <tier0/memdbgon.h>
@@ -64,16 +65,39 @@ private:
 #endif
 	int m_iMaxKeyValuesSize;
 
-	// string hash table
-	CMemoryStack m_Strings;
-	struct hash_item_t
+	// string hash table. It only ever grows, names are hashed into shards
+	// that each hold an open addressed table of symbols. Lookups probe the
+	// table without locking, adding a name locks its shard. A full table is
+	// replaced by one twice the size, the old one stays valid for readers
+	// still probing it.
+	enum
 	{
-		intp stringIndex;
-		hash_item_t *next;
+		SYMBOL_SHARD_BITS = 4,
+		SYMBOL_SHARDS = 1 << SYMBOL_SHARD_BITS,
+		SYMBOL_TABLE_INITIAL_SLOTS = 256,
 	};
-	CUtlMemoryPool m_HashItemMemPool;
-	CUtlVector<hash_item_t> m_HashTable;
-	int CaseInsensitiveHash(const char *string, int iBounds);
+
+	struct SymbolTable_t
+	{
+		SymbolTable_t *m_pOlder;		// replaced tables, freed with the system
+		int m_nMask;
+		int64 volatile m_Slots[1];		// hash << 32 | symbol, 0 while empty
+	};
+
+	struct ALIGN128 SymbolShard_t
+	{
+		SymbolTable_t * volatile m_pTable;
+		int m_nSymbols;
+		CThreadFastMutex m_mutex;
+	} ALIGN128_POST;
+
+	CMemoryStack m_Strings;
+	CThreadFastMutex m_StringsMutex;
+	SymbolShard_t m_SymbolShards[SYMBOL_SHARDS];
+
+	static unsigned HashSymbolName( const char *name );
+	HKeySymbol FindSymbol( const SymbolTable_t *pTable, unsigned hash, const char *name, int *pEmptySlot );
+	void GrowSymbolTable( SymbolShard_t &shard );
 
 	void DoInvalidateCache();
 
@@ -88,8 +112,6 @@ private:
 	}
 	CUtlRBTree<MemoryLeakTracker_t, int> m_KeyValuesTrackingList;
 
-	CThreadFastMutex m_mutex;
-
 	CUtlMap<CUtlString, KeyValues*> m_KeyValueCache;
 };
 
@@ -109,18 +131,21 @@ IKeyValuesSystem *KeyValuesSystem()
 // Purpose: Constructor
 //-----------------------------------------------------------------------------
 CKeyValuesSystem::CKeyValuesSystem()
-: m_HashItemMemPool(sizeof(hash_item_t), 64, CUtlMemoryPool::GROW_FAST, "CKeyValuesSystem::m_HashItemMemPool")
-, m_KeyValuesTrackingList(0, 0, MemoryLeakTrackerLessFunc)
+: m_KeyValuesTrackingList(0, 0, MemoryLeakTrackerLessFunc)
 , m_KeyValueCache( UtlStringLessFunc )
 {
 	// initialize hash table
-	m_HashTable.AddMultipleToTail(2047);
-	for (int i = 0; i < m_HashTable.Count(); i++)
+	for ( int i = 0; i < SYMBOL_SHARDS; i++ )
 	{
-		m_HashTable[i].stringIndex = 0;
-		m_HashTable[i].next = NULL;
+		size_t nSize = sizeof( SymbolTable_t ) + ( SYMBOL_TABLE_INITIAL_SLOTS - 1 ) * sizeof( int64 );
+		SymbolTable_t *pTable = (SymbolTable_t *)malloc( nSize );
+		memset( pTable, 0, nSize );
+		pTable->m_nMask = SYMBOL_TABLE_INITIAL_SLOTS - 1;
+		m_SymbolShards[i].m_pTable = pTable;
+		m_SymbolShards[i].m_nSymbols = 0;
 	}
 
+	// symbols are offsets into the strings, 0 is the empty string
 	m_Strings.Init( 4*1024*1024, 64*1024, 0, 4 );
 	char *pszEmpty = ((char *)m_Strings.Alloc(1));
 	*pszEmpty = 0;
@@ -158,6 +183,17 @@ CKeyValuesSystem::~CKeyValuesSystem()
 #endif
 
 	DoInvalidateCache();
+
+	for ( int i = 0; i < SYMBOL_SHARDS; i++ )
+	{
+		SymbolTable_t *pOlder;
+		for ( SymbolTable_t *pTable = m_SymbolShards[i].m_pTable; pTable; pTable = pOlder )
+		{
+			pOlder = pTable->m_pOlder;
+			free( pTable );
+		}
+		m_SymbolShards[i].m_pTable = NULL;
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -228,55 +264,128 @@ HKeySymbol CKeyValuesSystem::GetSymbolForString( const char *name, bool bCreate
 		return (-1);
 	}
 
-	AUTO_LOCK( m_mutex );
+	if ( !*name )
+	{
+		return 0;
+	}
+
+	unsigned hash = HashSymbolName( name );
+	SymbolShard_t &shard = m_SymbolShards[hash >> ( 32 - SYMBOL_SHARD_BITS )];
 
-	int hash = CaseInsensitiveHash(name, m_HashTable.Count());
-	int i = 0;
-	hash_item_t *item = &m_HashTable[hash];
-	while (1)
+	// Almost every name is already in the table, find those without locking
+	HKeySymbol symbol = FindSymbol( shard.m_pTable, hash, name, NULL );
+	if ( symbol != -1 || !bCreate )
 	{
-		if (!stricmp(name, (char *)m_Strings.GetBase() + item->stringIndex ))
-		{
-			return (HKeySymbol)item->stringIndex;
-		}
+		return symbol;
+	}
 
-		i++;
+	AUTO_LOCK( shard.m_mutex );
 
-		if (item->next == NULL)
-		{
-			if ( !bCreate )
-			{
-				// not found
-				return -1;
-			}
+	// someone else may have added it since we looked
+	int iSlot;
+	symbol = FindSymbol( shard.m_pTable, hash, name, &iSlot );
+	if ( symbol != -1 )
+	{
+		return symbol;
+	}
 
-			// we're not in the table
-			if (item->stringIndex != 0)
-			{
-				// first item is used, an new item
-				item->next = (hash_item_t *)m_HashItemMemPool.Alloc(sizeof(hash_item_t));
-				item = item->next;
-			}
+	// keep the table at most half full so probes stay short
+	if ( ( shard.m_nSymbols + 1 ) * 2 > shard.m_pTable->m_nMask + 1 )
+	{
+		GrowSymbolTable( shard );
+		FindSymbol( shard.m_pTable, hash, name, &iSlot );
+	}
 
-			// build up the new item
-			item->next = NULL;
-			char *pString = (char *)m_Strings.Alloc( V_strlen(name) + 1 );
-			if ( !pString )
+	int len = V_strlen( name ) + 1;
+	char *pString;
+	{
+		AUTO_LOCK( m_StringsMutex );
+		pString = (char *)m_Strings.Alloc( len );
+	}
+	if ( !pString )
+	{
+		Error( "Out of keyvalue string space" );
+		return -1;
+	}
+	V_memcpy( pString, name, len );
+	symbol = pString - (char *)m_Strings.GetBase();
+
+	// publishing the slot is a full barrier, so readers that see it see the string too
+	ThreadInterlockedExchange64( &shard.m_pTable->m_Slots[iSlot], ( (int64)hash << 32 ) | (uint32)symbol );
+	shard.m_nSymbols++;
+	return symbol;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Probes a table for a name. Returns -1 if it isn't there, along
+//			with the empty slot it would go in.
+//-----------------------------------------------------------------------------
+HKeySymbol CKeyValuesSystem::FindSymbol( const SymbolTable_t *pTable, unsigned hash, const char *name, int *pEmptySlot )
+{
+	const char *pBase = (const char *)m_Strings.GetBase();
+	for ( int i = hash & pTable->m_nMask; ; i = ( i + 1 ) & pTable->m_nMask )
+	{
+		int64 slot = pTable->m_Slots[i];
+		if ( !slot )
+		{
+			if ( pEmptySlot )
 			{
-				Error( "Out of keyvalue string space" );
-				return -1;
+				*pEmptySlot = i;
 			}
-			item->stringIndex = pString - (char *)m_Strings.GetBase();
-			strcpy(pString, name);
-			return (HKeySymbol)item->stringIndex;
+			return -1;
+		}
+
+		if ( (unsigned)( slot >> 32 ) == hash && !V_stricmp( name, pBase + (uint32)slot ) )
+		{
+			return (HKeySymbol)(uint32)slot;
 		}
+	}
+}
 
-		item = item->next;
+//-----------------------------------------------------------------------------
+// Purpose: Replaces a shard's table with one twice the size. Called with the
+//			shard locked.
+//-----------------------------------------------------------------------------
+void CKeyValuesSystem::GrowSymbolTable( SymbolShard_t &shard )
+{
+	SymbolTable_t *pOld = shard.m_pTable;
+	int nSlots = ( pOld->m_nMask + 1 ) * 2;
+	size_t nSize = sizeof( SymbolTable_t ) + ( nSlots - 1 ) * sizeof( int64 );
+	SymbolTable_t *pTable = (SymbolTable_t *)malloc( nSize );
+	memset( pTable, 0, nSize );
+	pTable->m_pOlder = pOld;
+	pTable->m_nMask = nSlots - 1;
+
+	for ( int i = 0; i <= pOld->m_nMask; i++ )
+	{
+		int64 slot = pOld->m_Slots[i];
+		if ( !slot )
+			continue;
+
+		int j = (unsigned)( slot >> 32 ) & pTable->m_nMask;
+		while ( pTable->m_Slots[j] )
+		{
+			j = ( j + 1 ) & pTable->m_nMask;
+		}
+		pTable->m_Slots[j] = slot;
 	}
 
-	// shouldn't be able to get here
-	Assert(0);
-	return (-1);
+	ThreadInterlockedExchangePointer( (void * volatile *)&shard.m_pTable, pTable );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Case insensitive 32 bit hash of a key name. The top bits pick the
+//			shard and the bottom ones the slot, so the bits are mixed well.
+//-----------------------------------------------------------------------------
+unsigned CKeyValuesSystem::HashSymbolName( const char *name )
+{
+	unsigned hash = HashStringCaselessConventional( name );
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
+	return hash;
 }
 
 //-----------------------------------------------------------------------------
@@ -375,28 +484,6 @@ void CKeyValuesSystem::InvalidateCache()
 	DoInvalidateCache();
 }
 
-//-----------------------------------------------------------------------------
-// Purpose: generates a simple hash value for a string
-//-----------------------------------------------------------------------------
-int CKeyValuesSystem::CaseInsensitiveHash(const char *string, int iBounds)
-{
-	unsigned int hash = 0;
-
-	for ( ; *string != 0; string++ )
-	{
-		if (*string >= 'A' && *string <= 'Z')
-		{
-			hash = (hash << 1) + (*string - 'A' + 'a');
-		}
-		else
-		{
-			hash = (hash << 1) + *string;
-		}
-	}
-	  
-	return hash % iBounds;
-}
-
 //-----------------------------------------------------------------------------
 // Purpose: Evicts everything from the cache, cleans up the memory used.
 //-----------------------------------------------------------------------------
@@ -0,0 +1,60 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Special case hash table for console commands
+//
+// $NoKeywords: $
+//
+//===========================================================================//
+
+#if !defined( CONCOMMANDHASH_H )
+#define CONCOMMANDHASH_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier1/utlvector.h"
+#include "tier1/generichash.h"
+#include "tier1/convar.h"
+
+// Looks up ConCommandBases by name, ignoring case, without storing the names.
+// Each name hashes to a bucket holding the commands and the full hashes of
+// their names, so walking a bucket rarely has to compare strings.
+//
+// It only indexes the commands, CCvar's linked list still owns their order.
+class CConCommandHash
+{
+public:
+	typedef unsigned int HashKey_t;
+
+	// Commands sharing a name are found newest first
+	void Insert( ConCommandBase *cmd );
+	bool Remove( ConCommandBase *cmd );
+	void RemoveAll( void );
+
+	// NULL if there is no command by that name
+	ConCommandBase *Find( const char *name ) const;
+
+	// Dump the bucket load to Msg
+	void Report( void ) const;
+
+	static HashKey_t Hash( const char *name ) { return HashStringCaseless( name ); }
+
+private:
+	enum
+	{
+		// HashStringCaseless makes 16 bit keys, this is a few commands a
+		// bucket with every game's commands registered
+		kNUM_BUCKETS = 1024,
+		kBUCKETMASK  = kNUM_BUCKETS - 1,
+	};
+
+	struct HashEntry_t
+	{
+		HashKey_t		m_uiKey;
+		ConCommandBase	*m_Data;
+	};
+
+	CUtlVector<HashEntry_t>	m_aBuckets[kNUM_BUCKETS];
+};
+
+#endif // CONCOMMANDHASH_H
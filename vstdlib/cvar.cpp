@@ -16,6 +16,7 @@
 #include "tier0/vprof.h"
 #include "tier1/tier1.h"
 #include "tier1/utlbuffer.h"
+#include "concommandhash.h"
 
 #ifdef _X360
 #include "xbox/xbox_console.h"
@@ -117,20 +118,19 @@ private:
 	CUtlVector< FnChangeCallback_t >	m_GlobalChangeCallbacks;
 	CUtlVector< IConsoleDisplayFunc* >	m_DisplayFuncs;
 	int									m_nNextDLLIdentifier;
-	ConCommandBase						*m_pConCommandList;
+	ConCommandBase						*m_pConCommandList;	// in registration order, newest first
+	CConCommandHash						m_CommandHash;		// the same commands by name
 
 	// temporary console area so we can store prints before console display funs are installed
 	mutable CUtlBuffer					m_TempConsoleBuffer;
 protected:
 
-	// internals for  ICVarIterator
+	// internals for  ICVarIterator, which walks the list so the order is stable
 	class CCVarIteratorInternal : public ICVarIteratorInternal
 	{
 	public:
 		CCVarIteratorInternal( CCvar *outer ) 
 			: m_pOuter( outer )
-			//, m_pHash( &outer->m_CommandHash ), // remember my CCvar,
-			//m_hashIter( -1, -1 ) // and invalid iterator
 			, m_pCur( NULL )
 		{}
 		virtual void		SetFirst( void );
@@ -139,8 +139,6 @@ protected:
 		virtual ConCommandBase *Get( void );
 	protected:
 		CCvar * const m_pOuter;
-		//CConCommandHash * const m_pHash;
-		//CConCommandHash::CCommandHashIterator_t m_hashIter;
 		ConCommandBase *m_pCur;
 	};
 
@@ -167,31 +165,28 @@ protected:
 private:
 	// Standard console commands -- DO NOT PLACE ANY HIGHER THAN HERE BECAUSE THESE MUST BE THE FIRST TO DESTRUCT
 	CON_COMMAND_MEMBER_F( CCvar, "find", Find, "Find concommands with the specified string in their name/help text.", 0 )
+	CON_COMMAND_MEMBER_F( CCvar, "ccvar_hash_report", HashReport, "Report the bucket load of the concommand hash.", FCVAR_DEVELOPMENTONLY )
 };
 
 void CCvar::CCVarIteratorInternal::SetFirst( void ) RESTRICT
 {
-	//m_hashIter = m_pHash->First();
 	m_pCur = m_pOuter->GetCommands();
 }
 
 void CCvar::CCVarIteratorInternal::Next( void ) RESTRICT
 {
-	//m_hashIter = m_pHash->Next( m_hashIter );
 	if ( m_pCur )
 		m_pCur = m_pCur->GetNext();
 }
 
 bool CCvar::CCVarIteratorInternal::IsValid( void ) RESTRICT
 {
-	//return m_pHash->IsValidIterator( m_hashIter );
 	return m_pCur != NULL;
 }
 
 ConCommandBase *CCvar::CCVarIteratorInternal::Get( void ) RESTRICT
 {
 	Assert( IsValid( ) );
-	//return (*m_pHash)[m_hashIter];
 	return m_pCur;
 }
 
@@ -405,6 +400,7 @@ void CCvar::RegisterConCommand( ConCommandBase *variable )
 	// link the variable in
 	variable->m_pNext = m_pConCommandList;
 	m_pConCommandList = variable;
+	m_CommandHash.Insert( variable );
 }
 
 void CCvar::UnregisterConCommand( ConCommandBase *pCommandToRemove )
@@ -434,6 +430,7 @@ void CCvar::UnregisterConCommand( ConCommandBase *pCommandToRemove )
 			pPrev->m_pNext = pCommand->m_pNext;
 		}
 		pCommand->m_pNext = NULL;
+		m_CommandHash.Remove( pCommand );
 		break;
 	}
 }
@@ -444,24 +441,26 @@ void CCvar::UnregisterConCommand( ConCommandBase *pCommandToRemove )
 #endif
 void CCvar::UnregisterConCommands( CVarDLLIdentifier_t id )
 {
-	ConCommandBase	*pNewList;
+	ConCommandBase	**ppPrev;
 	ConCommandBase  *pCommand, *pNext;
 
 	int iCommandsLooped = 0;
 
-	pNewList = NULL;
+	// The remaining commands keep their order
+	ppPrev = &m_pConCommandList;
 	pCommand = m_pConCommandList;
 	while ( pCommand )
 	{
 		pNext = pCommand->m_pNext;
 		if ( pCommand->GetDLLIdentifier() != id )
 		{
-			pCommand->m_pNext = pNewList;
-			pNewList = pCommand;
+			ppPrev = &pCommand->m_pNext;
 		}
 		else
 		{
 			// Unlink
+			*ppPrev = pNext;
+			m_CommandHash.Remove( pCommand );
 			pCommand->m_bRegistered = false;
 			pCommand->m_pNext = NULL;
 		}
@@ -469,8 +468,6 @@ void CCvar::UnregisterConCommands( CVarDLLIdentifier_t id )
 		pCommand = pNext;
 		iCommandsLooped++;
 	}
-
-	m_pConCommandList = pNewList;
 }
 #ifdef WIN32
 #pragma optimize( "", on )
@@ -482,24 +479,12 @@ void CCvar::UnregisterConCommands( CVarDLLIdentifier_t id )
 //-----------------------------------------------------------------------------
 const ConCommandBase *CCvar::FindCommandBase( const char *name ) const
 {
-	const ConCommandBase *cmd = GetCommands();
-	for ( ; cmd; cmd = cmd->GetNext() )
-	{
-		if ( !Q_stricmp( name, cmd->GetName() ) )
-			return cmd;
-	}
-	return NULL;
+	return m_CommandHash.Find( name );
 }
 
 ConCommandBase *CCvar::FindCommandBase( const char *name )
 {
-	ConCommandBase *cmd = GetCommands();
-	for ( ; cmd; cmd = cmd->GetNext() )
-	{
-		if ( !Q_stricmp( name, cmd->GetName() ) )
-			return cmd;
-	}
-	return NULL;
+	return m_CommandHash.Find( name );
 }
 
 
@@ -896,4 +881,73 @@ void CCvar::Find( const CCommand &args )
 	}	
 }
 
+void CCvar::HashReport( const CCommand &args )
+{
+	m_CommandHash.Report();
+}
+
+
+//-----------------------------------------------------------------------------
+// Console command hash data structure
+//-----------------------------------------------------------------------------
+void CConCommandHash::Insert( ConCommandBase *cmd )
+{
+	HashEntry_t entry;
+	entry.m_uiKey = Hash( cmd->GetName() );
+	entry.m_Data = cmd;
+	m_aBuckets[entry.m_uiKey & kBUCKETMASK].AddToTail( entry );
+}
+
+bool CConCommandHash::Remove( ConCommandBase *cmd )
+{
+	CUtlVector<HashEntry_t> &bucket = m_aBuckets[Hash( cmd->GetName() ) & kBUCKETMASK];
+	FOR_EACH_VEC( bucket, i )
+	{
+		if ( bucket[i].m_Data == cmd )
+		{
+			// keep the order, the newest of two commands with one name wins
+			bucket.Remove( i );
+			return true;
+		}
+	}
+	return false;
+}
+
+void CConCommandHash::RemoveAll( void )
+{
+	for ( int iBucket = 0; iBucket < kNUM_BUCKETS; ++iBucket )
+	{
+		m_aBuckets[iBucket].Purge();
+	}
+}
+
+ConCommandBase *CConCommandHash::Find( const char *name ) const
+{
+	HashKey_t hashkey = Hash( name );
+	const CUtlVector<HashEntry_t> &bucket = m_aBuckets[hashkey & kBUCKETMASK];
+	FOR_EACH_VEC_BACK( bucket, i )
+	{
+		const HashEntry_t &element = bucket[i];
+		if ( element.m_uiKey == hashkey && // if hashes of strings match,
+			 V_stricmp( name, element.m_Data->GetName() ) == 0 ) // then test the actual strings
+		{
+			return element.m_Data;
+		}
+	}
+	return NULL;
+}
+
+void CConCommandHash::Report( void ) const
+{
+	int nTotal = 0, nLongest = 0, nUsed = 0;
+	for ( int iBucket = 0; iBucket < kNUM_BUCKETS; ++iBucket )
+	{
+		int nCount = m_aBuckets[iBucket].Count();
+		nTotal += nCount;
+		nLongest = MAX( nLongest, nCount );
+		nUsed += nCount ? 1 : 0;
+	}
 
+	Msg( "Console command hash: %d commands in %d of %d buckets, %.1f a used bucket, longest %d\n",
+		nTotal, nUsed, kNUM_BUCKETS, nUsed ? nTotal / (float)nUsed : 0.0f, nLongest );
+}